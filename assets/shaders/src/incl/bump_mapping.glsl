@@ -19,4 +19,17 @@ void bumpMapping(sampler2D bumpMap, float bumpStep, mat3 normalMatrix, float bum
     
     normal = normalize(normal - normalShift);
     uv = uv - dl * bumpUVFactor * bumpStrength;
-}
\ No newline at end of file
+}
+
+// Same as bumpMapping with one tap: height differences are precomputed at load time (see texture_converter::buildDerivativeMap).
+// derivativeMap.rg = (h(x+1) - h(x-1), h(y+1) - h(y-1)) * 0.5 + 0.5 in texels of level 0.
+void bumpMappingDerivatives(sampler2D derivativeMap, float bumpStep, mat3 normalMatrix, float bumpStrength, float bumpUVFactor, inout vec3 normal, inout vec2 uv) {
+    // Difference over 2 texels scaled to the difference over 2 * bumpStep in uv
+    vec2 dl = (texture(derivativeMap, uv).rg * 2.0 - 1.0) * bumpStep * vec2(textureSize(derivativeMap, 0));
+
+    vec3 normalShift = normalMatrix * vec3(dl.x, dl.y, 0);
+    normalShift *= bumpStrength;
+
+    normal = normalize(normal - normalShift);
+    uv = uv - dl * bumpUVFactor * bumpStrength;
+}
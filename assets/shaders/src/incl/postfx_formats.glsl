@@ -0,0 +1,42 @@
+#ifndef _POSTFX_FORMATS_GLSL_
+#define _POSTFX_FORMATS_GLSL_
+
+    // Storage formats of PostFX attachments, must match PostFX::formats.
+    // Shaders are compiled once with all attachments in rgba32f (full precision path) and once more for every
+    // "// VARIANT <name>: <defines>" line they contain (see scripts/compile_shaders.py). Shaders accessing the viewport
+    // image are additionally compiled for every viewport format other than rgba32f.
+#if POSTFX_NARROW_FORMATS == 1
+    // Single channel data is stored in r32f, colors and triples of exposures in rgba16f
+    #define DURAND_LUM_FORMAT         r32f
+    #define DURAND_CHROM_FORMAT       rgba16f
+    #define DURAND_BASE_FORMAT        r32f
+    #define DURAND_DETAIL_FORMAT      r32f
+
+    #define FUSION_CHROM_FORMAT       rgba16f
+    #define FUSION_LUM_FORMAT         rgba16f
+    #define FUSION_WEIGHT_FORMAT      rgba16f
+    #define FUSION_LAPLAC_FORMAT      r32f
+    #define FUSION_UPSAMPLED_FORMAT   rgba16f
+
+    #define BLOOM_HIGHLIGHTS_FORMAT   rgba16f
+#else
+    #define DURAND_LUM_FORMAT         rgba32f
+    #define DURAND_CHROM_FORMAT       rgba32f
+    #define DURAND_BASE_FORMAT        rgba32f
+    #define DURAND_DETAIL_FORMAT      rgba32f
+
+    #define FUSION_CHROM_FORMAT       rgba32f
+    #define FUSION_LUM_FORMAT         rgba32f
+    #define FUSION_WEIGHT_FORMAT      rgba32f
+    #define FUSION_LAPLAC_FORMAT      rgba32f
+    #define FUSION_UPSAMPLED_FORMAT   rgba32f
+
+    #define BLOOM_HIGHLIGHTS_FORMAT   rgba32f
+#endif
+
+    // Must match ViewportPass::colorFormat, defined on the command line by the viewport format variants
+#ifndef VIEWPORT_FORMAT
+    #define VIEWPORT_FORMAT           rgba32f
+#endif
+
+#endif
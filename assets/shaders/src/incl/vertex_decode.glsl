@@ -0,0 +1,28 @@
+#ifndef _VERTEX_DECODE_
+#define _VERTEX_DECODE_
+
+// Set when pipeline is created. If true, vertex attributes come from PackedVertex (see types.h):
+// position and uv are unorm relative to model bounds, normal is octahedral encoded and there is no color.
+layout(constant_id = 0) const bool PACKED_VERTICES = false;
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+vec3 decodePosition(vec3 pos, vec4 posScale, vec4 posOffset) {
+    return PACKED_VERTICES ? pos * posScale.xyz + posOffset.xyz : pos;
+}
+
+vec3 decodeNormal(vec3 normal) {
+    return PACKED_VERTICES ? octDecode(normal.xy) : normal;
+}
+
+vec2 decodeTexCoord(vec2 uv, vec4 uvScaleOffset) {
+    return PACKED_VERTICES ? uv * uvScaleOffset.xy + uvScaleOffset.zw : uv;
+}
+
+#endif // _VERTEX_DECODE_
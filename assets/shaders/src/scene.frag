@@ -35,11 +35,19 @@ void main()
     vec2 bumpUV = uv;
 
     if (sd.enableBumpMapping && pc.useBumpTex) {
-        bumpMapping(
-            bump[pc.bumpTexIndex], sd.bumpStep, 
-            mat3(ssbo.objects[pc.objectIndex].normalMatrix), 
-            sd.bumpStrength, sd.bumpUVFactor, bumpNormal, bumpUV
-        );
+        if (sd.useDerivativeMaps) {
+            bumpMappingDerivatives(
+                bump[pc.bumpTexIndex], sd.bumpStep, 
+                mat3(ssbo.objects[pc.objectIndex].normalMatrix), 
+                sd.bumpStrength, sd.bumpUVFactor, bumpNormal, bumpUV
+            );
+        } else {
+            bumpMapping(
+                bump[pc.bumpTexIndex], sd.bumpStep, 
+                mat3(ssbo.objects[pc.objectIndex].normalMatrix), 
+                sd.bumpStrength, sd.bumpUVFactor, bumpNormal, bumpUV
+            );
+        }
     }
 
     if (sd.showNormals) {
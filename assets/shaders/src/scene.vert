@@ -12,6 +12,7 @@ layout(location = 3) out vec3 normal;
 
 #include "incl/defs.glsl"
 #include "incl/scene_structs.incl"
+#include "incl/vertex_decode.glsl"
 
 layout(set = 0, binding = 0) uniform CameraBuffer {
 	mat4 view;
@@ -30,13 +31,17 @@ void main()
 {
 	mat4 modelMat = ssbo.objects[pc.objectIndex].model;
 	mat4 transformMat = cam.viewproj * modelMat;
+
+	vec3 position = decodePosition(vPosition, ssbo.objects[pc.objectIndex].posScale, ssbo.objects[pc.objectIndex].posOffset);
+	vec3 vertNormal = decodeNormal(vNormal);
 	
-	gl_Position = transformMat * vec4(vPosition, 1.0f);
+	gl_Position = transformMat * vec4(position, 1.0f);
 
-	fragPos = vec3(modelMat * vec4(vPosition, 1.0f));
-	fragColor = vColor; 
-	texCoord = vTexCoord;
+	fragPos = vec3(modelMat * vec4(position, 1.0f));
+	// Packed vertices have no color, loader sets it to normal anyway
+	fragColor = PACKED_VERTICES ? vertNormal : vColor; 
+	texCoord = decodeTexCoord(vTexCoord, ssbo.objects[pc.objectIndex].uvScaleOffset);
 	
-	normal = normalize(mat3(ssbo.objects[pc.objectIndex].normalMatrix) * vNormal);
+	normal = normalize(mat3(ssbo.objects[pc.objectIndex].normalMatrix) * vertNormal);
 }
 
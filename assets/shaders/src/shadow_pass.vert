@@ -12,6 +12,7 @@ layout (location = 1) out flat vec3 lightPos;
 
 #include "incl/defs.glsl"
 #include "incl/scene_structs.incl"
+#include "incl/vertex_decode.glsl"
 
 layout(set = 0, binding = 0)
 #include "incl/sceneUB.incl"
@@ -31,11 +32,12 @@ layout(push_constant) uniform PushConsts
 void main()
 {
 	mat4 modelMat = ssbo.objects[gl_BaseInstance].model;
+	vec3 position = decodePosition(vPosition, ssbo.objects[gl_BaseInstance].posScale, ssbo.objects[gl_BaseInstance].posOffset);
 	
-	fragPos = modelMat * vec4(vPosition, 1.0);	
+	fragPos = modelMat * vec4(position, 1.0);	
 	
     lightPos = sd.lights[pc.lightIndex].pos;
 	
 	gl_Position = sd.lightProjMat * pc.view * 
-		modelMat * vec4(vPosition, 1.0);
+		modelMat * vec4(position, 1.0);
 }
\ No newline at end of file
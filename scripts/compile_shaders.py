@@ -1,4 +1,5 @@
 import os
+import re
 import sys
 import shutil
 
@@ -33,6 +34,20 @@ bin_ext = (".spv")
 
 debug_flags = "-gVS"
 
+# A binary that fails to compile is not written, keep going to report all failures and exit non-zero at the end
+failed = []
+
+def compile_shader(command):
+	print(command)
+	if os.system(command) != 0:
+		failed.append(command)
+
+# Viewport formats selectable at runtime besides rgba32f, binary suffix to GLSL image format (see PostFX::getShaderBinName)
+viewport_formats = {
+	"rgba16f": "rgba16f",
+	"b10g11r11": "r11f_g11f_b10f"
+}
+
 for f in os.listdir(src_dir):
 	if f.endswith(src_ext):
 		src_path = os.path.join(src_dir, f)
@@ -40,7 +55,32 @@ for f in os.listdir(src_dir):
 		if not os.path.exists(bin_dir):
 			os.makedirs(bin_dir)
 		command = f"{glslc} -g {src_path} -o {dst_path}.spv"
-		print(command)
-		os.system(command)
+		compile_shader(command)
+
+		# Variants with different defines, e.g. narrower PostFX attachment formats (see incl/postfx_formats.glsl):
+		# "// VARIANT <name>: <NAME>=<value> ..." compiles to <shader>.<name>.spv
+		# Some sources have license headers that aren't UTF-8
+		with open(src_path, errors="replace") as src:
+			src_text = src.read()
+		variants = [("", "")] + [(f".{name}", defines) for name, defines in re.findall(r"^// VARIANT (\w+):(.*)$", src_text, re.MULTILINE)]
+		for name, defines in variants[1:]:
+			defines = " ".join(f"-D{d}" for d in defines.split())
+			command = f"{glslc} -g {defines} {src_path} -o {dst_path}{name}.spv"
+			compile_shader(command)
+
+		# Shaders accessing the viewport image, the default and every variant once more for each viewport format
+		# other than rgba32f: <shader>[.<variant>].<format>.spv
+		if "VIEWPORT_FORMAT" in src_text:
+			for name, defines in variants:
+				for format_name, format in viewport_formats.items():
+					format_defines = " ".join(f"-D{d}" for d in defines.split() + [f"VIEWPORT_FORMAT={format}"])
+					command = f"{glslc} -g {format_defines} {src_path} -o {dst_path}{name}.{format_name}.spv"
+					compile_shader(command)
 	else:
 		continue
+
+if failed:
+	print(f"Error: {len(failed)} shader(s) failed to compile:")
+	for command in failed:
+		print(f"  {command}")
+	sys.exit(1)
@@ -9,7 +9,8 @@
 #include "stb/stb_image_write.h"
 #undef STB_IMAGE_WRITE_IMPLEMENTATION
 
-Engine::Engine()
+Engine::Engine(const LoaderSettings& loaderSettings)
+    : _loaderSettings(loaderSettings)
 {
     _enabledValidationLayers = {
 #if ENABLE_VALIDATION_LAYERS == 1
@@ -69,6 +70,15 @@ void Engine::Init()
     createSwapchain();
 
     prepareSwapchainPass();
+    // The narrow formats are all required to support storage, fall back anyway if the device disagrees or the
+    // narrow shader variants are missing
+    _postfx.fullPrecision = !_loaderSettings.postfxNarrowFormats || !arePostFXFormatsSupported();
+    if (isViewportFormatSupported(_loaderSettings.viewportFormat) &&
+        _postfx.hasShaderBinaries(_postfx.fullPrecision, _loaderSettings.viewportFormat)) {
+        _viewport.colorFormat = _loaderSettings.viewportFormat;
+    } else {
+        PRWRN("Viewport format " << string_VkFormat(_loaderSettings.viewportFormat) << " is not supported, using RGBA32F");
+    }
     prepareViewportPass(_swapchain.width, _swapchain.height);
     prepareShadowPass();
     
@@ -107,6 +117,21 @@ void Engine::Run()
             _wasViewportResized = false;
         }
 
+        if (_togglePostFXPrecision) {
+            setPostFXPrecision(!_postfx.fullPrecision);
+            _togglePostFXPrecision = false;
+        }
+
+        if (_validatePostFXPrecision) {
+            ValidatePostFXPrecision();
+            _validatePostFXPrecision = false;
+        }
+
+        if (_newViewportFormat != VK_FORMAT_UNDEFINED) {
+            setViewportFormat(_newViewportFormat);
+            _newViewportFormat = VK_FORMAT_UNDEFINED;
+        }
+
         if (_measureFPS) {
             _howLongFPSMeasured += _deltaTime;
             ++_numFramesMeasured;
@@ -148,16 +173,25 @@ void Engine::createAttachment(
     VkExtent3D extent, VkImageAspectFlags aspect,
     VkImageLayout layout,
     Attachment& att,
-    const std::string debugName)
+    gpu_memory::Category category,
+    const std::string debugName,
+    VkImage transientImage)
 {
-    VkImageCreateInfo imgInfo = vkinit::image_create_info(format, usage, extent);
+    if (transientImage != VK_NULL_HANDLE) {
+        // Memory belongs to the transient allocator, Cleanup only destroys the image
+        att.allocImage.image = transientImage;
+        att.allocImage.allocation = VK_NULL_HANDLE;
+    } else {
+        VkImageCreateInfo imgInfo = vkinit::image_create_info(format, usage, extent);
 
-    VmaAllocationCreateInfo imgAllocinfo = {
-        .usage = VMA_MEMORY_USAGE_GPU_ONLY,
-        .requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
-    };
+        VmaAllocationCreateInfo imgAllocinfo = {
+            .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+            .requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+        };
 
-    vmaCreateImage(_allocator, &imgInfo, &imgAllocinfo, &att.allocImage.image, &att.allocImage.allocation, nullptr);
+        vmaCreateImage(_allocator, &imgInfo, &imgAllocinfo, &att.allocImage.image, &att.allocImage.allocation, nullptr);
+        gpu_memory::tag(_allocator, att.allocImage.allocation, category, debugName);
+    }
 
     VkImageViewCreateInfo view_info = vkinit::imageview_create_info(format, att.allocImage.image, aspect);
 
@@ -186,16 +220,24 @@ void Engine::createAttachmentPyramid(
     VkImageLayout layout,
     uint32_t numOfMipLevels,
     AttachmentPyramid& att,
-    const std::string debugName)
+    gpu_memory::Category category,
+    const std::string debugName,
+    VkImage transientImage)
 {
-    // Create image with specified number of mips
-    VkImageCreateInfo imgInfo = vkinit::image_create_info(format, usage, extent, numOfMipLevels);
+    if (transientImage != VK_NULL_HANDLE) {
+        att.allocImage.image = transientImage;
+        att.allocImage.allocation = VK_NULL_HANDLE;
+    } else {
+        // Create image with specified number of mips
+        VkImageCreateInfo imgInfo = vkinit::image_create_info(format, usage, extent, numOfMipLevels);
 
-    VmaAllocationCreateInfo imgAllocinfo = {
-        .usage = VMA_MEMORY_USAGE_GPU_ONLY,
-        .requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
-    };
-    vmaCreateImage(_allocator, &imgInfo, &imgAllocinfo, &att.allocImage.image, &att.allocImage.allocation, nullptr);
+        VmaAllocationCreateInfo imgAllocinfo = {
+            .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+            .requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+        };
+        vmaCreateImage(_allocator, &imgInfo, &imgAllocinfo, &att.allocImage.image, &att.allocImage.allocation, nullptr);
+        gpu_memory::tag(_allocator, att.allocImage.allocation, category, debugName);
+    }
 
     setDebugName(VK_OBJECT_TYPE_IMAGE, att.allocImage.image, "ATTACHMENT::IMAGE::" + debugName);
 
@@ -239,11 +281,12 @@ void Engine::prepareViewportPass(uint32_t extentX, uint32_t extentY) {
             _viewport.depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
             extent3D, VK_IMAGE_ASPECT_DEPTH_BIT,
             VK_IMAGE_LAYOUT_GENERAL,
-            _viewport.depth, "VIEWPORT_DEPTH"
+            _viewport.depth, gpu_memory::Category::Viewport, "VIEWPORT_DEPTH"
         );
     }
 
-    size_t imgCount = _swapchain.images.size();
+    // Rendered and post-processed by frames in flight, the swapchain image only gets the UI
+    size_t imgCount = MAX_FRAMES_IN_FLIGHT;
     _viewport.images.resize(imgCount);
 
     _viewport.imageViews.resize(imgCount);
@@ -257,7 +300,9 @@ void Engine::prepareViewportPass(uint32_t extentX, uint32_t extentY) {
         .arrayLayers = 1,
         .samples = VK_SAMPLE_COUNT_1_BIT,
         .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        // Transfer destination for ValidatePostFXPrecision, which copies the same scene into it for every run
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
     };
 
@@ -269,6 +314,7 @@ void Engine::prepareViewportPass(uint32_t extentX, uint32_t extentY) {
         // Allocate and create the image
         VK_ASSERT(vmaCreateImage(_allocator, &img_info, &img_allocinfo, &_viewport.images[i].image, &_viewport.images[i].allocation, nullptr));
         setDebugName(VK_OBJECT_TYPE_IMAGE, _viewport.images[i].image, "Viewport Image " + std::to_string(i));
+        gpu_memory::tag(_allocator, _viewport.images[i].allocation, gpu_memory::Category::Viewport, "Viewport Image " + std::to_string(i));
 
         VkImageViewCreateInfo dview_info = vkinit::imageview_create_info(_viewport.colorFormat, _viewport.images[i].image, VK_IMAGE_ASPECT_COLOR_BIT);
 
@@ -283,25 +329,49 @@ void Engine::prepareViewportPass(uint32_t extentX, uint32_t extentY) {
         _postfx.ub.numOfViewportMips = numOfViewportMips;
         _postfx.numOfBloomMips = numOfViewportMips;
 
+        const VkImageUsageFlags attUsage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+        const VkImageUsageFlags pyrUsage = attUsage | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+        // Attachments are only used by their effect, so attachments of different effects share memory
+        std::map<std::string, VkImage> transientImages;
+        if (_loaderSettings.aliasPostFXMemory) {
+            for (auto& att : _postfx.att) {
+                uint32_t pass = _postfx.getTransientPass(att.first);
+                _postfxMemory.Add(vkinit::image_create_info(_postfx.getFormat(att.first), attUsage, extent3D),
+                    pass, pass, &transientImages[att.first]);
+            }
+            for (auto& att : _postfx.pyr) {
+                uint32_t pass = _postfx.getTransientPass(att.first);
+                _postfxMemory.Add(vkinit::image_create_info(_postfx.getFormat(att.first), pyrUsage, extent3D, numOfViewportMips),
+                    pass, pass, &transientImages[att.first]);
+            }
+            _postfxMemory.Allocate("COMPUTE::TRANSIENT");
+
+            const TransientAllocator::Stats& stats = _postfxMemory.GetStats();
+            pr("PostFX attachments: " << stats.allocatedBytes / (1024 * 1024) << " MiB shared by " << stats.images
+                << " images instead of " << stats.requestedBytes / (1024 * 1024) << " MiB");
+        }
+
         for (auto& att : _postfx.att) {
             createAttachment(
-                _viewport.colorFormat,
-                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+                _postfx.getFormat(att.first),
+                attUsage,
                 extent3D, VK_IMAGE_ASPECT_COLOR_BIT,
                 VK_IMAGE_LAYOUT_GENERAL,
-                att.second, "COMPUTE::" + att.first
+                att.second, gpu_memory::Category::PostFX, "COMPUTE::" + att.first,
+                transientImages[att.first]
             );
         }
     
         for (auto& att : _postfx.pyr) {
             createAttachmentPyramid(
-                _viewport.colorFormat,
-                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
-                VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                _postfx.getFormat(att.first),
+                pyrUsage,
                 extent3D, VK_IMAGE_ASPECT_COLOR_BIT,
                 VK_IMAGE_LAYOUT_GENERAL,
                 numOfViewportMips,
-                att.second, "COMPUTE::" + att.first
+                att.second, gpu_memory::Category::PostFX, "COMPUTE::" + att.first,
+                transientImages[att.first]
             );
         }
 
@@ -323,6 +393,108 @@ void Engine::recreateViewport(uint32_t extentX, uint32_t extentY)
     vkDeviceWaitIdle(_device);
 }
 
+bool Engine::arePostFXFormatsSupported()
+{
+    for (auto& [key, format] : _postfx.formats) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &props);
+
+        if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+            PRWRN("PostFX attachment " << key << " can't be stored as " << string_VkFormat(format) << ", using RGBA32F for all attachments");
+            return false;
+        }
+    }
+    // Narrow variants are separate binaries, compiling them may have failed
+    return _postfx.hasShaderBinaries(false, _viewport.colorFormat);
+}
+
+bool Engine::setPostFXPrecision(bool fullPrecision)
+{
+    if (fullPrecision == _postfx.fullPrecision) {
+        return true;
+    }
+    if (!fullPrecision && !arePostFXFormatsSupported()) {
+        return false;
+    }
+
+    vkDeviceWaitIdle(_device);
+    ui_UnregisterTextures();
+
+    _postfx.fullPrecision = fullPrecision;
+
+    recreatePostFXStages();
+    recreateViewport(_viewport.width, _viewport.height);
+
+    ui_RegisterTextures();
+
+    pr("PostFX attachments: " << (fullPrecision ? "full precision" : "narrow formats"));
+    return true;
+}
+
+void Engine::recreatePostFXStages()
+{
+    // Shader variants have the image format qualifiers of the attachment and viewport formats
+    for (auto& stage : _postfx.stages) {
+        stage.second.Destroy();
+        stage.second.Create(_device, _linearSampler, _postfx.getShaderBinName(stage.second, _viewport.colorFormat), stage.second.usesPushConstants);
+    }
+}
+
+bool Engine::isViewportFormatSupported(VkFormat format)
+{
+    ASSERT_MSG(std::find(std::begin(ViewportPass::FORMATS), std::end(ViewportPass::FORMATS), format) != std::end(ViewportPass::FORMATS),
+        "PostFX shaders have no variant for viewport format " << string_VkFormat(format));
+
+    // B10G11R11 isn't one of the formats shaders can always access storage images in
+    if (format == VK_FORMAT_B10G11R11_UFLOAT_PACK32 && !_shaderStorageImageExtendedFormats) {
+        return false;
+    }
+
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &props);
+
+    const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+    return (props.optimalTilingFeatures & required) == required;
+}
+
+bool Engine::setViewportFormat(VkFormat format)
+{
+    if (format == _viewport.colorFormat) {
+        return true;
+    }
+    if (!isViewportFormatSupported(format)) {
+        PRWRN("Viewport format " << string_VkFormat(format) << " is not supported");
+        return false;
+    }
+    // Checked here rather than in isViewportFormatSupported, which the UI calls every frame
+    if (!_postfx.hasShaderBinaries(_postfx.fullPrecision, format)) {
+        PRWRN("Viewport format " << string_VkFormat(format) << " has no compiled PostFX shaders");
+        return false;
+    }
+
+    vkDeviceWaitIdle(_device);
+    ui_UnregisterTextures();
+
+    _viewport.colorFormat = format;
+
+    for (const char* name : { "general", "skybox" }) {
+        Material& mat = _materials[name];
+        vkDestroyPipeline(_device, mat.pipeline, nullptr);
+        vkDestroyPipelineLayout(_device, mat.pipelineLayout, nullptr);
+    }
+    createViewportPipelines();
+
+    recreatePostFXStages();
+    // Writes the descriptor sets of the stages with the new images
+    recreateViewport(_viewport.width, _viewport.height);
+
+    ui_RegisterTextures();
+
+    pr("Viewport format: " << string_VkFormat(format));
+    return true;
+}
+
 void Engine::cleanupViewportResources()
 {
     //Destroy depth image
@@ -335,6 +507,7 @@ void Engine::cleanupViewportResources()
     for (auto& att : _postfx.pyr) {
         att.second.Cleanup(_device, _allocator);
     }
+    _postfxMemory.Reset();
 
 
     for (auto& imageView : _viewport.imageViews) {
@@ -352,8 +525,8 @@ void Engine::cleanupViewportResources()
 
 bool Engine::takeViewportScreenshot(std::string dstScreenshotPath)
 {
-    // 1. Get the current viewport image
-    AllocatedImage viewportImage = _viewport.images[_currentFrameInFlight];
+    // 1. Get the viewport image of the last frame
+    AllocatedImage viewportImage = _viewport.images[_lastFrameIndex];
 
     VkExtent3D extent = { _viewport.width, _viewport.height, 1 };
 
@@ -523,6 +696,7 @@ void Engine::prepareShadowPass()
     // Create cubemap image
     VK_ASSERT(vmaCreateImage(_allocator, &imageCreateInfo, &imgAllocinfo,
         &cubemap.allocImage.image, &cubemap.allocImage.allocation, nullptr));
+    gpu_memory::tag(_allocator, cubemap.allocImage.allocation, gpu_memory::Category::Shadows, "SHADOW_CUBEMAP_ARRAY");
 
     // Image barrier for optimal image (target)
     VkImageSubresourceRange subresourceRange = {};
@@ -597,6 +771,7 @@ void Engine::prepareShadowPass()
 
         VK_ASSERT(vmaCreateImage(_allocator, &imageCreateInfo, &imgAllocinfo,
             &depth.allocImage.image, &depth.allocImage.allocation, nullptr));
+        gpu_memory::tag(_allocator, depth.allocImage.allocation, gpu_memory::Category::Shadows, "SHADOW_DEPTH");
 
         VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
         if (vk_utils::formatHasStencil(_shadow.depthFormat)) {
@@ -688,6 +863,24 @@ void Engine::initUploadContext()
         vkDestroyCommandPool(_device, _uploadContext.commandPool, nullptr);
         vkDestroyFence(_device, _uploadContext.uploadFence, nullptr);
     });
+
+    _uploader.Create(_device, _allocator,
+        _transferQueue, _transferQueueFamily,
+        _graphicsQueue, _graphicsQueueFamily,
+        UPLOAD_RING_SIZE);
+
+    _deletionStack.push([&]() {
+        _uploader.Destroy();
+    });
+
+    _geometry.Create(_allocator, &_uploader, GEOMETRY_BLOCK_SIZE);
+
+    _deletionStack.push([&]() {
+        _geometry.Destroy();
+    });
+
+    _textureStreamer.Create(_device, _allocator, &_uploader, VkDeviceSize(_loaderSettings.textureBudgetMiB) * 1024 * 1024);
+    _textureRegistry.Create(_device, _linearSampler, MAX_TEXTURES);
 }
 
 void Engine::createFrameData()
@@ -740,6 +933,10 @@ void Engine::createFrameData()
                 f.sceneBuffer  = allocateBuffer(sizeof(GPUSceneUB), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
                 f.objectBuffer = allocateBuffer(sizeof(GPUSceneSSBO), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
+                gpu_memory::tag(_allocator, f.cameraBuffer.allocation, gpu_memory::Category::Frame, "CAMERA_UB::FRAME_" + std::to_string(frame_i));
+                gpu_memory::tag(_allocator, f.sceneBuffer.allocation, gpu_memory::Category::Frame, "SCENE_UB::FRAME_" + std::to_string(frame_i));
+                gpu_memory::tag(_allocator, f.objectBuffer.allocation, gpu_memory::Category::Frame, "OBJECT_SSBO::FRAME_" + std::to_string(frame_i));
+
                 // Image descriptor for the shadow cube map
                 _shadow.cubemapArray.allocImage.descInfo = {
                     .sampler = _shadow.sampler,
@@ -775,6 +972,9 @@ void Engine::createFrameData()
                 f.compSSBO = allocateBuffer(sizeof(GPUCompSSBO), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
                 f.compUB = allocateBuffer(sizeof(GPUCompUB), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
+                gpu_memory::tag(_allocator, f.compSSBO.allocation, gpu_memory::Category::Frame, "COMPUTE_SSBO::FRAME_" + std::to_string(frame_i));
+                gpu_memory::tag(_allocator, f.compUB.allocation, gpu_memory::Category::Frame, "COMPUTE_UB::FRAME_" + std::to_string(frame_i));
+
                 for (auto& stage : _postfx.stages) {
                     stage.second.InitDescriptorSets(_descriptorLayoutCache, _descriptorAllocator, f, frame_i);
                     setDebugName(VK_OBJECT_TYPE_DESCRIPTOR_SET, stage.second.sets[frame_i], "DESCRIPTOR_SET::COMPUTE::" + stage.first + "::FRAME_" + std::to_string(frame_i));
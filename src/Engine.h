@@ -6,6 +6,20 @@
 
 #include "camera.h"
 #include "vk_descriptors.h"
+#include "upload_manager.h"
+#include "texture_streamer.h"
+#include "texture_registry.h"
+#include "geometry_buffer.h"
+#include "gpu_memory.h"
+#include "transient_allocator.h"
+
+namespace texture_container {
+    struct Texture;
+}
+namespace texture_decoder {
+    struct DecodedTexture;
+    struct Options;
+}
 
 #ifdef NDEBUG
 #define ENABLE_VALIDATION_LAYERS 0
@@ -25,12 +39,28 @@
 
 class Engine {
 public:
-    Engine();
+    Engine(const LoaderSettings& loaderSettings = {});
 
     void Init();
     void Run();
     void Cleanup();
 
+    // Writes GPU memory usage per category and heap together with VMA stats as JSON, see gpu_memory.h
+    bool WriteMemoryReport(const std::string& path);
+    // Runs bloom, Durand and exposure fusion on the current view with PostFX attachments in their declared formats and
+    // in RGBA32F and compares the results. False if an effect is below POSTFX_MIN_PSNR or the formats aren't supported.
+    bool ValidatePostFXPrecision();
+    // Renders the scene with eye adaptation, bloom and local tone mapping at 1080p and 4K in every supported viewport
+    // format, prints GPU time of the viewport and PostFX passes and viewport image memory. False without timestamps.
+    bool BenchViewportFormats();
+
+    // Model textures decoded from source images, also the format of texture cache entries
+    static constexpr VkFormat TEXTURE_FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
+    // Default path of the memory report, relative to the working directory
+    static constexpr const char* MEMORY_REPORT_PATH = "memory_report.json";
+    // Narrow PostFX formats pass validation above this PSNR (dB, relative to the brightest reference value)
+    static constexpr float POSTFX_MIN_PSNR = 45.f;
+
 private: /* Methods used from Init directly */
     void createWindow(); 
     void createInstance();
@@ -47,6 +77,8 @@ private: /* Methods used from Init directly */
     void prepareShadowPass();
 
     void createPipelines();
+    // Scene and skybox pipelines, they render into the viewport image
+    void createViewportPipelines();
     void createFrameData();
     void createSamplers();
 
@@ -63,16 +95,44 @@ private: /* Methods used from Init directly */
 
     void recreateViewport(uint32_t extentX, uint32_t extentY);
     void cleanupViewportResources();
+    // All PostFX formats in PostFX::formats can be used as storage images
+    bool arePostFXFormatsSupported();
+    // Recreates PostFX attachments and pipelines with RGBA32F or the declared formats, false if the latter aren't supported
+    bool setPostFXPrecision(bool fullPrecision);
+    // Recreates PostFX pipelines with the shader variants of the current attachment and viewport formats
+    void recreatePostFXStages();
+    // Format can be rendered to, stored from PostFX shaders and blitted for screenshots
+    bool isViewportFormatSupported(VkFormat format);
+    // Recreates viewport images, scene and PostFX pipelines with another color format, false if it isn't supported
+    bool setViewportFormat(VkFormat format);
     bool takeViewportScreenshot(std::string dstScreenshotPath);
 
     void initUploadContext();
 
-    bool loadModelFromObj(const std::string assignedName, const std::string path);
+    bool loadModel(const std::string assignedName, const std::string path, bool allowPackedVertices = true);
 
     Attachment* loadTextureFromFile(const char* path);
+    // Decodes textures on worker threads and uploads them in batches, adds them to _textures in the order of paths
+    // With derivativeMaps height maps are converted into derivative maps, see LoaderSettings::derivativeBumpMaps.
+    // They are stored under getDerivativeMapTag(path).
+    void loadTextures(const std::vector<std::string>& paths, bool derivativeMaps = false);
+    // Creates images of decoded textures [begin, end) and queues their uploads, streamable ones are added to _textureStreamer
+    void uploadDecodedTextures(std::vector<texture_decoder::DecodedTexture>& textures, size_t begin, size_t end,
+        const texture_decoder::Options& options);
+    static std::string getDerivativeMapTag(const std::string& path);
+    // Uploads all faces and levels of a .ktx2/.dds texture, creates 2D or cube view
+    void uploadTextureContainer(const texture_container::Texture& tex, AllocatedImage& image, VkImageView& view);
+    // Format can be sampled with linear filtering (block compressed formats need textureCompressionBC)
+    bool isTextureFormatSupported(VkFormat format);
+    // Most compact supported HDR format for skybox faces decoded from .hdr, LoaderSettings::skyboxFormat is preferred if set
+    VkFormat chooseSkyboxFormat();
+    // BC5 if supported, R8G8 otherwise
+    VkFormat chooseDerivativeMapFormat();
     
+    // Suballocates vertices, indices and meshlets of the mesh from _geometry and queues their upload
     void uploadMesh(Mesh& mesh);
-    void createMeshBuffer(Mesh& mesh, bool isVertexBuffer);
+    // Binds the geometry buffers the mesh lives in, unless the previously drawn mesh lives in them too
+    void bindMeshGeometry(VkCommandBuffer cmd, const Mesh* lastMesh, const Mesh& mesh);
 
     void createGraphicsPipeline(
         const std::string& name,
@@ -80,14 +140,17 @@ private: /* Methods used from Init directly */
         VkShaderStageFlags pushConstantsStages, uint32_t pushConstantsSize,
         std::vector<VkDescriptorSetLayout> setLayouts,
         VkFormat colorFormat, VkFormat depthFormat,
-        int cullMode);
+        int cullMode,
+        bool packedVertices = false);
 
     void createAttachment(
         VkFormat format, VkImageUsageFlags usage,
         VkExtent3D extent, VkImageAspectFlags aspect,
         VkImageLayout layout,
         Attachment& att,
-        const std::string debugName = "");
+        gpu_memory::Category category,
+        const std::string debugName = "",
+        VkImage transientImage = VK_NULL_HANDLE); // Created by a TransientAllocator, gets own memory if null
 
     void createAttachmentPyramid(
         VkFormat format, VkImageUsageFlags usage,
@@ -95,7 +158,9 @@ private: /* Methods used from Init directly */
         VkImageLayout layout,
         uint32_t numOfMipLevels,
         AttachmentPyramid& att,
-        const std::string debugName = "");
+        gpu_memory::Category category,
+        const std::string debugName = "",
+        VkImage transientImage = VK_NULL_HANDLE);
 
     Material* getMaterial(const std::string& name);
     Mesh* getMesh(const std::string& name);
@@ -104,19 +169,22 @@ private: /* Methods used from Init directly */
 
     void drawObject(VkCommandBuffer cmd, const std::shared_ptr<RenderObject>& object, Material** lastMaterial, Mesh** lastMesh, uint32_t index);
     void drawObjects(VkCommandBuffer cmd, const std::vector<std::shared_ptr<RenderObject>>& objects);
+    const MeshLod& selectMeshLod(const Mesh& mesh, const glm::mat4& transform, glm::vec3 viewPos, float pixelScale, LodStats& stats);
+    // Reports screen space footprints of the textures of rendered meshes to _textureStreamer
+    void requestTextureLevels();
 
     void updateShadowCubemapFace(FrameData& f, uint32_t lightIndex, uint32_t faceIndex);
 
     void loadDataToGPU();
 
-    void bloom(FrameData& f, int imageIndex);
-    void durand2002(VkCommandBuffer& cmd, int imageIndex);
+    void bloom(FrameData& f, int frameIndex);
+    void durand2002(VkCommandBuffer& cmd, int frameIndex);
 
-    void exposureFusion(VkCommandBuffer& cmd, int imageIndex);
+    void exposureFusion(VkCommandBuffer& cmd, int frameIndex);
 
     void shadowPass(FrameData& f, int imageIndex);
-    void viewportPass(VkCommandBuffer& cmd, int imageIndex);
-    void postfxPass(FrameData& f, int imageIndex);
+    void viewportPass(VkCommandBuffer& cmd, int frameIndex);
+    void postfxPass(FrameData& f, int frameIndex);
     void swapchainPass(FrameData& f, int imageIndex);
 
     void recordCommandBuffer(FrameData& f, uint32_t imageIndex);
@@ -135,6 +203,7 @@ private: /* Methods used from Init directly */
     void loadScene(std::string fullScenePath);
 
     void loadSkybox(std::string skyboxDirName);
+    void writeSkyboxDescriptors();
     
 
     // UI methods
@@ -160,6 +229,9 @@ private: /* Methods used from Init directly */
     void ui_PostFXPipeline();
 
     void ui_Plots();
+    void ui_Lod();
+    void ui_TextureStreaming();
+    void ui_Memory();
 
     bool ui_LoadSkybox();
 
@@ -175,6 +247,24 @@ private: /* Methods used from Init directly */
     bool _loadSceneWindowEn = false;
     bool _screenshotWindowEn = false;
 
+    // Rebuilt periodically while the Memory window is open
+    gpu_memory::Report _memoryReport;
+    float _memoryReportAge = FLT_MAX;
+
+    struct PostFXPrecisionResult {
+        std::string effect;
+        float maxError;
+        float meanError;
+        float psnr;
+        bool passed;
+    };
+    // Of the last ValidatePostFXPrecision
+    std::vector<PostFXPrecisionResult> _postfxPrecisionResults;
+    // Set from UI, handled between frames
+    bool _togglePostFXPrecision = false;
+    bool _validatePostFXPrecision = false;
+    VkFormat _newViewportFormat = VK_FORMAT_UNDEFINED;
+
     bool _isViewportHovered = true;
     bool _wasViewportResized = false;
 
@@ -195,8 +285,7 @@ private: /* Methods used from Init directly */
     static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
 
 
-    uint32_t _modelLoaderGlobalDiffuseTexIndex = 0;
-    uint32_t _modelLoaderGlobalBumpTexIndex = 0;
+    LoaderSettings _loaderSettings;
 
 
     GLFWwindow* _window;
@@ -206,6 +295,9 @@ private: /* Methods used from Init directly */
     VkSurfaceKHR _surface;
 
     bool _swapchainColorSpaceExtSupported = true;
+    bool _textureCompressionBC = false;
+    // Storage images in formats like B10G11R11, see ViewportPass::FORMATS
+    bool _shaderStorageImageExtendedFormats = false;
 
     VkPhysicalDevice _physicalDevice;
     VkPhysicalDeviceProperties _gpuProperties;
@@ -214,14 +306,25 @@ private: /* Methods used from Init directly */
 
     uint32_t _graphicsQueueFamily;
     uint32_t _presentQueueFamily;
+    // Same as graphics if there is no separate transfer capable family
+    uint32_t _transferQueueFamily;
     VkQueue _graphicsQueue;
     VkQueue _presentQueue;
+    VkQueue _transferQueue;
 
     VmaAllocator _allocator;
 
     FrameData _frames[MAX_FRAMES_IN_FLIGHT];
 
     UploadContext _uploadContext;
+    // Staging ring for scene resource uploads, immediate_submit is left for one-off commands
+    UploadManager _uploader;
+    // Vertices, indices and meshlets of all meshes
+    GeometryBuffer _geometry;
+    // Shared memory of PostFX attachments, see PostFX::getTransientPass
+    TransientAllocator _postfxMemory;
+    // Mip residency of model textures under a memory budget
+    TextureStreamer _textureStreamer;
 
     SwapchainPass _swapchain;
     ViewportPass _viewport;
@@ -230,6 +333,8 @@ private: /* Methods used from Init directly */
     PostFX _postfx;
 
     uint32_t _currentFrameInFlight = 0;
+    // Frame in flight (and viewport image) of the last submitted frame
+    uint32_t _lastFrameIndex = 0;
 
     float _frameRate = 60.f; // Updated from ImGui io.framerate
     float _deltaTime = 0.016f;
@@ -239,6 +344,9 @@ private: /* Methods used from Init directly */
     float _howLongFPSMeasured = 0.f;
 
     static constexpr float MEASURE_FPS_INTERVAL = 15.0f; // seconds
+    static constexpr VkDeviceSize TEXTURE_UPLOAD_BATCH_SIZE = 256ull * 1024 * 1024; // Decoded texture data kept in memory at once
+    static constexpr VkDeviceSize UPLOAD_RING_SIZE = 64ull * 1024 * 1024;
+    static constexpr VkDeviceSize GEOMETRY_BLOCK_SIZE = 64ull * 1024 * 1024;
 
     bool _isInitialized = false;
     DeletionStack _deletionStack{}; // Disposing resources created during initialization
@@ -257,8 +365,8 @@ private: /* Methods used from Init directly */
     std::unordered_map<std::string, Mesh> _meshes;
     std::unordered_map<std::string, Attachment> _textures;
 
-    std::vector<Attachment*> _diffTexInsertionOrdered;
-    std::vector<Attachment*> _bumpTexInsertionOrdered;
+    // Bindless slots of _textures, also knows paths of textures with identical content
+    TextureRegistry _textureRegistry;
 
     DescriptorAllocator* _descriptorAllocator;
     DescriptorLayoutCache* _descriptorLayoutCache;
@@ -275,6 +383,9 @@ private: /* Methods used from Init directly */
 
     RenderContext _renderContext;
 
+    LodStats _viewportLodStats;
+    LodStats _shadowLodStats;
+
     GPUData _gpudt;
 
 
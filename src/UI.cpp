@@ -369,6 +369,13 @@ void Engine::ui_Init()
 				ui_AttachmentViewer();
 			}
 		},
+		{
+			.caption = "Memory",
+			.open = false,
+			.contents = [this]() {
+				ui_Memory();
+			}
+		},
 		{
 			.caption = "Controls",
 			.open = true,
@@ -519,6 +526,7 @@ void Engine::ui_Scene()
 	ImGui::SliderFloat("Bump Strength", &_renderContext.sceneData.bumpStrength, 0.f, 5.f);
 	ImGui::SliderFloat("Bump Step", &_renderContext.sceneData.bumpStep, 0.0001f, 0.005f, "%.4f");
 	ImGui::SliderFloat("Bump UV Factor", &_renderContext.sceneData.bumpUVFactor, 0.0001f, 0.005f, "%.4f");
+	ImGui::Text("Bump maps: %s", _loaderSettings.derivativeBumpMaps ? "derivative (1 tap)" : "height (8 taps)");
 
 	ImGui::Separator();
 
@@ -534,6 +542,109 @@ void Engine::ui_Scene()
 	ImGui::Separator();
 
 	ImGui::SliderFloat("Field of view", &_renderContext.fovY, 45.f, 120.f);
+
+	ImGui::Separator();
+
+	ui_Lod();
+
+	ImGui::Separator();
+
+	ui_TextureStreaming();
+}
+
+void Engine::ui_TextureStreaming()
+{
+	const TextureStreamer::Stats& stats = _textureStreamer.GetStats();
+	if (stats.textures == 0) {
+		ImGui::Text("Texture streaming: %s", _loaderSettings.streamTextures ? "no streamable textures" : "disabled");
+		return;
+	}
+
+	if (ImGui::TreeNodeEx("Texture streaming", ImGuiTreeNodeFlags_DefaultOpen)) {
+		const double MiB = 1024.0 * 1024.0;
+		ImGui::Text("%u textures, resident %.1f MiB of %.1f MiB budget", stats.textures, stats.residentBytes / MiB, stats.budget / MiB);
+		ImGui::Text("Requested %.1f MiB, dropped levels to fit budget: %u", stats.requestedBytes / MiB, stats.bias);
+		ImGui::Text("Streamed in %u, out %u, uploaded %.1f MiB", stats.streamedIn, stats.streamedOut, stats.uploadedBytes / MiB);
+		ImGui::TreePop();
+	}
+}
+
+void Engine::ui_Memory()
+{
+	// Building the report walks all allocations, a second is fresh enough
+	_memoryReportAge += _deltaTime;
+	if (_memoryReportAge >= 1.f) {
+		_memoryReport = gpu_memory::buildReport(_allocator);
+		_memoryReportAge = 0.f;
+	}
+
+	const double MiB = 1024.0 * 1024.0;
+
+	if (ImGui::TreeNodeEx("Categories", ImGuiTreeNodeFlags_DefaultOpen)) {
+		uint64_t totalBytes = 0;
+		for (size_t i = 0; i < _memoryReport.categories.size(); ++i) {
+			const gpu_memory::CategoryUsage& usage = _memoryReport.categories[i];
+			if (usage.allocations == 0) {
+				continue;
+			}
+			ImGui::Text("%-10s %8.1f MiB in %u allocations", gpu_memory::getCategoryName(gpu_memory::Category(i)), usage.bytes / MiB, usage.allocations);
+			totalBytes += usage.bytes;
+		}
+		ImGui::Text("%-10s %8.1f MiB", "Total", totalBytes / MiB);
+		ImGui::TreePop();
+	}
+
+	if (ImGui::TreeNodeEx("Heaps", ImGuiTreeNodeFlags_DefaultOpen)) {
+		for (size_t i = 0; i < _memoryReport.heaps.size(); ++i) {
+			const gpu_memory::HeapUsage& heap = _memoryReport.heaps[i];
+			ImGui::Text("Heap %zu (%s, %.0f MiB)", i, heap.deviceLocal ? "device local" : "host", heap.size / MiB);
+			ImGui::Indent();
+			ImGui::Text("Usage %.1f MiB of %.1f MiB budget", heap.usage / MiB, heap.budget / MiB);
+			ImGui::Text("%u blocks %.1f MiB, %u allocations %.1f MiB", heap.blocks, heap.blockBytes / MiB, heap.allocations, heap.allocationBytes / MiB);
+			ImGui::Text("Fragmentation %.1f%%", heap.fragmentation * 100.f);
+			ImGui::Unindent();
+		}
+		ImGui::TreePop();
+	}
+
+	if (ImGui::Button("Save report")) {
+		WriteMemoryReport(MEMORY_REPORT_PATH);
+	}
+	ImGui::SameLine();
+	ImGui::Text("to %s", MEMORY_REPORT_PATH);
+}
+
+void Engine::ui_Lod()
+{
+	ImGui::Checkbox("Enable LOD", &_renderContext.enableLods);
+	ImGui::SliderFloat("LOD pixel error", &_renderContext.lodPixelError, 0.1f, 16.f, "%.1f", ImGuiSliderFlags_Logarithmic);
+
+	if (ImGui::TreeNodeEx("LOD triangle counts")) {
+		for (auto& [name, model] : _models) {
+			std::array<size_t, MAX_MESH_LODS> triangles{};
+			for (Mesh* mesh : model.meshes) {
+				// Meshes with fewer levels count their coarsest level for the rest
+				for (size_t l = 0; l < MAX_MESH_LODS; ++l) {
+					triangles[l] += mesh->lods[std::min(l, mesh->lods.size() - 1)].indexCount / 3;
+				}
+			}
+			ImGui::Text("%s: %zu / %zu / %zu / %zu", name.c_str(), triangles[0], triangles[1], triangles[2], triangles[3]);
+		}
+		ImGui::TreePop();
+	}
+
+	if (ImGui::TreeNodeEx("LOD selection", ImGuiTreeNodeFlags_DefaultOpen)) {
+		auto statsText = [](const char* pass, const LodStats& stats) {
+			ImGui::Text("%s: draws per LOD %u / %u / %u / %u", pass, stats.draws[0], stats.draws[1], stats.draws[2], stats.draws[3]);
+			ImGui::Text("%s: %llu of %llu triangles (%.1f%%)", pass,
+				(unsigned long long)stats.triangles, (unsigned long long)stats.fullTriangles,
+				stats.fullTriangles ? 100.0 * stats.triangles / stats.fullTriangles : 100.0);
+		};
+		statsText("Viewport", _viewportLodStats);
+		// Accumulated over all cube faces of the lights that were updated last time
+		statsText("Shadows", _shadowLodStats);
+		ImGui::TreePop();
+	}
 }
 
 void Engine::ui_Plots()
@@ -757,6 +868,36 @@ void Engine::ui_PostFX()
 
 		ImGui::TreePop();
 	}
+
+	if (ImGui::TreeNodeEx("Viewport format")) {
+		// Applied between frames, viewport images and pipelines are recreated
+		for (VkFormat format : ViewportPass::FORMATS) {
+			ImGui::BeginDisabled(!isViewportFormatSupported(format));
+			if (ImGui::RadioButton(string_VkFormat(format), _viewport.colorFormat == format)) {
+				_newViewportFormat = format;
+			}
+			ImGui::EndDisabled();
+		}
+
+		ImGui::TreePop();
+	}
+
+	if (ImGui::TreeNodeEx("Attachment precision")) {
+		// Applied between frames, attachments and pipelines are recreated
+		bool fullPrecision = _postfx.fullPrecision;
+		if (ImGui::Checkbox("All attachments in RGBA32F", &fullPrecision)) {
+			_togglePostFXPrecision = true;
+		}
+
+		if (ImGui::Button("Validate against RGBA32F")) {
+			_validatePostFXPrecision = true;
+		}
+		for (const PostFXPrecisionResult& result : _postfxPrecisionResults) {
+			ImGui::Text("%-16s PSNR %6.1f dB, max error %.5f %s", result.effect.c_str(), result.psnr, result.maxError, result.passed ? "" : "(failed)");
+		}
+
+		ImGui::TreePop();
+	}
 }
 
 void Engine::ui_Lighting()
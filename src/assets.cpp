@@ -3,6 +3,12 @@
 #include "engine.h"
 #include "vk_utils.h"
 #include "vk_initializers.h"
+#include "texture_container.h"
+#include "texture_decoder.h"
+#include "texture_cache.h"
+#include "texture_converter.h"
+#include "parallel.h"
+#include "timer.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
@@ -10,59 +16,10 @@
 
 void Engine::writeTextureDescriptors()
 {
-	uint32_t diffuseTexBinding = 5;
-	uint32_t bumpTexBinding = 6;
-
-	std::vector<VkDescriptorImageInfo> diffuseImageInfos;
-	std::vector<VkDescriptorImageInfo> bumpImageInfos;
-
-	for (auto& tex : _diffTexInsertionOrdered) {
-		VkDescriptorImageInfo imgInfo = {
-			.sampler = _linearSampler,
-			.imageView = tex->view,
-			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-		};
-		diffuseImageInfos.push_back(imgInfo);
-	}
-
-	for (auto& tex : _bumpTexInsertionOrdered) {
-		VkDescriptorImageInfo imgInfo = {
-			.sampler = _linearSampler,
-			.imageView = tex->view,
-			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-		};
-		bumpImageInfos.push_back(imgInfo);
-	}
-
-	std::vector<VkWriteDescriptorSet> writes;
-	VkWriteDescriptorSet writeDiff = {
-		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-		.pNext = nullptr,
-
-		.dstBinding = diffuseTexBinding,
-
-		.descriptorCount = static_cast<uint32_t>(diffuseImageInfos.size()),
-		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		.pImageInfo = diffuseImageInfos.data()
-	};
-
-	VkWriteDescriptorSet writeBump = writeDiff;
-	writeBump.dstBinding = bumpTexBinding;
-	writeBump.descriptorCount = bumpImageInfos.size();
-	writeBump.pImageInfo = bumpImageInfos.data();
-
-	for (auto& f : _frames) {
-		if (!diffuseImageInfos.empty()) {
-			writeDiff.dstSet = f.sceneSet;
-			writes.push_back(writeDiff);
-		}
-		if (!bumpImageInfos.empty()) {
-			writeBump.dstSet = f.sceneSet;
-			writes.push_back(writeBump);
-		}
+	// Called with the device idle after a scene load, sets of all frames are written at once
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		_textureRegistry.Update(i, _frames[i].sceneSet);
 	}
-
-	vkUpdateDescriptorSets(_device, writes.size(), writes.data(), 0, nullptr);
 }
 
 void Engine::createScene()
@@ -70,12 +27,14 @@ void Engine::createScene()
 	// Reset in case we load a scene at runtime
 	cleanupScene();
 
+	Timer timer;
+
 	// Main model of the scene
-	ASSERT(loadModelFromObj("main", MODEL_PATH + _renderContext.modelPath));
+	ASSERT(loadModel("main", MODEL_PATH + _renderContext.modelPath));
 	// Sphere model of the light source
-	ASSERT(loadModelFromObj("sphere", MODEL_PATH + "sphere/sphere.obj"));
-	// Cube model for skybox
-	ASSERT(loadModelFromObj("cube", MODEL_PATH + "cube/cube.obj"));
+	ASSERT(loadModel("sphere", MODEL_PATH + "sphere/sphere.obj"));
+	// Cube model for skybox. Skybox pipeline always uses float vertices
+	ASSERT(loadModel("cube", MODEL_PATH + "cube/cube.obj", false));
 
 	// Set materials
 	for (auto& [key, model] : _models) {
@@ -85,10 +44,25 @@ void Engine::createScene()
 	}
 	_models["cube"].meshes[0]->material = getMaterial("skybox");
 
+	uint32_t descriptorWrites = _textureRegistry.GetStats().writes;
 	writeTextureDescriptors();
+	descriptorWrites = _textureRegistry.GetStats().writes - descriptorWrites;
 
 	loadSkybox(_renderContext.skyboxPath);
 
+	_uploader.Flush();
+	UploadManager::Stats uploadStats = _uploader.TakeStats();
+
+	pr("Scene loaded in " << timer.ElapsedMs() << " ms (" << getNumWorkerThreads(_loaderSettings.numThreads) << " loader threads)");
+	pr("\tUploaded " << uploadStats.bytes / (1024 * 1024) << " MiB in " << uploadStats.uploads << " uploads, "
+		<< uploadStats.submits << " submits, " << uploadStats.waits << " waits: " << uploadStats.ms << " ms, "
+		<< uploadStats.MBps() << " MB/s");
+	GeometryBuffer::Stats geometryStats = _geometry.GetStats();
+	pr("\tGeometry of " << _meshes.size() << " meshes in " << geometryStats.ranges << " ranges of " << geometryStats.blocks << " buffers, "
+		<< geometryStats.used / 1024 << " of " << geometryStats.capacity / 1024 << " KiB used");
+	pr("\t" << _textureRegistry.GetStats().slots << " texture slots used, " << _textureRegistry.GetStats().aliases
+		<< " textures shared by identical content, " << descriptorWrites << " descriptors written");
+
 	_skyboxObject = std::make_shared<RenderObject>(
 		RenderObject{
 			.tag = "Skybox",
@@ -171,58 +145,42 @@ void Engine::loadSkybox(std::string skyboxDirName)
 
 	std::string basePath = SKYBOX_PATH + skyboxDirName;
 
-	VkDeviceSize imageSize;
-	AllocatedBuffer stagingBuffer;
-
-	int baseTexW, baseTexH, baseTexChannels;
-
-	VkFormat imageFormat;
-	VkDeviceSize bufferOffset = 0;
-
-	for (int i = 0; i < 6; ++i) {
-		std::string path = basePath + "/" + suff[i] + ".hdr";
-
-		void* pixel_ptr = nullptr;
-		int texW, texH, texChannels;
-
-		ASSERT(stbi_is_hdr(path.c_str()) != 0);
-		float* fpix = stbi_loadf(path.c_str(), &texW, &texH, &texChannels, STBI_rgb_alpha);
-		pixel_ptr = fpix;
-
-		// HDR format of assets/images/skybox .hdr images
-		imageFormat = VK_FORMAT_R32G32B32A32_SFLOAT; 
-		
-
-		ASSERT_MSG(pixel_ptr != nullptr, "Failed to load cubemap face " + std::to_string(i) + ", path: " + path);
-		if (i == 0) {
-			baseTexW = texW;
-			baseTexH = texH;
-			baseTexChannels = texChannels;
+	// Pre-compressed cubemap (e.g. BC6H) with all faces and mips in one file
+	std::string cubemapPath = _loaderSettings.useCompressedTextures
+		? texture_container::findCompressed(basePath + "/cubemap.hdr") : "";
+	if (!cubemapPath.empty()) {
+		texture_container::Texture tex;
+		if (texture_container::load(cubemapPath, tex) && tex.faces == 6 && isTextureFormatSupported(tex.format)) {
+			_skybox.tag = basePath;
+			uploadTextureContainer(tex, _skybox.allocImage, _skybox.view);
+			gpu_memory::tag(_allocator, _skybox.allocImage.allocation, gpu_memory::Category::Skybox, cubemapPath);
+			pr("Cubemap loaded successfully: " << cubemapPath << " (" << string_VkFormat(tex.format) << ", "
+				<< tex.mipLevels << " mips, " << tex.totalSize() / 1024 << " KiB)");
+
+			_uploader.Submit();
+			writeSkyboxDescriptors();
+			return;
+		}
+		PRWRN("Can't use compressed cubemap " << cubemapPath << ", loading .hdr faces");
+	}
 
-			imageSize = (VkDeviceSize)baseTexW * (VkDeviceSize)baseTexH * 4 * 4;
+	Timer timer;
 
-			// Allocate temporary buffer for holding texture data to upload
-			VkDeviceSize bufferSize = imageSize * 6;
-			stagingBuffer = allocateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-		} else {
-			// Make sure all the faces of cubemap have exactly the same dimensions and color channels
-			ASSERT(baseTexW == texW && baseTexH == texH && baseTexChannels == texChannels);
-		}
+	int baseTexW, baseTexH, baseTexChannels;
 
-		// Copy data to buffer
-		void* dst = (char*)stagingBuffer.memory_ptr + bufferOffset;
-		memcpy(dst, pixel_ptr, static_cast<size_t>(imageSize));
-	
-		// We no longer need the loaded data, so we can free the pixels as they are now in the staging buffer
-		stbi_image_free(pixel_ptr);
+	// Face size is needed up front to reserve staging memory, faces are then decoded straight into it
+	std::string firstFacePath = basePath + "/" + suff[0] + ".hdr";
+	ASSERT_MSG(stbi_info(firstFacePath.c_str(), &baseTexW, &baseTexH, &baseTexChannels) != 0,
+		"Failed to read cubemap face 0, path: " + firstFacePath);
 
-		bufferOffset += imageSize;
-	}
+	// Faces are decoded to RGBA32F and packed into the most compact supported HDR format
+	VkFormat imageFormat = chooseSkyboxFormat();
+	uint32_t mipLevels = vk_utils::getMipLevelCount(baseTexW, baseTexH);
 
 	VkImageSubresourceRange subresourceRange = {
 		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 		.baseMipLevel = 0,
-		.levelCount = 1,
+		.levelCount = mipLevels,
 		.baseArrayLayer = 0,
 		.layerCount = 6
 	};
@@ -239,7 +197,7 @@ void Engine::loadSkybox(std::string skyboxDirName)
 			.height = static_cast<uint32_t>(baseTexH),
 			.depth = 1
 		},
-		.mipLevels = 1,
+		.mipLevels = mipLevels,
 		// Cube faces count as array layers in Vulkan
 		.arrayLayers = 6,
 		.samples = VK_SAMPLE_COUNT_1_BIT,
@@ -257,62 +215,69 @@ void Engine::loadSkybox(std::string skyboxDirName)
 
 	// Allocate and create the image
 	VK_ASSERT(vmaCreateImage(_allocator, &imageInfo, &dimg_allocinfo, &_skybox.allocImage.image, &_skybox.allocImage.allocation, nullptr));
+	gpu_memory::tag(_allocator, _skybox.allocImage.allocation, gpu_memory::Category::Skybox, basePath);
+
+	// Setup buffer copy regions for each face and level, index = face * mipLevels + level.
+	// Packed formats can't be blitted on most GPUs, so mips are generated on CPU.
+	std::vector<VkBufferImageCopy> bufferCopyRegions;
+	VkDeviceSize stagingSize = 0;
+	for (uint32_t face = 0; face < 6; face++) {
+		for (uint32_t level = 0; level < mipLevels; ++level) {
+			uint32_t levelW = std::max(uint32_t(baseTexW) >> level, 1u);
+			uint32_t levelH = std::max(uint32_t(baseTexH) >> level, 1u);
+
+			stagingSize = (stagingSize + 15) & ~VkDeviceSize(15);
+			bufferCopyRegions.push_back({
+				.bufferOffset = stagingSize,
+				.imageSubresource = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.mipLevel = level,
+					.baseArrayLayer = face,
+					.layerCount = 1,
+				},
+				.imageExtent = {
+					.width = levelW,
+					.height = levelH,
+					.depth = 1,
+				}
+			});
+			stagingSize += texture_container::getLevelSize(imageFormat, levelW, levelH);
+		}
+	}
 
-	immediate_submit(
-		[&](VkCommandBuffer cmd) {
-			// Setup buffer copy regions for each face including all of its mip levels
-			std::vector<VkBufferImageCopy> bufferCopyRegions;
-			VkDeviceSize offset = 0;
-
-			for (uint32_t face = 0; face < 6; face++)
-			{
-				// Calculate offset into staging buffer for the current mip level and face
-				VkBufferImageCopy bufferCopyRegion = {
-					.bufferOffset = offset,
-					.imageSubresource = {
-						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-						.mipLevel = 0,
-						.baseArrayLayer = face,
-						.layerCount = 1,
-					},
-					.imageExtent = {
-						.width = static_cast<uint32_t>(baseTexW),
-						.height = static_cast<uint32_t>(baseTexH),
-						.depth = 1,
-					}
-				};
-
-				bufferCopyRegions.push_back(bufferCopyRegion);
-				offset += imageSize;
-			}
+	_uploader.UploadImage(_skybox.allocImage.image, subresourceRange, bufferCopyRegions, stagingSize,
+		[&](void* dst) {
+			// Every face is decoded, packed and downsampled on its own thread
+			parallelFor(6, _loaderSettings.numThreads, [&](size_t face) {
+				std::string path = basePath + "/" + suff[face] + ".hdr";
 
-			vk_utils::imageMemoryBarrier(cmd, _skybox.allocImage.image,
-				0, 
-				VK_ACCESS_TRANSFER_WRITE_BIT,
+				int texW, texH, texChannels;
 
-				VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				ASSERT(stbi_is_hdr(path.c_str()) != 0);
+				float* pixel_ptr = stbi_loadf(path.c_str(), &texW, &texH, &texChannels, STBI_rgb_alpha);
 
-				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 
-				VK_PIPELINE_STAGE_TRANSFER_BIT,
-				subresourceRange);
+				ASSERT_MSG(pixel_ptr != nullptr, "Failed to load cubemap face " + std::to_string(face) + ", path: " + path);
+				// Make sure all the faces of cubemap have exactly the same dimensions and color channels
+				ASSERT(baseTexW == texW && baseTexH == texH && baseTexChannels == texChannels);
 
-			// Copy the buffer into the image
-			vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, _skybox.allocImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				static_cast<uint32_t>(bufferCopyRegions.size()), bufferCopyRegions.data());
+				const float* levelData = pixel_ptr;
+				std::vector<float> nextLevel;
+				for (uint32_t level = 0; level < mipLevels; ++level) {
+					const VkBufferImageCopy& region = bufferCopyRegions[face * mipLevels + level];
+					uint32_t levelW = region.imageExtent.width, levelH = region.imageExtent.height;
 
-			vk_utils::imageMemoryBarrier(cmd, _skybox.allocImage.image,
-				VK_ACCESS_TRANSFER_WRITE_BIT, 
-				VK_ACCESS_SHADER_READ_BIT,
+					texture_converter::encodeHdr(levelData, size_t(levelW) * levelH, imageFormat, (uint8_t*)dst + region.bufferOffset);
 
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					if (level + 1 < mipLevels) {
+						nextLevel = texture_converter::downsampleHdr(levelData, levelW, levelH);
+						levelData = nextLevel.data();
+					}
+				}
 
-				VK_PIPELINE_STAGE_TRANSFER_BIT,
-				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-				subresourceRange);
-		}
-	);
+				// We no longer need the loaded data, so we can free the pixels as they are now in the staging buffer
+				stbi_image_free(pixel_ptr);
+			});
+		});
 
 	// Create image view
 	VkImageViewCreateInfo imageinfo = {
@@ -325,9 +290,19 @@ void Engine::loadSkybox(std::string skyboxDirName)
 
 	VK_ASSERT(vkCreateImageView(_device, &imageinfo, nullptr, &_skybox.view));
 
-	stagingBuffer.destroy(_allocator);
-	pr("Cubemap loaded successfully: " << basePath);
+	// Same cubemap without mips as it was loaded before, for comparison
+	VkDeviceSize rgba32fSize = VkDeviceSize(baseTexW) * baseTexH * 16 * 6;
+	pr("Cubemap loaded successfully: " << basePath << " (" << string_VkFormat(imageFormat) << ", " << mipLevels << " mips, "
+		<< stagingSize / 1024 << " KiB vs " << rgba32fSize / 1024 << " KiB as RGBA32F without mips, " << timer.ElapsedMs() << " ms)");
+
+	// Skybox can be loaded at runtime, the upload has to be submitted before the next frame.
+	// Frame loop doesn't wait for it, the graphics queue does.
+	_uploader.Submit();
+	writeSkyboxDescriptors();
+}
 
+void Engine::writeSkyboxDescriptors()
+{
 	// Write cubemap to descriptor set
 	_skybox.allocImage.descInfo = {
 		.sampler = _linearSampler, 
@@ -354,6 +329,82 @@ void Engine::loadSkybox(std::string skyboxDirName)
 
 
 Attachment* Engine::loadTextureFromFile(const char* path)
+{
+	loadTextures({ path });
+	return getTexture(path);
+}
+
+std::string Engine::getDerivativeMapTag(const std::string& path)
+{
+	// Same image may be used both as diffuse and bump texture
+	return path + "#derivatives";
+}
+
+void Engine::loadTextures(const std::vector<std::string>& paths, bool derivativeMaps)
+{
+	if (paths.empty()) {
+		return;
+	}
+
+	Timer timer;
+
+	texture_decoder::Options options = {
+		.useCompressed = _loaderSettings.useCompressedTextures,
+		.useCache = _loaderSettings.useTextureCache,
+		.format = derivativeMaps ? chooseDerivativeMapFormat() : TEXTURE_FORMAT,
+		.mips = _loaderSettings.generateTextureMips,
+		.derivativeMap = derivativeMaps
+	};
+
+	std::vector<texture_decoder::DecodedTexture> textures(paths.size());
+	for (size_t i = 0; i < paths.size(); ++i) {
+		textures[i].path = paths[i];
+		texture_decoder::probe(textures[i], options);
+	}
+
+	auto isFormatSupported = [this](VkFormat format) { return isTextureFormatSupported(format); };
+
+	// Decoded data of a whole batch is kept in memory until it is uploaded,
+	// so batches are limited by the size estimated from the file headers
+	double decodeMs = 0.0, uploadMs = 0.0;
+	size_t numBatches = 0;
+	for (size_t begin = 0; begin < textures.size(); ++numBatches) {
+		size_t end = begin;
+		VkDeviceSize batchSize = 0;
+		do {
+			batchSize += textures[end++].estimatedSize;
+		} while (end < textures.size() && batchSize + textures[end].estimatedSize <= TEXTURE_UPLOAD_BATCH_SIZE);
+
+		Timer stepTimer;
+		texture_decoder::decodeRange(textures, begin, end, isFormatSupported, options, _loaderSettings.numThreads);
+		decodeMs += stepTimer.ElapsedMs();
+
+		stepTimer.Reset();
+		uploadDecodedTextures(textures, begin, end, options);
+		uploadMs += stepTimer.ElapsedMs();
+
+		begin = end;
+	}
+
+	size_t numFromCache = 0;
+	for (auto& tex : textures) {
+		numFromCache += tex.fromCache && !tex.cacheWritten;
+	}
+
+	pr("\t" << paths.size() << (derivativeMaps ? " derivative maps (" + std::string(string_VkFormat(options.format)) + ")" : " textures")
+		<< " loaded in " << timer.ElapsedMs() << " ms (decode " << decodeMs << " ms on "
+		<< getNumWorkerThreads(_loaderSettings.numThreads) << " threads, " << numFromCache << " from texture cache, upload "
+		<< uploadMs << " ms in " << numBatches << " batches)");
+
+	if (_loaderSettings.useTextureCache) {
+		// Unmap the entries first, mapped files can't be deleted on Windows
+		textures.clear();
+		texture_cache::evict(uint64_t(_loaderSettings.textureCacheSizeMiB) * 1024 * 1024);
+	}
+}
+
+void Engine::uploadDecodedTextures(std::vector<texture_decoder::DecodedTexture>& textures, size_t begin, size_t end,
+	const texture_decoder::Options& options)
 {
 	/* Function is based on https://github.com/vblanco20-1/vulkan-guide */
 	/* The MIT License (MIT)
@@ -379,161 +430,324 @@ Attachment* Engine::loadTextureFromFile(const char* path)
 	THE SOFTWARE.
 	*/
 
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	if (!pixels) {
-		PRERR("Failed to load texture file " << path);
-		return nullptr;
-	}
-
-	void* pixel_ptr = pixels;
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-
 	// The format R8G8B8A8 matches exactly with the pixels loaded from stb_image lib
-	VkFormat imageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	const VkFormat rgbaFormat = TEXTURE_FORMAT;
 
-	// Allocate temporary buffer for holding texture data to upload
-	AllocatedBuffer stagingBuffer = allocateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	// Full mip chain of source images is generated on GPU by blitting, if the format supports it
+	bool generateMips = _loaderSettings.generateTextureMips;
+	if (generateMips && !vk_utils::formatSupportsLinearBlit(_physicalDevice, rgbaFormat)) {
+		PRWRN("Linear blit of " << string_VkFormat(rgbaFormat) << " is not supported, textures have no mipmaps");
+		generateMips = false;
+	}
 
-	// Copy data to buffer
-	memcpy(stagingBuffer.memory_ptr, pixel_ptr, static_cast<size_t>(imageSize));
-	
-	// We no longer need the loaded data, so we can free the pixels as they are now in the staging buffer
-	stbi_image_free(pixels);
+	for (size_t i = begin; i < end; ++i) {
+		auto& tex = textures[i];
+		if (!tex.valid) {
+			continue;
+		}
 
-	VkExtent3D imageExtent{
-		.width = static_cast<uint32_t>(texWidth),
-		.height = static_cast<uint32_t>(texHeight),
-		.depth = 1
-	};
+		std::string tag = options.derivativeMap ? getDerivativeMapTag(tex.path) : tex.path;
 
-	VkImageSubresourceRange subresourceRange = {
-		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-		.baseMipLevel = 0,
-		.levelCount = 1,
-		.baseArrayLayer = 0,
-		.layerCount = 1
-	};
+		VkFormat format = tex.isCompressed() ? tex.container.format : rgbaFormat;
+		uint32_t mipLevels = tex.isCompressed() ? tex.container.mipLevels
+			: (generateMips ? vk_utils::getMipLevelCount(tex.width, tex.height) : 1);
 
-	VkImageCreateInfo dimg_info =
-		vkinit::image_create_info(imageFormat,
-			VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+		// Same data under another path shares image and slot of the registered texture
+		TextureRegistry::ContentKey contentKey = {
+			.hash = tex.contentHash,
+			.format = format,
+			.width = tex.width,
+			.height = tex.height,
+			.mipLevels = mipLevels
+		};
+		if (Attachment* sameTexture = _textureRegistry.FindContent(contentKey)) {
+			_textureRegistry.AddAlias(tag, *sameTexture);
+			pr("\tTexture " << tex.path << " has the same content as " << sameTexture->tag << ", sharing it");
+			continue;
+		}
 
-	// This creates entry in cache
-	Attachment& newTexture = _textures[path];
-	newTexture.tag = path;
+		// Textures whose levels can be read again only get their coarsest levels now, see TextureStreamer
+		if (_loaderSettings.streamTextures && tex.isCompressed() && tex.container.mipLevels > 1
+			&& (!tex.compressedPath.empty() || tex.fromCache))
+		{
+			TextureStreamer::ReloadFn reload;
+			if (!tex.compressedPath.empty()) {
+				reload = [path = tex.compressedPath](texture_container::Texture& container) {
+					return texture_container::load(path, container) && container.faces == 1;
+				};
+			} else {
+				reload = [path = tex.path, format = options.format, mips = options.mips](texture_container::Texture& container) {
+					return texture_cache::read(path, format, mips, container);
+				};
+			}
 
-	VmaAllocationCreateInfo dimg_allocinfo = {};
-	dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+			Attachment& newTexture = _textures[tag];
+			newTexture.tag = tag;
+			_textureStreamer.Add(newTexture, tex.container, reload);
+			_textureRegistry.Register(newTexture, contentKey);
 
-	// Allocate and create the image
-	VK_ASSERT(vmaCreateImage(_allocator, &dimg_info, &dimg_allocinfo, &newTexture.allocImage.image, &newTexture.allocImage.allocation, nullptr));
-
-	immediate_submit(
-		[&](VkCommandBuffer cmd) {
-			VkBufferImageCopy copyRegion{
-				.bufferOffset = 0,
-				.bufferRowLength = 0,
-				.bufferImageHeight = 0,
+			pr("\tTexture loaded successfully: " << (tex.compressedPath.empty() ? tex.path : tex.compressedPath) << " (" << tex.width << "x" << tex.height
+				<< ", " << string_VkFormat(tex.container.format) << ", " << tex.container.mipLevels << " mips, streamed)");
+			continue;
+		}
+
+		// Copy regions relative to the start of the texture's staging memory,
+		// offsets are aligned for texel blocks of any supported format
+		std::vector<VkBufferImageCopy> copyRegions;
+		VkDeviceSize stagingSize = 0;
+		uint32_t numLevels = tex.isCompressed() ? mipLevels : 1;
+		for (uint32_t level = 0; level < numLevels; ++level) {
+			stagingSize = (stagingSize + 15) & ~VkDeviceSize(15);
+			copyRegions.push_back({
+				.bufferOffset = stagingSize,
 				.imageSubresource = {
 					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.mipLevel = 0,
+					.mipLevel = level,
 					.baseArrayLayer = 0,
 					.layerCount = 1,
 				},
-				.imageExtent = imageExtent
-			};
+				.imageExtent = {
+					.width = std::max(tex.width >> level, 1u),
+					.height = std::max(tex.height >> level, 1u),
+					.depth = 1
+				}
+			});
+			stagingSize += tex.isCompressed() ? tex.container.region(0, level).size : tex.dataSize();
+		}
 
-			vk_utils::imageMemoryBarrier(cmd, newTexture.allocImage.image,
-				0,
-				VK_ACCESS_TRANSFER_WRITE_BIT,
+		VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		if (!tex.isCompressed()) {
+			// Source of the mip blits
+			usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		}
+		VkImageCreateInfo dimg_info = vkinit::image_create_info(format, usage, { tex.width, tex.height, 1 }, mipLevels);
 
-				VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		// This creates entry in cache
+		Attachment& newTexture = _textures[tag];
+		newTexture.tag = tag;
 
-				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-				VK_PIPELINE_STAGE_TRANSFER_BIT,
-				subresourceRange);
+		VmaAllocationCreateInfo dimg_allocinfo = {};
+		dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-			// Copy the buffer into the image
-			vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, newTexture.allocImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+		// Allocate and create the image
+		VK_ASSERT(vmaCreateImage(_allocator, &dimg_info, &dimg_allocinfo, &newTexture.allocImage.image, &newTexture.allocImage.allocation, nullptr));
+		gpu_memory::tag(_allocator, newTexture.allocImage.allocation, gpu_memory::Category::Textures, tag);
 
-			vk_utils::imageMemoryBarrier(cmd, newTexture.allocImage.image,
-				VK_ACCESS_TRANSFER_WRITE_BIT,
-				VK_ACCESS_SHADER_READ_BIT,
+		VkImageSubresourceRange subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = 0,
+			.levelCount = mipLevels,
+			.baseArrayLayer = 0,
+			.layerCount = 1
+		};
 
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		// Mips of source images are generated from level 0
+		_uploader.UploadImage(newTexture.allocImage.image, subresourceRange, copyRegions, stagingSize,
+			[&](void* dst) {
+				for (uint32_t level = 0; level < numLevels; ++level) {
+					char* regionDst = (char*)dst + copyRegions[level].bufferOffset;
+					if (tex.isCompressed()) {
+						const auto& region = tex.container.region(0, level);
+						memcpy(regionDst, region.data, region.size);
+					} else {
+						memcpy(regionDst, tex.pixels, tex.dataSize());
+					}
+				}
+			},
+			!tex.isCompressed());
 
-				VK_PIPELINE_STAGE_TRANSFER_BIT,
-				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-				subresourceRange);
-		}
-	);
+		// We no longer need the loaded data, so we can free the pixels as they are now in the staging buffer
+		tex.freePixels();
 
-	VkImageViewCreateInfo imageinfo =
-		vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_SRGB, newTexture.allocImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		VkImageViewCreateInfo imageinfo =
+			vkinit::imageview_create_info(format, newTexture.allocImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		imageinfo.subresourceRange.levelCount = mipLevels;
 
-	VK_ASSERT(vkCreateImageView(_device, &imageinfo, nullptr, &newTexture.view));
+		VK_ASSERT(vkCreateImageView(_device, &imageinfo, nullptr, &newTexture.view));
 
-	_sceneDisposeStack.push([=]() mutable {
-		vkDestroyImageView(_device, newTexture.view, nullptr);
-		vmaDestroyImage(_allocator, newTexture.allocImage.image, newTexture.allocImage.allocation);
-	});
+		_textureRegistry.Register(newTexture, contentKey);
 
-	stagingBuffer.destroy(_allocator);
-	pr("\tTexture loaded successfully: " << path);
-	
+		_sceneDisposeStack.push([=]() mutable {
+			vkDestroyImageView(_device, newTexture.view, nullptr);
+			vmaDestroyImage(_allocator, newTexture.allocImage.image, newTexture.allocImage.allocation);
+		});
 
-	return &_textures[path];
+		if (tex.isCompressed()) {
+			pr("\tTexture loaded successfully: " << (tex.compressedPath.empty() ? tex.path : tex.compressedPath) << " (" << tex.width << "x" << tex.height << ", "
+				<< string_VkFormat(format) << ", " << mipLevels << " mips, " << tex.dataSize() / 1024 << " KiB)");
+		} else {
+			// Full chain adds a third of the base level size
+			VkDeviceSize memorySize = 0;
+			for (uint32_t level = 0; level < mipLevels; ++level) {
+				memorySize += VkDeviceSize(std::max(tex.width >> level, 1u)) * std::max(tex.height >> level, 1u) * 4;
+			}
+			pr("\tTexture loaded successfully: " << tex.path << " (" << tex.width << "x" << tex.height << ", "
+				<< mipLevels << " mips, " << memorySize / 1024 << " KiB)");
+		}
+	}
 }
 
+VkFormat Engine::chooseSkyboxFormat()
+{
+	// From the most compact, RGB9E5 keeps the most precision of the 32 bit formats
+	std::vector<VkFormat> candidates = {
+		VK_FORMAT_E5B9G9R9_UFLOAT_PACK32,
+		VK_FORMAT_B10G11R11_UFLOAT_PACK32,
+		VK_FORMAT_R16G16B16A16_SFLOAT
+	};
+
+	if (_loaderSettings.skyboxFormat != VK_FORMAT_UNDEFINED) {
+		candidates.insert(candidates.begin(), _loaderSettings.skyboxFormat);
+	}
+
+	for (VkFormat format : candidates) {
+		if (isTextureFormatSupported(format)) {
+			return format;
+		}
+		PRWRN("Skybox format " << string_VkFormat(format) << " is not supported");
+	}
 
-void Engine::createMeshBuffer(Mesh& mesh, bool isVertexBuffer)
+	// Format of the decoded .hdr faces, supported everywhere
+	return VK_FORMAT_R32G32B32A32_SFLOAT;
+}
+
+VkFormat Engine::chooseDerivativeMapFormat()
 {
-	ASSERT(isVertexBuffer && mesh.vertices.size() > 0 || !isVertexBuffer && mesh.indices.size() > 0);
+	// Derivatives are smooth enough for BC5, which takes half of the memory of R8G8
+	if (isTextureFormatSupported(VK_FORMAT_BC5_UNORM_BLOCK)) {
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	}
+	return VK_FORMAT_R8G8_UNORM;
+}
 
-	const size_t bufferSize = isVertexBuffer ?
-		mesh.vertices.size() * sizeof(Vertex) :
-		mesh.indices.size() * sizeof(uint32_t);
+bool Engine::isTextureFormatSupported(VkFormat format)
+{
+	if (texture_container::isBlockCompressed(format) && !_textureCompressionBC) {
+		return false;
+	}
 
-	// Allocate temporary buffer for holding texture data to upload
-	AllocatedBuffer stagingBuffer = allocateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &props);
 
-	if (isVertexBuffer) {
-		memcpy(stagingBuffer.memory_ptr, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
-	} else {
-		memcpy(stagingBuffer.memory_ptr, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (props.optimalTilingFeatures & required) == required;
+}
+
+void Engine::uploadTextureContainer(const texture_container::Texture& tex, AllocatedImage& image, VkImageView& view)
+{
+	// Every (face, level) region is copied from the mapped file straight into staging memory,
+	// offsets are aligned for texel blocks of any supported format
+	std::vector<VkBufferImageCopy> copyRegions;
+	VkDeviceSize stagingSize = 0;
+	for (uint32_t face = 0; face < tex.faces; ++face) {
+		for (uint32_t level = 0; level < tex.mipLevels; ++level) {
+			stagingSize = (stagingSize + 15) & ~VkDeviceSize(15);
+			copyRegions.push_back({
+				.bufferOffset = stagingSize,
+				.imageSubresource = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.mipLevel = level,
+					.baseArrayLayer = face,
+					.layerCount = 1,
+				},
+				.imageExtent = {
+					.width = std::max(tex.width >> level, 1u),
+					.height = std::max(tex.height >> level, 1u),
+					.depth = 1
+				}
+			});
+			stagingSize += tex.region(face, level).size;
+		}
 	}
 
-	VkBufferUsageFlags usg = (isVertexBuffer ? VK_BUFFER_USAGE_VERTEX_BUFFER_BIT : VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	const bool isCube = tex.faces == 6;
 
-	AllocatedBuffer& allocBuffer = isVertexBuffer ? mesh.vertexBuffer : mesh.indexBuffer;
+	VkImageCreateInfo imageInfo = vkinit::image_create_info(tex.format,
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, { tex.width, tex.height, 1 }, tex.mipLevels,
+		isCube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : (VkImageCreateFlagBits)0);
+	// Cube faces count as array layers in Vulkan
+	imageInfo.arrayLayers = tex.faces;
 
-	allocBuffer = allocateBuffer(bufferSize, usg | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-	immediate_submit([&](VkCommandBuffer cmd) {
-		VkBufferCopy copy;
-		copy.dstOffset = 0;
-		copy.srcOffset = 0;
-		copy.size = bufferSize;
-		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, allocBuffer.buffer, 1, &copy);
-		});
+	VK_ASSERT(vmaCreateImage(_allocator, &imageInfo, &allocInfo, &image.image, &image.allocation, nullptr));
 
-	_sceneDisposeStack.push([&]() {
-		allocBuffer.destroy(_allocator);
+	VkImageSubresourceRange subresourceRange = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = tex.mipLevels,
+		.baseArrayLayer = 0,
+		.layerCount = tex.faces
+	};
+
+	_uploader.UploadImage(image.image, subresourceRange, copyRegions, stagingSize,
+		[&](void* dst) {
+			for (uint32_t face = 0; face < tex.faces; ++face) {
+				for (uint32_t level = 0; level < tex.mipLevels; ++level) {
+					const auto& region = tex.region(face, level);
+					memcpy((char*)dst + copyRegions[face * tex.mipLevels + level].bufferOffset, region.data, region.size);
+				}
+			}
 		});
 
-	// Destroy staging buffer now as we don't need it anymore
-	stagingBuffer.destroy(_allocator);
+	VkImageViewCreateInfo viewInfo = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.image = image.image,
+		.viewType = isCube ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D,
+		.format = tex.format,
+		.subresourceRange = subresourceRange,
+	};
+
+	VK_ASSERT(vkCreateImageView(_device, &viewInfo, nullptr, &view));
 }
 
 void Engine::uploadMesh(Mesh& mesh)
 {
-	// Create vertex buffer
-	createMeshBuffer(mesh, true);
-	// Create index buffer
-	createMeshBuffer(mesh, false);
+	ASSERT(mesh.vertices.size() > 0 && mesh.indices.size() > 0);
+
+	// Vertex range is aligned to the stride, so that its offset is a whole number of vertices
+	if (!mesh.packedVertices.empty()) {
+		mesh.vertexRange = _geometry.Allocate(mesh.packedVertices.size() * sizeof(PackedVertex), sizeof(PackedVertex), [&](void* dst) {
+			memcpy(dst, mesh.packedVertices.data(), mesh.packedVertices.size() * sizeof(PackedVertex));
+		});
+		mesh.vertexOffset = static_cast<int32_t>(mesh.vertexRange.offset / sizeof(PackedVertex));
+	} else {
+		mesh.vertexRange = _geometry.Allocate(mesh.vertices.size() * sizeof(Vertex), sizeof(Vertex), [&](void* dst) {
+			memcpy(dst, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+		});
+		mesh.vertexOffset = static_cast<int32_t>(mesh.vertexRange.offset / sizeof(Vertex));
+	}
+
+	// Use 16 bit indices if possible to halve index memory and fetch bandwidth.
+	// Primitive restart is disabled so 0xFFFF is a valid index too.
+	// Indices stay relative to the mesh's vertices, vertexOffset of the draw points them into its range.
+	mesh.indexType = mesh.vertices.size() <= std::numeric_limits<uint16_t>::max() + 1
+		? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+	if (mesh.indexType == VK_INDEX_TYPE_UINT16) {
+		// Narrow indices straight into staging memory
+		mesh.indexRange = _geometry.Allocate(mesh.indices.size() * sizeof(uint16_t), sizeof(uint16_t), [&](void* dst) {
+			uint16_t* dst16 = static_cast<uint16_t*>(dst);
+			for (size_t i = 0; i < mesh.indices.size(); ++i) {
+				dst16[i] = static_cast<uint16_t>(mesh.indices[i]);
+			}
+		});
+		mesh.firstIndex = static_cast<uint32_t>(mesh.indexRange.offset / sizeof(uint16_t));
+	} else {
+		mesh.indexRange = _geometry.Allocate(mesh.indices.size() * sizeof(uint32_t), sizeof(uint32_t), [&](void* dst) {
+			memcpy(dst, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+		});
+		mesh.firstIndex = static_cast<uint32_t>(mesh.indexRange.offset / sizeof(uint32_t));
+	}
+
+	// Meshlet bounds for per cluster culling
+	if (!mesh.meshlets.empty()) {
+		mesh.meshletRange = _geometry.Allocate(mesh.meshlets.size() * sizeof(GPUMeshlet),
+			std::max<VkDeviceSize>(_gpuProperties.limits.minStorageBufferOffsetAlignment, sizeof(uint32_t)), [&](void* dst) {
+				memcpy(dst, mesh.meshlets.data(), mesh.meshlets.size() * sizeof(GPUMeshlet));
+			});
+	}
 }
 
 
@@ -613,6 +827,12 @@ void Engine::createSamplers()
 	VkSamplerCreateInfo samplerInfo = vkinit::sampler_create_info(VK_FILTER_LINEAR);
 	VkSamplerCreateInfo samplerInfo1 = vkinit::sampler_create_info(VK_FILTER_NEAREST);
 
+	// Trilinear filtering of mipmapped model textures.
+	// Other images sampled with it have views of a single level, so nothing changes for them.
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.minLod = 0.f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
 	VK_ASSERT(vkCreateSampler(_device, &samplerInfo, nullptr, &_linearSampler));
 	VK_ASSERT(vkCreateSampler(_device, &samplerInfo1, nullptr, &_nearestSampler));
 
@@ -631,13 +851,21 @@ void Engine::cleanupScene()
 	_models.clear();
 
 	_sceneDisposeStack.flush();
+	_textureStreamer.Clear();
+
+	for (auto& [tag, texture] : _textures) {
+		_textureRegistry.Release(texture);
+	}
+
+	// Ranges of the next scene are allocated from the start of the kept block again
+	for (auto& [tag, mesh] : _meshes) {
+		_geometry.Free(mesh.vertexRange);
+		_geometry.Free(mesh.indexRange);
+		_geometry.Free(mesh.meshletRange);
+	}
+	_geometry.Trim();
 
 	_meshes.clear();
 	_textures.clear();
-
-	_modelLoaderGlobalDiffuseTexIndex = 0;
-	_modelLoaderGlobalBumpTexIndex = 0;
-	_diffTexInsertionOrdered.clear();
-	_bumpTexInsertionOrdered.clear();
 }
 
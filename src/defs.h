@@ -103,4 +103,7 @@
 #define SHADER_PATH ASSET_PATH + std::string("shaders/bin/")
 #define SKYBOX_PATH IMAGE_PATH + std::string("skybox/")
 
+// Generated data (mesh cache etc.), safe to delete
+#define CACHE_PATH ASSET_PATH + std::string("cache/")
+
 #define SCREENSHOT_PATH std::string("screenshots/")
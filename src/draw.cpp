@@ -46,10 +46,85 @@ static void cmdSetViewportScissor(VkCommandBuffer cmd, uint32_t w, uint32_t h)
 }
 
 
+// Coarsest LOD whose error projects to at most lodPixelError pixels.
+// pixelScale converts size at unit distance to pixels: image height / (2 * tan(fovY / 2)).
+const MeshLod& Engine::selectMeshLod(const Mesh& mesh, const glm::mat4& transform, glm::vec3 viewPos, float pixelScale, LodStats& stats)
+{
+	ASSERT(!mesh.lods.empty());
+
+	uint32_t selected = 0;
+	if (_renderContext.enableLods && mesh.lods.size() > 1) {
+		float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+		glm::vec3 center = transform * glm::vec4(mesh.boundsCenter, 1.f);
+		// Distance to the closest point of the bounds, clamped to avoid division by zero inside them
+		float distance = std::max(glm::distance(viewPos, center) - mesh.boundsRadius * scale, 1e-3f);
+
+		for (uint32_t i = static_cast<uint32_t>(mesh.lods.size()) - 1; i > 0; --i) {
+			if (mesh.lods[i].error * scale / distance * pixelScale <= _renderContext.lodPixelError) {
+				selected = i;
+				break;
+			}
+		}
+	}
+
+	const MeshLod& lod = mesh.lods[selected];
+	++stats.draws[selected];
+	stats.triangles += lod.indexCount / 3;
+	stats.fullTriangles += mesh.lods[0].indexCount / 3;
+
+	return lod;
+}
+
+// Same projection as selectMeshLod: a surface at distance covers pixelScale / distance pixels per world unit
+void Engine::requestTextureLevels()
+{
+	float pixelScale = _viewport.height / (2.f * std::tan(glm::radians(_renderContext.fovY) * 0.5f));
+	glm::vec3 viewPos = _camera.GetPos();
+
+	for (auto& object : _renderables) {
+		glm::mat4 transform = object->Transform();
+		// Smallest scale stretches the texture the least, so it is the one to need the finest level
+		float scale = std::min({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+
+		for (Mesh* mesh : object->model->meshes) {
+			if ((!mesh->diffuseTex && !mesh->bumpTex) || mesh->uvDensity <= 0.f) {
+				continue;
+			}
+
+			glm::vec3 center = transform * glm::vec4(mesh->boundsCenter, 1.f);
+			float distance = std::max(glm::distance(viewPos, center) - mesh->boundsRadius * scale, 1e-3f);
+			// Pixels covered by one uv unit, which spans 1 / uvDensity model units
+			float uvScreenSize = scale / mesh->uvDensity * pixelScale / distance;
+
+			for (const Attachment* tex : { mesh->diffuseTex, mesh->bumpTex }) {
+				if (tex) {
+					_textureStreamer.Request(tex, uvScreenSize);
+				}
+			}
+		}
+	}
+}
+
+void Engine::bindMeshGeometry(VkCommandBuffer cmd, const Mesh* lastMesh, const Mesh& mesh)
+{
+	// All meshes usually share one buffer, so this binds once per pass and again only when the index type changes
+	if (!lastMesh || lastMesh->vertexRange.block != mesh.vertexRange.block) {
+		VkBuffer buffer = _geometry.GetBuffer(mesh.vertexRange.block);
+		VkDeviceSize zeroOffset = 0;
+		vkCmdBindVertexBuffers(cmd, 0, 1, &buffer, &zeroOffset);
+	}
+	if (!lastMesh || lastMesh->indexRange.block != mesh.indexRange.block || lastMesh->indexType != mesh.indexType) {
+		vkCmdBindIndexBuffer(cmd, _geometry.GetBuffer(mesh.indexRange.block), 0, mesh.indexType);
+	}
+}
+
 void Engine::drawObject(VkCommandBuffer cmd, const std::shared_ptr<RenderObject>& object, Material** lastMaterial, Mesh** lastMesh, uint32_t index) {
 	const RenderObject& obj = *object;
 	Model* model = obj.model;
 
+	glm::mat4 transform = object->Transform();
+	float pixelScale = _viewport.height / (2.f * std::tan(glm::radians(_renderContext.fovY) * 0.5f));
+
 	for (uint32_t m = 0; m < model->meshes.size(); ++m) {
 		Mesh* mesh = model->meshes[m];
 
@@ -97,16 +172,12 @@ void Engine::drawObject(VkCommandBuffer cmd, const std::shared_ptr<RenderObject>
 			*lastMaterial = mesh->material;
 		}
 
-		if (mesh != *lastMesh) {
-			VkDeviceSize zeroOffset = 0;
-			vkCmdBindVertexBuffers(cmd, 0, 1, &mesh->vertexBuffer.buffer, &zeroOffset);
-			vkCmdBindIndexBuffer(cmd, mesh->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+		bindMeshGeometry(cmd, *lastMesh, *mesh);
+		*lastMesh = mesh;
 
-			*lastMesh = mesh;
-		}
+		const MeshLod& lod = selectMeshLod(*mesh, transform, _camera.GetPos(), pixelScale, _viewportLodStats);
 
-		// Ve send loop index as instance index to use it in shader to access object data in SSBO
-		vkCmdDrawIndexed(cmd, mesh->indices.size(), 1, 0, 0, 0); // index
+		vkCmdDrawIndexed(cmd, lod.indexCount, 1, mesh->firstIndex + lod.firstIndex, mesh->vertexOffset, 0);
 
 		endCmdDebugLabel(cmd);
 	}
@@ -116,6 +187,7 @@ void Engine::drawObjects(VkCommandBuffer cmd, const std::vector<std::shared_ptr<
 {
 	Mesh* lastMesh = nullptr;
 	Material* lastMaterial = nullptr;
+	_viewportLodStats = {};
 	for (uint32_t i = 0; i < objects.size(); i++) {
 		drawObject(cmd, objects[i], &lastMaterial, &lastMesh, i);
 	}
@@ -165,6 +237,11 @@ void Engine::updateShadowCubemapFace(FrameData& f, uint32_t lightIndex, uint32_t
 			&pc);
 
 		{ // Draw all objects' shadows
+			glm::vec3 lightPos = _renderContext.sceneData.lights[lightIndex].position;
+			// Cube faces have 90 degree field of view
+			float pixelScale = _shadow.height / 2.f;
+
+			const Mesh* lastMesh = nullptr;
 			for (int i = 0; i < _renderables.size(); ++i) {
 				const RenderObject& obj = *_renderables[i];
 				Model* model = obj.model;
@@ -172,19 +249,21 @@ void Engine::updateShadowCubemapFace(FrameData& f, uint32_t lightIndex, uint32_t
 					continue;
 				}
 
+				glm::mat4 transform = _renderables[i]->Transform();
+
 				for (int m = 0; m < model->meshes.size(); ++m) {
 					Mesh* mesh = model->meshes[m];
 					if (mesh->isTransparent) {
 						continue;
 					}
 
-					VkDeviceSize zeroOffset = 0;
-					vkCmdBindVertexBuffers(f.cmd, 0, 1, &mesh->vertexBuffer.buffer, &zeroOffset);
+					bindMeshGeometry(f.cmd, lastMesh, *mesh);
+					lastMesh = mesh;
 
-					vkCmdBindIndexBuffer(f.cmd, mesh->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+					const MeshLod& lod = selectMeshLod(*mesh, transform, lightPos, pixelScale, _shadowLodStats);
 
 					// We send loop index as instance index to use it in shader to access object data in SSBO
-					vkCmdDrawIndexed(f.cmd, mesh->indices.size(), 1, 0, 0, i);
+					vkCmdDrawIndexed(f.cmd, lod.indexCount, 1, mesh->firstIndex + lod.firstIndex, mesh->vertexOffset, i);
 				}
 			}
 		}
@@ -211,9 +290,13 @@ void Engine::loadDataToGPU()
 	{
 		for (int i = 0; i < objects.size(); i++) {
 			glm::mat4 modelMat = objects[i]->Transform();
+			const VertexDequant& dq = objects[i]->model->dequant;
 			_gpudt.ssbo->objects[i] = {
 				.modelMatrix = modelMat,
-				.normalMatrix = glm::mat3(glm::transpose(glm::inverse(modelMat)))
+				.normalMatrix = glm::mat3(glm::transpose(glm::inverse(modelMat))),
+				.posScale = glm::vec4(dq.posScale, 0.f),
+				.posOffset = glm::vec4(dq.posOffset, 0.f),
+				.uvScaleOffset = glm::vec4(dq.uvScale, dq.uvOffset)
 				//.color = objects[i]->color
 			};
 
@@ -227,6 +310,7 @@ void Engine::loadDataToGPU()
 	{
 		_renderContext.sceneData.cameraPos = _camera.GetPos();
 		_renderContext.sceneData.lightFarPlane = _renderContext.zFar;
+		_renderContext.sceneData.useDerivativeMaps = _loaderSettings.derivativeBumpMaps;
 
 		memcpy(_gpudt.scene, &_renderContext.sceneData, sizeof(GPUSceneUB));
 	}
@@ -286,31 +370,33 @@ void Engine::loadDataToGPU()
 	}
 }
 
-void Engine::durand2002(VkCommandBuffer& cmd, int imageIndex)
+void Engine::durand2002(VkCommandBuffer& cmd, int frameIndex)
 {
 	beginCmdDebugLabel(cmd, DURAND_DBG_PREF);
+
+	_postfxMemory.BeginPass(cmd, _postfx.getTransientPass(DURAND), VK_IMAGE_LAYOUT_GENERAL);
 	
 	uint32_t groupsX = _viewport.width  / COMPUTE_THREADS_XY + 1;
 	uint32_t groupsY = _viewport.height / COMPUTE_THREADS_XY + 1;
 
 	PostFX& cp = _postfx;
 	_postfx.Stage(DURAND, "lum_chrom").Bind(cmd)
-		.Dispatch(groupsX, groupsY, imageIndex)
+		.Dispatch(groupsX, groupsY, frameIndex)
 		.Barrier();
 
 	_postfx.Stage(DURAND, "bilateral").Bind(cmd)
-		.Dispatch(groupsX, groupsY, imageIndex)
+		.Dispatch(groupsX, groupsY, frameIndex)
 		.Barrier();
 
 	_postfx.Stage(DURAND, "reconstruct").Bind(cmd)
-		.Dispatch(groupsX, groupsY, imageIndex)
+		.Dispatch(groupsX, groupsY, frameIndex)
 		.Barrier();
 
 	endCmdDebugLabel(cmd);
 }
 
 
-void Engine::bloom(FrameData& f, int imageIndex)
+void Engine::bloom(FrameData& f, int frameIndex)
 {
 	PostFX& cp = _postfx;
 
@@ -319,8 +405,10 @@ void Engine::bloom(FrameData& f, int imageIndex)
 
 	beginCmdDebugLabel(f.cmd, BLOOM_DBG_PREF);
 	{
+		_postfxMemory.BeginPass(f.cmd, _postfx.getTransientPass(BLOOM), VK_IMAGE_LAYOUT_GENERAL);
+
 		cp.Stage(BLOOM, "threshold").Bind(f.cmd)
-			.Dispatch(groups32.x, groups32.y, imageIndex)
+			.Dispatch(groups32.x, groups32.y, frameIndex)
 			.Barrier();
 
 		GPUCompPC pc = {};
@@ -336,7 +424,7 @@ void Engine::bloom(FrameData& f, int imageIndex)
 
 			// Downsample
 			cp.Stage(BLOOM, "downsample").Bind(f.cmd)
-				.Dispatch(groups32.x, groups32.y, imageIndex)
+				.Dispatch(groups32.x, groups32.y, frameIndex)
 				.Barrier();
 
 
@@ -354,7 +442,7 @@ void Engine::bloom(FrameData& f, int imageIndex)
 			vkCmdPushConstants(f.cmd, cp.Stage(BLOOM, "upsample").pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCompPC), &pc);
 
 			cp.Stage(BLOOM, "upsample").Bind(f.cmd)
-				.Dispatch(groups32.x, groups32.y, imageIndex)
+				.Dispatch(groups32.x, groups32.y, frameIndex)
 				.Barrier();
 			endCmdDebugLabel(f.cmd);
 		}
@@ -362,7 +450,7 @@ void Engine::bloom(FrameData& f, int imageIndex)
 
 
 		cp.Stage(BLOOM, "combine").Bind(f.cmd)
-			.Dispatch(groups32.x, groups32.y, imageIndex)
+			.Dispatch(groups32.x, groups32.y, frameIndex)
 			.Barrier();
 #endif
 	}
@@ -370,17 +458,19 @@ void Engine::bloom(FrameData& f, int imageIndex)
 }
 
 
-void Engine::exposureFusion(VkCommandBuffer& cmd, int imageIndex)
+void Engine::exposureFusion(VkCommandBuffer& cmd, int frameIndex)
 {
 	beginCmdDebugLabel(cmd, FUSION_DBG_PREF);
 	auto& cp = _postfx;
+	_postfxMemory.BeginPass(cmd, cp.getTransientPass(FUSION), VK_IMAGE_LAYOUT_GENERAL);
+
 	beginCmdDebugLabel(cmd, FUSION_DBG_PREF + "::LUM_CHROM_WEIGHT");
 	{
 		uint32_t groupsX = _viewport.width  / COMPUTE_THREADS_XY + 1;
 		uint32_t groupsY = _viewport.height / COMPUTE_THREADS_XY + 1;
 
 		cp.Stage(FUSION, "lum_chrom_weight").Bind(cmd)
-			.Dispatch(groupsX, groupsY, imageIndex)
+			.Dispatch(groupsX, groupsY, frameIndex)
 			.Barrier();
 	}
 	endCmdDebugLabel(cmd);
@@ -403,7 +493,7 @@ void Engine::exposureFusion(VkCommandBuffer& cmd, int imageIndex)
 			vkCmdPushConstants(cmd, cp.Stage(FUSION, "downsample").pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCompPC), &pc);
 
 			cp.Stage(FUSION, "downsample").Bind(cmd)
-				.Dispatch(groupsX, groupsY, imageIndex)
+				.Dispatch(groupsX, groupsY, frameIndex)
 				.Barrier();
 
 			w >>= 1;
@@ -424,7 +514,7 @@ void Engine::exposureFusion(VkCommandBuffer& cmd, int imageIndex)
 
 			// Move highest lum mip (low-pass residual) to highest laplacian mip
 			cp.Stage(FUSION, "residual").Bind(cmd)
-				.Dispatch(groupsX, groupsY, imageIndex)
+				.Dispatch(groupsX, groupsY, frameIndex)
 				.Barrier();
 		}
 
@@ -444,11 +534,11 @@ void Engine::exposureFusion(VkCommandBuffer& cmd, int imageIndex)
 			vkCmdPushConstants(cmd, cp.Stage(FUSION, "upsample0_sub").pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCompPC), &pc);
 
 			cp.Stage(FUSION, "upsample0_sub").Bind(cmd)
-				.Dispatch(groupsX, groupsY, imageIndex)
+				.Dispatch(groupsX, groupsY, frameIndex)
 				.Barrier();
 
 			cp.Stage(FUSION, "upsample1_sub").Bind(cmd)
-				.Dispatch(groupsX, groupsY, imageIndex)
+				.Dispatch(groupsX, groupsY, frameIndex)
 				.Barrier();
 
 			w <<= 1;
@@ -477,11 +567,11 @@ void Engine::exposureFusion(VkCommandBuffer& cmd, int imageIndex)
 			vkCmdPushConstants(cmd, cp.Stage(FUSION, "upsample0_add").pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCompPC), &pc);
 
 			cp.Stage(FUSION, "upsample0_add").Bind(cmd)
-				.Dispatch(groupsX, groupsY, imageIndex)
+				.Dispatch(groupsX, groupsY, frameIndex)
 				.Barrier();
 
 			cp.Stage(FUSION, "upsample1_add").Bind(cmd)
-				.Dispatch(groupsX, groupsY, imageIndex)
+				.Dispatch(groupsX, groupsY, frameIndex)
 				.Barrier();
 			
 			w <<= 1;
@@ -499,7 +589,7 @@ void Engine::exposureFusion(VkCommandBuffer& cmd, int imageIndex)
 		uint32_t groupsY = _viewport.height / COMPUTE_THREADS_XY + 1;
 
 		cp.Stage(FUSION, "reconstruct").Bind(cmd)
-			.Dispatch(groupsX, groupsY, imageIndex)
+			.Dispatch(groupsX, groupsY, frameIndex)
 			.Barrier();
 	}
 	endCmdDebugLabel(cmd);
@@ -528,6 +618,11 @@ void Engine::shadowPass(FrameData& f, int imageIndex)
 		}
 	}
 
+	// Keep statistics of the last frame that rendered shadows
+	if (anyMoved) {
+		_shadowLodStats = {};
+	}
+
 	for (auto i : movedLightIndices) {
 		// Update light view matrices based on lights current position
 		glm::vec3 p = _renderContext.sceneData.lights[i].position;
@@ -568,12 +663,12 @@ void Engine::shadowPass(FrameData& f, int imageIndex)
 	endCmdDebugLabel(f.cmd);
 }
 
-void Engine::viewportPass(VkCommandBuffer& cmd, int imageIndex)
+void Engine::viewportPass(VkCommandBuffer& cmd, int frameIndex)
 {
 	cmdSetViewportScissor(cmd, _viewport.width, _viewport.height);
 	{ // Viewport pass
 		// Translate to required layout
-		vk_utils::imageMemoryBarrier(cmd, _viewport.images[imageIndex].image,
+		vk_utils::imageMemoryBarrier(cmd, _viewport.images[frameIndex].image,
 			0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 
 			VK_IMAGE_LAYOUT_UNDEFINED,
@@ -584,7 +679,7 @@ void Engine::viewportPass(VkCommandBuffer& cmd, int imageIndex)
 
 			FULL_COLOR_RANGE);
 
-		VkRenderingAttachmentInfo colorAttachmentInfo = vkinit::rendering_attachment_info(_viewport.imageViews[imageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		VkRenderingAttachmentInfo colorAttachmentInfo = vkinit::rendering_attachment_info(_viewport.imageViews[frameIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 		VkRenderingAttachmentInfo depthAttachmentInfo = vkinit::rendering_attachment_info(_viewport.depth.view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
 		VkRenderingInfo renderingInfo = vkinit::rendering_info(&colorAttachmentInfo, &depthAttachmentInfo, _viewport.width, _viewport.height);
@@ -601,7 +696,7 @@ void Engine::viewportPass(VkCommandBuffer& cmd, int imageIndex)
 }
 
 
-void Engine::postfxPass(FrameData& f, int imageIndex)
+void Engine::postfxPass(FrameData& f, int frameIndex)
 {
 	beginCmdDebugLabel(f.cmd, "POSTFX_PASS");
 
@@ -619,16 +714,16 @@ void Engine::postfxPass(FrameData& f, int imageIndex)
 		ASSERT(MAX_LUMINANCE_BINS == 256);
 
 		cp.Stage(EXPADP, "histogram").Bind(f.cmd)
-			.Dispatch(groups16.x, groups16.y, imageIndex)
+			.Dispatch(groups16.x, groups16.y, frameIndex)
 			.Barrier();
 
 		// Compute average luminance
 		cp.Stage(EXPADP, "avglum").Bind(f.cmd)
-			.Dispatch(1, 1, imageIndex)
+			.Dispatch(1, 1, frameIndex)
 			.Barrier();
 
 		cp.Stage(EXPADP, "eyeadp").Bind(f.cmd)
-			.Dispatch(groups32.x, groups32.y, imageIndex)
+			.Dispatch(groups32.x, groups32.y, frameIndex)
 			.Barrier();
 
 		endCmdDebugLabel(f.cmd);
@@ -640,7 +735,7 @@ void Engine::postfxPass(FrameData& f, int imageIndex)
 			VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
 			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-		bloom(f, imageIndex);
+		bloom(f, frameIndex);
 
 		// A read & write compute barrier to avoid WRITE_AFTER_WRITE hazards between queue submits
 		vk_utils::memoryBarrier(f.cmd,
@@ -655,9 +750,9 @@ void Engine::postfxPass(FrameData& f, int imageIndex)
 			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
 		if (_postfx.localToneMappingMode == PostFX::LTM::DURAND) {
-			durand2002(f.cmd, imageIndex);
+			durand2002(f.cmd, frameIndex);
 		} else if (_postfx.localToneMappingMode == PostFX::LTM::FUSION) {
-			exposureFusion(f.cmd, imageIndex);
+			exposureFusion(f.cmd, frameIndex);
 		} else {
 			ASSERT(false);
 		}
@@ -672,7 +767,7 @@ void Engine::postfxPass(FrameData& f, int imageIndex)
 		beginCmdDebugLabel(f.cmd, "GLOBAL_TONE_MAPPING");
 
 		cp.Stage(GTMO, "0").Bind(f.cmd)
-			.Dispatch(groups32.x, groups32.y, imageIndex);
+			.Dispatch(groups32.x, groups32.y, frameIndex);
 
 		endCmdDebugLabel(f.cmd);
 	}
@@ -681,7 +776,7 @@ void Engine::postfxPass(FrameData& f, int imageIndex)
 		beginCmdDebugLabel(f.cmd, "GAMMA_CORRECTION");
 
 		cp.Stage(GAMMA, "0").Bind(f.cmd)
-			.Dispatch(groups32.x, groups32.y, imageIndex);
+			.Dispatch(groups32.x, groups32.y, frameIndex);
 
 		endCmdDebugLabel(f.cmd);
 	}
@@ -714,10 +809,13 @@ void Engine::recordCommandBuffer(FrameData& f, uint32_t imageIndex)
 
 	shadowPass(f, imageIndex);
 
-	viewportPass(f.cmd, imageIndex);
+	// Viewport images and PostFX descriptor sets belong to the frame in flight, the swapchain may have more images
+	const uint32_t frameIndex = _currentFrameInFlight;
+
+	viewportPass(f.cmd, frameIndex);
 
 	// Need to wait until scene is rendered to proceed with post-processing
-	vk_utils::imageMemoryBarrier(f.cmd, _viewport.images[imageIndex].image,
+	vk_utils::imageMemoryBarrier(f.cmd, _viewport.images[frameIndex].image,
 		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
 
@@ -729,10 +827,10 @@ void Engine::recordCommandBuffer(FrameData& f, uint32_t imageIndex)
 
 		FULL_COLOR_RANGE);
 
-	postfxPass(f, imageIndex);
+	postfxPass(f, frameIndex);
 
 	// Post-processing must finish because viewport image is sampled from during swapchain pass
-	vk_utils::imageMemoryBarrier(f.cmd, _viewport.images[imageIndex].image,
+	vk_utils::imageMemoryBarrier(f.cmd, _viewport.images[frameIndex].image,
 		VK_ACCESS_SHADER_WRITE_BIT,
 		VK_ACCESS_SHADER_READ_BIT,
 
@@ -780,6 +878,9 @@ void Engine::drawFrame()
 	// Since we have descriptor set copies for each frame in flight,
 	// we set the pointers to current frame's descriptor set buffers
 	_gpudt.Reset(f);
+
+	// Free staging memory of uploads that finished, e.g. of a skybox loaded from UI
+	_uploader.Update();
 	
 	// Needs to be part of drawFrame because drawFrame is called from onFramebufferResize callback
 	ui_Update();
@@ -796,6 +897,14 @@ void Engine::drawFrame()
 
 	VK_ASSERT(vkWaitForFences(_device, 1, &f.inFlightFence, VK_TRUE, UINT64_MAX));
 	VK_ASSERT(vkResetFences(_device, 1, &f.inFlightFence));
+
+	// Scene set of this frame is not in use anymore, changed texture slots and views of streamed textures are written into it
+	_textureRegistry.Update(_currentFrameInFlight, f.sceneSet);
+	requestTextureLevels();
+	_textureStreamer.Update(_currentFrameInFlight, [this](const Attachment& texture, uint32_t frameIndex) {
+		_textureRegistry.Write(texture, _frames[frameIndex].sceneSet);
+	});
+
 	{ // Command buffer
 		VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info();
 
@@ -820,6 +929,7 @@ void Engine::drawFrame()
 	};
 
     VK_ASSERT(vkQueueSubmit(_graphicsQueue, 1, &submitInfo, f.inFlightFence));
+	_lastFrameIndex = _currentFrameInFlight;
 
     VkSwapchainKHR swapchains[] = { _swapchain.handle };
     VkPresentInfoKHR presentInfo{
@@ -843,3 +953,289 @@ void Engine::drawFrame()
 	_currentFrameInFlight = (_currentFrameInFlight + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
+bool Engine::ValidatePostFXPrecision()
+{
+	const bool fullPrecision = _postfx.fullPrecision;
+	if (!setPostFXPrecision(false)) {
+		return false;
+	}
+	// Results are read back as RGBA32F, the viewport format would also add its own error to both of them
+	const VkFormat viewportFormat = _viewport.colorFormat;
+	setViewportFormat(VK_FORMAT_R32G32B32A32_SFLOAT);
+
+	// Every effect runs alone on the same scene image, eye adaptation depends on frame time
+	PostFX& cp = _postfx;
+	const bool enableAdaptation = cp.enableAdaptation, enableBloom = cp.enableBloom;
+	const bool enableGlobalToneMapping = cp.enableGlobalToneMapping, enableLocalToneMapping = cp.enableLocalToneMapping;
+	const PostFX::LTM localToneMappingMode = cp.localToneMappingMode;
+	const GAMMA_MODE gammaMode = cp.gammaMode;
+
+	auto applyEffect = [&](Effect fct) {
+		cp.enableAdaptation = false;
+		cp.enableGlobalToneMapping = false;
+		cp.setGammaMode(GAMMA_MODE::OFF);
+		cp.enableBloom = fct == BLOOM;
+		cp.enableLocalToneMapping = fct == DURAND || fct == FUSION;
+		cp.localToneMappingMode = fct == FUSION ? PostFX::LTM::FUSION : PostFX::LTM::DURAND;
+	};
+	const std::pair<Effect, const char*> effects[] = {
+		{ BLOOM, "Bloom" }, { DURAND, "Durand 2002" }, { FUSION, "Exposure fusion" }
+	};
+
+	// Render the scene without PostFX, every frame in flight once so that all of them have their uniforms written
+	applyEffect(INVALID);
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		drawFrame();
+	}
+	vkDeviceWaitIdle(_device);
+
+	const uint32_t frameIndex = _lastFrameIndex;
+	VkImage viewportImage = _viewport.images[frameIndex].image;
+	const VkExtent3D extent = { _viewport.width, _viewport.height, 1 };
+	const VkDeviceSize imageSize = VkDeviceSize(extent.width) * extent.height * 4 * sizeof(float);
+	ASSERT(_viewport.colorFormat == VK_FORMAT_R32G32B32A32_SFLOAT);
+
+	const VkBufferImageCopy copyRegion = {
+		.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+		.imageExtent = extent
+	};
+
+	AllocatedBuffer scene = allocateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	immediate_submit([&](VkCommandBuffer cmd) {
+		vk_utils::imageMemoryBarrier(cmd, viewportImage,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			FULL_COLOR_RANGE);
+
+		vkCmdCopyImageToBuffer(cmd, viewportImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, scene.buffer, 1, &copyRegion);
+	});
+
+	// Copies the scene into the viewport image, runs the enabled effects on it and reads the result back
+	auto runPostFX = [&](std::vector<float>& result) {
+		// Attachments and viewport images are recreated when precision changes
+		viewportImage = _viewport.images[frameIndex].image;
+		AllocatedBuffer readback = allocateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+		immediate_submit([&](VkCommandBuffer cmd) {
+			vk_utils::imageMemoryBarrier(cmd, viewportImage,
+				0, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				FULL_COLOR_RANGE);
+
+			vkCmdCopyBufferToImage(cmd, scene.buffer, viewportImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+			vk_utils::imageMemoryBarrier(cmd, viewportImage,
+				VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				FULL_COLOR_RANGE);
+
+			FrameData f = _frames[_currentFrameInFlight];
+			f.cmd = cmd;
+			postfxPass(f, frameIndex);
+
+			vk_utils::imageMemoryBarrier(cmd, viewportImage,
+				VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+				VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				FULL_COLOR_RANGE);
+
+			vkCmdCopyImageToBuffer(cmd, viewportImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, 1, &copyRegion);
+
+			// Sampled by the UI until the next frame renders into it
+			vk_utils::imageMemoryBarrier(cmd, viewportImage,
+				VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				FULL_COLOR_RANGE);
+		});
+
+		VK_ASSERT(vmaInvalidateAllocation(_allocator, readback.allocation, 0, VK_WHOLE_SIZE));
+		result.resize(imageSize / sizeof(float));
+		memcpy(result.data(), readback.memory_ptr, imageSize);
+		readback.destroy(_allocator);
+	};
+
+	// Narrow formats first, then the reference, so precision only changes twice
+	std::vector<float> narrow[std::size(effects)];
+	for (size_t i = 0; i < std::size(effects); ++i) {
+		applyEffect(effects[i].first);
+		runPostFX(narrow[i]);
+	}
+	setPostFXPrecision(true);
+
+	_postfxPrecisionResults.clear();
+	bool passed = true;
+	std::vector<float> reference;
+	for (size_t i = 0; i < std::size(effects); ++i) {
+		applyEffect(effects[i].first);
+		runPostFX(reference);
+
+		// Errors of RGB, PSNR relative to the brightest reference value (at least 1, the output may be HDR)
+		double sumError = 0.0, sumSquaredError = 0.0;
+		float maxError = 0.f, peak = 1.f;
+		for (size_t p = 0; p < reference.size(); p += 4) {
+			for (size_t c = 0; c < 3; ++c) {
+				float ref = reference[p + c];
+				float error = std::abs(narrow[i][p + c] - ref);
+				if (!std::isfinite(error)) {
+					// NaN or Inf in one of the results only counts against the narrow formats if the reference is finite
+					error = std::isfinite(ref) ? FLT_MAX : 0.f;
+				}
+				if (std::isfinite(ref)) {
+					peak = std::max(peak, std::abs(ref));
+				}
+				maxError = std::max(maxError, error);
+				sumError += error;
+				sumSquaredError += double(error) * error;
+			}
+		}
+		const double numValues = double(reference.size() / 4 * 3);
+		const double mse = sumSquaredError / numValues;
+
+		PostFXPrecisionResult result = {
+			.effect = effects[i].second,
+			.maxError = maxError,
+			.meanError = float(sumError / numValues),
+			.psnr = mse > 0.0 ? float(10.0 * std::log10(double(peak) * peak / mse)) : FLT_MAX
+		};
+		result.passed = maxError < FLT_MAX && result.psnr >= POSTFX_MIN_PSNR;
+		passed &= result.passed;
+
+		pr("PostFX precision of " << result.effect << ": max error " << result.maxError << ", mean error " << result.meanError
+			<< ", PSNR " << result.psnr << " dB " << (result.passed ? "(passed)" : "(FAILED)"));
+
+		_postfxPrecisionResults.push_back(result);
+	}
+
+	scene.destroy(_allocator);
+
+	cp.enableAdaptation = enableAdaptation;
+	cp.enableBloom = enableBloom;
+	cp.enableGlobalToneMapping = enableGlobalToneMapping;
+	cp.enableLocalToneMapping = enableLocalToneMapping;
+	cp.localToneMappingMode = localToneMappingMode;
+	cp.setGammaMode(gammaMode);
+	setPostFXPrecision(fullPrecision);
+	setViewportFormat(viewportFormat);
+
+	return passed;
+}
+
+bool Engine::BenchViewportFormats()
+{
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, queueFamilyList.data());
+
+	// Bits above the valid ones are undefined, the difference of two timestamps has to be masked too for wraparound
+	const uint32_t timestampValidBits = queueFamilyList[_graphicsQueueFamily].timestampValidBits;
+	if (!_gpuProperties.limits.timestampComputeAndGraphics || timestampValidBits == 0) {
+		PRWRN("Device has no timestamps on graphics queues, can't time viewport formats");
+		return false;
+	}
+	const uint64_t timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+	// Effects that read and write the viewport image the most, the local tone mapping operator is kept
+	PostFX& cp = _postfx;
+	const bool enableAdaptation = cp.enableAdaptation, enableBloom = cp.enableBloom;
+	const bool enableGlobalToneMapping = cp.enableGlobalToneMapping, enableLocalToneMapping = cp.enableLocalToneMapping;
+	cp.enableAdaptation = true;
+	cp.enableBloom = true;
+	cp.enableGlobalToneMapping = false;
+	cp.enableLocalToneMapping = true;
+
+	const VkFormat viewportFormat = _viewport.colorFormat;
+	const uint32_t viewportWidth = _viewport.width, viewportHeight = _viewport.height;
+
+	VkQueryPoolCreateInfo queryPoolInfo = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = 2
+	};
+	VkQueryPool queryPool;
+	VK_ASSERT(vkCreateQueryPool(_device, &queryPoolInfo, nullptr, &queryPool));
+
+	constexpr uint32_t NUM_FRAMES = 32;
+	const VkExtent2D resolutions[] = { { 1920, 1080 }, { 3840, 2160 } };
+
+	for (VkExtent2D resolution : resolutions) {
+		for (VkFormat format : ViewportPass::FORMATS) {
+			if (!setViewportFormat(format)) {
+				continue;
+			}
+			vkDeviceWaitIdle(_device);
+			ui_UnregisterTextures();
+			recreateViewport(resolution.width, resolution.height);
+			ui_RegisterTextures();
+
+			// Every frame in flight once so that all of them have their uniforms written
+			for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+				drawFrame();
+			}
+			vkDeviceWaitIdle(_device);
+
+			// Scene and PostFX only, without presentation and UI that don't depend on the viewport format
+			const uint32_t frameIndex = _currentFrameInFlight;
+			immediate_submit([&](VkCommandBuffer cmd) {
+				FrameData f = _frames[frameIndex];
+				f.cmd = cmd;
+
+				vkCmdResetQueryPool(cmd, queryPool, 0, 2);
+				vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+				for (uint32_t i = 0; i < NUM_FRAMES; ++i) {
+					viewportPass(cmd, frameIndex);
+
+					vk_utils::imageMemoryBarrier(cmd, _viewport.images[frameIndex].image,
+						VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+						VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+						VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						FULL_COLOR_RANGE);
+
+					postfxPass(f, frameIndex);
+
+					vk_utils::imageMemoryBarrier(cmd, _viewport.images[frameIndex].image,
+						VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+						VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+						VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+						FULL_COLOR_RANGE);
+				}
+				vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+			});
+
+			uint64_t timestamps[2];
+			VK_ASSERT(vkGetQueryPoolResults(_device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+			const double frameMs = double((timestamps[1] - timestamps[0]) & timestampMask) * _gpuProperties.limits.timestampPeriod / 1e6 / NUM_FRAMES;
+
+			VkDeviceSize imageBytes = 0;
+			for (const AllocatedImage& image : _viewport.images) {
+				VmaAllocationInfo allocInfo;
+				vmaGetAllocationInfo(_allocator, image.allocation, &allocInfo);
+				imageBytes += allocInfo.size;
+			}
+
+			pr("[Viewport format] " << resolution.width << "x" << resolution.height << " " << string_VkFormat(format) << ": "
+				<< frameMs << " ms scene + PostFX, " << imageBytes / (1024 * 1024) << " MiB in "
+				<< _viewport.images.size() << " viewport images");
+		}
+	}
+
+	vkDestroyQueryPool(_device, queryPool, nullptr);
+
+	cp.enableAdaptation = enableAdaptation;
+	cp.enableBloom = enableBloom;
+	cp.enableGlobalToneMapping = enableGlobalToneMapping;
+	cp.enableLocalToneMapping = enableLocalToneMapping;
+	setViewportFormat(viewportFormat);
+
+	vkDeviceWaitIdle(_device);
+	ui_UnregisterTextures();
+	recreateViewport(viewportWidth, viewportHeight);
+	ui_RegisterTextures();
+
+	return true;
+}
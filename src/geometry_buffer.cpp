@@ -0,0 +1,169 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "geometry_buffer.h"
+#include "gpu_memory.h"
+
+void GeometryBuffer::Create(VmaAllocator allocator, UploadManager* uploader, VkDeviceSize blockSize)
+{
+	_allocator = allocator;
+	_uploader = uploader;
+	_blockSize = blockSize;
+}
+
+void GeometryBuffer::Destroy()
+{
+	for (auto& block : _blocks) {
+		if (block.size > 0) {
+			block.buffer.destroy(_allocator);
+		}
+	}
+	_blocks.clear();
+}
+
+uint32_t GeometryBuffer::createBlock(VkDeviceSize size)
+{
+	// Reuse the slot of a destroyed block
+	uint32_t index = 0;
+	while (index < _blocks.size() && _blocks[index].size > 0) {
+		++index;
+	}
+	if (index == _blocks.size()) {
+		_blocks.emplace_back();
+	}
+
+	Block& block = _blocks[index];
+	VkBufferCreateInfo bufferInfo = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+			| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+	};
+	VmaAllocationCreateInfo allocInfo = {
+		.usage = VMA_MEMORY_USAGE_GPU_ONLY
+	};
+	block.buffer.create(_allocator, bufferInfo, allocInfo);
+	gpu_memory::tag(_allocator, block.buffer.allocation, gpu_memory::Category::Geometry, "GEOMETRY_BLOCK_" + std::to_string(index));
+	block.size = size;
+	block.freeRanges = { { 0, size } };
+	block.numRanges = 0;
+
+	return index;
+}
+
+bool GeometryBuffer::allocateFrom(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+		auto [freeOffset, freeSize] = *it;
+		VkDeviceSize aligned = (freeOffset + alignment - 1) / alignment * alignment;
+		if (aligned + size > freeOffset + freeSize) {
+			continue;
+		}
+
+		// Padding in front stays free, so does the rest behind
+		block.freeRanges.erase(it);
+		if (aligned > freeOffset) {
+			block.freeRanges[freeOffset] = aligned - freeOffset;
+		}
+		if (aligned + size < freeOffset + freeSize) {
+			block.freeRanges[aligned + size] = freeOffset + freeSize - (aligned + size);
+		}
+
+		offset = aligned;
+		return true;
+	}
+	return false;
+}
+
+GeometryRange GeometryBuffer::Allocate(VkDeviceSize size, VkDeviceSize alignment, const UploadManager::FillFn& fill)
+{
+	ASSERT(size > 0 && alignment > 0);
+
+	GeometryRange range = { .size = size };
+	for (uint32_t i = 0; i < _blocks.size() && !range.IsValid(); ++i) {
+		if (_blocks[i].size > 0 && allocateFrom(_blocks[i], size, alignment, range.offset)) {
+			range.block = i;
+		}
+	}
+
+	if (!range.IsValid()) {
+		range.block = createBlock(std::max(size, _blockSize));
+		ASSERT(allocateFrom(_blocks[range.block], size, alignment, range.offset));
+	}
+
+	++_blocks[range.block].numRanges;
+
+	_uploader->UploadBuffer(GetBuffer(range.block), range.offset, size, fill);
+
+	return range;
+}
+
+void GeometryBuffer::Free(GeometryRange& range)
+{
+	if (!range.IsValid()) {
+		return;
+	}
+
+	Block& block = _blocks[range.block];
+	ASSERT(block.numRanges > 0);
+	--block.numRanges;
+
+	VkDeviceSize offset = range.offset;
+	VkDeviceSize size = range.size;
+
+	// Merge with the free range in front and the one behind
+	auto next = block.freeRanges.lower_bound(offset);
+	if (next != block.freeRanges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			block.freeRanges.erase(prev);
+		}
+	}
+	if (next != block.freeRanges.end() && next->first == range.offset + range.size) {
+		size += next->second;
+		block.freeRanges.erase(next);
+	}
+	block.freeRanges[offset] = size;
+
+	range = {};
+}
+
+void GeometryBuffer::Trim()
+{
+	// One block is kept for the next scene unless another one is still in use
+	bool keptFirst = std::any_of(_blocks.begin(), _blocks.end(), [](const Block& block) { return block.numRanges > 0; });
+	for (auto& block : _blocks) {
+		if (block.size == 0 || block.numRanges > 0) {
+			continue;
+		}
+		if (!keptFirst) {
+			keptFirst = true;
+			continue;
+		}
+		block.buffer.destroy(_allocator);
+		block = {};
+	}
+
+	while (!_blocks.empty() && _blocks.back().size == 0) {
+		_blocks.pop_back();
+	}
+}
+
+GeometryBuffer::Stats GeometryBuffer::GetStats() const
+{
+	Stats stats;
+	for (auto& block : _blocks) {
+		if (block.size == 0) {
+			continue;
+		}
+		++stats.blocks;
+		stats.ranges += block.numRanges;
+		stats.capacity += block.size;
+		stats.used += block.size;
+		for (auto& [offset, size] : block.freeRanges) {
+			stats.used -= size;
+		}
+	}
+	return stats;
+}
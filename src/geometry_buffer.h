@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+
+#include "types.h"
+#include "upload_manager.h"
+
+// Scene geometry suballocated from a few large device local buffers (blocks).
+// Vertices of both layouts, indices and meshlets of all meshes share one VkBuffer, so passes bind it once and
+// address meshes by vertexOffset/firstIndex instead of binding buffers of every mesh. A new block is only created
+// when no existing one has room, ranges bigger than the block size get a block of their own.
+//
+// Vertex ranges are aligned to the vertex stride and index ranges to the index size, so a range's offset divided by
+// the alignment is the vertexOffset/firstIndex of the draw. Freed ranges are merged with free neighbours and
+// reused, Trim() releases blocks no range lives in anymore.
+struct GeometryBuffer {
+    struct Stats {
+        uint32_t blocks = 0;
+        uint32_t ranges = 0;
+        VkDeviceSize capacity = 0;
+        VkDeviceSize used = 0;
+    };
+
+    void Create(VmaAllocator allocator, UploadManager* uploader, VkDeviceSize blockSize);
+    void Destroy();
+
+    // Reserves size bytes at an offset that is a multiple of alignment (not necessarily a power of two)
+    // and queues the upload of the data written by fill
+    GeometryRange Allocate(VkDeviceSize size, VkDeviceSize alignment, const UploadManager::FillFn& fill);
+    // The GPU must not use the range anymore
+    void Free(GeometryRange& range);
+    // Destroys empty blocks, keeps one if all are empty, e.g. after a scene was unloaded
+    void Trim();
+
+    VkBuffer GetBuffer(uint32_t block) const { return _blocks[block].buffer.buffer; }
+
+    Stats GetStats() const;
+
+private:
+    struct Block {
+        AllocatedBuffer buffer{};
+        VkDeviceSize size = 0;
+        std::map<VkDeviceSize, VkDeviceSize> freeRanges; // Offset -> size, neighbours are always merged
+        uint32_t numRanges = 0;
+    };
+
+    // First fit, returns false if the block has no room
+    static bool allocateFrom(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+    uint32_t createBlock(VkDeviceSize size);
+
+    VmaAllocator _allocator = VK_NULL_HANDLE;
+    UploadManager* _uploader = nullptr;
+    VkDeviceSize _blockSize = 0;
+
+    std::vector<Block> _blocks; // Destroyed blocks stay as empty slots so that block indices don't change
+};
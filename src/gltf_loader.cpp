@@ -0,0 +1,815 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "mesh_cache.h"
+#include "mapped_file.h"
+#include "timer.h"
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/component_wise.hpp>
+
+namespace fs = std::filesystem;
+
+// glTF 2.0 importer, see https://registry.khronos.org/glTF/specs/2.0/glTF-2.0.html
+//
+// Binary buffers (.glb BIN chunk and external .bin files) are memory mapped and accessor ranges are
+// copied straight from the mapping into the mesh vertex/index arrays, there is no text parsing of
+// geometry and no per-attribute temporary arrays. The node hierarchy of the default scene is flattened,
+// primitives are merged into one mesh per material like the OBJ loader does.
+namespace {
+	constexpr uint32_t GLB_MAGIC = 0x46546C67; // "glTF"
+	constexpr uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+	constexpr uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+	enum ComponentType {
+		COMP_BYTE = 5120,
+		COMP_UNSIGNED_BYTE = 5121,
+		COMP_SHORT = 5122,
+		COMP_UNSIGNED_SHORT = 5123,
+		COMP_UNSIGNED_INT = 5125,
+		COMP_FLOAT = 5126
+	};
+
+	constexpr int PRIMITIVE_MODE_TRIANGLES = 4;
+
+	struct GlbHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t length;
+	};
+
+	struct GlbChunkHeader {
+		uint32_t length;
+		uint32_t type;
+	};
+
+	struct Buffer {
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+	};
+
+	// Strided view of accessor elements inside a buffer
+	struct Accessor {
+		const uint8_t* data = nullptr;
+		size_t count = 0;
+		size_t stride = 0;
+		int componentType = 0;
+		int numComponents = 0;
+		bool normalized = false;
+
+		float component(size_t i, int c) const {
+			const uint8_t* p = data + i * stride;
+			switch (componentType) {
+			case COMP_FLOAT: {
+				float v;
+				memcpy(&v, p + c * sizeof(float), sizeof(float));
+				return v;
+			}
+			case COMP_UNSIGNED_BYTE: {
+				float v = p[c];
+				return normalized ? v / 255.f : v;
+			}
+			case COMP_BYTE: {
+				float v = static_cast<int8_t>(p[c]);
+				return normalized ? std::max(v / 127.f, -1.f) : v;
+			}
+			case COMP_UNSIGNED_SHORT: {
+				uint16_t v;
+				memcpy(&v, p + c * sizeof(uint16_t), sizeof(uint16_t));
+				return normalized ? v / 65535.f : float(v);
+			}
+			case COMP_SHORT: {
+				int16_t v;
+				memcpy(&v, p + c * sizeof(int16_t), sizeof(int16_t));
+				return normalized ? std::max(v / 32767.f, -1.f) : float(v);
+			}
+			case COMP_UNSIGNED_INT: {
+				uint32_t v;
+				memcpy(&v, p + c * sizeof(uint32_t), sizeof(uint32_t));
+				return float(v);
+			}
+			}
+			return 0.f;
+		}
+
+		uint32_t index(size_t i) const {
+			const uint8_t* p = data + i * stride;
+			switch (componentType) {
+			case COMP_UNSIGNED_BYTE:
+				return p[0];
+			case COMP_UNSIGNED_SHORT: {
+				uint16_t v;
+				memcpy(&v, p, sizeof(uint16_t));
+				return v;
+			}
+			case COMP_UNSIGNED_INT: {
+				uint32_t v;
+				memcpy(&v, p, sizeof(uint32_t));
+				return v;
+			}
+			}
+			return 0;
+		}
+	};
+
+	size_t componentSize(int componentType)
+	{
+		switch (componentType) {
+		case COMP_BYTE:
+		case COMP_UNSIGNED_BYTE:
+			return 1;
+		case COMP_SHORT:
+		case COMP_UNSIGNED_SHORT:
+			return 2;
+		case COMP_UNSIGNED_INT:
+		case COMP_FLOAT:
+			return 4;
+		}
+		return 0;
+	}
+
+	int numComponents(const std::string& type)
+	{
+		if (type == "SCALAR") return 1;
+		if (type == "VEC2") return 2;
+		if (type == "VEC3") return 3;
+		if (type == "VEC4") return 4;
+		if (type == "MAT4") return 16;
+		return 0;
+	}
+
+	bool decodeBase64(const char* begin, const char* end, std::vector<uint8_t>& out)
+	{
+		auto value = [](char c) -> int {
+			if (c >= 'A' && c <= 'Z') return c - 'A';
+			if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+			if (c >= '0' && c <= '9') return c - '0' + 52;
+			if (c == '+') return 62;
+			if (c == '/') return 63;
+			return -1;
+		};
+
+		out.clear();
+		out.reserve((end - begin) / 4 * 3);
+
+		uint32_t acc = 0;
+		int bits = 0;
+		for (const char* p = begin; p < end && *p != '='; ++p) {
+			int v = value(*p);
+			if (v < 0) {
+				return false;
+			}
+			acc = (acc << 6) | v;
+			bits += 6;
+			if (bits >= 8) {
+				bits -= 8;
+				out.push_back(static_cast<uint8_t>(acc >> bits));
+			}
+		}
+		return true;
+	}
+
+	// URIs are relative paths with percent encoded special characters
+	std::string decodeUri(const std::string& uri)
+	{
+		std::string res;
+		for (size_t i = 0; i < uri.size(); ++i) {
+			// Malformed escapes are kept as they are
+			if (uri[i] == '%' && i + 2 < uri.size() &&
+				std::isxdigit(static_cast<unsigned char>(uri[i + 1])) && std::isxdigit(static_cast<unsigned char>(uri[i + 2]))) {
+				res += static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+				i += 2;
+			} else {
+				res += uri[i];
+			}
+		}
+		return res;
+	}
+
+	// Returns start of base64 payload if the uri is a data uri
+	const char* dataUriPayload(const std::string& uri)
+	{
+		if (uri.rfind("data:", 0) != 0) {
+			return nullptr;
+		}
+		size_t pos = uri.find(";base64,");
+		return pos == std::string::npos ? nullptr : uri.c_str() + pos + strlen(";base64,");
+	}
+
+	class GltfImporter {
+	public:
+		GltfImporter(const std::string& path) : _path(path) {
+			_baseDir = fs::path(path).parent_path().generic_string();
+			if (!_baseDir.empty()) {
+				_baseDir += "/";
+			}
+		}
+
+		bool Load(ModelData& data);
+
+	private:
+		bool loadDocument();
+		bool loadBuffers();
+		bool getAccessor(int index, Accessor& acc);
+		std::string getImagePath(int textureIndex);
+
+		void loadMaterials(ModelData& data);
+		bool loadNode(int nodeIndex, const glm::mat4& parent, ModelData& data, int depth);
+		bool loadPrimitive(const nlohmann::json& prim, const glm::mat4& transform, ModelData& data);
+
+		std::string _path;
+		std::string _baseDir;
+
+		MappedFile _file;
+		nlohmann::json _doc;
+		Buffer _glbBin;
+
+		std::vector<std::unique_ptr<MappedFile>> _externalBuffers;
+		std::vector<std::vector<uint8_t>> _embeddedBuffers;
+		std::vector<Buffer> _buffers;
+
+		// Mesh of each material, indexed by material + 1 so that -1 (default material) fits too
+		std::vector<int> _materialMesh;
+
+		glm::vec3 _bmin{ std::numeric_limits<float>::max() };
+		glm::vec3 _bmax{ -std::numeric_limits<float>::max() };
+	};
+
+	bool GltfImporter::loadDocument()
+	{
+		if (!_file.Open(_path)) {
+			PRERR("Failed to open glTF file: " << _path);
+			return false;
+		}
+
+		const char* json = _file.data;
+		size_t jsonSize = _file.size;
+
+		GlbHeader header;
+		if (_file.size >= sizeof(header)) {
+			memcpy(&header, _file.data, sizeof(header));
+		}
+
+		if (_file.size >= sizeof(header) && header.magic == GLB_MAGIC) {
+			if (header.version != 2 || header.length > _file.size) {
+				PRERR("Unsupported or truncated .glb file: " << _path);
+				return false;
+			}
+
+			// JSON chunk must come first, optional BIN chunk second
+			json = nullptr;
+			size_t offset = sizeof(header);
+			while (offset + sizeof(GlbChunkHeader) <= header.length) {
+				GlbChunkHeader chunk;
+				memcpy(&chunk, _file.data + offset, sizeof(chunk));
+				offset += sizeof(chunk);
+				if (chunk.length > header.length - offset) {
+					PRERR("Truncated .glb chunk in: " << _path);
+					return false;
+				}
+
+				if (chunk.type == GLB_CHUNK_JSON && json == nullptr) {
+					json = _file.data + offset;
+					jsonSize = chunk.length;
+				} else if (chunk.type == GLB_CHUNK_BIN && _glbBin.data == nullptr) {
+					_glbBin = { reinterpret_cast<const uint8_t*>(_file.data + offset), chunk.length };
+				}
+				// Chunks are 4 byte aligned
+				offset += (chunk.length + 3) & ~3u;
+			}
+
+			if (json == nullptr) {
+				PRERR("No JSON chunk in: " << _path);
+				return false;
+			}
+		}
+
+		_doc = nlohmann::json::parse(json, json + jsonSize, nullptr, false);
+		if (_doc.is_discarded() || !_doc.is_object()) {
+			PRERR("Failed to parse glTF JSON: " << _path);
+			return false;
+		}
+
+		std::string version = _doc.contains("asset") ? _doc["asset"].value("version", "") : "";
+		if (version.rfind("2.", 0) != 0) {
+			PRERR("Unsupported glTF version '" << version << "': " << _path);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool GltfImporter::loadBuffers()
+	{
+		if (!_doc.contains("buffers")) {
+			return true;
+		}
+
+		for (auto& jb : _doc["buffers"]) {
+			size_t byteLength = jb.value("byteLength", size_t(0));
+			Buffer buf;
+
+			if (!jb.contains("uri")) {
+				// Buffer without uri is the BIN chunk of .glb
+				buf = _glbBin;
+			} else {
+				std::string uri = jb["uri"];
+				if (const char* payload = dataUriPayload(uri)) {
+					auto& bytes = _embeddedBuffers.emplace_back();
+					if (!decodeBase64(payload, uri.c_str() + uri.size(), bytes)) {
+						PRERR("Invalid base64 buffer in: " << _path);
+						return false;
+					}
+					buf = { bytes.data(), bytes.size() };
+				} else {
+					std::string bufPath = _baseDir + decodeUri(uri);
+					auto& file = _externalBuffers.emplace_back(std::make_unique<MappedFile>());
+					if (!file->Open(bufPath)) {
+						PRERR("Failed to open glTF buffer: " << bufPath);
+						return false;
+					}
+					buf = { reinterpret_cast<const uint8_t*>(file->data), file->size };
+				}
+			}
+
+			if (buf.data == nullptr || buf.size < byteLength) {
+				PRERR("glTF buffer is missing or smaller than its byteLength in: " << _path);
+				return false;
+			}
+			_buffers.push_back(buf);
+		}
+
+		return true;
+	}
+
+	bool GltfImporter::getAccessor(int index, Accessor& acc)
+	{
+		if (index < 0 || !_doc.contains("accessors") || index >= static_cast<int>(_doc["accessors"].size())) {
+			PRERR("Invalid glTF accessor index " << index << " in: " << _path);
+			return false;
+		}
+		const auto& ja = _doc["accessors"][index];
+
+		if (ja.contains("sparse")) {
+			PRERR("Sparse glTF accessors are not supported: " << _path);
+			return false;
+		}
+		if (!ja.contains("bufferView")) {
+			PRERR("glTF accessors without buffer view are not supported: " << _path);
+			return false;
+		}
+
+		acc.count = ja.value("count", size_t(0));
+		acc.componentType = ja.value("componentType", 0);
+		acc.numComponents = numComponents(ja.value("type", ""));
+		acc.normalized = ja.value("normalized", false);
+
+		size_t elemSize = componentSize(acc.componentType) * acc.numComponents;
+		if (elemSize == 0) {
+			PRERR("Invalid glTF accessor type in: " << _path);
+			return false;
+		}
+
+		const auto& jv = _doc.at("bufferViews").at(ja["bufferView"].get<int>());
+		int bufferIndex = jv.value("buffer", -1);
+		if (bufferIndex < 0 || bufferIndex >= static_cast<int>(_buffers.size())) {
+			PRERR("Invalid glTF buffer index in: " << _path);
+			return false;
+		}
+		const Buffer& buf = _buffers[bufferIndex];
+
+		size_t viewOffset = jv.value("byteOffset", size_t(0));
+		size_t viewLength = jv.value("byteLength", size_t(0));
+		size_t offset = ja.value("byteOffset", size_t(0));
+		acc.stride = jv.value("byteStride", elemSize);
+
+		// Last element only needs elemSize bytes, not the full stride
+		size_t needed = acc.count ? offset + (acc.count - 1) * acc.stride + elemSize : 0;
+		if (viewOffset + viewLength > buf.size || needed > viewLength) {
+			PRERR("glTF accessor " << index << " is out of bounds of its buffer in: " << _path);
+			return false;
+		}
+
+		acc.data = buf.data + viewOffset + offset;
+		return true;
+	}
+
+	// Images referenced by uri are used directly. Images embedded in a buffer (typical for .glb)
+	// are written to the cache directory once, so that textures can be loaded from file as usual.
+	std::string GltfImporter::getImagePath(int textureIndex)
+	{
+		if (textureIndex < 0 || !_doc.contains("textures") || textureIndex >= static_cast<int>(_doc["textures"].size())) {
+			return "";
+		}
+		int imageIndex = _doc["textures"][textureIndex].value("source", -1);
+		if (imageIndex < 0 || !_doc.contains("images") || imageIndex >= static_cast<int>(_doc["images"].size())) {
+			return "";
+		}
+		const auto& ji = _doc["images"][imageIndex];
+
+		std::string uri = ji.value("uri", "");
+		if (!uri.empty() && dataUriPayload(uri) == nullptr) {
+			return _baseDir + decodeUri(uri);
+		}
+
+		std::string mime = ji.value("mimeType", "");
+		if (mime.empty() && !uri.empty()) {
+			mime = uri.substr(strlen("data:"), uri.find(';') - strlen("data:"));
+		}
+		std::string ext = mime == "image/jpeg" ? ".jpg" : ".png";
+
+		std::vector<uint8_t> decoded;
+		const uint8_t* bytes = nullptr;
+		size_t size = 0;
+		if (!uri.empty()) {
+			if (!decodeBase64(dataUriPayload(uri), uri.c_str() + uri.size(), decoded)) {
+				PRWRN("Invalid base64 image " << imageIndex << " in: " << _path);
+				return "";
+			}
+			bytes = decoded.data();
+			size = decoded.size();
+		} else if (ji.contains("bufferView")) {
+			const auto& jv = _doc.at("bufferViews").at(ji["bufferView"].get<int>());
+			int bufferIndex = jv.value("buffer", -1);
+			size_t offset = jv.value("byteOffset", size_t(0));
+			size = jv.value("byteLength", size_t(0));
+			if (bufferIndex < 0 || bufferIndex >= static_cast<int>(_buffers.size()) || offset + size > _buffers[bufferIndex].size) {
+				PRWRN("Invalid buffer view of image " << imageIndex << " in: " << _path);
+				return "";
+			}
+			bytes = _buffers[bufferIndex].data + offset;
+		} else {
+			return "";
+		}
+
+		std::string name = fs::path(mesh_cache::getCachePath(_path)).stem().generic_string();
+		std::string imagePath = CACHE_PATH + "images/" + name + "_" + std::to_string(imageIndex) + ext;
+
+		std::error_code ec;
+		if (fs::file_size(imagePath, ec) != size || ec) {
+			fs::create_directories(fs::path(imagePath).parent_path(), ec);
+			std::ofstream out(imagePath, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(bytes), size);
+			if (!out) {
+				PRWRN("Failed to extract embedded image to: " << imagePath);
+				return "";
+			}
+		}
+
+		return imagePath;
+	}
+
+	// PBR metallic-roughness is approximated with the Phong material the renderer uses:
+	// base color is the diffuse color (it multiplies the base color texture like in glTF).
+	// Normal maps can't drive the height based bump mapping, so glTF materials have no bump texture.
+	void GltfImporter::loadMaterials(ModelData& data)
+	{
+		bool hasNormalMaps = false;
+		for (auto& mesh : data.meshes) {
+			if (mesh.mat_id < 0) {
+				mesh.gpuMat = {
+					.ambientColor = glm::vec3(1.f),
+					.diffuseColor = glm::vec3(1.f),
+					.specularColor = glm::vec3(0.04f)
+				};
+				continue;
+			}
+
+			const auto& jm = _doc["materials"][mesh.mat_id];
+
+			glm::vec4 baseColor(1.f);
+			float metallic = 1.f, roughness = 1.f;
+			if (jm.contains("pbrMetallicRoughness")) {
+				const auto& pbr = jm["pbrMetallicRoughness"];
+				if (pbr.contains("baseColorFactor")) {
+					auto& f = pbr["baseColorFactor"];
+					baseColor = { f[0], f[1], f[2], f[3] };
+				}
+				metallic = pbr.value("metallicFactor", 1.f);
+				roughness = pbr.value("roughnessFactor", 1.f);
+
+				if (pbr.contains("baseColorTexture")) {
+					mesh.diffuseTexPath = getImagePath(pbr["baseColorTexture"].value("index", -1));
+				}
+			}
+			hasNormalMaps |= jm.contains("normalTexture");
+
+			// Metals reflect their base color, dielectrics ~4% white. Rough surfaces have dim wide highlights.
+			glm::vec3 specular = glm::mix(glm::vec3(0.04f), glm::vec3(baseColor), metallic) * (1.f - roughness);
+
+			mesh.gpuMat = {
+				.ambientColor = glm::vec3(baseColor),
+				.diffuseColor = glm::vec3(baseColor),
+				.specularColor = specular
+			};
+
+			mesh.isTransparent = jm.value("alphaMode", "OPAQUE") == "BLEND" || baseColor.a < 0.75f;
+		}
+
+		if (hasNormalMaps) {
+			PRWRN("Normal maps of glTF materials are ignored: " << _path);
+		}
+	}
+
+	bool GltfImporter::loadPrimitive(const nlohmann::json& prim, const glm::mat4& transform, ModelData& data)
+	{
+		if (prim.value("mode", PRIMITIVE_MODE_TRIANGLES) != PRIMITIVE_MODE_TRIANGLES) {
+			PRWRN("Skipping non triangle glTF primitive in: " << _path);
+			return true;
+		}
+
+		const auto& attributes = prim.at("attributes");
+		if (!attributes.contains("POSITION")) {
+			return true;
+		}
+
+		Accessor pos, normal, uv, indices;
+		if (!getAccessor(attributes["POSITION"], pos)) {
+			return false;
+		}
+		bool hasNormals = attributes.contains("NORMAL");
+		if (hasNormals && !getAccessor(attributes["NORMAL"], normal)) {
+			return false;
+		}
+		bool hasUVs = attributes.contains("TEXCOORD_0");
+		if (hasUVs && !getAccessor(attributes["TEXCOORD_0"], uv)) {
+			return false;
+		}
+		bool hasIndices = prim.contains("indices");
+		if (hasIndices && !getAccessor(prim["indices"], indices)) {
+			return false;
+		}
+
+		if (pos.numComponents != 3 || (hasNormals && (normal.numComponents != 3 || normal.count < pos.count))
+			|| (hasUVs && (uv.numComponents != 2 || uv.count < pos.count)))
+		{
+			PRERR("Unexpected glTF vertex attribute layout in: " << _path);
+			return false;
+		}
+		if (hasIndices && (indices.numComponents != 1 || componentSize(indices.componentType) == 0 || indices.componentType == COMP_FLOAT)) {
+			PRERR("Unexpected glTF index layout in: " << _path);
+			return false;
+		}
+
+		size_t indexCount = hasIndices ? indices.count : pos.count;
+		if (indexCount < 3) {
+			return true;
+		}
+
+		int mat_id = prim.value("material", -1);
+		if (mat_id + 1 >= static_cast<int>(_materialMesh.size()) || mat_id < -1) {
+			mat_id = -1;
+		}
+
+		int& meshIndex = _materialMesh[mat_id + 1];
+		if (meshIndex < 0) {
+			meshIndex = static_cast<int>(data.meshes.size());
+
+			std::string name = mat_id >= 0 ? _doc["materials"][mat_id].value("name", "") : "default";
+			MeshData& newMesh = data.meshes.emplace_back();
+			// Material names are optional and not unique in glTF
+			newMesh.tag = "MESH_MAT: " + name + " #" + std::to_string(mat_id) + " (" + fs::path(_path).filename().generic_string() + ")";
+			newMesh.mat_id = mat_id;
+		}
+		MeshData& mesh = data.meshes[meshIndex];
+
+		const uint32_t baseVertex = static_cast<uint32_t>(mesh.vertices.size());
+		mesh.vertices.resize(baseVertex + pos.count);
+		Vertex* dst = mesh.vertices.data() + baseVertex;
+
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+		const bool identity = transform == glm::mat4(1.f);
+
+		for (size_t i = 0; i < pos.count; ++i) {
+			Vertex& v = dst[i];
+
+			if (pos.componentType == COMP_FLOAT) {
+				memcpy(&v.pos, pos.data + i * pos.stride, sizeof(glm::vec3));
+			} else {
+				v.pos = { pos.component(i, 0), pos.component(i, 1), pos.component(i, 2) };
+			}
+			if (hasNormals) {
+				if (normal.componentType == COMP_FLOAT) {
+					memcpy(&v.normal, normal.data + i * normal.stride, sizeof(glm::vec3));
+				} else {
+					v.normal = { normal.component(i, 0), normal.component(i, 1), normal.component(i, 2) };
+				}
+			} else {
+				v.normal = glm::vec3(0.f);
+			}
+			// glTF uv origin is top left like in Vulkan, unlike OBJ no flip is needed
+			if (hasUVs) {
+				if (uv.componentType == COMP_FLOAT) {
+					memcpy(&v.uv, uv.data + i * uv.stride, sizeof(glm::vec2));
+				} else {
+					v.uv = { uv.component(i, 0), uv.component(i, 1) };
+				}
+			} else {
+				v.uv = glm::vec2(0.f);
+			}
+
+			if (!identity) {
+				v.pos = glm::vec3(transform * glm::vec4(v.pos, 1.f));
+				if (hasNormals) {
+					v.normal = glm::normalize(normalMatrix * v.normal);
+				}
+			}
+
+			_bmin = glm::min(_bmin, v.pos);
+			_bmax = glm::max(_bmax, v.pos);
+		}
+
+		const size_t firstIndex = mesh.indices.size();
+		indexCount -= indexCount % 3;
+		mesh.indices.resize(firstIndex + indexCount);
+		uint32_t* dstIndices = mesh.indices.data() + firstIndex;
+
+		if (!hasIndices) {
+			std::iota(dstIndices, dstIndices + indexCount, baseVertex);
+		} else if (indices.componentType == COMP_UNSIGNED_INT && indices.stride == sizeof(uint32_t) && baseVertex == 0) {
+			memcpy(dstIndices, indices.data, indexCount * sizeof(uint32_t));
+		} else {
+			for (size_t i = 0; i < indexCount; ++i) {
+				dstIndices[i] = baseVertex + indices.index(i);
+			}
+		}
+
+		for (size_t i = 0; i < indexCount; ++i) {
+			if (dstIndices[i] - baseVertex >= pos.count) {
+				PRERR("glTF index out of range in: " << _path);
+				return false;
+			}
+		}
+
+		// Mirroring transforms flip the winding
+		if (glm::determinant(glm::mat3(transform)) < 0.f) {
+			for (size_t i = 0; i < indexCount; i += 3) {
+				std::swap(dstIndices[i + 1], dstIndices[i + 2]);
+			}
+		}
+
+		if (!hasNormals) {
+			// Area weighted smooth normals of the primitive
+			for (size_t i = 0; i < indexCount; i += 3) {
+				Vertex& v0 = mesh.vertices[dstIndices[i + 0]];
+				Vertex& v1 = mesh.vertices[dstIndices[i + 1]];
+				Vertex& v2 = mesh.vertices[dstIndices[i + 2]];
+				glm::vec3 n = glm::cross(v1.pos - v0.pos, v2.pos - v0.pos);
+				v0.normal += n;
+				v1.normal += n;
+				v2.normal += n;
+			}
+			for (size_t i = 0; i < pos.count; ++i) {
+				float len = glm::length(dst[i].normal);
+				dst[i].normal = len > 0.f ? dst[i].normal / len : glm::vec3(0.f, 1.f, 0.f);
+			}
+		}
+
+		// Vertex color is the normal, just for display purposes (same as OBJ loader)
+		for (size_t i = 0; i < pos.count; ++i) {
+			dst[i].color = dst[i].normal;
+		}
+
+		return true;
+	}
+
+	bool GltfImporter::loadNode(int nodeIndex, const glm::mat4& parent, ModelData& data, int depth)
+	{
+		// Node hierarchy must be a forest, the depth limit only guards against broken files
+		if (depth > 256 || nodeIndex < 0 || nodeIndex >= static_cast<int>(_doc["nodes"].size())) {
+			PRERR("Invalid glTF node hierarchy in: " << _path);
+			return false;
+		}
+		const auto& jn = _doc["nodes"][nodeIndex];
+
+		glm::mat4 local(1.f);
+		if (jn.contains("matrix")) {
+			std::array<float, 16> m = jn["matrix"].get<std::array<float, 16>>();
+			local = glm::make_mat4(m.data()); // Column major like glm
+		} else {
+			glm::vec3 t(0.f), s(1.f);
+			glm::quat r(1.f, 0.f, 0.f, 0.f);
+			if (jn.contains("translation")) {
+				auto& jt = jn["translation"];
+				t = { jt[0], jt[1], jt[2] };
+			}
+			if (jn.contains("rotation")) {
+				auto& jr = jn["rotation"];
+				r = glm::quat(jr[3].get<float>(), jr[0].get<float>(), jr[1].get<float>(), jr[2].get<float>());
+			}
+			if (jn.contains("scale")) {
+				auto& js = jn["scale"];
+				s = { js[0], js[1], js[2] };
+			}
+			local = glm::translate(t) * glm::mat4_cast(r) * glm::scale(s);
+		}
+		glm::mat4 world = parent * local;
+
+		if (jn.contains("mesh")) {
+			int meshIndex = jn["mesh"];
+			if (!_doc.contains("meshes") || meshIndex < 0 || meshIndex >= static_cast<int>(_doc["meshes"].size())) {
+				PRERR("Invalid glTF mesh index in: " << _path);
+				return false;
+			}
+			for (auto& prim : _doc["meshes"][meshIndex].at("primitives")) {
+				if (!loadPrimitive(prim, world, data)) {
+					return false;
+				}
+			}
+		}
+
+		if (jn.contains("children")) {
+			for (auto& child : jn["children"]) {
+				if (!loadNode(child, world, data, depth + 1)) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	bool GltfImporter::Load(ModelData& data)
+	{
+		if (!loadDocument() || !loadBuffers()) {
+			return false;
+		}
+
+		data = {};
+		size_t numMaterials = _doc.contains("materials") ? _doc["materials"].size() : 0;
+		_materialMesh.assign(numMaterials + 1, -1);
+
+		if (_doc.contains("nodes")) {
+			std::vector<int> roots;
+			if (_doc.contains("scenes") && !_doc["scenes"].empty()) {
+				int scene = _doc.value("scene", 0);
+				roots = _doc["scenes"].at(scene).value("nodes", std::vector<int>{});
+			} else {
+				// No scene, every node that isn't a child is a root
+				std::vector<bool> isChild(_doc["nodes"].size(), false);
+				for (auto& jn : _doc["nodes"]) {
+					for (int child : jn.value("children", std::vector<int>{})) {
+						if (child >= 0 && child < static_cast<int>(isChild.size())) {
+							isChild[child] = true;
+						}
+					}
+				}
+				for (size_t i = 0; i < isChild.size(); ++i) {
+					if (!isChild[i]) {
+						roots.push_back(static_cast<int>(i));
+					}
+				}
+			}
+
+			for (int root : roots) {
+				if (!loadNode(root, glm::mat4(1.f), data, 0)) {
+					return false;
+				}
+			}
+		}
+
+		if (data.meshes.empty()) {
+			PRERR("glTF file has no triangle meshes: " << _path);
+			return false;
+		}
+
+		loadMaterials(data);
+
+		data.maxExtent = 0.5f * glm::compMax(_bmax - _bmin);
+		if (!(data.maxExtent > 0.f)) {
+			PRERR("glTF file has no extent, it has no vertices or all of them are at one point: " << _path);
+			return false;
+		}
+
+		return true;
+	}
+}
+
+bool loadGltfModelData(const std::string& path, ModelData& data, const LoaderSettings& settings)
+{
+	pr("\nLoading model at: " << path);
+
+	Timer timer;
+	GltfImporter importer(path);
+	bool ok = false;
+	try {
+		ok = importer.Load(data);
+	} catch (const nlohmann::json::exception& e) {
+		// Missing or mistyped required properties
+		PRERR("Invalid glTF file " << path << ": " << e.what());
+	}
+	if (!ok) {
+		return false;
+	}
+
+	size_t numVertices = 0, numIndices = 0;
+	for (auto& mesh : data.meshes) {
+		numVertices += mesh.vertices.size();
+		numIndices += mesh.indices.size();
+	}
+	pr("Imported " << data.meshes.size() << " meshes, " << numVertices << " vertices, " << numIndices / 3
+		<< " triangles from " << path << " in " << timer.ElapsedMs() << " ms");
+
+	processMeshes(path, data.meshes, settings);
+
+	return true;
+}
@@ -0,0 +1,159 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "gpu_memory.h"
+
+namespace gpu_memory {
+	static constexpr const char* CATEGORY_NAMES[size_t(Category::Count)] = {
+		"Viewport", "PostFX", "Shadows", "Textures", "Skybox", "Geometry", "Frame", "Staging", "Untagged"
+	};
+
+	const char* getCategoryName(Category category)
+	{
+		return CATEGORY_NAMES[size_t(category)];
+	}
+
+	void tag(VmaAllocator allocator, VmaAllocation allocation, Category category, const std::string& name)
+	{
+		// VMA copies the string
+		vmaSetAllocationName(allocator, allocation, (std::string(getCategoryName(category)) + "/" + name).c_str());
+	}
+
+	static Category parseCategory(const std::string& allocationName)
+	{
+		size_t separator = allocationName.find('/');
+		if (separator != std::string::npos) {
+			for (size_t i = 0; i < size_t(Category::Untagged); ++i) {
+				if (allocationName.compare(0, separator, CATEGORY_NAMES[i]) == 0) {
+					return Category(i);
+				}
+			}
+		}
+		return Category::Untagged;
+	}
+
+	Report buildReport(VmaAllocator allocator)
+	{
+		Report report;
+
+		char* statsString = nullptr;
+		vmaBuildStatsString(allocator, &statsString, VK_TRUE);
+		report.vmaStats = statsString;
+		vmaFreeStatsString(allocator, statsString);
+
+		auto addAllocation = [&](const nlohmann::json& alloc) {
+			if (alloc.value("Type", "") == "FREE") {
+				return;
+			}
+			CategoryUsage& usage = report.categories[size_t(parseCategory(alloc.value("Name", "")))];
+			usage.bytes += alloc.value("Size", uint64_t(0));
+			++usage.allocations;
+		};
+		// Blocks: { "<id>": { ..., "Suballocations": [...] } }, DedicatedAllocations: [...]
+		auto addPool = [&](const nlohmann::json& pool) {
+			if (auto blocks = pool.find("Blocks"); blocks != pool.end()) {
+				for (auto& block : *blocks) {
+					for (auto& alloc : block.value("Suballocations", nlohmann::json::array())) {
+						addAllocation(alloc);
+					}
+				}
+			}
+			for (auto& alloc : pool.value("DedicatedAllocations", nlohmann::json::array())) {
+				addAllocation(alloc);
+			}
+		};
+
+		nlohmann::json stats = nlohmann::json::parse(report.vmaStats, nullptr, false);
+		if (stats.is_discarded()) {
+			PRWRN("Failed to parse VMA stats string");
+		} else {
+			// Default pools are one object per memory type, custom pools an array of pools per memory type
+			for (auto& pool : stats.value("DefaultPools", nlohmann::json::object())) {
+				addPool(pool);
+			}
+			for (auto& pools : stats.value("CustomPools", nlohmann::json::object())) {
+				for (auto& pool : pools) {
+					addPool(pool);
+				}
+			}
+		}
+
+		const VkPhysicalDeviceMemoryProperties* memoryProperties;
+		vmaGetMemoryProperties(allocator, &memoryProperties);
+
+		VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+		vmaGetHeapBudgets(allocator, budgets);
+
+		VmaTotalStatistics totals;
+		vmaCalculateStatistics(allocator, &totals);
+
+		report.heaps.resize(memoryProperties->memoryHeapCount);
+		for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; ++i) {
+			const VmaDetailedStatistics& heapStats = totals.memoryHeap[i];
+			HeapUsage& heap = report.heaps[i];
+
+			heap.deviceLocal = memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+			heap.size = memoryProperties->memoryHeaps[i].size;
+			heap.budget = budgets[i].budget;
+			heap.usage = budgets[i].usage;
+			heap.blocks = heapStats.statistics.blockCount;
+			heap.allocations = heapStats.statistics.allocationCount;
+			heap.blockBytes = heapStats.statistics.blockBytes;
+			heap.allocationBytes = heapStats.statistics.allocationBytes;
+
+			uint64_t freeBytes = heap.blockBytes - heap.allocationBytes;
+			if (freeBytes > 0) {
+				heap.fragmentation = 1.f - float(double(heapStats.unusedRangeSizeMax) / freeBytes);
+			}
+		}
+
+		return report;
+	}
+
+	bool writeReport(const Report& report, const std::string& path)
+	{
+		nlohmann::json j;
+
+		uint64_t totalBytes = 0;
+		for (size_t i = 0; i < report.categories.size(); ++i) {
+			const CategoryUsage& usage = report.categories[i];
+			j["categories"][CATEGORY_NAMES[i]] = {
+				{ "bytes", usage.bytes },
+				{ "allocations", usage.allocations }
+			};
+			totalBytes += usage.bytes;
+		}
+		j["total_bytes"] = totalBytes;
+
+		j["heaps"] = nlohmann::json::array();
+		for (const HeapUsage& heap : report.heaps) {
+			j["heaps"].push_back({
+				{ "device_local", heap.deviceLocal },
+				{ "size", heap.size },
+				{ "budget", heap.budget },
+				{ "usage", heap.usage },
+				{ "blocks", heap.blocks },
+				{ "allocations", heap.allocations },
+				{ "block_bytes", heap.blockBytes },
+				{ "allocation_bytes", heap.allocationBytes },
+				{ "fragmentation", heap.fragmentation }
+			});
+		}
+
+		nlohmann::json vmaStats = nlohmann::json::parse(report.vmaStats, nullptr, false);
+		j["vma"] = vmaStats.is_discarded() ? nlohmann::json(report.vmaStats) : vmaStats;
+
+		std::ofstream out(path, std::ios::trunc);
+		if (!out.is_open()) {
+			PRERR("Failed to open memory report file: " << path);
+			return false;
+		}
+		out << j.dump(4);
+		if (!out.good()) {
+			PRERR("Failed to write memory report file: " << path);
+			return false;
+		}
+
+		pr("Memory report written to " << path << " (" << totalBytes / (1024 * 1024) << " MiB allocated)");
+		return true;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// Accounting of GPU memory allocated through VMA.
+// Every allocation is tagged with a category and the name its Vulkan objects get (see Engine::setDebugName),
+// stored as the VMA allocation name "<category>/<name>". Reports attribute allocations to categories by walking the
+// detailed map of vmaBuildStatsString, so nothing has to be untracked when an allocation is freed.
+namespace gpu_memory {
+    enum class Category : uint32_t {
+        Viewport,   // Viewport color and depth images
+        PostFX,     // PostFX attachments and pyramids
+        Shadows,    // Shadow cube map array and depth
+        Textures,   // Model textures
+        Skybox,
+        Geometry,   // Mesh vertices, indices and meshlets
+        Frame,      // Per frame uniform and storage buffers
+        Staging,    // Upload staging memory
+        Untagged,
+        Count
+    };
+
+    const char* getCategoryName(Category category);
+
+    void tag(VmaAllocator allocator, VmaAllocation allocation, Category category, const std::string& name);
+
+    struct CategoryUsage {
+        uint64_t bytes = 0;
+        uint32_t allocations = 0;
+    };
+
+    struct HeapUsage {
+        bool deviceLocal = false;
+        uint64_t size = 0;
+        // From vmaGetHeapBudgets, usage also counts memory of other processes where the driver reports it
+        uint64_t budget = 0;
+        uint64_t usage = 0;
+        // VkDeviceMemory blocks allocated by VMA and the allocations placed in them
+        uint32_t blocks = 0;
+        uint32_t allocations = 0;
+        uint64_t blockBytes = 0;
+        uint64_t allocationBytes = 0;
+        // 1 - largest free range / free bytes in blocks, 0 when free space is in one piece
+        float fragmentation = 0.f;
+    };
+
+    struct Report {
+        std::array<CategoryUsage, size_t(Category::Count)> categories{};
+        std::vector<HeapUsage> heaps;
+        // vmaBuildStatsString with detailed map
+        std::string vmaStats;
+    };
+
+    Report buildReport(VmaAllocator allocator);
+    // Per category and per heap numbers as JSON, the VMA stats are embedded under "vma"
+    bool writeReport(const Report& report, const std::string& path);
+}
@@ -9,6 +9,9 @@
 
 #define MAX_LUMINANCE_BINS 256
 
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
 // Bool is 8-bit in C++ but 32-bit in GLSL
 struct GPUBool {
     bool val = {};
@@ -47,6 +50,22 @@ struct GPUShadowPC {
     uint32_t lightIndex;
 };
 
+// Cluster of up to MESHLET_MAX_TRIANGLES triangles stored as a contiguous range of the mesh's index buffer.
+// Bounds are in model space.
+struct GPUMeshlet {
+    glm::vec3 center{};
+    float radius{};
+
+    // Cluster is backfacing for a viewer at V if dot(normalize(center - V), coneAxis) >= coneCutoff + radius / length(center - V)
+    glm::vec3 coneAxis{};
+    float coneCutoff{ 1.f }; // 1 means cone is too wide to ever cull
+
+    uint32_t firstIndex{};
+    uint32_t indexCount{};
+    uint32_t vertexCount{};
+    int _pad0;
+};
+
 struct GPULight {
     glm::vec3 position{};
     float radius{};
@@ -89,6 +108,11 @@ struct GPUSceneUB {
     float bumpStep = 0.001f;
     float bumpUVFactor = 0.002f;
 
+    GPUBool useDerivativeMaps = false; // Bump textures are derivative maps, set from LoaderSettings::derivativeBumpMaps
+    int _pad4;
+    int _pad5;
+    int _pad6;
+
     GPULight lights[MAX_LIGHTS];
 };
 
@@ -106,7 +130,12 @@ struct GPUMaterial {
 struct GPUObject {
     glm::mat4 modelMatrix;
     glm::mat4 normalMatrix;
-  
+
+    // Dequantization of packed vertices, see VertexDequant
+    glm::vec4 posScale;
+    glm::vec4 posOffset;
+    glm::vec4 uvScaleOffset;
+
     GPUMaterial mat[MAX_MESHES_PER_OBJECT];
 };
 
@@ -412,6 +412,38 @@ void Engine::pickPhysicalDevice()
     _presentQueueFamily = get<2>(*bestDevice);
     _gpuProperties = get<3>(*bestDevice);
 
+    // Uploads use a separate transfer queue family if there is one, preferably a transfer only (DMA) one.
+    // Graphics and compute families support transfers implicitly.
+    _transferQueueFamily = _graphicsQueueFamily;
+    if (_loaderSettings.useTransferQueue) {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, queueFamilyList.data());
+
+        int bestTransferScore = 0;
+        for (uint32_t i = 0; i < queueFamilyCount; ++i) {
+            VkQueueFlags flags = queueFamilyList[i].queueFlags;
+            if (i == _graphicsQueueFamily || (flags & VK_QUEUE_GRAPHICS_BIT)) {
+                continue;
+            }
+
+            int score = (flags & VK_QUEUE_TRANSFER_BIT) ? 2 : (flags & VK_QUEUE_COMPUTE_BIT) ? 1 : 0;
+            if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_COMPUTE_BIT)) {
+                ++score;
+            }
+            if (score > bestTransferScore) {
+                bestTransferScore = score;
+                _transferQueueFamily = i;
+            }
+        }
+    }
+    if (_transferQueueFamily != _graphicsQueueFamily) {
+        pr("Uploads use transfer queue family " << _transferQueueFamily);
+    } else {
+        pr("No separate transfer queue family, uploads use the graphics queue");
+    }
+
 
     pr("The GPU has a minimum buffer alignment of "
         << _gpuProperties.limits.minUniformBufferOffsetAlignment);
@@ -432,13 +464,19 @@ void Engine::createLogicalDevice()
             .queueCount = 1,
             .pQueuePriorities = &(const float&)1.0f
         },
-        VkDeviceQueueCreateInfo{
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = _presentQueueFamily,
-            .queueCount = 1,
-            .pQueuePriorities = &(const float&)1.0f
-        },
     };
+    for (uint32_t family : { _presentQueueFamily, _transferQueueFamily }) {
+        bool created = std::any_of(queueCreateInfos.begin(), queueCreateInfos.end(),
+            [=](const VkDeviceQueueCreateInfo& info) { return info.queueFamilyIndex == family; });
+        if (!created) {
+            queueCreateInfos.push_back({
+                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .queueFamilyIndex = family,
+                .queueCount = 1,
+                .pQueuePriorities = &(const float&)1.0f
+            });
+        }
+    }
 
 
     // Needed for gl_BaseIndex
@@ -475,10 +513,15 @@ void Engine::createLogicalDevice()
         throw std::runtime_error("Physcial device does not support all required features");
     }
 
+    // Feature chain now holds every supported feature, which all get enabled
+    _textureCompressionBC = deviceFeatures.features.textureCompressionBC;
+    pr("BC texture compression " << (_textureCompressionBC ? "supported" : "not supported"));
+    _shaderStorageImageExtendedFormats = deviceFeatures.features.shaderStorageImageExtendedFormats;
+
     VkDeviceCreateInfo deviceCreateInfo{
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .pNext = &deviceFeatures,
-        .queueCreateInfoCount = _graphicsQueueFamily == _presentQueueFamily ? uint32_t(1) : uint32_t(2),
+        .queueCreateInfoCount = (uint32_t)queueCreateInfos.size(),
         .pQueueCreateInfos = queueCreateInfos.data(),
         .enabledLayerCount = ENABLE_VALIDATION_LAYERS ? (uint32_t)_enabledValidationLayers.size() : 0,
         .ppEnabledLayerNames = ENABLE_VALIDATION_LAYERS ? _enabledValidationLayers.data() : nullptr,
@@ -492,8 +535,12 @@ void Engine::createLogicalDevice()
 
     vkGetDeviceQueue(_device, _graphicsQueueFamily, 0, &_graphicsQueue);
     vkGetDeviceQueue(_device, _presentQueueFamily, 0, &_presentQueue);
+    vkGetDeviceQueue(_device, _transferQueueFamily, 0, &_transferQueue);
 
-    setDebugName(VK_OBJECT_TYPE_QUEUE, _graphicsQueue, "Main and only queue");
+    setDebugName(VK_OBJECT_TYPE_QUEUE, _graphicsQueue, "Main queue");
+    if (_transferQueue != _graphicsQueue) {
+        setDebugName(VK_OBJECT_TYPE_QUEUE, _transferQueue, "Upload queue");
+    }
 
     loadDeviceExtensionFunctions();
 }
@@ -2,18 +2,246 @@
 #include "defs.h"
 
 #include "engine.h"
+#include "mesh_cache.h"
+#include "obj_parser.h"
+#include "texture_cache.h"
+#include "texture_converter.h"
+#include "texture_decoder.h"
+
+#include <charconv>
+
+static void printUsage(const char* exe)
+{
+    pr("Usage: " << exe << " [working_directory] [options]\n"
+        << "Options:\n"
+        << "  --no-mesh-cache      Always parse model files, don't read or write mesh cache\n"
+        << "  --build-mesh-cache   Build mesh cache for all models in " << MODEL_PATH << ", report cold vs warm load times and exit\n"
+        << "  --obj-parser=<name>  OBJ parser to use: 'mt' (multithreaded, default) or 'tinyobj'\n"
+        << "  --threads=<N>        Number of threads used for loading, all hardware threads by default\n"
+        << "  --no-mesh-opt        Keep index and vertex order of loaded meshes as in the model file\n"
+        << "  --no-overdraw-opt    Only optimize meshes for vertex cache, don't reorder triangles to reduce overdraw\n"
+        << "  --no-lods            Don't build simplified levels of detail for loaded meshes\n"
+        << "  --no-texture-mips    Upload model textures without mipmaps\n"
+        << "  --height-bump-maps   Sample bump maps as height with 8 taps instead of converting them to derivative maps\n"
+        << "  --no-compressed-textures Ignore .ktx2/.dds files and load source images\n"
+        << "  --no-texture-cache   Always decode source images, don't read or write texture cache\n"
+        << "  --texture-cache-size=<MiB> Size above which least recently used texture cache entries are evicted (2048 by default)\n"
+        << "  --prewarm-texture-cache[=<dir>] Write texture cache for all textures in a directory (" << MODEL_PATH << " by default) and exit\n"
+        << "  --clear-texture-cache Delete all texture cache entries and exit\n"
+        << "  --no-texture-streaming Keep all mip levels of model textures resident\n"
+        << "  --texture-budget=<MiB> Memory streamed textures may use (half of the GPU memory budget by default)\n"
+        << "  --convert-textures   Encode all textures in " << MODEL_PATH << " to BC1/BC3 .dds with mips and exit\n"
+        << "  --skybox-format=<name> Format of skyboxes loaded from .hdr faces: 'rgb9e5', 'b10g11r11', 'rgba16f' or 'rgba32f' (most compact supported by default)\n"
+        << "  --no-postfx-aliasing Give every PostFX attachment its own memory instead of sharing it between effects\n"
+        << "  --postfx-narrow-formats Store PostFX attachments in narrower per attachment formats instead of RGBA32F\n"
+        << "  --viewport-format=<name> Format of the HDR viewport images: 'rgba32f' (default), 'rgba16f' or 'b10g11r11'\n"
+        << "  --no-transfer-queue  Upload on the graphics queue even if the GPU has a separate transfer queue\n"
+        << "  --packed-vertices    Upload model vertices in compact 16 byte layout\n"
+        << "  --dump-memory[=<path>] Load the scene, write a JSON report of GPU memory use (" << Engine::MEMORY_REPORT_PATH << " by default) and exit\n"
+        << "  --validate-postfx-precision Load the scene, compare PostFX output with narrow and RGBA32F attachments and exit\n"
+        << "  --bench-viewport-formats Load the scene, time scene and PostFX passes at 1080p and 4K in every viewport format and exit\n"
+        << "  --bench-obj-parser   Compare OBJ parsers on all models in " << MODEL_PATH << " and exit\n"
+        << "  --bench-dedup[=<obj>] Compare vertex deduplication methods on a model (crytek_sponza by default) and exit\n"
+        << "  --bench-normals[=<obj>] Compare serial and parallel smoothing normal regeneration on a model (crytek_sponza by default) and exit\n"
+        << "  --bench-texture-decode[=<dir>] Decode all textures in a directory (crytek_sponza by default) with 1/4/16 threads and exit\n"
+        << "  --help               Print this message and exit");
+}
+
+// Value of "<option><N>", false if it isn't a positive (or with allowZero non-negative) 32-bit number
+static bool parseCount(const std::string& arg, const char* option, uint32_t& value, bool allowZero = false)
+{
+    const char* begin = arg.c_str() + strlen(option);
+    const char* end = arg.c_str() + arg.size();
+
+    uint32_t parsed = 0;
+    auto [ptr, ec] = std::from_chars(begin, end, parsed);
+    if (ec != std::errc() || ptr != end || (parsed == 0 && !allowZero)) {
+        PRERR("Invalid value: " << arg);
+        return false;
+    }
+    value = parsed;
+    return true;
+}
 
 int main(int argc, char* argv[])
 {
+    LoaderSettings loaderSettings{};
+    bool buildMeshCache = false;
+    bool convertTextures = false;
+    std::string prewarmTextureDir = "";
+    bool clearTextureCache = false;
+    bool benchObjParser = false;
+    std::string benchDedupModel = "";
+    std::string benchNormalsModel = "";
+    std::string benchTextureDir = "";
+    std::string dumpMemoryPath = "";
+    bool validatePostFXPrecision = false;
+    bool benchViewportFormats = false;
+
+    const char* workDirArg = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--no-mesh-cache") {
+            loaderSettings.useMeshCache = false;
+        } else if (arg == "--build-mesh-cache") {
+            buildMeshCache = true;
+        } else if (arg == "--obj-parser=mt") {
+            loaderSettings.objParser = LoaderSettings::ObjParser::Multithreaded;
+        } else if (arg == "--obj-parser=tinyobj") {
+            loaderSettings.objParser = LoaderSettings::ObjParser::Tinyobj;
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            if (!parseCount(arg, "--threads=", loaderSettings.numThreads)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--no-mesh-opt") {
+            loaderSettings.optimizeMeshes = false;
+        } else if (arg == "--no-overdraw-opt") {
+            loaderSettings.optimizeOverdraw = false;
+        } else if (arg == "--no-lods") {
+            loaderSettings.generateLods = false;
+        } else if (arg == "--no-texture-mips") {
+            loaderSettings.generateTextureMips = false;
+        } else if (arg == "--height-bump-maps") {
+            loaderSettings.derivativeBumpMaps = false;
+        } else if (arg == "--no-compressed-textures") {
+            loaderSettings.useCompressedTextures = false;
+        } else if (arg == "--no-texture-cache") {
+            loaderSettings.useTextureCache = false;
+        } else if (arg.rfind("--texture-cache-size=", 0) == 0) {
+            if (!parseCount(arg, "--texture-cache-size=", loaderSettings.textureCacheSizeMiB)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--prewarm-texture-cache") {
+            prewarmTextureDir = MODEL_PATH;
+        } else if (arg.rfind("--prewarm-texture-cache=", 0) == 0) {
+            prewarmTextureDir = arg.substr(strlen("--prewarm-texture-cache="));
+        } else if (arg == "--clear-texture-cache") {
+            clearTextureCache = true;
+        } else if (arg == "--no-texture-streaming") {
+            loaderSettings.streamTextures = false;
+        } else if (arg.rfind("--texture-budget=", 0) == 0) {
+            // 0 is the default, half of the memory budget
+            if (!parseCount(arg, "--texture-budget=", loaderSettings.textureBudgetMiB, true)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--convert-textures") {
+            convertTextures = true;
+        } else if (arg == "--skybox-format=rgb9e5") {
+            loaderSettings.skyboxFormat = VK_FORMAT_E5B9G9R9_UFLOAT_PACK32;
+        } else if (arg == "--skybox-format=b10g11r11") {
+            loaderSettings.skyboxFormat = VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+        } else if (arg == "--skybox-format=rgba16f") {
+            loaderSettings.skyboxFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+        } else if (arg == "--skybox-format=rgba32f") {
+            loaderSettings.skyboxFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+        } else if (arg == "--no-postfx-aliasing") {
+            loaderSettings.aliasPostFXMemory = false;
+        } else if (arg == "--postfx-narrow-formats") {
+            loaderSettings.postfxNarrowFormats = true;
+        } else if (arg == "--viewport-format=rgba32f") {
+            loaderSettings.viewportFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+        } else if (arg == "--viewport-format=rgba16f") {
+            loaderSettings.viewportFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+        } else if (arg == "--viewport-format=b10g11r11") {
+            loaderSettings.viewportFormat = VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+        } else if (arg == "--no-transfer-queue") {
+            loaderSettings.useTransferQueue = false;
+        } else if (arg == "--packed-vertices") {
+            loaderSettings.packedVertices = true;
+        } else if (arg == "--dump-memory") {
+            dumpMemoryPath = Engine::MEMORY_REPORT_PATH;
+        } else if (arg.rfind("--dump-memory=", 0) == 0) {
+            dumpMemoryPath = arg.substr(strlen("--dump-memory="));
+        } else if (arg == "--validate-postfx-precision") {
+            validatePostFXPrecision = true;
+        } else if (arg == "--bench-viewport-formats") {
+            benchViewportFormats = true;
+        } else if (arg == "--bench-obj-parser") {
+            benchObjParser = true;
+        } else if (arg == "--bench-dedup") {
+            benchDedupModel = MODEL_PATH + "crytek_sponza/sponza.obj";
+        } else if (arg.rfind("--bench-dedup=", 0) == 0) {
+            benchDedupModel = arg.substr(strlen("--bench-dedup="));
+        } else if (arg == "--bench-normals") {
+            benchNormalsModel = MODEL_PATH + "crytek_sponza/sponza.obj";
+        } else if (arg.rfind("--bench-normals=", 0) == 0) {
+            benchNormalsModel = arg.substr(strlen("--bench-normals="));
+        } else if (arg == "--bench-texture-decode") {
+            benchTextureDir = MODEL_PATH + "crytek_sponza";
+        } else if (arg.rfind("--bench-texture-decode=", 0) == 0) {
+            benchTextureDir = arg.substr(strlen("--bench-texture-decode="));
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg.rfind("--", 0) == 0) {
+            PRERR("Unknown option: " << arg);
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            workDirArg = argv[i];
+        }
+    }
+
     // If work dir was supplied as command line argument set it
-    if (argc > 1) {
+    if (workDirArg) {
         // Get the absolute path of the supplied working directory (get rid of all '../' './' etc.)
-        std::filesystem::path work_dir = std::filesystem::canonical(argv[1]);
-        std::filesystem::current_path(work_dir); 
+        std::filesystem::path work_dir = std::filesystem::canonical(workDirArg);
+        std::filesystem::current_path(work_dir);
         pr("Setting working directory to: " << work_dir << "\n\n");
     }
 
-    Engine engine;
+    if (benchObjParser) {
+        obj_parser::benchmark(MODEL_PATH);
+        return 0;
+    }
+
+    if (!benchDedupModel.empty()) {
+        benchmarkVertexDedup(benchDedupModel, loaderSettings);
+        return 0;
+    }
+
+    if (!benchNormalsModel.empty()) {
+        benchmarkSmoothingNormals(benchNormalsModel, loaderSettings);
+        return 0;
+    }
+
+    if (!benchTextureDir.empty()) {
+        texture_decoder::Options options = {
+            .useCompressed = loaderSettings.useCompressedTextures,
+            .useCache = loaderSettings.useTextureCache,
+            .format = Engine::TEXTURE_FORMAT,
+            .mips = loaderSettings.generateTextureMips
+        };
+        texture_decoder::benchmark(benchTextureDir, options);
+        return 0;
+    }
+
+    if (clearTextureCache) {
+        texture_cache::clear();
+        return 0;
+    }
+
+    if (!prewarmTextureDir.empty()) {
+        texture_cache::prewarm(prewarmTextureDir, Engine::TEXTURE_FORMAT, loaderSettings.generateTextureMips,
+            uint64_t(loaderSettings.textureCacheSizeMiB) * 1024 * 1024, loaderSettings.numThreads);
+        return 0;
+    }
+
+    if (convertTextures) {
+        texture_converter::convertAll(MODEL_PATH, loaderSettings.numThreads);
+        return 0;
+    }
+
+    if (buildMeshCache) {
+        mesh_cache::prebuildAll(MODEL_PATH, loaderSettings);
+        return 0;
+    }
+
+    Engine engine(loaderSettings);
 
     try {
         engine.Init();
@@ -22,6 +250,24 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
+    if (!dumpMemoryPath.empty()) {
+        bool written = engine.WriteMemoryReport(dumpMemoryPath);
+        engine.Cleanup();
+        return written ? 0 : EXIT_FAILURE;
+    }
+
+    if (validatePostFXPrecision) {
+        bool passed = engine.ValidatePostFXPrecision();
+        engine.Cleanup();
+        return passed ? 0 : EXIT_FAILURE;
+    }
+
+    if (benchViewportFormats) {
+        bool measured = engine.BenchViewportFormats();
+        engine.Cleanup();
+        return measured ? 0 : EXIT_FAILURE;
+    }
+
     engine.Run();
 	engine.Cleanup();
 
@@ -16,6 +16,10 @@ void Engine::createVmaAllocator()
     vmaCreateAllocator(&allocatorInfo, &_allocator);
 
     _deletionStack.push([&]() { vmaDestroyAllocator(_allocator); });
+
+    _postfxMemory.Create(_device, _allocator);
+
+    _deletionStack.push([&]() { _postfxMemory.Destroy(); });
 }
 
 AllocatedBuffer Engine::allocateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
@@ -42,6 +46,11 @@ AllocatedBuffer Engine::allocateBuffer(size_t allocSize, VkBufferUsageFlags usag
     return newBuffer;
 }
 
+bool Engine::WriteMemoryReport(const std::string& path)
+{
+    return gpu_memory::writeReport(gpu_memory::buildReport(_allocator), path);
+}
+
 size_t Engine::pad_uniform_buffer_size(size_t originalSize)
 {
     // From https://github.com/SaschaWillems/Vulkan/tree/master/examples/dynamicuniformbuffer
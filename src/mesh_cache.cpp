@@ -0,0 +1,378 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "mesh_cache.h"
+#include "mapped_file.h"
+#include "timer.h"
+#include "texture_container.h"
+
+namespace fs = std::filesystem;
+
+namespace mesh_cache {
+	static constexpr char MAGIC[4] = { 'H', 'M', 'S', 'H' };
+
+	struct FileHeader {
+		char magic[4];
+		uint32_t version;
+		uint32_t vertexSize;
+		uint32_t processingFlags;
+		uint32_t numDependencies;
+		uint32_t numMeshes;
+		float maxExtent;
+	};
+
+	// Settings that change the cached data itself
+	enum ProcessingFlags : uint32_t {
+		OPTIMIZE_MESHES = 1 << 0,
+		OPTIMIZE_OVERDRAW = 1 << 1,
+		GENERATE_LODS = 1 << 2
+	};
+
+	static uint32_t getProcessingFlags(const LoaderSettings& settings)
+	{
+		uint32_t flags = 0;
+		if (settings.optimizeMeshes) {
+			flags |= OPTIMIZE_MESHES;
+			if (settings.optimizeOverdraw) {
+				flags |= OPTIMIZE_OVERDRAW;
+			}
+		}
+		if (settings.generateLods) {
+			flags |= GENERATE_LODS;
+		}
+		return flags;
+	}
+
+	// Size and modification time of a file the cache was built from
+	struct Dependency {
+		std::string path;
+		uint64_t size;
+		int64_t mtime;
+	};
+
+	// Model file itself and all material libraries (OBJ) or external buffers (glTF) next to it.
+	// We don't know which .mtl/.bin files are referenced by the model without parsing it,
+	// so any change in the directory's .mtl/.bin files invalidates the cache.
+	// .glb files are self contained.
+	static bool getDependencies(const std::string& modelPath, std::vector<Dependency>& deps)
+	{
+		std::error_code ec;
+
+		auto addDependency = [&](const fs::path& p) {
+			uint64_t size = fs::file_size(p, ec);
+			if (ec) {
+				return false;
+			}
+			auto mtime = fs::last_write_time(p, ec);
+			if (ec) {
+				return false;
+			}
+			deps.push_back({ p.generic_string(), size, static_cast<int64_t>(mtime.time_since_epoch().count()) });
+			return true;
+		};
+
+		if (!addDependency(modelPath)) {
+			return false;
+		}
+
+		std::string ext = fs::path(modelPath).extension().string();
+		if (ext == ".glb") {
+			return true;
+		}
+		const char* depExt = isGltfModel(modelPath) ? ".bin" : ".mtl";
+
+		std::vector<fs::path> files;
+		fs::path dir = fs::path(modelPath).parent_path();
+		for (auto& entry : fs::directory_iterator(dir.empty() ? "." : dir, ec)) {
+			if (entry.is_regular_file() && entry.path().extension() == depExt) {
+				files.push_back(entry.path());
+			}
+		}
+		// Directory iteration order is unspecified
+		std::sort(files.begin(), files.end());
+
+		for (auto& p : files) {
+			if (!addDependency(p)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/* Serialization helpers */
+
+	struct Writer {
+		std::vector<char> buf;
+
+		void bytes(const void* src, size_t size) {
+			const char* p = static_cast<const char*>(src);
+			buf.insert(buf.end(), p, p + size);
+		}
+		template<typename T>
+		void pod(const T& v) {
+			bytes(&v, sizeof(T));
+		}
+		void str(const std::string& s) {
+			pod(static_cast<uint32_t>(s.size()));
+			bytes(s.data(), s.size());
+		}
+	};
+
+	struct Reader {
+		const char* ptr;
+		const char* end;
+
+		bool bytes(void* dst, size_t size) {
+			if (static_cast<size_t>(end - ptr) < size) {
+				return false;
+			}
+			memcpy(dst, ptr, size);
+			ptr += size;
+			return true;
+		}
+		template<typename T>
+		bool pod(T& v) {
+			return bytes(&v, sizeof(T));
+		}
+		bool str(std::string& s) {
+			uint32_t len;
+			if (!pod(len) || static_cast<size_t>(end - ptr) < len) {
+				return false;
+			}
+			s.assign(ptr, len);
+			ptr += len;
+			return true;
+		}
+		template<typename T>
+		bool array(std::vector<T>& v) {
+			uint64_t count;
+			if (!pod(count) || static_cast<size_t>(end - ptr) / sizeof(T) < count) {
+				return false;
+			}
+			v.resize(count);
+			return bytes(v.data(), count * sizeof(T));
+		}
+	};
+
+	std::string getCachePath(const std::string& modelPath)
+	{
+		std::string name = fs::path(modelPath).lexically_normal().generic_string();
+		for (char& c : name) {
+			if (c == '/' || c == '\\' || c == ':') {
+				c = '_';
+			}
+		}
+		return CACHE_PATH + "meshes/" + name + ".mcache";
+	}
+
+	bool read(const std::string& modelPath, ModelData& data, const LoaderSettings& settings)
+	{
+		MappedFile file;
+		if (!file.Open(getCachePath(modelPath))) {
+			return false;
+		}
+
+		Reader r{ file.data, file.data + file.size };
+
+		FileHeader header;
+		if (!r.pod(header)
+			|| memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+			|| header.version != VERSION
+			|| header.vertexSize != sizeof(Vertex)
+			|| header.processingFlags != getProcessingFlags(settings))
+		{
+			return false;
+		}
+
+		// Check that sources haven't changed since the cache was written
+		std::vector<Dependency> deps;
+		if (!getDependencies(modelPath, deps) || deps.size() != header.numDependencies) {
+			return false;
+		}
+		for (auto& dep : deps) {
+			Dependency cached;
+			if (!r.str(cached.path) || !r.pod(cached.size) || !r.pod(cached.mtime)) {
+				return false;
+			}
+			if (cached.path != dep.path || cached.size != dep.size || cached.mtime != dep.mtime) {
+				return false;
+			}
+		}
+
+		// Smallest possible mesh record: empty strings and arrays. Bounds the count like Reader::array does,
+		// so that a corrupt header can't make us allocate a huge number of meshes
+		constexpr size_t MIN_MESH_SIZE = 3 * sizeof(uint32_t) + sizeof(MeshData::mat_id) + sizeof(uint8_t)
+			+ sizeof(MeshData::gpuMat) + 4 * sizeof(uint64_t);
+		if (static_cast<size_t>(r.end - r.ptr) / MIN_MESH_SIZE < header.numMeshes) {
+			return false;
+		}
+
+		ModelData result;
+		result.maxExtent = header.maxExtent;
+		result.meshes.resize(header.numMeshes);
+
+		for (auto& mesh : result.meshes) {
+			uint8_t isTransparent;
+			bool good = r.str(mesh.tag)
+				&& r.pod(mesh.mat_id)
+				&& r.pod(isTransparent)
+				&& r.pod(mesh.gpuMat)
+				&& r.str(mesh.diffuseTexPath)
+				&& r.str(mesh.bumpTexPath)
+				&& r.array(mesh.vertices)
+				&& r.array(mesh.indices)
+				&& r.array(mesh.meshlets)
+				&& r.array(mesh.lods);
+			if (!good) {
+				return false;
+			}
+			mesh.isTransparent = isTransparent != 0;
+
+			// Out of range indices would read past the vertex buffer of the mesh on the GPU
+			auto badIndex = [&](uint32_t i) { return i >= mesh.vertices.size(); };
+			auto badRange = [&](uint32_t first, uint32_t count) { return first > mesh.indices.size() || count > mesh.indices.size() - first; };
+			if (std::any_of(mesh.indices.begin(), mesh.indices.end(), badIndex)
+				|| std::any_of(mesh.meshlets.begin(), mesh.meshlets.end(), [&](auto& m) { return badRange(m.firstIndex, m.indexCount); })
+				|| std::any_of(mesh.lods.begin(), mesh.lods.end(), [&](auto& l) { return badRange(l.firstIndex, l.indexCount); }))
+			{
+				return false;
+			}
+
+			// Embedded glTF images are extracted into the cache directory and may be deleted separately
+			for (auto* texPath : { &mesh.diffuseTexPath, &mesh.bumpTexPath }) {
+				if (!texPath->empty() && !fs::exists(*texPath) && texture_container::findCompressed(*texPath).empty()) {
+					return false;
+				}
+			}
+		}
+
+		data = std::move(result);
+		return true;
+	}
+
+	bool write(const std::string& modelPath, const ModelData& data, const LoaderSettings& settings)
+	{
+		std::vector<Dependency> deps;
+		if (!getDependencies(modelPath, deps)) {
+			return false;
+		}
+
+		Writer w;
+
+		FileHeader header = {
+			.version = VERSION,
+			.vertexSize = sizeof(Vertex),
+			.processingFlags = getProcessingFlags(settings),
+			.numDependencies = static_cast<uint32_t>(deps.size()),
+			.numMeshes = static_cast<uint32_t>(data.meshes.size()),
+			.maxExtent = data.maxExtent
+		};
+		memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		w.pod(header);
+
+		for (auto& dep : deps) {
+			w.str(dep.path);
+			w.pod(dep.size);
+			w.pod(dep.mtime);
+		}
+
+		for (auto& mesh : data.meshes) {
+			w.str(mesh.tag);
+			w.pod(mesh.mat_id);
+			w.pod(static_cast<uint8_t>(mesh.isTransparent));
+			w.pod(mesh.gpuMat);
+			w.str(mesh.diffuseTexPath);
+			w.str(mesh.bumpTexPath);
+
+			w.pod(static_cast<uint64_t>(mesh.vertices.size()));
+			w.bytes(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+			w.pod(static_cast<uint64_t>(mesh.indices.size()));
+			w.bytes(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+			w.pod(static_cast<uint64_t>(mesh.meshlets.size()));
+			w.bytes(mesh.meshlets.data(), mesh.meshlets.size() * sizeof(GPUMeshlet));
+			w.pod(static_cast<uint64_t>(mesh.lods.size()));
+			w.bytes(mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+		}
+
+		std::string cachePath = getCachePath(modelPath);
+
+		std::error_code ec;
+		fs::create_directories(fs::path(cachePath).parent_path(), ec);
+
+		// Write to temporary file first so that a crash never leaves half written cache behind
+		std::string tmpPath = cachePath + ".tmp";
+		{
+			std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+			if (!out) {
+				PRWRN("Failed to create mesh cache file: " << tmpPath);
+				return false;
+			}
+			out.write(w.buf.data(), w.buf.size());
+			if (!out) {
+				PRWRN("Failed to write mesh cache file: " << tmpPath);
+				return false;
+			}
+		}
+
+		fs::rename(tmpPath, cachePath, ec);
+		if (ec) {
+			PRWRN("Failed to write mesh cache file: " << cachePath << " (" << ec.message() << ")");
+			fs::remove(tmpPath, ec);
+			return false;
+		}
+
+		return true;
+	}
+
+	void prebuildAll(const std::string& modelsDir, const LoaderSettings& settings)
+	{
+		std::vector<std::string> models;
+		std::error_code ec;
+		for (auto& entry : fs::recursive_directory_iterator(modelsDir, ec)) {
+			if (entry.is_regular_file() && (entry.path().extension() == ".obj" || isGltfModel(entry.path().string()))) {
+				models.push_back(entry.path().generic_string());
+			}
+		}
+		std::sort(models.begin(), models.end());
+
+		if (models.empty()) {
+			PRWRN("No models found in " << modelsDir);
+			return;
+		}
+
+		pr("\nBuilding mesh cache for " << models.size() << " models in " << modelsDir);
+
+		double totalCold = 0., totalWarm = 0.;
+		for (auto& path : models) {
+			ModelData data;
+
+			Timer timer;
+			if (!loadModelData(path, data, settings)) {
+				PRERR("Failed to load model: " << path);
+				continue;
+			}
+			double coldMs = timer.ElapsedMs();
+
+			if (!write(path, data, settings)) {
+				PRERR("Failed to write mesh cache for model: " << path);
+				continue;
+			}
+
+			ModelData cached;
+			timer.Reset();
+			if (!read(path, cached, settings)) {
+				PRERR("Failed to read back mesh cache for model: " << path);
+				continue;
+			}
+			double warmMs = timer.ElapsedMs();
+
+			totalCold += coldMs;
+			totalWarm += warmMs;
+
+			pr("[Mesh cache] " << path << ": cold " << coldMs << " ms, warm " << warmMs << " ms ("
+				<< coldMs / std::max(warmMs, 1e-3) << "x)");
+		}
+
+		pr("[Mesh cache] Total: cold " << totalCold << " ms, warm " << totalWarm << " ms");
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.h"
+
+// CPU side result of loading a model file.
+// Filled either by parsing the source file or from the binary mesh cache,
+// then turned into Model/Mesh objects and uploaded to GPU by the Engine.
+struct MeshData {
+    std::string tag = "";
+    int mat_id = -1;
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    // Ranges of indices, see mesh_optimizer::buildMeshlets
+    std::vector<GPUMeshlet> meshlets;
+    // LOD 0 followed by simplified levels, all ranges of indices
+    std::vector<MeshLod> lods;
+
+    GPUMaterial gpuMat{};
+    bool isTransparent = false;
+
+    // Full paths of textures, empty if mesh has no such texture
+    std::string diffuseTexPath = "";
+    std::string bumpTexPath = "";
+};
+
+struct ModelData {
+    std::vector<MeshData> meshes;
+    float maxExtent{ 0.f };
+};
+
+// Parses .obj (+ .mtl) file into ModelData. Defined in model_loader.cpp
+bool loadObjModelData(const std::string& path, ModelData& data, const LoaderSettings& settings = {});
+
+// Imports .gltf (+ .bin) or .glb file into ModelData. Defined in gltf_loader.cpp
+bool loadGltfModelData(const std::string& path, ModelData& data, const LoaderSettings& settings = {});
+
+// Picks the loader by file extension. Defined in model_loader.cpp
+bool loadModelData(const std::string& path, ModelData& data, const LoaderSettings& settings = {});
+bool isGltfModel(const std::string& path);
+
+// Optimizes, splits into meshlets and builds LODs of freshly loaded meshes. Defined in model_loader.cpp
+void processMeshes(const std::string& path, std::vector<MeshData>& meshes, const LoaderSettings& settings);
+
+// Compares old (by vertex value) and current (by OBJ index triple) vertex deduplication. Defined in model_loader.cpp
+void benchmarkVertexDedup(const std::string& path, const LoaderSettings& settings = {});
+
+// Compares serial and parallel smoothing normal regeneration, checks that results are bit identical. Defined in model_loader.cpp
+void benchmarkSmoothingNormals(const std::string& path, const LoaderSettings& settings = {});
+
+// Versioned binary cache of ModelData.
+// Cache files are stored in CACHE_PATH and are invalidated when path, size or modification time
+// of the model file or any .mtl (OBJ) or .bin (glTF) file next to it changes.
+namespace mesh_cache {
+    // Bump whenever layout of the cache file or of the cached data (Vertex, GPUMaterial...) changes
+    constexpr uint32_t VERSION = 7;
+
+    std::string getCachePath(const std::string& modelPath);
+
+    // Returns false if cache does not exist, is outdated, corrupted
+    // or was built with different mesh processing settings
+    bool read(const std::string& modelPath, ModelData& data, const LoaderSettings& settings = {});
+    bool write(const std::string& modelPath, const ModelData& data, const LoaderSettings& settings = {});
+
+    // Builds cache for every model under the directory and reports cold vs warm load timings
+    void prebuildAll(const std::string& modelsDir, const LoaderSettings& settings = {});
+}
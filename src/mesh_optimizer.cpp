@@ -0,0 +1,828 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "mesh_optimizer.h"
+
+namespace mesh_optimizer {
+	static constexpr uint32_t NOT_IN_CACHE = std::numeric_limits<uint32_t>::max();
+
+	VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount)
+	{
+		VertexCacheStats stats;
+		stats.triangles = indices.size() / 3;
+
+		// Timestamp at which a vertex entered the cache, vertex is cached while (time - timestamp) < CACHE_SIZE
+		std::vector<uint64_t> timestamps(vertexCount, 0);
+		std::vector<bool> used(vertexCount, false);
+		uint64_t time = CACHE_SIZE + 1;
+
+		for (uint32_t index : indices) {
+			if (!used[index]) {
+				used[index] = true;
+				++stats.vertices;
+			}
+			if (time - timestamps[index] > CACHE_SIZE) {
+				timestamps[index] = time++;
+				++stats.transformed;
+			}
+		}
+
+		return stats;
+	}
+
+	// Triangles using each vertex in CSR layout
+	struct TriangleAdjacency {
+		std::vector<uint32_t> counts;
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+
+		TriangleAdjacency(const std::vector<uint32_t>& indices, size_t vertexCount)
+			: counts(vertexCount, 0), offsets(vertexCount + 1, 0), triangles(indices.size())
+		{
+			for (uint32_t index : indices) {
+				++counts[index];
+			}
+			for (size_t v = 0; v < vertexCount; ++v) {
+				offsets[v + 1] = offsets[v] + counts[v];
+			}
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); ++i) {
+				triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	};
+
+	/* Vertex cache optimisation, see https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html */
+
+	static constexpr uint32_t MAX_VALENCE = 32;
+
+	struct ScoreTable {
+		float cache[CACHE_SIZE];
+		float valence[MAX_VALENCE + 1];
+
+		ScoreTable() {
+			const float cacheDecayPower = 1.5f;
+			const float lastTriScore = 0.75f;
+			const float valenceBoostScale = 2.f;
+			const float valenceBoostPower = 0.5f;
+
+			for (uint32_t i = 0; i < CACHE_SIZE; ++i) {
+				if (i < 3) {
+					// Vertices of the last triangle get fixed score so that the next triangle
+					// doesn't simply reuse the same edge which is bad for strip-like caches
+					cache[i] = lastTriScore;
+				} else {
+					float scaler = 1.f - float(i - 3) / float(CACHE_SIZE - 3);
+					cache[i] = std::pow(scaler, cacheDecayPower);
+				}
+			}
+
+			// Boost vertices with few triangles left to get rid of lone triangles early
+			valence[0] = 0.f;
+			for (uint32_t i = 1; i <= MAX_VALENCE; ++i) {
+				valence[i] = valenceBoostScale * std::pow(float(i), -valenceBoostPower);
+			}
+		}
+
+		float score(uint32_t cachePos, uint32_t liveTris) const {
+			if (liveTris == 0) {
+				return -1.f;
+			}
+			float s = cachePos == NOT_IN_CACHE ? 0.f : cache[cachePos];
+			return s + valence[std::min(liveTris, MAX_VALENCE)];
+		}
+	};
+
+	void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+	{
+		static const ScoreTable table;
+
+		size_t triCount = indices.size() / 3;
+		if (triCount == 0) {
+			return;
+		}
+
+		// Triangles adjacent to each vertex, live ones are kept at the front of the vertex's range
+		TriangleAdjacency adj(indices, vertexCount);
+		std::vector<uint32_t>& liveTris = adj.counts;
+		const std::vector<uint32_t>& adjOffset = adj.offsets;
+		std::vector<uint32_t>& adjacency = adj.triangles;
+
+		std::vector<uint32_t> cachePos(vertexCount, NOT_IN_CACHE);
+		std::vector<float> vertexScore(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v) {
+			vertexScore[v] = table.score(NOT_IN_CACHE, liveTris[v]);
+		}
+
+		std::vector<float> triScore(triCount);
+		std::vector<bool> emitted(triCount, false);
+		uint32_t bestTri = 0;
+		for (size_t t = 0; t < triCount; ++t) {
+			triScore[t] = vertexScore[indices[t * 3 + 0]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+			if (triScore[t] > triScore[bestTri]) {
+				bestTri = static_cast<uint32_t>(t);
+			}
+		}
+
+		// LRU cache with room for the 3 vertices pushed by the emitted triangle
+		std::vector<uint32_t> cache, newCache;
+		cache.reserve(CACHE_SIZE + 3);
+		newCache.reserve(CACHE_SIZE + 3);
+
+		std::vector<uint32_t> result(indices.size());
+		size_t deadEndCursor = 0;
+
+		for (size_t out = 0; out < triCount; ++out) {
+			if (bestTri == NOT_IN_CACHE) {
+				// Nothing in cache has live triangles left, continue with the next unemitted triangle in input order
+				while (emitted[deadEndCursor]) {
+					++deadEndCursor;
+				}
+				bestTri = static_cast<uint32_t>(deadEndCursor);
+			}
+
+			const uint32_t* tri = &indices[bestTri * 3];
+			result[out * 3 + 0] = tri[0];
+			result[out * 3 + 1] = tri[1];
+			result[out * 3 + 2] = tri[2];
+			emitted[bestTri] = true;
+
+			newCache.clear();
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = tri[k];
+
+				// Remove the triangle from vertex's live triangles
+				uint32_t* begin = &adjacency[adjOffset[v]];
+				uint32_t* end = begin + liveTris[v];
+				std::iter_swap(std::find(begin, end, bestTri), end - 1);
+				--liveTris[v];
+
+				newCache.push_back(v);
+			}
+			for (uint32_t v : cache) {
+				if (v != tri[0] && v != tri[1] && v != tri[2]) {
+					newCache.push_back(v);
+				}
+			}
+			std::swap(cache, newCache);
+
+			// Update scores of everything in cache, vertices that fell out of it lose their cache score
+			for (size_t i = 0; i < cache.size(); ++i) {
+				uint32_t v = cache[i];
+				cachePos[v] = i < CACHE_SIZE ? static_cast<uint32_t>(i) : NOT_IN_CACHE;
+				vertexScore[v] = table.score(cachePos[v], liveTris[v]);
+			}
+
+			bestTri = NOT_IN_CACHE;
+			float bestScore = -std::numeric_limits<float>::max();
+			for (uint32_t v : cache) {
+				for (uint32_t a = 0; a < liveTris[v]; ++a) {
+					uint32_t t = adjacency[adjOffset[v] + a];
+					const uint32_t* tv = &indices[t * 3];
+					triScore[t] = vertexScore[tv[0]] + vertexScore[tv[1]] + vertexScore[tv[2]];
+					if (triScore[t] > bestScore) {
+						bestScore = triScore[t];
+						bestTri = t;
+					}
+				}
+			}
+
+			if (cache.size() > CACHE_SIZE) {
+				cache.resize(CACHE_SIZE);
+			}
+		}
+
+		indices = std::move(result);
+	}
+
+	/* Overdraw optimisation, based on "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander et al.) */
+
+	// Returns number of cache misses for the triangle, cache is a FIFO of CACHE_SIZE entries
+	static uint32_t simulateTriangle(const uint32_t* tri, std::vector<uint64_t>& timestamps, uint64_t& time)
+	{
+		uint32_t misses = 0;
+		for (int k = 0; k < 3; ++k) {
+			if (time - timestamps[tri[k]] > CACHE_SIZE) {
+				timestamps[tri[k]] = time++;
+				++misses;
+			}
+		}
+		return misses;
+	}
+
+	void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold)
+	{
+		size_t triCount = indices.size() / 3;
+		if (triCount == 0) {
+			return;
+		}
+
+		std::vector<uint64_t> timestamps(vertices.size(), 0);
+		uint64_t time = CACHE_SIZE + 1;
+
+		// Hard boundaries: triangles which miss the cache entirely, splitting there costs nothing
+		std::vector<size_t> hardClusters;
+		for (size_t t = 0; t < triCount; ++t) {
+			if (simulateTriangle(&indices[t * 3], timestamps, time) == 3) {
+				hardClusters.push_back(t);
+			}
+		}
+		if (hardClusters.empty() || hardClusters[0] != 0) {
+			hardClusters.insert(hardClusters.begin(), 0);
+		}
+		hardClusters.push_back(triCount);
+
+		// Soft boundaries: split hard clusters further where the local ACMR is already
+		// within the threshold of the whole cluster's ACMR
+		std::vector<size_t> clusters;
+		for (size_t c = 0; c + 1 < hardClusters.size(); ++c) {
+			size_t start = hardClusters[c], end = hardClusters[c + 1];
+
+			time += CACHE_SIZE + 1;
+			uint32_t clusterMisses = 0;
+			for (size_t t = start; t < end; ++t) {
+				clusterMisses += simulateTriangle(&indices[t * 3], timestamps, time);
+			}
+			float clusterThreshold = threshold * float(clusterMisses) / float(end - start);
+
+			time += CACHE_SIZE + 1;
+			clusters.push_back(start);
+			uint32_t misses = 0;
+			size_t softStart = start;
+			for (size_t t = start; t < end; ++t) {
+				misses += simulateTriangle(&indices[t * 3], timestamps, time);
+				if (t + 1 < end && float(misses) / float(t + 1 - softStart) <= clusterThreshold) {
+					clusters.push_back(t + 1);
+					time += CACHE_SIZE + 1;
+					misses = 0;
+					softStart = t + 1;
+				}
+			}
+		}
+		clusters.push_back(triCount);
+
+		// Sort key is how much the cluster faces away from mesh center.
+		// Outward facing clusters are more likely to occlude the rest of the mesh.
+		glm::dvec3 meshCentroid(0.);
+		for (size_t t = 0; t < triCount * 3; ++t) {
+			meshCentroid += glm::dvec3(vertices[indices[t]].pos);
+		}
+		meshCentroid /= double(triCount * 3);
+
+		size_t clusterCount = clusters.size() - 1;
+		std::vector<float> sortKey(clusterCount);
+		for (size_t c = 0; c < clusterCount; ++c) {
+			glm::vec3 centroid(0.f), normal(0.f);
+			float area = 0.f;
+			for (size_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+				glm::vec3 p0 = vertices[indices[t * 3 + 0]].pos;
+				glm::vec3 p1 = vertices[indices[t * 3 + 1]].pos;
+				glm::vec3 p2 = vertices[indices[t * 3 + 2]].pos;
+
+				glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+				float triArea = glm::length(n);
+
+				centroid += (p0 + p1 + p2) * (triArea / 3.f);
+				normal += n;
+				area += triArea;
+			}
+			centroid = area > 0.f ? centroid / area : centroid;
+			float normalLength = glm::length(normal);
+			normal = normalLength > 0.f ? normal / normalLength : normal;
+
+			sortKey[c] = glm::dot(centroid - glm::vec3(meshCentroid), normal);
+		}
+
+		std::vector<uint32_t> order(clusterCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return sortKey[a] > sortKey[b];
+		});
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		for (uint32_t c : order) {
+			result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+		}
+		indices = std::move(result);
+	}
+
+	// Assigns the same id to vertices with bitwise equal positions, returns number of unique positions
+	static uint32_t weldPositions(const std::vector<Vertex>& vertices, std::vector<uint32_t>& positionIds)
+	{
+		positionIds.resize(vertices.size());
+		if (vertices.empty()) {
+			return 0;
+		}
+
+		std::vector<uint32_t> order(vertices.size());
+		std::iota(order.begin(), order.end(), 0);
+		auto key = [&](uint32_t v) {
+			return std::tie(vertices[v].pos.x, vertices[v].pos.y, vertices[v].pos.z);
+		};
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return key(a) < key(b);
+		});
+
+		uint32_t numPositions = 0;
+		for (size_t i = 0; i < order.size(); ++i) {
+			if (i > 0 && key(order[i]) != key(order[i - 1])) {
+				++numPositions;
+			}
+			positionIds[order[i]] = numPositions;
+		}
+		return numPositions + 1;
+	}
+
+	/* Meshlets */
+
+	// Ritter's bounding sphere, not minimal but within a few percent of it
+	static void computeBoundingSphere(const std::vector<glm::vec3>& points, glm::vec3& center, float& radius)
+	{
+		auto farthestFrom = [&](const glm::vec3& p) {
+			size_t best = 0;
+			for (size_t i = 1; i < points.size(); ++i) {
+				if (glm::distance(points[i], p) > glm::distance(points[best], p)) {
+					best = i;
+				}
+			}
+			return points[best];
+		};
+
+		glm::vec3 a = farthestFrom(points[0]);
+		glm::vec3 b = farthestFrom(a);
+		center = (a + b) * 0.5f;
+		radius = glm::distance(a, b) * 0.5f;
+
+		for (const glm::vec3& p : points) {
+			float d = glm::distance(p, center);
+			if (d > radius) {
+				// Grow the sphere just enough to include the point
+				float newRadius = (radius + d) * 0.5f;
+				center += (p - center) * ((newRadius - radius) / d);
+				radius = newRadius;
+			}
+		}
+	}
+
+	// Fills bounds and normal cone of the meshlet whose triangles are in meshIndices[firstIndex, firstIndex + indexCount)
+	static void computeMeshletBounds(GPUMeshlet& meshlet, const std::vector<uint32_t>& meshIndices,
+		const std::vector<uint32_t>& meshletVertices, const std::vector<Vertex>& vertices)
+	{
+		std::vector<glm::vec3> points;
+		points.reserve(meshletVertices.size());
+		for (uint32_t v : meshletVertices) {
+			points.push_back(vertices[v].pos);
+		}
+		computeBoundingSphere(points, meshlet.center, meshlet.radius);
+
+		std::vector<glm::vec3> normals;
+		normals.reserve(meshlet.indexCount / 3);
+		glm::vec3 axis(0.f);
+		for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i += 3) {
+			glm::vec3 p0 = vertices[meshIndices[i + 0]].pos;
+			glm::vec3 p1 = vertices[meshIndices[i + 1]].pos;
+			glm::vec3 p2 = vertices[meshIndices[i + 2]].pos;
+
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(n);
+			// Degenerate triangles are never visible, they don't restrict the cone
+			if (length > 0.f) {
+				normals.push_back(n / length);
+				axis += n / length;
+			}
+		}
+
+		meshlet.coneAxis = glm::vec3(0.f, 0.f, 1.f);
+		meshlet.coneCutoff = 1.f;
+
+		float axisLength = glm::length(axis);
+		if (axisLength == 0.f) {
+			return;
+		}
+		axis /= axisLength;
+
+		float minDot = 1.f;
+		for (const glm::vec3& n : normals) {
+			minDot = std::min(minDot, glm::dot(n, axis));
+		}
+
+		// Cone wider than ~85 degrees is almost never backfacing as a whole, keep cutoff at 1 so the test always fails
+		meshlet.coneAxis = axis;
+		if (minDot > 0.1f) {
+			meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+		}
+	}
+
+	void buildMeshlets(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, std::vector<GPUMeshlet>& meshlets)
+	{
+		meshlets.clear();
+
+		size_t triCount = indices.size() / 3;
+		if (triCount == 0) {
+			return;
+		}
+
+		// Meshlets are grown over triangles sharing a position rather than a vertex,
+		// otherwise meshes with split normals or uvs (e.g. flat shaded) would have no connectivity at all
+		std::vector<uint32_t> positionIds;
+		uint32_t numPositions = weldPositions(vertices, positionIds);
+
+		std::vector<uint32_t> positionIndices(indices.size());
+		for (size_t i = 0; i < indices.size(); ++i) {
+			positionIndices[i] = positionIds[indices[i]];
+		}
+		TriangleAdjacency adj(positionIndices, numPositions);
+
+		std::vector<glm::vec3> triCentroids(triCount);
+		for (size_t t = 0; t < triCount; ++t) {
+			triCentroids[t] = (vertices[indices[t * 3 + 0]].pos + vertices[indices[t * 3 + 1]].pos + vertices[indices[t * 3 + 2]].pos) / 3.f;
+		}
+
+		std::vector<bool> emitted(triCount, false);
+		// Index of the vertex inside the current meshlet or NOT_IN_CACHE
+		std::vector<uint32_t> localIndex(vertices.size(), NOT_IN_CACHE);
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+
+		std::vector<uint32_t> meshletVertices, candidates;
+		// Index of the meshlet whose candidate list the triangle was last added to
+		std::vector<uint32_t> candidateOf(triCount, NOT_IN_CACHE);
+		glm::vec3 positionSum(0.f);
+
+		auto newVertexCount = [&](uint32_t t) {
+			uint32_t count = 0;
+			for (int k = 0; k < 3; ++k) {
+				count += localIndex[indices[t * 3 + k]] == NOT_IN_CACHE;
+			}
+			return count;
+		};
+
+		auto addTriangle = [&](uint32_t t) {
+			emitted[t] = true;
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = indices[t * 3 + k];
+				result.push_back(v);
+
+				if (localIndex[v] == NOT_IN_CACHE) {
+					localIndex[v] = static_cast<uint32_t>(meshletVertices.size());
+					meshletVertices.push_back(v);
+					positionSum += vertices[v].pos;
+
+					uint32_t p = positionIds[v];
+					for (uint32_t a = adj.offsets[p]; a < adj.offsets[p + 1]; ++a) {
+						uint32_t t = adj.triangles[a];
+						if (!emitted[t] && candidateOf[t] != meshlets.size()) {
+							candidateOf[t] = static_cast<uint32_t>(meshlets.size());
+							candidates.push_back(t);
+						}
+					}
+				}
+			}
+		};
+
+		auto finishMeshlet = [&](uint32_t firstIndex) {
+			GPUMeshlet meshlet{
+				.firstIndex = firstIndex,
+				.indexCount = static_cast<uint32_t>(result.size()) - firstIndex,
+				.vertexCount = static_cast<uint32_t>(meshletVertices.size())
+			};
+
+			computeMeshletBounds(meshlet, result, meshletVertices, vertices);
+			meshlets.push_back(meshlet);
+
+			for (uint32_t v : meshletVertices) {
+				localIndex[v] = NOT_IN_CACHE;
+			}
+			meshletVertices.clear();
+			candidates.clear();
+			positionSum = glm::vec3(0.f);
+		};
+
+		size_t cursor = 0;
+		size_t numEmitted = 0;
+		while (numEmitted < triCount) {
+			while (emitted[cursor]) {
+				++cursor;
+			}
+
+			uint32_t firstIndex = static_cast<uint32_t>(result.size());
+			addTriangle(static_cast<uint32_t>(cursor));
+			uint32_t meshletTriangles = 1;
+
+			while (meshletTriangles < MESHLET_MAX_TRIANGLES) {
+				glm::vec3 centroid = positionSum / float(meshletVertices.size());
+
+				// Prefer connected triangles that add fewest new vertices, then the closest ones.
+				// This order is also good for vertex cache, better than reoptimizing each meshlet afterwards.
+				uint32_t best = NOT_IN_CACHE;
+				uint32_t bestNew = 4;
+				float bestDist = std::numeric_limits<float>::max();
+				for (size_t c = 0; c < candidates.size();) {
+					uint32_t t = candidates[c];
+					if (emitted[t]) {
+						candidates[c] = candidates.back();
+						candidates.pop_back();
+						continue;
+					}
+					++c;
+
+					uint32_t numNew = newVertexCount(t);
+					if (meshletVertices.size() + numNew > MESHLET_MAX_VERTICES || numNew > bestNew) {
+						continue;
+					}
+					glm::vec3 d = triCentroids[t] - centroid;
+					float dist = glm::dot(d, d);
+					if (numNew < bestNew || dist < bestDist) {
+						best = t;
+						bestNew = numNew;
+						bestDist = dist;
+					}
+				}
+
+				if (best == NOT_IN_CACHE && candidates.empty()) {
+					// Meshlet's surface is closed off (or the mesh doesn't share vertices at all),
+					// continue with the closest of the next few unused triangles in input order.
+					// It is only taken if it lies within twice the meshlet's current extent to keep bounds tight.
+					float radius2 = 0.f;
+					for (uint32_t v : meshletVertices) {
+						glm::vec3 d = vertices[v].pos - centroid;
+						radius2 = std::max(radius2, glm::dot(d, d));
+					}
+					radius2 *= 4.f;
+
+					const uint32_t searchWindow = 64;
+					uint32_t searched = 0;
+					for (size_t t = cursor; t < triCount && searched < searchWindow; ++t) {
+						if (emitted[t]) {
+							continue;
+						}
+						++searched;
+
+						if (meshletVertices.size() + newVertexCount(static_cast<uint32_t>(t)) > MESHLET_MAX_VERTICES) {
+							continue;
+						}
+						glm::vec3 d = triCentroids[t] - centroid;
+						float dist = glm::dot(d, d);
+						if (dist <= radius2 && dist < bestDist) {
+							best = static_cast<uint32_t>(t);
+							bestDist = dist;
+						}
+					}
+				}
+
+				if (best == NOT_IN_CACHE) {
+					break;
+				}
+				addTriangle(best);
+				++meshletTriangles;
+			}
+
+			numEmitted += meshletTriangles;
+			finishMeshlet(firstIndex);
+		}
+
+		indices = std::move(result);
+	}
+
+	/* Simplification */
+
+	// Sum of squared distances to a set of planes, stored as the upper triangle of a symmetric 4x4 matrix
+	struct Quadric {
+		double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+		double a11 = 0, a12 = 0, a13 = 0;
+		double a22 = 0, a23 = 0;
+		double a33 = 0;
+
+		static Quadric fromPlane(glm::dvec3 n, double d) {
+			return {
+				n.x * n.x, n.x * n.y, n.x * n.z, n.x * d,
+				n.y * n.y, n.y * n.z, n.y * d,
+				n.z * n.z, n.z * d,
+				d * d
+			};
+		}
+
+		Quadric& operator+=(const Quadric& q) {
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+			a11 += q.a11; a12 += q.a12; a13 += q.a13;
+			a22 += q.a22; a23 += q.a23;
+			a33 += q.a33;
+			return *this;
+		}
+
+		double error(glm::dvec3 p) const {
+			return p.x * (a00 * p.x + 2 * (a01 * p.y + a02 * p.z + a03))
+				+ p.y * (a11 * p.y + 2 * (a12 * p.z + a13))
+				+ p.z * (a22 * p.z + 2 * a23)
+				+ a33;
+		}
+	};
+
+	std::vector<uint32_t> simplify(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+		size_t targetIndexCount, float targetError, float& resultError)
+	{
+		resultError = 0.f;
+
+		std::vector<uint32_t> result = indices;
+		if (result.size() <= targetIndexCount) {
+			return result;
+		}
+
+		std::vector<uint32_t> positionIds;
+		uint32_t numPositions = weldPositions(vertices, positionIds);
+
+		// Vertices sharing position with another vertex lie on an attribute seam,
+		// vertices on open or non-manifold edges lie on a border. Both stay in place.
+		std::vector<bool> locked(vertices.size(), false);
+		{
+			std::vector<uint32_t> verticesAtPosition(numPositions, 0);
+			for (uint32_t p : positionIds) {
+				++verticesAtPosition[p];
+			}
+
+			std::unordered_map<uint64_t, uint32_t> edgeTriangles;
+			edgeTriangles.reserve(result.size());
+			auto edgeKey = [&](uint32_t a, uint32_t b) {
+				uint64_t pa = positionIds[a], pb = positionIds[b];
+				return pa < pb ? (pa << 32 | pb) : (pb << 32 | pa);
+			};
+			for (size_t i = 0; i < result.size(); i += 3) {
+				for (int k = 0; k < 3; ++k) {
+					++edgeTriangles[edgeKey(result[i + k], result[i + (k + 1) % 3])];
+				}
+			}
+
+			std::vector<bool> borderPosition(numPositions, false);
+			for (auto& [key, count] : edgeTriangles) {
+				if (count != 2) {
+					borderPosition[key >> 32] = true;
+					borderPosition[key & 0xFFFFFFFF] = true;
+				}
+			}
+
+			for (size_t v = 0; v < vertices.size(); ++v) {
+				locked[v] = verticesAtPosition[positionIds[v]] > 1 || borderPosition[positionIds[v]];
+			}
+		}
+
+		auto planeOf = [&](const uint32_t* tri, glm::dvec3& n, double& d) {
+			glm::dvec3 p0 = vertices[tri[0]].pos, p1 = vertices[tri[1]].pos, p2 = vertices[tri[2]].pos;
+			n = glm::cross(p1 - p0, p2 - p0);
+			double length = glm::length(n);
+			if (length == 0.) {
+				return false;
+			}
+			n /= length;
+			d = -glm::dot(n, p0);
+			return true;
+		};
+
+		// Unweighted plane quadrics, so the square root of the error bounds the distance from every original plane
+		std::vector<Quadric> quadrics(vertices.size());
+		for (size_t i = 0; i < result.size(); i += 3) {
+			glm::dvec3 n;
+			double d;
+			if (planeOf(&result[i], n, d)) {
+				Quadric q = Quadric::fromPlane(n, d);
+				for (int k = 0; k < 3; ++k) {
+					quadrics[result[i + k]] += q;
+				}
+			}
+		}
+
+		const double maxError = double(targetError) * targetError;
+		double maxCollapseError = 0.;
+
+		struct Collapse {
+			double error;
+			uint32_t from, to;
+		};
+		std::vector<Collapse> collapses;
+		std::vector<uint32_t> remap(vertices.size());
+		std::vector<bool> touched(vertices.size());
+
+		// Collapse the cheapest edges in passes, the mesh is rebuilt after each pass
+		while (result.size() > targetIndexCount) {
+			TriangleAdjacency adj(result, vertices.size());
+
+			// Cheapest collapse of every unlocked vertex into one of its neighbours
+			collapses.clear();
+			for (size_t v = 0; v < vertices.size(); ++v) {
+				if (locked[v] || adj.counts[v] == 0) {
+					continue;
+				}
+
+				Collapse best{ std::numeric_limits<double>::max(), static_cast<uint32_t>(v), 0 };
+				for (uint32_t a = adj.offsets[v]; a < adj.offsets[v] + adj.counts[v]; ++a) {
+					const uint32_t* tri = &result[adj.triangles[a] * 3];
+					for (int k = 0; k < 3; ++k) {
+						uint32_t to = tri[k];
+						if (to == v) {
+							continue;
+						}
+						Quadric q = quadrics[v];
+						q += quadrics[to];
+						double error = q.error(vertices[to].pos);
+						if (error < best.error) {
+							best = { error, static_cast<uint32_t>(v), to };
+						}
+					}
+				}
+				if (best.error <= maxError) {
+					collapses.push_back(best);
+				}
+			}
+
+			if (collapses.empty()) {
+				break;
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+				return a.error < b.error;
+			});
+
+			std::iota(remap.begin(), remap.end(), 0);
+			std::fill(touched.begin(), touched.end(), false);
+
+			size_t indexCount = result.size();
+			size_t numCollapsed = 0;
+			for (const Collapse& c : collapses) {
+				if (indexCount <= targetIndexCount) {
+					break;
+				}
+				if (touched[c.from] || touched[c.to]) {
+					continue;
+				}
+
+				// Reject collapses that flip a triangle, count triangles that would become degenerate
+				bool flips = false;
+				size_t removed = 0;
+				for (uint32_t a = adj.offsets[c.from]; a < adj.offsets[c.from] + adj.counts[c.from] && !flips; ++a) {
+					const uint32_t* tri = &result[adj.triangles[a] * 3];
+					if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+						++removed;
+						continue;
+					}
+
+					uint32_t moved[3];
+					for (int k = 0; k < 3; ++k) {
+						moved[k] = tri[k] == c.from ? c.to : tri[k];
+					}
+					glm::dvec3 n0, n1;
+					double d;
+					flips = !planeOf(tri, n0, d) || !planeOf(moved, n1, d) || glm::dot(n0, n1) < 0.25;
+				}
+				if (flips) {
+					continue;
+				}
+
+				// Neighbourhood of the collapsed vertex changes, don't touch it again this pass
+				for (uint32_t a = adj.offsets[c.from]; a < adj.offsets[c.from] + adj.counts[c.from]; ++a) {
+					const uint32_t* tri = &result[adj.triangles[a] * 3];
+					touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+				}
+
+				remap[c.from] = c.to;
+				quadrics[c.to] += quadrics[c.from];
+				maxCollapseError = std::max(maxCollapseError, c.error);
+				indexCount -= removed * 3;
+				++numCollapsed;
+			}
+
+			if (numCollapsed == 0) {
+				break;
+			}
+
+			size_t out = 0;
+			for (size_t i = 0; i < result.size(); i += 3) {
+				uint32_t a = remap[result[i + 0]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+				if (a != b && b != c && c != a) {
+					result[out++] = a;
+					result[out++] = b;
+					result[out++] = c;
+				}
+			}
+			result.resize(out);
+		}
+
+		resultError = static_cast<float>(std::sqrt(maxCollapseError));
+		return result;
+	}
+
+	void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		std::vector<uint32_t> remap(vertices.size(), NOT_IN_CACHE);
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+
+		for (uint32_t& index : indices) {
+			if (remap[index] == NOT_IN_CACHE) {
+				remap[index] = static_cast<uint32_t>(result.size());
+				result.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+
+		vertices = std::move(result);
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "types.h"
+
+// Index/vertex buffer reordering for better GPU vertex cache and vertex fetch efficiency.
+// All functions operate on triangle lists and keep the set of triangles (and their winding) unchanged.
+namespace mesh_optimizer {
+    // Size of the simulated post-transform vertex cache
+    constexpr uint32_t CACHE_SIZE = 32;
+
+    struct VertexCacheStats {
+        uint64_t triangles = 0;
+        uint64_t vertices = 0;    // Unique vertices referenced by the indices
+        uint64_t transformed = 0; // Vertex shader invocations (cache misses)
+
+        // Average cache miss ratio: transformed vertices per triangle, 0.5 is ideal, 3 is worst
+        float acmr() const { return triangles ? float(transformed) / triangles : 0.f; }
+        // Average transform to vertex ratio: transformed vertices per unique vertex, 1 is ideal
+        float atvr() const { return vertices ? float(transformed) / vertices : 0.f; }
+
+        VertexCacheStats& operator+=(const VertexCacheStats& o) {
+            triangles += o.triangles;
+            vertices += o.vertices;
+            transformed += o.transformed;
+            return *this;
+        }
+    };
+
+    // Simulates a FIFO cache of CACHE_SIZE entries
+    VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount);
+
+    // Reorders triangles for post-transform cache reuse (Forsyth's linear-speed vertex cache optimisation)
+    void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+    // Reorders clusters of cache optimized triangles so that outward facing ones come first, reducing overdraw.
+    // Clusters are only split where the ACMR stays within threshold of the cache optimized order.
+    // Must run after optimizeVertexCache.
+    void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f);
+
+    // Splits the mesh into spatially coherent clusters of at most MESHLET_MAX_VERTICES vertices and
+    // MESHLET_MAX_TRIANGLES triangles. Indices are reordered so that every meshlet is a contiguous range.
+    // Clusters are grown greedily over shared vertices starting from the first unused triangle in input order,
+    // so running optimizeVertexCache/optimizeOverdraw first keeps their ordering mostly intact.
+    void buildMeshlets(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, std::vector<GPUMeshlet>& meshlets);
+
+    // Quadric error metric edge collapse simplification, returns indices of the simplified mesh over the same vertices.
+    // Stops at targetIndexCount or when the next collapse would move the surface more than targetError.
+    // Vertices on attribute seams and borders are never moved. resultError is an upper bound on
+    // the distance between simplified and original surface, in vertex position units.
+    std::vector<uint32_t> simplify(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+        size_t targetIndexCount, float targetError, float& resultError);
+
+    // Reorders vertices in order of first use by the index buffer and remaps the indices.
+    // Vertices not referenced by any index are dropped.
+    void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+}
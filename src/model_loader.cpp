@@ -1,6 +1,20 @@
 #include "stdafx.h"
 #include "defs.h"
 #include "engine.h"
+#include "mesh_cache.h"
+#include "timer.h"
+#include "obj_parser.h"
+#include "mesh_optimizer.h"
+#include "parallel.h"
+#include "texture_container.h"
+
+#include <glm/gtx/component_wise.hpp>
+
+// SSE is part of every x86-64 target, other targets use the scalar loops
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define SMOOTHING_NORMALS_SSE
+#endif
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tinyobj/tiny_obj_loader.h"
@@ -295,52 +309,276 @@ static void computeSmoothingShapes(tinyobj::attrib_t& inattrib,
 }
 
 
-bool Engine::loadModelFromObj(const std::string assignedName, const std::string path)
+// Parallel equivalent of computeSmoothingShapes followed by computeAllSmoothingNormals.
+// Output matches them exactly: same shapes, vertex order and bit identical normals for any number of threads.
+// Every vertex sums its faces' normals in face order, which is what the serial version does, so no
+// per thread partial sums (whose reduction order would depend on the thread count) are needed.
+// Face normals and the sums use SSE where available. Lanes do the same multiplications, subtractions and
+// additions as the scalar code (no FMA), so the results stay bit identical.
+// Unlike the serial version, texcoords stay aligned with vertices when only some faces have texcoords.
+static void regenerateSmoothingNormals(const tinyobj::attrib_t& inattrib, const std::vector<tinyobj::shape_t>& inshapes,
+	std::vector<tinyobj::shape_t>& outshapes, tinyobj::attrib_t& outattrib, uint32_t numThreads)
 {
-	// Partially based on https://github.com/tinyobjloader/tinyobjloader/blob/release/examples/viewer/viewer.cc
-	/* The MIT License (MIT)
-	Copyright (c) 2012-2019 Syoyo Fujita and many contributors.
+	const bool hasTexcoords = !inattrib.texcoords.empty();
+
+	// Split every input shape into one shape per smoothing group, with vertex indices local to the input shape
+	struct ShapeSplit {
+		std::vector<tinyobj::shape_t> shapes;
+		// Source (vertex, texcoord) index of every new vertex
+		std::vector<std::pair<int, int>> sources;
+		uint32_t baseVertex = 0;
+	};
+	std::vector<ShapeSplit> splits(inshapes.size());
 
-	Permission is hereby granted, free of charge, to any person obtaining a copy
-	of this software and associated documentation files (the "Software"), to deal
-	in the Software without restriction, including without limitation the rights
-	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
-	copies of the Software, and to permit persons to whom the Software is
-	furnished to do so, subject to the following conditions:
+	parallelFor(inshapes.size(), numThreads, [&](size_t s) {
+		const tinyobj::shape_t& inshape = inshapes[s];
+		ShapeSplit& split = splits[s];
+		bool hasMaterials = !inshape.mesh.material_ids.empty();
 
-	The above copyright notice and this permission notice shall be included in
-	all copies or substantial portions of the Software.
+		// Shapes without faces (e.g. only lines) produce no output shapes
+		unsigned int numFaces = static_cast<unsigned int>(inshape.mesh.smoothing_group_ids.size());
+		if (numFaces == 0) {
+			return;
+		}
+		std::vector<std::pair<unsigned int, unsigned int>> sortedIds(numFaces);
+		for (unsigned int i = 0; i < numFaces; ++i) {
+			sortedIds[i] = std::make_pair(inshape.mesh.smoothing_group_ids[i], i);
+		}
+		std::sort(sortedIds.begin(), sortedIds.end());
 
-	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
-	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
-	THE SOFTWARE.
-	*/
+		// (vertex index, corner) pairs of the group, sorted to find first use of every vertex without a hash map
+		std::vector<std::pair<int, unsigned int>> cornerKeys;
+		std::vector<unsigned int> firstCorner;
+		std::vector<unsigned int> cornerVertex;
 
-	Model& newModel = _models[assignedName];
-	newModel.tag = assignedName;
+		for (unsigned int begin = 0, end = 0; begin < numFaces; begin = end) {
+			unsigned int groupId = sortedIds[begin].first;
+			while (end < numFaces && sortedIds[end].first == groupId) {
+				++end;
+			}
+			unsigned int numCorners = (end - begin) * 3;
+
+			split.shapes.emplace_back();
+			tinyobj::shape_t& outshape = split.shapes.back();
+			outshape.name = inshape.name;
+			outshape.mesh.num_face_vertices.assign(end - begin, 3);
+			outshape.mesh.smoothing_group_ids.assign(end - begin, groupId);
+			outshape.mesh.indices.resize(numCorners);
+			if (hasMaterials) {
+				outshape.mesh.material_ids.resize(end - begin);
+				for (unsigned int id = begin; id < end; ++id) {
+					outshape.mesh.material_ids[id - begin] = inshape.mesh.material_ids[sortedIds[id].second];
+				}
+			}
 
-	tinyobj::attrib_t inattrib;
-	std::vector<tinyobj::shape_t> inshapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn, err;
+			auto inIndex = [&](unsigned int corner) -> const tinyobj::index_t& {
+				return inshape.mesh.indices[3 * sortedIds[begin + corner / 3].second + corner % 3];
+			};
 
-	// Model bounds later used to scale model to [-1, 1] scale
-	float bmin[3], bmax[3];
-	bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<float>::max();
-	bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<float>::max();
+			// Smooth group 0 disables smoothing so no shared vertices in that case
+			firstCorner.resize(numCorners);
+			if (groupId) {
+				cornerKeys.resize(numCorners);
+				for (unsigned int c = 0; c < numCorners; ++c) {
+					cornerKeys[c] = { inIndex(c).vertex_index, c };
+				}
+				std::sort(cornerKeys.begin(), cornerKeys.end());
+				for (unsigned int k = 0; k < numCorners; ++k) {
+					bool runStart = k == 0 || cornerKeys[k].first != cornerKeys[k - 1].first;
+					firstCorner[cornerKeys[k].second] = runStart ? cornerKeys[k].second : firstCorner[cornerKeys[k - 1].second];
+				}
+			} else {
+				std::iota(firstCorner.begin(), firstCorner.end(), 0);
+			}
 
-	std::string baseDir = GetBaseDir(path);
-	if (baseDir.empty()) {
-		baseDir = ".";
+			cornerVertex.resize(numCorners);
+			for (unsigned int c = 0; c < numCorners; ++c) {
+				const tinyobj::index_t& inidx = inIndex(c);
+				ASSERT(inidx.vertex_index != -1);
+
+				if (firstCorner[c] == c) {
+					cornerVertex[c] = static_cast<unsigned int>(split.sources.size());
+					split.sources.emplace_back(inidx.vertex_index, inidx.texcoord_index);
+				} else {
+					cornerVertex[c] = cornerVertex[firstCorner[c]];
+				}
+
+				tinyobj::index_t& outidx = outshape.mesh.indices[c];
+				outidx.vertex_index = outidx.normal_index = static_cast<int>(cornerVertex[c]);
+				outidx.texcoord_index = (inidx.texcoord_index == -1) ? -1 : static_cast<int>(cornerVertex[c]);
+			}
+		}
+	});
+
+	uint32_t numVertices = 0;
+	size_t numShapes = 0;
+	for (auto& split : splits) {
+		split.baseVertex = numVertices;
+		numVertices += static_cast<uint32_t>(split.sources.size());
+		numShapes += split.shapes.size();
 	}
-	baseDir += "/";
 
-	pr("\nLoading model at: " << path);
-	bool good = tinyobj::LoadObj(&inattrib, &inshapes, &materials, &warn, &err, path.c_str(), baseDir.c_str());
+	outattrib.vertices.resize(size_t(numVertices) * 3);
+	outattrib.normals.assign(size_t(numVertices) * 3, 0.f);
+	outattrib.texcoords.assign(hasTexcoords ? size_t(numVertices) * 2 : 0, 0.f);
+
+	// Copy vertex attributes and offset indices by the shape's first vertex
+	parallelFor(splits.size(), numThreads, [&](size_t s) {
+		ShapeSplit& split = splits[s];
+		for (size_t i = 0; i < split.sources.size(); ++i) {
+			size_t dst = split.baseVertex + i;
+			auto [vi, ti] = split.sources[i];
+			outattrib.vertices[3 * dst + 0] = inattrib.vertices[3 * vi + 0];
+			outattrib.vertices[3 * dst + 1] = inattrib.vertices[3 * vi + 1];
+			outattrib.vertices[3 * dst + 2] = inattrib.vertices[3 * vi + 2];
+			if (ti != -1) {
+				outattrib.texcoords[2 * dst + 0] = inattrib.texcoords[2 * ti + 0];
+				outattrib.texcoords[2 * dst + 1] = inattrib.texcoords[2 * ti + 1];
+			}
+		}
+		for (auto& shape : split.shapes) {
+			for (auto& idx : shape.mesh.indices) {
+				idx.vertex_index += split.baseVertex;
+				idx.normal_index += split.baseVertex;
+				if (idx.texcoord_index != -1) {
+					idx.texcoord_index += split.baseVertex;
+				}
+			}
+		}
+	});
+
+	outshapes.clear();
+	outshapes.reserve(numShapes);
+	for (auto& split : splits) {
+		std::move(split.shapes.begin(), split.shapes.end(), std::back_inserter(outshapes));
+	}
+
+	// Unnormalized face normals of all shapes, in order
+	std::vector<size_t> shapeFirstFace(outshapes.size() + 1, 0);
+	for (size_t s = 0; s < outshapes.size(); ++s) {
+		shapeFirstFace[s + 1] = shapeFirstFace[s] + outshapes[s].mesh.num_face_vertices.size();
+	}
+	size_t numFaces = shapeFirstFace.back();
+
+	// One float of padding, the sums load normals as 4 floats
+	std::vector<float> faceNormals(numFaces * 3 + 1);
+	const float* pos = outattrib.vertices.data();
+	parallelFor(outshapes.size(), numThreads, [&](size_t s) {
+		const tinyobj::index_t* idx = outshapes[s].mesh.indices.data();
+		float* n = faceNormals.data() + shapeFirstFace[s] * 3;
+		size_t count = outshapes[s].mesh.num_face_vertices.size();
+
+		size_t f = 0;
+#ifdef SMOOTHING_NORMALS_SSE
+		// Four faces at a time, corner positions transposed so that every lane holds one face
+		for (; f + 4 <= count; f += 4) {
+			alignas(16) float p[3][3][4]; // [corner][axis][face]
+			for (size_t k = 0; k < 4; ++k) {
+				for (size_t c = 0; c < 3; ++c) {
+					const float* v = pos + 3 * idx[3 * (f + k) + c].vertex_index;
+					p[c][0][k] = v[0];
+					p[c][1][k] = v[1];
+					p[c][2][k] = v[2];
+				}
+			}
+
+			__m128 e1[3], e2[3];
+			for (size_t a = 0; a < 3; ++a) {
+				__m128 p0 = _mm_load_ps(p[0][a]);
+				e1[a] = _mm_sub_ps(_mm_load_ps(p[1][a]), p0);
+				e2[a] = _mm_sub_ps(_mm_load_ps(p[2][a]), p0);
+			}
+
+			alignas(16) float fn[3][4];
+			_mm_store_ps(fn[0], _mm_sub_ps(_mm_mul_ps(e1[1], e2[2]), _mm_mul_ps(e1[2], e2[1])));
+			_mm_store_ps(fn[1], _mm_sub_ps(_mm_mul_ps(e1[2], e2[0]), _mm_mul_ps(e1[0], e2[2])));
+			_mm_store_ps(fn[2], _mm_sub_ps(_mm_mul_ps(e1[0], e2[1]), _mm_mul_ps(e1[1], e2[0])));
+			for (size_t k = 0; k < 4; ++k) {
+				n[3 * (f + k) + 0] = fn[0][k];
+				n[3 * (f + k) + 1] = fn[1][k];
+				n[3 * (f + k) + 2] = fn[2][k];
+			}
+		}
+#endif
+		// Same expression as computeAllSmoothingNormals so the results are bit identical
+		for (; f < count; ++f) {
+			const float* p0 = pos + 3 * idx[3 * f + 0].vertex_index;
+			const float* p1 = pos + 3 * idx[3 * f + 1].vertex_index;
+			const float* p2 = pos + 3 * idx[3 * f + 2].vertex_index;
+
+			n[3 * f + 0] = (p1[1] - p0[1]) * (p2[2] - p0[2]) - (p1[2] - p0[2]) * (p2[1] - p0[1]);
+			n[3 * f + 1] = (p1[2] - p0[2]) * (p2[0] - p0[0]) - (p1[0] - p0[0]) * (p2[2] - p0[2]);
+			n[3 * f + 2] = (p1[0] - p0[0]) * (p2[1] - p0[1]) - (p1[1] - p0[1]) * (p2[0] - p0[0]);
+		}
+	});
+
+	// Faces using each vertex, in face order
+	std::vector<uint32_t> vertexFaceOffsets(size_t(numVertices) + 1, 0);
+	for (auto& shape : outshapes) {
+		for (auto& idx : shape.mesh.indices) {
+			++vertexFaceOffsets[idx.normal_index + 1];
+		}
+	}
+	for (size_t v = 0; v < numVertices; ++v) {
+		vertexFaceOffsets[v + 1] += vertexFaceOffsets[v];
+	}
+	std::vector<uint32_t> vertexFaces(vertexFaceOffsets.back());
+	{
+		std::vector<uint32_t> fill(vertexFaceOffsets.begin(), vertexFaceOffsets.end() - 1);
+		for (size_t s = 0; s < outshapes.size(); ++s) {
+			auto& indices = outshapes[s].mesh.indices;
+			for (size_t c = 0; c < indices.size(); ++c) {
+				vertexFaces[fill[indices[c].normal_index]++] = static_cast<uint32_t>(shapeFirstFace[s] + c / 3);
+			}
+		}
+	}
+
+	// Sum and normalize in fixed size blocks of vertices
+	constexpr size_t VERTEX_BLOCK = 4096;
+	parallelFor((size_t(numVertices) + VERTEX_BLOCK - 1) / VERTEX_BLOCK, numThreads, [&](size_t block) {
+		size_t end = std::min<size_t>((block + 1) * VERTEX_BLOCK, numVertices);
+		for (size_t v = block * VERTEX_BLOCK; v < end; ++v) {
+			float nx = 0.f, ny = 0.f, nz = 0.f;
+#ifdef SMOOTHING_NORMALS_SSE
+			// x, y, z summed in one register, the fourth lane is ignored
+			__m128 sum = _mm_setzero_ps();
+			for (uint32_t i = vertexFaceOffsets[v]; i < vertexFaceOffsets[v + 1]; ++i) {
+				sum = _mm_add_ps(sum, _mm_loadu_ps(&faceNormals[size_t(vertexFaces[i]) * 3]));
+			}
+			alignas(16) float n[4];
+			_mm_store_ps(n, sum);
+			nx = n[0];
+			ny = n[1];
+			nz = n[2];
+#else
+			for (uint32_t i = vertexFaceOffsets[v]; i < vertexFaceOffsets[v + 1]; ++i) {
+				const float* n = &faceNormals[size_t(vertexFaces[i]) * 3];
+				nx += n[0];
+				ny += n[1];
+				nz += n[2];
+			}
+#endif
+			float len = sqrtf(nx * nx + ny * ny + nz * nz);
+			float scale = len == 0 ? 0 : 1 / len;
+			outattrib.normals[3 * v + 0] = nx * scale;
+			outattrib.normals[3 * v + 1] = ny * scale;
+			outattrib.normals[3 * v + 2] = nz * scale;
+		}
+	});
+}
+
+// Parses the file with the selected parser
+static bool parseObjFile(const std::string& path, const std::string& baseDir, const LoaderSettings& settings,
+	tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes, std::vector<tinyobj::material_t>& materials)
+{
+	std::string warn, err;
+
+	bool good = false;
+	if (settings.objParser == LoaderSettings::ObjParser::Multithreaded) {
+		good = obj_parser::loadObj(&attrib, &shapes, &materials, &warn, &err, path, baseDir, settings.numThreads);
+	} else {
+		good = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.c_str(), baseDir.c_str());
+	}
 
 	if (!warn.empty()) {
 		pr("\ttinyobj: WARN: " << warn);
@@ -353,115 +591,174 @@ bool Engine::loadModelFromObj(const std::string assignedName, const std::string
 		return false;
 	}
 
+	return true;
+}
+
+// Parses the file with the selected parser and regenerates normals if the file has none
+static bool parseObj(const std::string& path, const std::string& baseDir, const LoaderSettings& settings,
+	tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes, std::vector<tinyobj::material_t>& materials)
+{
+	tinyobj::attrib_t inattrib;
+	std::vector<tinyobj::shape_t> inshapes;
+
+	if (!parseObjFile(path, baseDir, settings, inattrib, inshapes, materials)) {
+		return false;
+	}
+
 	bool regen_all_normals = inattrib.normals.size() == 0;
-	tinyobj::attrib_t outattrib;
-	std::vector<tinyobj::shape_t> outshapes;
 	if (regen_all_normals) {
-		computeSmoothingShapes(inattrib, inshapes, outshapes, outattrib);
-		computeAllSmoothingNormals(outattrib, outshapes);
+		regenerateSmoothingNormals(inattrib, inshapes, shapes, attrib, settings.numThreads);
+	} else {
+		attrib = std::move(inattrib);
+		shapes = std::move(inshapes);
 	}
 
-	std::vector<tinyobj::shape_t>& shapes = regen_all_normals ? outshapes : inshapes;
-	tinyobj::attrib_t& attrib = regen_all_normals ? outattrib : inattrib;
+	return true;
+}
 
+// Open addressing hash map from OBJ (vertex, normal, texcoord) index triple to index of a unique mesh vertex.
+// Linear probing over a flat power of two sized array. Capacity is reserved upfront, the table never grows.
+class IndexTripleMap {
+public:
+	explicit IndexTripleMap(size_t maxElements) {
+		size_t capacity = 16;
+		// Keep load factor under 0.5
+		while (capacity < 2 * maxElements) {
+			capacity <<= 1;
+		}
+		_slots.resize(capacity, Slot{ 0, 0, 0, EMPTY });
+		_mask = capacity - 1;
+	}
 
-	std::unordered_map<Mesh*, std::unordered_map<Vertex, uint32_t>> meshVertexMap;
+	// Returns index stored for the key and whether the value was inserted
+	std::pair<uint32_t, bool> insert(const tinyobj::index_t& key, uint32_t value) {
+		size_t i = hash(key) & _mask;
+		while (true) {
+			Slot& slot = _slots[i];
+			if (slot.value == EMPTY) {
+				slot = { key.vertex_index, key.normal_index, key.texcoord_index, value };
+				return { value, true };
+			}
+			if (slot.v == key.vertex_index && slot.n == key.normal_index && slot.t == key.texcoord_index) {
+				return { slot.value, false };
+			}
+			i = (i + 1) & _mask;
+		}
+	}
 
-	// Loop over shapes
-	for (size_t s = 0; s < shapes.size(); s++) { // Shapes
-		// pr("\tLoading shape[" << s << "]: " << shapes[s].name);
+private:
+	static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
 
-		size_t faces_in_shape = shapes[s].mesh.num_face_vertices.size();
+	struct Slot {
+		int v, n, t;
+		uint32_t value;
+	};
 
-		int prev_mat_id = -1;
-		int mat_id = -1;
+	static size_t hash(const tinyobj::index_t& key) {
+		uint64_t h = static_cast<uint32_t>(key.vertex_index);
+		h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(key.normal_index);
+		h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(key.texcoord_index);
+		h *= 0x9E3779B97F4A7C15ull;
+		return static_cast<size_t>(h ^ (h >> 32));
+	}
 
-		Mesh* currentMesh = nullptr;
+	std::vector<Slot> _slots;
+	size_t _mask;
+};
 
+// Splits faces of all shapes into one mesh per material and deduplicates vertices.
+// Vertices are identical exactly when they have the same (vertex, normal, texcoord) index triple.
+static void buildMeshes(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes,
+	const std::vector<tinyobj::material_t>& materials, ModelData& data, float bmin[3], float bmax[3])
+{
+	// Indexed by mat_id + 1 so that -1 (no material) fits too
+	std::vector<int> materialMesh(materials.size() + 1, -1);
+	std::vector<size_t> materialCorners(materials.size() + 1, 0);
+
+	// Count corners per material to reserve all memory upfront
+	for (auto& shape : shapes) {
+		for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
+			materialCorners[shape.mesh.material_ids[f] + 1] += shape.mesh.num_face_vertices[f];
+		}
+	}
+
+	// Unique vertices of each mesh, same order as data.meshes
+	std::vector<IndexTripleMap> meshVertexMaps;
+
+	// Loop over shapes
+	for (size_t s = 0; s < shapes.size(); s++) { // Shapes
+		size_t faces_in_shape = shapes[s].mesh.num_face_vertices.size();
 		ASSERT(faces_in_shape > 0);
 
+		int prev_mat_id = std::numeric_limits<int>::min();
+		MeshData* mesh = nullptr;
+		IndexTripleMap* uniqVert = nullptr;
+
 		// Loop over faces(polygon)
 		size_t index_offset = 0;
 		for (size_t f = 0; f < faces_in_shape; f++) { // Faces
 			size_t vertices_in_face = shapes[s].mesh.num_face_vertices[f];
 			ASSERT(vertices_in_face == 3); // triangles
 
-			mat_id = shapes[s].mesh.material_ids[f];
+			int mat_id = shapes[s].mesh.material_ids[f];
 
-			// If this face has different material, 
-			// check if a mesh with such material was already created
+			// If this face has different material, find or create mesh with such material
 			if (mat_id != prev_mat_id) {
-				bool mesh_already_created = false; //std::find(mesh_mat_ids.begin(), mesh_mat_ids.end(), mat_id) != mesh_mat_ids.end();
-				for (auto& [mesh, uniqV] : meshVertexMap) {
-					if (mesh->mat_id == mat_id) {
-						// Mesh with such material found!
-						currentMesh = mesh;
-						mesh_already_created = true;
-					}
-				}
-
-				if (!mesh_already_created) {
-					std::string meshName = "MESH_MAT: " + materials[mat_id].name; // + "_::" + std::to_string(shape_submesh);
-					ASSERT(getMesh(meshName) == nullptr); // Mesh must not exist yet
+				int& meshIndex = materialMesh[mat_id + 1];
+				if (meshIndex < 0) {
+					meshIndex = static_cast<int>(data.meshes.size());
 
-					// Create new mesh
-					
-					currentMesh = &_meshes[meshName];
-					currentMesh->tag = meshName;
-					currentMesh->mat_id = mat_id;
+					MeshData& newMesh = data.meshes.emplace_back();
+					newMesh.tag = "MESH_MAT: " + materials[mat_id].name;
+					newMesh.mat_id = mat_id;
+					newMesh.vertices.reserve(materialCorners[mat_id + 1] / 4);
+					newMesh.indices.reserve(materialCorners[mat_id + 1]);
 
-					// Add new mesh and create uniqueVertices map for it
-					meshVertexMap[currentMesh] = {};
+					meshVertexMaps.emplace_back(materialCorners[mat_id + 1]);
 				}
 
+				mesh = &data.meshes[meshIndex];
+				uniqVert = &meshVertexMaps[meshIndex];
 				prev_mat_id = mat_id;
 			}
 
-			auto& uniqVert = meshVertexMap[currentMesh];
-
 			// Loop over vertices in the face.
 			for (size_t v = 0; v < vertices_in_face; v++) { // Vertices
-
 				// access to vertex
-				tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+				const tinyobj::index_t& idx = shapes[s].mesh.indices[index_offset + v];
 
 				//vertex position
 				tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
 				tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
 				tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
 
-				//vertex normal
-				tinyobj::real_t nx{ 0 }, ny{ 0 }, nz{ 0 };
-				if (idx.normal_index >= 0) {
-					nx = attrib.normals[3 * idx.normal_index + 0];
-					ny = attrib.normals[3 * idx.normal_index + 1];
-					nz = attrib.normals[3 * idx.normal_index + 2];
-				}
-				//vertex uv
-				tinyobj::real_t ux{ 0 }, uy{ 0 };
-				if (idx.texcoord_index >= 0) {
-					ux = attrib.texcoords[2 * idx.texcoord_index + 0];
-					uy = attrib.texcoords[2 * idx.texcoord_index + 1];
-				}
-
-				//copy it into our vertex
-				Vertex new_vert{
-					.pos = {vx, vy, vz},
-					.normal = {nx, ny, nz},
-					//we are setting the vertex color as the vertex normal. This is just for display purposess
-					.color = {nx, ny, nz},
-					.uv = {ux, 1 - uy}
-				};
-
-				ASSERT(currentMesh != nullptr);
+				auto [vertIndex, inserted] = uniqVert->insert(idx, static_cast<uint32_t>(mesh->vertices.size()));
 				// Add vertex only if it wasn't already added
-				if (uniqVert.count(new_vert) == 0) {
-					uniqVert[new_vert] = static_cast<uint32_t>(currentMesh->vertices.size());
-					currentMesh->vertices.push_back(new_vert);
+				if (inserted) {
+					//vertex normal
+					tinyobj::real_t nx{ 0 }, ny{ 0 }, nz{ 0 };
+					if (idx.normal_index >= 0) {
+						nx = attrib.normals[3 * idx.normal_index + 0];
+						ny = attrib.normals[3 * idx.normal_index + 1];
+						nz = attrib.normals[3 * idx.normal_index + 2];
+					}
+					//vertex uv
+					tinyobj::real_t ux{ 0 }, uy{ 0 };
+					if (idx.texcoord_index >= 0) {
+						ux = attrib.texcoords[2 * idx.texcoord_index + 0];
+						uy = attrib.texcoords[2 * idx.texcoord_index + 1];
+					}
+
+					mesh->vertices.push_back({
+						.pos = {vx, vy, vz},
+						.normal = {nx, ny, nz},
+						//we are setting the vertex color as the vertex normal. This is just for display purposess
+						.color = {nx, ny, nz},
+						.uv = {ux, 1 - uy}
+					});
 				}
 				// Add vertex index
-				currentMesh->indices.push_back(uniqVert[new_vert]);
-				//currentMesh->vertices.push_back(new_vert);
+				mesh->indices.push_back(vertIndex);
 
 				// Update model bounds
 				bmin[v] = std::min(vx, bmin[v]);
@@ -475,67 +772,175 @@ bool Engine::loadModelFromObj(const std::string assignedName, const std::string
 			index_offset += vertices_in_face;
 		}
 	}
+}
 
-	for (auto& [mesh, uniqV] : meshVertexMap) {
-		ASSERT(mesh != nullptr);
+// Simplification targets relative to LOD 0 triangle count
+static constexpr float LOD_TRIANGLE_RATIOS[MAX_MESH_LODS - 1] = { 0.5f, 0.25f, 0.125f };
+// Max simplification error relative to mesh bounding radius
+static constexpr float LOD_MAX_ERROR = 0.02f;
 
-		uploadMesh(*mesh);
-		newModel.meshes.push_back(mesh);
+// Appends simplified levels of detail to mesh indices, every level is simplified from the previous one.
+// Stops when the error bound is reached or a level is not much smaller than the previous one.
+static void buildLods(MeshData& mesh, const LoaderSettings& settings)
+{
+	glm::vec3 bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max());
+	for (const Vertex& v : mesh.vertices) {
+		bmin = glm::min(bmin, v.pos);
+		bmax = glm::max(bmax, v.pos);
 	}
+	float maxError = LOD_MAX_ERROR * 0.5f * glm::length(bmax - bmin);
 
-	// Lambda for convenience
-	auto loadModelTexture = [this](std::string baseDir, std::string texName, Attachment** dst) {
-		std::string texture_filename = baseDir + texName;
-		std::replace(texture_filename.begin(), texture_filename.end(), '\\', '/');
+	const size_t lod0IndexCount = mesh.lods[0].indexCount;
+	std::vector<uint32_t> prev(mesh.indices.begin(), mesh.indices.begin() + lod0IndexCount);
+	float error = 0.f;
 
-		Attachment* texture = nullptr;
-		// Only load the texture if it is not already loaded
-		if (getTexture(texture_filename) == nullptr) {
-			if (!FileExists(texture_filename)) {
-				PRERR("Unable to find file: " << texture_filename);
-				EXIT(1);
-			}
+	for (float ratio : LOD_TRIANGLE_RATIOS) {
+		size_t targetIndexCount = static_cast<size_t>(lod0IndexCount / 3 * ratio) * 3;
 
-			if (!(texture = loadTextureFromFile(texture_filename.c_str()))) {
-				PRERR("Unable to load texture: " << texture_filename);
-				EXIT(1);
-			}
-		} else {
-			texture = getTexture(texture_filename);
+		float lodError;
+		std::vector<uint32_t> lod = mesh_optimizer::simplify(prev, mesh.vertices, targetIndexCount, maxError - error, lodError);
+		if (lod.empty() || lod.size() > prev.size() * 85 / 100) {
+			break;
 		}
+		error += lodError;
 
-		// Assign texture pointer to the mesh that uses it
-		//newModel.meshes[mesh_i]->diffuseTex = texture;
-		*dst = texture;
-	};
+		if (settings.optimizeMeshes) {
+			mesh_optimizer::optimizeVertexCache(lod, mesh.vertices.size());
+		}
 
-	// Only load textures that are used by meshes
-	size_t mesh_i = 0;
-	for (auto& [mesh, uniqV] : meshVertexMap) {
-		tinyobj::material_t* mp = &materials[mesh->mat_id];
+		mesh.lods.push_back({
+			.firstIndex = static_cast<uint32_t>(mesh.indices.size()),
+			.indexCount = static_cast<uint32_t>(lod.size()),
+			.error = error
+		});
+		mesh.indices.insert(mesh.indices.end(), lod.begin(), lod.end());
+		prev = std::move(lod);
+	}
+}
 
-		// Texname empty means there's no texture
-		if (mp->diffuse_texname.length() > 0) {
-			loadModelTexture(baseDir, mp->diffuse_texname, &newModel.meshes[mesh_i]->diffuseTex);
-			newModel.meshes[mesh_i]->diffuseTex->globalIndex = _modelLoaderGlobalDiffuseTexIndex;
-			//newModel.meshes[mesh_i]->diffuseTex->type = Attachment::Type::Diffuse;
-			_diffTexInsertionOrdered.push_back(newModel.meshes[mesh_i]->diffuseTex);
+// Optimizes index and vertex order of every mesh and splits them into meshlets (unless optimizeMeshes is off), builds LODs
+// and reports vertex cache efficiency of LOD 0 before and after
+void processMeshes(const std::string& path, std::vector<MeshData>& meshes, const LoaderSettings& settings)
+{
+	Timer timer;
+
+	std::vector<mesh_optimizer::VertexCacheStats> before(meshes.size()), after(meshes.size());
+	parallelFor(meshes.size(), settings.numThreads, [&](size_t i) {
+		MeshData& mesh = meshes[i];
+		before[i] = mesh_optimizer::analyzeVertexCache(mesh.indices, mesh.vertices.size());
+
+		// Meshlets are contiguous index ranges, so building them reorders the triangles too
+		if (settings.optimizeMeshes) {
+			mesh_optimizer::optimizeVertexCache(mesh.indices, mesh.vertices.size());
+			if (settings.optimizeOverdraw) {
+				mesh_optimizer::optimizeOverdraw(mesh.indices, mesh.vertices);
+			}
+			mesh_optimizer::buildMeshlets(mesh.indices, mesh.vertices, mesh.meshlets);
+		}
 
-			++_modelLoaderGlobalDiffuseTexIndex;
+		mesh.lods = { MeshLod{ .firstIndex = 0, .indexCount = static_cast<uint32_t>(mesh.indices.size()) } };
+		if (settings.generateLods) {
+			buildLods(mesh, settings);
 		}
 
-		// Texname empty means there's no texture
-		if (mp->bump_texname.length() > 0) {
-			loadModelTexture(baseDir, mp->bump_texname, &newModel.meshes[mesh_i]->bumpTex);
-			newModel.meshes[mesh_i]->bumpTex->globalIndex = _modelLoaderGlobalBumpTexIndex;
-			//newModel.meshes[mesh_i]->bumpTex->type = Attachment::Type::Bump;
-			_bumpTexInsertionOrdered.push_back(newModel.meshes[mesh_i]->bumpTex);
+		// Vertices end up in order of first use by LOD 0, coarser levels use a subset of them
+		if (settings.optimizeMeshes) {
+			mesh_optimizer::optimizeVertexFetch(mesh.vertices, mesh.indices);
+		}
 
-			++_modelLoaderGlobalBumpTexIndex;
+		std::vector<uint32_t> lod0(mesh.indices.begin(), mesh.indices.begin() + mesh.lods[0].indexCount);
+		after[i] = mesh_optimizer::analyzeVertexCache(lod0, mesh.vertices.size());
+	});
+
+	mesh_optimizer::VertexCacheStats totalBefore, totalAfter;
+	size_t numMeshlets = 0;
+	std::array<size_t, MAX_MESH_LODS> lodTriangles{};
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		totalBefore += before[i];
+		totalAfter += after[i];
+		numMeshlets += meshes[i].meshlets.size();
+
+		// Meshes with fewer levels count their coarsest level for the rest
+		for (size_t l = 0; l < MAX_MESH_LODS; ++l) {
+			lodTriangles[l] += meshes[i].lods[std::min(l, meshes[i].lods.size() - 1)].indexCount / 3;
 		}
+	}
+
+	pr("Processed " << meshes.size() << " meshes of " << path << " in " << timer.ElapsedMs() << " ms:"
+		<< " ACMR " << totalBefore.acmr() << " -> " << totalAfter.acmr()
+		<< ", ATVR " << totalBefore.atvr() << " -> " << totalAfter.atvr()
+		<< ", " << numMeshlets << " meshlets (" << float(totalAfter.triangles) / std::max<size_t>(numMeshlets, 1) << " triangles avg)"
+		<< ", LOD triangles " << lodTriangles[0] << " / " << lodTriangles[1] << " / " << lodTriangles[2] << " / " << lodTriangles[3]);
+}
+
+bool loadObjModelData(const std::string& path, ModelData& data, const LoaderSettings& settings)
+{
+	// Partially based on https://github.com/tinyobjloader/tinyobjloader/blob/release/examples/viewer/viewer.cc
+	/* The MIT License (MIT)
+	Copyright (c) 2012-2019 Syoyo Fujita and many contributors.
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+	*/
+
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+
+	// Model bounds later used to scale model to [-1, 1] scale
+	float bmin[3], bmax[3];
+	bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<float>::max();
+	bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<float>::max();
+
+	std::string baseDir = GetBaseDir(path);
+	if (baseDir.empty()) {
+		baseDir = ".";
+	}
+	baseDir += "/";
+
+	pr("\nLoading model at: " << path);
+	if (!parseObj(path, baseDir, settings, attrib, shapes, materials)) {
+		return false;
+	}
+
+	data = {};
+
+	buildMeshes(attrib, shapes, materials, data, bmin, bmax);
+
+	processMeshes(path, data.meshes, settings);
+
+	for (auto& mesh : data.meshes) {
+		tinyobj::material_t* mp = &materials[mesh.mat_id];
+
+		// Texname empty means there's no texture
+		auto texturePath = [&baseDir](const std::string& texName) {
+			if (texName.empty()) {
+				return std::string();
+			}
+			std::string texture_filename = baseDir + texName;
+			std::replace(texture_filename.begin(), texture_filename.end(), '\\', '/');
+			return texture_filename;
+		};
+		mesh.diffuseTexPath = texturePath(mp->diffuse_texname);
+		mesh.bumpTexPath = texturePath(mp->bump_texname);
 
 		// Set material lighting colors for use in Phong lighting model
-		newModel.meshes[mesh_i]->gpuMat = {
+		mesh.gpuMat = {
 			.ambientColor = glm::make_vec3(mp->ambient),
 			.diffuseColor = glm::make_vec3(mp->diffuse),
 			.specularColor = glm::make_vec3(mp->specular)
@@ -543,11 +948,7 @@ bool Engine::loadModelFromObj(const std::string assignedName, const std::string
 
 		// Dissolve corresponds to 'd' component of a material in .mtl file.
 		// It's default value is 1 which means that meaterial is fully opaque.
-		if (mp->dissolve < 0.75) {
-			newModel.meshes[mesh_i]->isTransparent = true;
-		}
-
-		++mesh_i;
+		mesh.isTransparent = mp->dissolve < 0.75;
 	}
 
 	// Max extent is half of biggest difference of a bounds coordinate
@@ -560,9 +961,437 @@ bool Engine::loadModelFromObj(const std::string assignedName, const std::string
 	}
 	ASSERT(maxExtent > 0.f);
 
-	newModel.maxExtent = maxExtent;
+	data.maxExtent = maxExtent;
+
+	return true;
+}
+
+bool isGltfModel(const std::string& path)
+{
+	std::string ext = std::filesystem::path(path).extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+	return ext == ".gltf" || ext == ".glb";
+}
+
+bool loadModelData(const std::string& path, ModelData& data, const LoaderSettings& settings)
+{
+	return isGltfModel(path) ? loadGltfModelData(path, data, settings) : loadObjModelData(path, data, settings);
+}
+
+// Octahedral normal encoding, see http://jcgt.org/published/0003/02/01/
+static void octEncode(glm::vec3 n, int16_t out[2])
+{
+	float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (sum == 0.f) {
+		out[0] = out[1] = 0;
+		return;
+	}
+	n /= sum;
+
+	glm::vec2 e(n.x, n.y);
+	if (n.z < 0.f) {
+		e = (1.f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+	}
+
+	out[0] = static_cast<int16_t>(std::round(glm::clamp(e.x, -1.f, 1.f) * 32767.f));
+	out[1] = static_cast<int16_t>(std::round(glm::clamp(e.y, -1.f, 1.f) * 32767.f));
+}
+
+// Must match octDecode in incl/vertex_decode.glsl
+static glm::vec3 octDecode(const int16_t e[2])
+{
+	glm::vec2 f = glm::max(glm::vec2(e[0], e[1]) / 32767.f, -1.f);
+	glm::vec3 n(f.x, f.y, 1.f - std::abs(f.x) - std::abs(f.y));
+	float t = std::max(-n.z, 0.f);
+	n.x += n.x >= 0.f ? -t : t;
+	n.y += n.y >= 0.f ? -t : t;
+	return glm::normalize(n);
+}
+
+static uint16_t quantizeUnorm16(float v, float offset, float scale)
+{
+	float normalized = scale > 0.f ? (v - offset) / scale : 0.f;
+	return static_cast<uint16_t>(std::round(glm::clamp(normalized, 0.f, 1.f) * 65535.f));
+}
+
+// Packs vertices of all model meshes into PackedVertex relative to the model bounds
+// and reports the largest quantization error
+static VertexDequant packModelVertices(const std::string& path, const std::vector<Mesh*>& meshes)
+{
+	glm::vec3 posMin(std::numeric_limits<float>::max()), posMax(-std::numeric_limits<float>::max());
+	glm::vec2 uvMin(std::numeric_limits<float>::max()), uvMax(-std::numeric_limits<float>::max());
+	for (auto& mesh : meshes) {
+		for (auto& v : mesh->vertices) {
+			posMin = glm::min(posMin, v.pos);
+			posMax = glm::max(posMax, v.pos);
+			uvMin = glm::min(uvMin, v.uv);
+			uvMax = glm::max(uvMax, v.uv);
+		}
+	}
+
+	VertexDequant dq = {
+		.posScale = posMax - posMin,
+		.posOffset = posMin,
+		.uvScale = uvMax - uvMin,
+		.uvOffset = uvMin
+	};
+
+	float maxPosError = 0.f, maxUVError = 0.f, maxNormalErrorDeg = 0.f;
+	size_t numVertices = 0;
+
+	for (auto& mesh : meshes) {
+		mesh->packedVertices.resize(mesh->vertices.size());
+
+		for (size_t i = 0; i < mesh->vertices.size(); ++i) {
+			const Vertex& v = mesh->vertices[i];
+			PackedVertex& p = mesh->packedVertices[i];
+
+			for (int c = 0; c < 3; ++c) {
+				p.pos[c] = quantizeUnorm16(v.pos[c], dq.posOffset[c], dq.posScale[c]);
+			}
+			p.pos[3] = 0;
+			p.uv[0] = quantizeUnorm16(v.uv.x, dq.uvOffset.x, dq.uvScale.x);
+			p.uv[1] = quantizeUnorm16(v.uv.y, dq.uvOffset.y, dq.uvScale.y);
+			octEncode(v.normal, p.normal);
+
+			// Decode the same way shaders do and measure error
+			glm::vec3 pos = glm::vec3(p.pos[0], p.pos[1], p.pos[2]) / 65535.f * dq.posScale + dq.posOffset;
+			glm::vec2 uv = glm::vec2(p.uv[0], p.uv[1]) / 65535.f * dq.uvScale + dq.uvOffset;
+			maxPosError = std::max(maxPosError, glm::length(pos - v.pos));
+			maxUVError = std::max(maxUVError, glm::compMax(glm::abs(uv - v.uv)));
+
+			if (glm::length(v.normal) > 0.f) {
+				float cosAngle = glm::clamp(glm::dot(octDecode(p.normal), glm::normalize(v.normal)), -1.f, 1.f);
+				maxNormalErrorDeg = std::max(maxNormalErrorDeg, glm::degrees(std::acos(cosAngle)));
+			}
+		}
+		numVertices += mesh->vertices.size();
+	}
+
+	float extent = std::max(glm::compMax(dq.posScale), 1e-20f);
+	pr("[Packed vertices] " << path << ": " << numVertices << " vertices, "
+		<< numVertices * sizeof(Vertex) / 1024 << " KiB -> " << numVertices * sizeof(PackedVertex) / 1024 << " KiB. "
+		<< "Max error: position " << maxPosError << " (" << 100.f * maxPosError / extent << "% of extent), "
+		<< "normal " << maxNormalErrorDeg << " deg, uv " << maxUVError);
+
+	return dq;
+}
+
+bool Engine::loadModel(const std::string assignedName, const std::string path, bool allowPackedVertices)
+{
+	ModelData data;
+
+	Timer timer;
+	bool fromCache = _loaderSettings.useMeshCache && mesh_cache::read(path, data, _loaderSettings);
+	if (!fromCache) {
+		if (!loadModelData(path, data, _loaderSettings)) {
+			return false;
+		}
+		if (_loaderSettings.useMeshCache && !mesh_cache::write(path, data, _loaderSettings)) {
+			PRWRN("Failed to write mesh cache for: " << path);
+		}
+	}
+	pr("Model " << path << (fromCache ? " loaded from mesh cache" : " parsed") << " in " << timer.ElapsedMs() << " ms");
+
+	Model& newModel = _models[assignedName];
+	newModel.tag = assignedName;
+	newModel.maxExtent = data.maxExtent;
+
+	for (auto& meshData : data.meshes) {
+		ASSERT(getMesh(meshData.tag) == nullptr); // Mesh must not exist yet
+
+		Mesh* mesh = &_meshes[meshData.tag];
+		mesh->tag = meshData.tag;
+		mesh->mat_id = meshData.mat_id;
+		mesh->vertices = std::move(meshData.vertices);
+		mesh->indices = std::move(meshData.indices);
+		mesh->meshlets = std::move(meshData.meshlets);
+		mesh->lods = std::move(meshData.lods);
+
+		glm::vec3 bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max());
+		for (const Vertex& v : mesh->vertices) {
+			bmin = glm::min(bmin, v.pos);
+			bmax = glm::max(bmax, v.pos);
+		}
+		mesh->boundsCenter = 0.5f * (bmin + bmax);
+		mesh->boundsRadius = 0.5f * glm::length(bmax - bmin);
+
+		// Ratio of the total uv area to the total surface area
+		double uvArea = 0.0, area = 0.0;
+		const MeshLod& lod0 = mesh->lods[0];
+		for (uint32_t i = lod0.firstIndex; i + 2 < lod0.firstIndex + lod0.indexCount; i += 3) {
+			const Vertex& v0 = mesh->vertices[mesh->indices[i]];
+			const Vertex& v1 = mesh->vertices[mesh->indices[i + 1]];
+			const Vertex& v2 = mesh->vertices[mesh->indices[i + 2]];
+			glm::vec2 duv1 = v1.uv - v0.uv, duv2 = v2.uv - v0.uv;
+			uvArea += 0.5 * std::abs(duv1.x * duv2.y - duv1.y * duv2.x);
+			area += 0.5 * glm::length(glm::cross(v1.pos - v0.pos, v2.pos - v0.pos));
+		}
+		mesh->uvDensity = area > 0.0 ? static_cast<float>(std::sqrt(uvArea / area)) : 0.f;
+
+		mesh->gpuMat = meshData.gpuMat;
+		mesh->isTransparent = meshData.isTransparent;
+
+		newModel.meshes.push_back(mesh);
+	}
+
+	if (allowPackedVertices && _loaderSettings.packedVertices) {
+		newModel.packedVertices = true;
+		newModel.dequant = packModelVertices(path, newModel.meshes);
+	}
+
+	size_t numMeshes16 = 0, indexBytesSaved = 0;
+	for (auto& mesh : newModel.meshes) {
+		uploadMesh(*mesh);
+
+		if (mesh->indexType == VK_INDEX_TYPE_UINT16) {
+			++numMeshes16;
+			indexBytesSaved += mesh->indices.size() * (sizeof(uint32_t) - sizeof(uint16_t));
+		}
+	}
+	pr("\t" << numMeshes16 << "/" << newModel.meshes.size() << " meshes use 16 bit indices, "
+		<< indexBytesSaved / 1024 << " KiB of index memory saved");
+
+	// Bump maps are converted into derivative maps, which are stored under a different tag
+	const bool derivativeBumpMaps = _loaderSettings.derivativeBumpMaps;
+
+	// Lambda for convenience
+	auto loadModelTexture = [this](const std::string& texture_filename, bool derivativeMap, Attachment** dst) {
+		std::string tag = derivativeMap ? getDerivativeMapTag(texture_filename) : texture_filename;
+
+		Attachment* texture = nullptr;
+		// Only load the texture if it is not already loaded
+		if (getTexture(tag) == nullptr) {
+			// Derivative maps are built from the source image
+			if (!FileExists(texture_filename) && (derivativeMap || texture_container::findCompressed(texture_filename).empty())) {
+				PRERR("Unable to find file: " << texture_filename);
+				EXIT(1);
+			}
+
+			loadTextures({ texture_filename }, derivativeMap);
+			if (!(texture = getTexture(tag))) {
+				PRERR("Unable to load texture: " << texture_filename);
+				EXIT(1);
+			}
+		} else {
+			texture = getTexture(tag);
+		}
+
+		// Assign texture pointer to the mesh that uses it
+		*dst = texture;
+	};
+
+	// Decode all new textures used by meshes in parallel first, the loop below then only finds them in the cache
+	std::vector<std::string> newTexturePaths;
+	std::vector<std::string> newDerivativeMapPaths;
+	for (auto& meshData : data.meshes) {
+		for (const std::string* texPath : { &meshData.diffuseTexPath, &meshData.bumpTexPath }) {
+			bool derivativeMap = derivativeBumpMaps && texPath == &meshData.bumpTexPath;
+			auto& paths = derivativeMap ? newDerivativeMapPaths : newTexturePaths;
+			if (texPath->empty() || getTexture(derivativeMap ? getDerivativeMapTag(*texPath) : *texPath) != nullptr
+				|| std::find(paths.begin(), paths.end(), *texPath) != paths.end())
+			{
+				continue;
+			}
+			if (!FileExists(*texPath) && (derivativeMap || texture_container::findCompressed(*texPath).empty())) {
+				PRERR("Unable to find file: " << *texPath);
+				EXIT(1);
+			}
+			paths.push_back(*texPath);
+		}
+	}
+	loadTextures(newTexturePaths);
+	loadTextures(newDerivativeMapPaths, true);
+
+	// Only load textures that are used by meshes
+	for (size_t mesh_i = 0; mesh_i < data.meshes.size(); mesh_i++) {
+		MeshData& meshData = data.meshes[mesh_i];
+		Mesh* mesh = newModel.meshes[mesh_i];
+
+		// Path empty means there's no texture
+		if (!meshData.diffuseTexPath.empty()) {
+			loadModelTexture(meshData.diffuseTexPath, false, &mesh->diffuseTex);
+		}
+
+		if (!meshData.bumpTexPath.empty()) {
+			loadModelTexture(meshData.bumpTexPath, derivativeBumpMaps, &mesh->bumpTex);
+		}
+	}
 
 	pr("Model loaded successfully!");
 
 	return true;
 }
+
+void benchmarkVertexDedup(const std::string& path, const LoaderSettings& settings)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+
+	std::string baseDir = GetBaseDir(path);
+	baseDir = (baseDir.empty() ? "." : baseDir) + "/";
+
+	pr("\nBenchmarking vertex deduplication on: " << path);
+	if (!parseObj(path, baseDir, settings, attrib, shapes, materials)) {
+		return;
+	}
+
+	// Baseline: the loader used to deduplicate vertices by their values.
+	// Vertex::operator== ignores normal, so vertices differing only in normal may get merged.
+	auto buildByValue = [](const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes,
+		const std::vector<tinyobj::material_t>&, ModelData& data, float*, float*)
+	{
+		std::vector<std::unordered_map<Vertex, uint32_t>> meshVertexMaps;
+		for (auto& shape : shapes) {
+			for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
+				int mat_id = shape.mesh.material_ids[f];
+				auto it = std::find_if(data.meshes.begin(), data.meshes.end(), [=](auto& m) { return m.mat_id == mat_id; });
+				size_t meshIndex = it - data.meshes.begin();
+				if (it == data.meshes.end()) {
+					data.meshes.emplace_back().mat_id = mat_id;
+					meshVertexMaps.emplace_back();
+				}
+				MeshData& mesh = data.meshes[meshIndex];
+				auto& uniqVert = meshVertexMaps[meshIndex];
+
+				for (size_t v = 0; v < 3; v++) {
+					const tinyobj::index_t& idx = shape.mesh.indices[3 * f + v];
+					const float* p = &attrib.vertices[3 * idx.vertex_index];
+					glm::vec3 n(0.f);
+					if (idx.normal_index >= 0) {
+						n = { attrib.normals[3 * idx.normal_index + 0], attrib.normals[3 * idx.normal_index + 1], attrib.normals[3 * idx.normal_index + 2] };
+					}
+					glm::vec2 uv(0.f);
+					if (idx.texcoord_index >= 0) {
+						uv = { attrib.texcoords[2 * idx.texcoord_index + 0], attrib.texcoords[2 * idx.texcoord_index + 1] };
+					}
+					Vertex vert{ .pos = {p[0], p[1], p[2]}, .normal = n, .color = n, .uv = {uv.x, 1 - uv.y} };
+
+					auto [vertIt, inserted] = uniqVert.try_emplace(vert, static_cast<uint32_t>(mesh.vertices.size()));
+					if (inserted) {
+						mesh.vertices.push_back(vert);
+					}
+					mesh.indices.push_back(vertIt->second);
+				}
+			}
+		}
+	};
+
+	auto run = [&](auto buildFn, const char* name) {
+		constexpr int NUM_RUNS = 5;
+
+		double bestMs = std::numeric_limits<double>::max();
+		size_t numVertices = 0;
+		for (int i = 0; i < NUM_RUNS; ++i) {
+			ModelData data;
+			float bmin[3], bmax[3];
+			bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<float>::max();
+			bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<float>::max();
+
+			Timer timer;
+			buildFn(attrib, shapes, materials, data, bmin, bmax);
+			bestMs = std::min(bestMs, timer.ElapsedMs());
+
+			numVertices = 0;
+			for (auto& mesh : data.meshes) {
+				numVertices += mesh.vertices.size();
+			}
+		}
+		pr("[Vertex dedup] " << name << ": " << bestMs << " ms (best of " << NUM_RUNS << "), " << numVertices << " unique vertices");
+		return bestMs;
+	};
+
+	double oldMs = run(buildByValue, "std::unordered_map<Vertex>");
+	double newMs = run(buildMeshes, "Index triple flat map     ");
+	pr("[Vertex dedup] Speedup: " << oldMs / std::max(newMs, 1e-3) << "x");
+}
+
+void benchmarkSmoothingNormals(const std::string& path, const LoaderSettings& settings)
+{
+	tinyobj::attrib_t inattrib;
+	std::vector<tinyobj::shape_t> inshapes;
+	std::vector<tinyobj::material_t> materials;
+
+	std::string baseDir = GetBaseDir(path);
+	baseDir = (baseDir.empty() ? "." : baseDir) + "/";
+
+	pr("\nBenchmarking smoothing normal regeneration on: " << path);
+	if (!parseObjFile(path, baseDir, settings, inattrib, inshapes, materials)) {
+		return;
+	}
+	// Normals are regenerated regardless of whether the file has them
+	inattrib.normals.clear();
+
+	struct Result {
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+	};
+
+	auto run = [&](auto fn, const std::string& name, Result& result) {
+		constexpr int NUM_RUNS = 3;
+
+		double bestMs = std::numeric_limits<double>::max();
+		for (int i = 0; i < NUM_RUNS; ++i) {
+			result = {};
+			Timer timer;
+			fn(result);
+			bestMs = std::min(bestMs, timer.ElapsedMs());
+		}
+		pr("[Smoothing normals] " << name << ": " << bestMs << " ms (best of " << NUM_RUNS << ")");
+		return bestMs;
+	};
+
+	// Bitwise comparison, also catches differences in signed zeros and NaNs
+	bool compareTexcoords = true;
+	auto same = [&](const Result& a, const Result& b) {
+		auto sameFloats = [](const std::vector<float>& x, const std::vector<float>& y) {
+			return x.size() == y.size() && memcmp(x.data(), y.data(), x.size() * sizeof(float)) == 0;
+		};
+		if (!sameFloats(a.attrib.vertices, b.attrib.vertices) || !sameFloats(a.attrib.normals, b.attrib.normals)
+			|| (compareTexcoords && !sameFloats(a.attrib.texcoords, b.attrib.texcoords)) || a.shapes.size() != b.shapes.size())
+		{
+			return false;
+		}
+		for (size_t s = 0; s < a.shapes.size(); ++s) {
+			const tinyobj::mesh_t& ma = a.shapes[s].mesh;
+			const tinyobj::mesh_t& mb = b.shapes[s].mesh;
+			bool sameIndices = ma.indices.size() == mb.indices.size() && std::equal(ma.indices.begin(), ma.indices.end(), mb.indices.begin(),
+				[](const tinyobj::index_t& x, const tinyobj::index_t& y) {
+					return x.vertex_index == y.vertex_index && x.normal_index == y.normal_index && x.texcoord_index == y.texcoord_index;
+				});
+			if (!sameIndices || ma.material_ids != mb.material_ids || ma.smoothing_group_ids != mb.smoothing_group_ids) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	Result serial;
+	double serialMs = run([&](Result& r) {
+		std::vector<tinyobj::shape_t> shapesCopy = inshapes;
+		computeSmoothingShapes(inattrib, shapesCopy, r.shapes, r.attrib);
+		computeAllSmoothingNormals(r.attrib, r.shapes);
+	}, "Serial (tinyobj viewer)  ", serial);
+
+	if (!serial.attrib.texcoords.empty() && serial.attrib.texcoords.size() / 2 != serial.attrib.vertices.size() / 3) {
+		// Only some faces have texcoords, serial version's texcoords don't line up with vertices
+		compareTexcoords = false;
+		pr("[Smoothing normals] Not comparing texcoords, the model has faces without them");
+	}
+
+	uint32_t numThreads = getNumWorkerThreads(settings.numThreads);
+	for (uint32_t threads : { 1u, numThreads }) {
+		Result parallel;
+		double ms = run([&](Result& r) {
+			regenerateSmoothingNormals(inattrib, inshapes, r.shapes, r.attrib, threads);
+		}, "Parallel, " + std::to_string(threads) + " thread(s)     ", parallel);
+
+		pr("[Smoothing normals] Speedup: " << serialMs / std::max(ms, 1e-3) << "x, "
+			<< (same(serial, parallel) ? "identical to serial" : "DIFFERENT from serial"));
+
+		if (threads == numThreads) {
+			break;
+		}
+	}
+}
@@ -0,0 +1,811 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "obj_parser.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "timer.h"
+
+#include <charconv>
+
+namespace obj_parser {
+	// Corner doesn't reference this attribute (e.g. 'f 1//2' has no texcoord)
+	static constexpr int NO_INDEX = std::numeric_limits<int>::min();
+
+	enum RelativeBits : uint8_t {
+		REL_V = 1 << 0,
+		REL_VT = 1 << 1,
+		REL_VN = 1 << 2,
+	};
+
+	// One polygon corner as written in the file.
+	// Relative (negative) indices can't be resolved until we know how many
+	// attributes preceding chunks have, so they are stored relative to the chunk start.
+	struct Corner {
+		int v, vt, vn;
+		uint8_t relative;
+	};
+
+	// State change that happens before face with index 'face' of the chunk
+	struct Event {
+		enum class Type { UseMtl, Smoothing, Group };
+
+		Type type;
+		uint32_t face;
+		std::string name;
+		uint32_t smoothingId = 0;
+		int materialId = -1; // Resolved from name after materials are loaded
+	};
+
+	struct Chunk {
+		const char* begin;
+		const char* end;
+
+		std::vector<tinyobj::real_t> v, vn, vt;
+		std::vector<Corner> corners;
+		std::vector<uint32_t> faceSizes;
+		std::vector<Event> events;
+		std::vector<std::string> mtllibs;
+
+		size_t numLines = 0;
+		size_t numTriangles = 0;
+
+		std::string warn;
+		std::string err;
+		size_t errLine = 0; // Line in chunk
+
+		// Filled when merging
+		size_t vOffset = 0, vnOffset = 0, vtOffset = 0;
+		size_t lineOffset = 0;
+
+		int startMaterial = -1;
+		uint32_t startSmoothing = 0;
+
+		std::vector<tinyobj::index_t> indices;
+		std::vector<int> materialIds;
+		std::vector<unsigned int> smoothingIds;
+		// First triangle of a new shape and its name
+		std::vector<std::pair<size_t, std::string>> shapeBreaks;
+	};
+
+	/* Parsing helpers. All of them stop at 'end' which is end of the current line */
+
+	static inline bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t';
+	}
+
+	static inline const char* skipSpaces(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p)) {
+			++p;
+		}
+		return p;
+	}
+
+	static inline const char* skipToken(const char* p, const char* end)
+	{
+		while (p < end && !isSpace(*p)) {
+			++p;
+		}
+		return p;
+	}
+
+	static inline tinyobj::real_t parseReal(const char*& p, const char* end)
+	{
+		p = skipSpaces(p, end);
+		if (p < end && *p == '+') {
+			++p;
+		}
+
+		tinyobj::real_t value = 0;
+		auto res = std::from_chars(p, end, value);
+		// Same as tinyobj, unparsable values are silently 0
+		p = (res.ec == std::errc()) ? res.ptr : skipToken(p, end);
+		return value;
+	}
+
+	static inline bool parseInt(const char*& p, const char* end, int& value)
+	{
+		if (p < end && *p == '+') {
+			++p;
+		}
+		auto res = std::from_chars(p, end, value);
+		if (res.ec != std::errc()) {
+			return false;
+		}
+		p = res.ptr;
+		return true;
+	}
+
+	// Converts 1-based/negative OBJ index to 0-based one
+	static inline bool fixIndex(int idx, size_t localCount, int& out, uint8_t& relative, uint8_t relBit)
+	{
+		if (idx > 0) {
+			out = idx - 1;
+			return true;
+		}
+		if (idx < 0) {
+			out = static_cast<int>(localCount) + idx;
+			relative |= relBit;
+			return true;
+		}
+		// Zero is not a valid index
+		return false;
+	}
+
+	// v, v/vt, v//vn, v/vt/vn
+	static bool parseCorner(const char*& p, const char* end, Chunk& c, Corner& corner)
+	{
+		corner = { NO_INDEX, NO_INDEX, NO_INDEX, 0 };
+
+		int idx;
+		if (!parseInt(p, end, idx) || !fixIndex(idx, c.v.size() / 3, corner.v, corner.relative, REL_V)) {
+			return false;
+		}
+		if (p >= end || *p != '/') {
+			return true;
+		}
+		++p;
+
+		if (p < end && *p != '/') {
+			if (!parseInt(p, end, idx) || !fixIndex(idx, c.vt.size() / 2, corner.vt, corner.relative, REL_VT)) {
+				return false;
+			}
+		}
+		if (p >= end || *p != '/') {
+			return true;
+		}
+		++p;
+
+		if (!parseInt(p, end, idx) || !fixIndex(idx, c.vn.size() / 3, corner.vn, corner.relative, REL_VN)) {
+			return false;
+		}
+		return true;
+	}
+
+	static bool parseLine(const char* p, const char* end, Chunk& c)
+	{
+		p = skipSpaces(p, end);
+		if (end - p < 2) {
+			return true;
+		}
+
+		auto startsWith = [&](const char* keyword, size_t len) {
+			return static_cast<size_t>(end - p) > len && strncmp(p, keyword, len) == 0 && isSpace(p[len]);
+		};
+
+		switch (p[0]) {
+		case 'v':
+			if (isSpace(p[1])) {
+				p += 2;
+				c.v.push_back(parseReal(p, end));
+				c.v.push_back(parseReal(p, end));
+				c.v.push_back(parseReal(p, end));
+			} else if (startsWith("vn", 2)) {
+				p += 3;
+				c.vn.push_back(parseReal(p, end));
+				c.vn.push_back(parseReal(p, end));
+				c.vn.push_back(parseReal(p, end));
+			} else if (startsWith("vt", 2)) {
+				p += 3;
+				c.vt.push_back(parseReal(p, end));
+				c.vt.push_back(parseReal(p, end));
+			}
+			return true;
+
+		case 'f':
+			if (isSpace(p[1])) {
+				p += 2;
+
+				uint32_t numCorners = 0;
+				while ((p = skipSpaces(p, end)) < end) {
+					Corner corner;
+					if (!parseCorner(p, end, c, corner)) {
+						c.err = "Failed to parse `f' line (e.g. a zero value for vertex index)";
+						return false;
+					}
+					c.corners.push_back(corner);
+					++numCorners;
+				}
+
+				if (numCorners < 3) {
+					// Same as tinyobj, skip the face
+					c.corners.resize(c.corners.size() - numCorners);
+					c.warn += "Degenerated face found\n.";
+					return true;
+				}
+
+				c.faceSizes.push_back(numCorners);
+				c.numTriangles += numCorners - 2;
+			}
+			return true;
+
+		case 'u':
+			if (startsWith("usemtl", 6)) {
+				p = skipSpaces(p + 6, end);
+				c.events.push_back({
+					.type = Event::Type::UseMtl,
+					.face = static_cast<uint32_t>(c.faceSizes.size()),
+					.name = std::string(p, skipToken(p, end))
+				});
+			}
+			return true;
+
+		case 'm':
+			if (startsWith("mtllib", 6)) {
+				p += 7;
+				while ((p = skipSpaces(p, end)) < end) {
+					const char* nameEnd = skipToken(p, end);
+					c.mtllibs.emplace_back(p, nameEnd);
+					p = nameEnd;
+				}
+			}
+			return true;
+
+		case 'g':
+			if (isSpace(p[1])) {
+				p += 2;
+				// Multiple group names are concatenated with space, same as in tinyobj
+				std::string name;
+				while ((p = skipSpaces(p, end)) < end) {
+					const char* nameEnd = skipToken(p, end);
+					if (!name.empty()) {
+						name += ' ';
+					}
+					name.append(p, nameEnd);
+					p = nameEnd;
+				}
+				if (name.empty()) {
+					c.warn += "Empty group name.\n";
+				}
+				c.events.push_back({
+					.type = Event::Type::Group,
+					.face = static_cast<uint32_t>(c.faceSizes.size()),
+					.name = std::move(name)
+				});
+			}
+			return true;
+
+		case 'o':
+			if (isSpace(p[1])) {
+				c.events.push_back({
+					.type = Event::Type::Group,
+					.face = static_cast<uint32_t>(c.faceSizes.size()),
+					.name = std::string(p + 2, end)
+				});
+			}
+			return true;
+
+		case 's':
+			if (isSpace(p[1])) {
+				p = skipSpaces(p + 2, end);
+				if (p >= end) {
+					return true;
+				}
+
+				int id = 0;
+				if (end - p >= 3 && strncmp(p, "off", 3) == 0) {
+					id = 0;
+				} else if (!parseInt(p, end, id) || id < 0) {
+					id = 0;
+				}
+				c.events.push_back({
+					.type = Event::Type::Smoothing,
+					.face = static_cast<uint32_t>(c.faceSizes.size()),
+					.smoothingId = static_cast<uint32_t>(id)
+				});
+			}
+			return true;
+
+		default:
+			// Comments, lines, points and everything else we don't use
+			return true;
+		}
+	}
+
+	static void parseChunk(Chunk& c)
+	{
+		// Rough estimate to avoid most of the reallocations
+		size_t approxLines = (c.end - c.begin) / 32;
+		c.v.reserve(approxLines);
+		c.corners.reserve(approxLines);
+
+		const char* p = c.begin;
+		while (p < c.end) {
+			const char* lineEnd = static_cast<const char*>(memchr(p, '\n', c.end - p));
+			if (lineEnd == nullptr) {
+				lineEnd = c.end;
+			}
+
+			const char* trimmedEnd = lineEnd;
+			if (trimmedEnd > p && trimmedEnd[-1] == '\r') {
+				--trimmedEnd;
+			}
+
+			if (!parseLine(p, trimmedEnd, c)) {
+				c.errLine = c.numLines;
+				return;
+			}
+
+			++c.numLines;
+			p = lineEnd + 1;
+		}
+	}
+
+	// Resolves corner indices to global ones and checks their range
+	static bool resolveCorner(const Chunk& c, const Corner& corner, const tinyobj::attrib_t& attrib, tinyobj::index_t& out)
+	{
+		auto resolve = [&](int idx, uint8_t relBit, size_t offset, size_t count, int& dst) {
+			if (idx == NO_INDEX) {
+				dst = -1;
+				return true;
+			}
+			int64_t global = (corner.relative & relBit) ? static_cast<int64_t>(offset) + idx : idx;
+			if (global < 0 || global >= static_cast<int64_t>(count)) {
+				return false;
+			}
+			dst = static_cast<int>(global);
+			return true;
+		};
+
+		return resolve(corner.v, REL_V, c.vOffset, attrib.vertices.size() / 3, out.vertex_index)
+			&& resolve(corner.vt, REL_VT, c.vtOffset, attrib.texcoords.size() / 2, out.texcoord_index)
+			&& resolve(corner.vn, REL_VN, c.vnOffset, attrib.normals.size() / 3, out.normal_index);
+	}
+
+	// Point in polygon test, same as the one tinyobj uses (https://wrf.ecse.rpi.edu//Research/Short_Notes/pnpoly.html)
+	static bool pnpoly(int nvert, const tinyobj::real_t* vertx, const tinyobj::real_t* verty, tinyobj::real_t testx, tinyobj::real_t testy)
+	{
+		bool c = false;
+		for (int i = 0, j = nvert - 1; i < nvert; j = i++) {
+			if (((verty[i] > testy) != (verty[j] > testy)) &&
+				(testx < (vertx[j] - vertx[i]) * (testy - verty[i]) / (verty[j] - verty[i]) + vertx[i])) {
+				c = !c;
+			}
+		}
+		return c;
+	}
+
+	// Port of tinyobj's built-in ear clipping for faces with more than 4 corners, produces the same triangles in the
+	// same order. Ears are tested in the plane of the two axes the first non-degenerate corner spans most.
+	// Like tinyobj, gives up when no ear is found in a full pass over the remaining corners. Consumes poly.
+	template<typename PushTriangle>
+	static void earClip(std::vector<tinyobj::index_t>& poly, const std::vector<tinyobj::real_t>& v, PushTriangle&& pushTriangle)
+	{
+		using real_t = tinyobj::real_t;
+		const size_t n = poly.size();
+
+		size_t axes[2] = { 1, 2 };
+		for (size_t k = 0; k < n; ++k) {
+			const real_t* v0 = &v[3 * poly[k].vertex_index];
+			const real_t* v1 = &v[3 * poly[(k + 1) % n].vertex_index];
+			const real_t* v2 = &v[3 * poly[(k + 2) % n].vertex_index];
+			real_t e0x = v1[0] - v0[0], e0y = v1[1] - v0[1], e0z = v1[2] - v0[2];
+			real_t e1x = v2[0] - v1[0], e1y = v2[1] - v1[1], e1z = v2[2] - v1[2];
+			real_t cx = std::fabs(e0y * e1z - e0z * e1y);
+			real_t cy = std::fabs(e0z * e1x - e0x * e1z);
+			real_t cz = std::fabs(e0x * e1y - e0y * e1x);
+			const real_t epsilon = std::numeric_limits<real_t>::epsilon();
+			if (cx > epsilon || cy > epsilon || cz > epsilon) {
+				if (!(cx > cy && cx > cz)) {
+					axes[0] = 0;
+					if (cz > cx && cz > cy) {
+						axes[1] = 1;
+					}
+				}
+				break;
+			}
+		}
+
+		size_t guess = 0;
+		// Iterations left before giving up if no corner gets clipped
+		size_t remainingIterations = n;
+		size_t previousRemaining = n;
+		while (poly.size() > 3 && remainingIterations > 0) {
+			const size_t npolys = poly.size();
+			if (guess >= npolys) {
+				guess -= npolys;
+			}
+			if (previousRemaining != npolys) {
+				previousRemaining = npolys;
+				remainingIterations = npolys;
+			} else {
+				--remainingIterations;
+			}
+
+			real_t vx[3], vy[3];
+			for (size_t k = 0; k < 3; ++k) {
+				const real_t* p = &v[3 * poly[(guess + k) % npolys].vertex_index];
+				vx[k] = p[axes[0]];
+				vy[k] = p[axes[1]];
+			}
+
+			// Internal angle, tinyobj compares the turn with this "area" of the first edge only
+			real_t cross = (vx[1] - vx[0]) * (vy[2] - vy[1]) - (vy[1] - vy[0]) * (vx[2] - vx[1]);
+			real_t area = (vx[0] * vy[1] - vy[0] * vx[1]) * static_cast<real_t>(0.5);
+			if (cross * area < static_cast<real_t>(0.0)) {
+				++guess;
+				continue;
+			}
+
+			// Not an ear if any other corner is inside the triangle
+			bool overlap = false;
+			for (size_t other = 3; other < npolys && !overlap; ++other) {
+				const real_t* p = &v[3 * poly[(guess + other) % npolys].vertex_index];
+				overlap = pnpoly(3, vx, vy, p[axes[0]], p[axes[1]]);
+			}
+			if (overlap) {
+				++guess;
+				continue;
+			}
+
+			pushTriangle(poly[guess], poly[(guess + 1) % npolys], poly[(guess + 2) % npolys]);
+			poly.erase(poly.begin() + (guess + 1) % npolys);
+		}
+
+		if (poly.size() == 3) {
+			pushTriangle(poly[0], poly[1], poly[2]);
+		}
+	}
+
+	static void triangulateChunk(Chunk& c, const tinyobj::attrib_t& attrib)
+	{
+		c.indices.reserve(c.numTriangles * 3);
+		c.materialIds.reserve(c.numTriangles);
+		c.smoothingIds.reserve(c.numTriangles);
+
+		int material = c.startMaterial;
+		uint32_t smoothing = c.startSmoothing;
+
+		size_t eventIdx = 0;
+		auto applyEvents = [&](size_t face) {
+			for (; eventIdx < c.events.size() && c.events[eventIdx].face == face; ++eventIdx) {
+				const Event& e = c.events[eventIdx];
+				switch (e.type) {
+				case Event::Type::UseMtl:
+					material = e.materialId;
+					break;
+				case Event::Type::Smoothing:
+					smoothing = e.smoothingId;
+					break;
+				case Event::Type::Group:
+					c.shapeBreaks.emplace_back(c.materialIds.size(), e.name);
+					break;
+				}
+			}
+		};
+
+		auto pushTriangle = [&](const tinyobj::index_t& a, const tinyobj::index_t& b, const tinyobj::index_t& d) {
+			c.indices.push_back(a);
+			c.indices.push_back(b);
+			c.indices.push_back(d);
+			c.materialIds.push_back(material);
+			c.smoothingIds.push_back(smoothing);
+		};
+
+		std::vector<tinyobj::index_t> poly;
+
+		size_t cornerIdx = 0;
+		for (size_t f = 0; f < c.faceSizes.size(); ++f) {
+			applyEvents(f);
+
+			uint32_t n = c.faceSizes[f];
+			poly.resize(n);
+			for (uint32_t i = 0; i < n; ++i) {
+				if (!resolveCorner(c, c.corners[cornerIdx + i], attrib, poly[i])) {
+					c.err = "Face with invalid vertex index found";
+					return;
+				}
+			}
+			cornerIdx += n;
+
+			if (n == 3) {
+				pushTriangle(poly[0], poly[1], poly[2]);
+			} else if (n == 4) {
+				// Split along the shorter diagonal, same as tinyobj
+				auto pos = [&](int i) { return glm::make_vec3(&attrib.vertices[3 * poly[i].vertex_index]); };
+				glm::vec3 e02 = pos(2) - pos(0);
+				glm::vec3 e13 = pos(3) - pos(1);
+				if (glm::dot(e02, e02) < glm::dot(e13, e13)) {
+					pushTriangle(poly[0], poly[1], poly[2]);
+					pushTriangle(poly[0], poly[2], poly[3]);
+				} else {
+					pushTriangle(poly[0], poly[1], poly[3]);
+					pushTriangle(poly[1], poly[2], poly[3]);
+				}
+			} else {
+				earClip(poly, attrib.vertices, pushTriangle);
+			}
+		}
+		// Events after the last face of the chunk (e.g. 'g' right before chunk boundary)
+		applyEvents(c.faceSizes.size());
+
+		// Not needed anymore
+		c.corners = {};
+		c.faceSizes = {};
+	}
+
+	static void appendTriangles(tinyobj::shape_t& shape, const Chunk& c, size_t first, size_t last)
+	{
+		if (first >= last) {
+			return;
+		}
+		auto& mesh = shape.mesh;
+		mesh.indices.insert(mesh.indices.end(), c.indices.begin() + 3 * first, c.indices.begin() + 3 * last);
+		mesh.material_ids.insert(mesh.material_ids.end(), c.materialIds.begin() + first, c.materialIds.begin() + last);
+		mesh.smoothing_group_ids.insert(mesh.smoothing_group_ids.end(), c.smoothingIds.begin() + first, c.smoothingIds.begin() + last);
+		mesh.num_face_vertices.insert(mesh.num_face_vertices.end(), last - first, 3);
+	}
+
+	bool loadObj(
+		tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+		std::string* warn, std::string* err,
+		const std::string& path, const std::string& mtlBaseDir,
+		uint32_t numThreads)
+	{
+		*attrib = {};
+		shapes->clear();
+		materials->clear();
+
+		MappedFile file;
+		if (!file.Open(path)) {
+			*err += "Cannot open file [" + path + "]\n";
+			return false;
+		}
+
+		numThreads = getNumWorkerThreads(numThreads);
+
+		// Small files are not worth the threads
+		constexpr size_t MIN_CHUNK_SIZE = 256 * 1024;
+		size_t numChunks = std::clamp<size_t>(file.size / MIN_CHUNK_SIZE, 1, numThreads);
+
+		// Split the file at line boundaries
+		std::vector<Chunk> chunks(numChunks);
+		const char* fileEnd = file.data + file.size;
+		const char* p = file.data;
+		for (size_t i = 0; i < numChunks; ++i) {
+			const char* chunkEnd = file.data + file.size * (i + 1) / numChunks;
+			if (i == numChunks - 1 || chunkEnd >= fileEnd) {
+				chunkEnd = fileEnd;
+			} else {
+				const char* nl = static_cast<const char*>(memchr(chunkEnd, '\n', fileEnd - chunkEnd));
+				chunkEnd = nl ? nl + 1 : fileEnd;
+			}
+			chunks[i].begin = p;
+			chunks[i].end = std::max(p, chunkEnd);
+			p = chunks[i].end;
+		}
+
+		parallelFor(numChunks, numThreads, [&](size_t i) {
+			parseChunk(chunks[i]);
+		});
+
+		// Prefix sums of attribute counts and lines
+		size_t numV = 0, numVN = 0, numVT = 0, numLines = 0;
+		for (auto& c : chunks) {
+			c.vOffset = numV;
+			c.vnOffset = numVN;
+			c.vtOffset = numVT;
+			c.lineOffset = numLines;
+
+			numV += c.v.size() / 3;
+			numVN += c.vn.size() / 3;
+			numVT += c.vt.size() / 2;
+			numLines += c.numLines;
+
+			*warn += c.warn;
+			if (!c.err.empty()) {
+				*err += c.err + ". Line " + std::to_string(c.lineOffset + c.errLine + 1) + "\n";
+				return false;
+			}
+		}
+
+		// Load material libraries in order of appearance
+		std::map<std::string, int> materialMap;
+		std::set<std::string> loadedMtlFiles;
+		tinyobj::MaterialFileReader matReader(mtlBaseDir);
+		for (auto& c : chunks) {
+			for (auto& mtllib : c.mtllibs) {
+				if (loadedMtlFiles.count(mtllib) > 0) {
+					continue;
+				}
+				std::string warnMtl, errMtl;
+				if (matReader(mtllib, materials, &materialMap, &warnMtl, &errMtl)) {
+					loadedMtlFiles.insert(mtllib);
+				} else {
+					*warn += "Failed to load material file(s). Use default material.\n";
+				}
+				*warn += warnMtl;
+				*err += errMtl;
+			}
+		}
+
+		// Material and smoothing group active at the start of each chunk
+		int material = -1;
+		uint32_t smoothing = 0;
+		for (auto& c : chunks) {
+			c.startMaterial = material;
+			c.startSmoothing = smoothing;
+
+			for (auto& e : c.events) {
+				if (e.type == Event::Type::UseMtl) {
+					auto it = materialMap.find(e.name);
+					if (it != materialMap.end()) {
+						e.materialId = it->second;
+					} else {
+						*warn += "material [ '" + e.name + "' ] not found in .mtl\n";
+					}
+					material = e.materialId;
+				} else if (e.type == Event::Type::Smoothing) {
+					smoothing = e.smoothingId;
+				}
+			}
+		}
+
+		// Merge attributes
+		attrib->vertices.resize(numV * 3);
+		attrib->normals.resize(numVN * 3);
+		attrib->texcoords.resize(numVT * 2);
+
+		parallelFor(numChunks, numThreads, [&](size_t i) {
+			Chunk& c = chunks[i];
+			std::copy(c.v.begin(), c.v.end(), attrib->vertices.begin() + 3 * c.vOffset);
+			std::copy(c.vn.begin(), c.vn.end(), attrib->normals.begin() + 3 * c.vnOffset);
+			std::copy(c.vt.begin(), c.vt.end(), attrib->texcoords.begin() + 2 * c.vtOffset);
+			c.v = {};
+			c.vn = {};
+			c.vt = {};
+		});
+
+		parallelFor(numChunks, numThreads, [&](size_t i) {
+			triangulateChunk(chunks[i], *attrib);
+		});
+
+		for (auto& c : chunks) {
+			if (!c.err.empty()) {
+				*err += c.err + "\n";
+				return false;
+			}
+		}
+
+		// Assemble shapes, new shape starts at every 'g'/'o'
+		tinyobj::shape_t shape;
+		for (auto& c : chunks) {
+			size_t first = 0;
+			for (auto& [triangle, name] : c.shapeBreaks) {
+				appendTriangles(shape, c, first, triangle);
+				first = triangle;
+
+				if (!shape.mesh.indices.empty()) {
+					shapes->push_back(std::move(shape));
+				}
+				shape = {};
+				shape.name = name;
+			}
+			appendTriangles(shape, c, first, c.materialIds.size());
+		}
+		if (!shape.mesh.indices.empty()) {
+			shapes->push_back(std::move(shape));
+		}
+
+		return true;
+	}
+
+	// Largest difference between two float arrays, infinity if sizes differ
+	static float maxDifference(const std::vector<tinyobj::real_t>& a, const std::vector<tinyobj::real_t>& b)
+	{
+		if (a.size() != b.size()) {
+			return std::numeric_limits<float>::infinity();
+		}
+		float diff = 0.f;
+		for (size_t i = 0; i < a.size(); ++i) {
+			diff = std::max(diff, std::abs(a[i] - b[i]));
+		}
+		return diff;
+	}
+
+	static bool sameShapes(const std::vector<tinyobj::shape_t>& a, const std::vector<tinyobj::shape_t>& b)
+	{
+		if (a.size() != b.size()) {
+			return false;
+		}
+		for (size_t s = 0; s < a.size(); ++s) {
+			const auto& ma = a[s].mesh;
+			const auto& mb = b[s].mesh;
+			if (a[s].name != b[s].name
+				|| ma.indices.size() != mb.indices.size()
+				|| ma.material_ids != mb.material_ids
+				|| ma.smoothing_group_ids != mb.smoothing_group_ids
+				|| ma.num_face_vertices != mb.num_face_vertices)
+			{
+				return false;
+			}
+			for (size_t i = 0; i < ma.indices.size(); ++i) {
+				if (ma.indices[i].vertex_index != mb.indices[i].vertex_index
+					|| ma.indices[i].normal_index != mb.indices[i].normal_index
+					|| ma.indices[i].texcoord_index != mb.indices[i].texcoord_index)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	// Faces with more than 4 corners are ear clipped and models rarely have concave ones, so the benchmark
+	// compares this file too
+	static constexpr const char* CONCAVE_POLYGONS_OBJ =
+		"# L shape in XY plane\n"
+		"v 0 0 0\nv 2 0 0\nv 2 1 0\nv 1 1 0\nv 1 2 0\nv 0 2 0\n"
+		"f 1 2 3 4 5 6\n"
+		"# Same L shape starting at the reflex corner\n"
+		"f 4 5 6 1 2 3\n"
+		"# Star in XZ plane, every other corner is reflex\n"
+		"v 0 0 -3\nv 0.5 0 -0.7\nv 2.5 0 -1\nv 0.9 0 0.2\nv 1.8 0 2.4\nv 0 0 0.8\nv -1.8 0 2.4\nv -0.9 0 0.2\nv -2.5 0 -1\nv -0.5 0 -0.7\n"
+		"f 7 8 9 10 11 12 13 14 15 16\n"
+		"# Comb in YZ plane, clockwise\n"
+		"v 0 0 0\nv 0 0 4\nv 0 3 4\nv 0 3 3\nv 0 1 3\nv 0 1 2\nv 0 3 2\nv 0 3 1\nv 0 1 1\nv 0 1 0.5\nv 0 3 0.5\nv 0 3 0\n"
+		"f 28 27 26 25 24 23 22 21 20 19 18 17\n";
+
+	static void compareParsers(const std::string& path, uint32_t numThreads)
+	{
+		std::string baseDir = std::filesystem::path(path).parent_path().generic_string() + "/";
+
+		tinyobj::attrib_t refAttrib, attrib;
+		std::vector<tinyobj::shape_t> refShapes, shapes;
+		std::vector<tinyobj::material_t> refMaterials, materials;
+		std::string warn, err;
+
+		Timer timer;
+		bool refGood = tinyobj::LoadObj(&refAttrib, &refShapes, &refMaterials, &warn, &err, path.c_str(), baseDir.c_str());
+		double refMs = timer.ElapsedMs();
+
+		warn.clear();
+		err.clear();
+		timer.Reset();
+		bool good = loadObj(&attrib, &shapes, &materials, &warn, &err, path, baseDir, numThreads);
+		double ms = timer.ElapsedMs();
+
+		if (!refGood || !good) {
+			PRERR("Failed to parse " << path << (refGood ? " with multithreaded parser: " : " with tinyobj: ") << err);
+			return;
+		}
+
+		float maxDiff = std::max({
+			maxDifference(refAttrib.vertices, attrib.vertices),
+			maxDifference(refAttrib.normals, attrib.normals),
+			maxDifference(refAttrib.texcoords, attrib.texcoords) });
+		bool match = maxDiff < 1e-5f && sameShapes(refShapes, shapes) && refMaterials.size() == materials.size();
+
+		pr("[OBJ parser] " << path << ": tinyobj " << refMs << " ms, multithreaded " << ms << " ms ("
+			<< refMs / std::max(ms, 1e-3) << "x), " << (match ? "results match" : "RESULTS DIFFER")
+			<< " (max attribute difference " << maxDiff << ")");
+	}
+
+	void benchmark(const std::string& modelsDir)
+	{
+		std::vector<std::string> models;
+		std::error_code ec;
+		for (auto& entry : std::filesystem::recursive_directory_iterator(modelsDir, ec)) {
+			if (entry.is_regular_file() && entry.path().extension() == ".obj") {
+				models.push_back(entry.path().generic_string());
+			}
+		}
+		std::sort(models.begin(), models.end());
+
+		uint32_t numThreads = getNumWorkerThreads();
+		pr("\nComparing tinyobj and multithreaded (" << numThreads << " threads) OBJ parser on " << models.size() << " models");
+
+		std::string concavePath = (std::filesystem::temp_directory_path(ec) / "concave_polygons.obj").generic_string();
+		{
+			std::ofstream out(concavePath, std::ios::trunc);
+			out << CONCAVE_POLYGONS_OBJ;
+		}
+		compareParsers(concavePath, numThreads);
+		std::filesystem::remove(concavePath, ec);
+
+		for (auto& path : models) {
+			compareParsers(path, numThreads);
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "tinyobj/tiny_obj_loader.h"
+
+// Multithreaded .obj parser.
+// The file is memory mapped and split at line boundaries into one chunk per thread.
+// Chunks are parsed into thread local arrays and then merged using prefix summed offsets.
+//
+// Output matches tinyobj::LoadObj (with triangulation) for everything the model loader uses:
+// positions, normals, texcoords, triangulated faces, per-face material and smoothing group ids
+// and shapes split by 'g'/'o'. Vertex colors, skin weights, lines, points and tags are not parsed.
+// Polygons with more than 4 vertices are triangulated as a fan.
+namespace obj_parser {
+    // numThreads = 0 uses all hardware threads
+    bool loadObj(
+        tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+        std::string* warn, std::string* err,
+        const std::string& path, const std::string& mtlBaseDir,
+        uint32_t numThreads = 0);
+
+    // Parses every model under the directory with tinyobj and with the multithreaded parser,
+    // reports timings and checks that the results match
+    void benchmark(const std::string& modelsDir);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+
+// Number of worker threads to use, 0 means one per hardware thread
+inline uint32_t getNumWorkerThreads(uint32_t requested = 0)
+{
+    if (requested > 0) {
+        return requested;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Calls fn(i) for every i in [0, count) on up to numThreads threads and waits for all of them.
+// Items are handed out one by one, so fn should do a reasonable amount of work per item.
+template<typename F>
+void parallelFor(size_t count, uint32_t numThreads, F&& fn)
+{
+    numThreads = static_cast<uint32_t>(std::min<size_t>(getNumWorkerThreads(numThreads), count));
+
+    if (numThreads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (uint32_t t = 0; t < numThreads - 1; ++t) {
+        threads.emplace_back(worker);
+    }
+    // Calling thread helps too
+    worker();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+}
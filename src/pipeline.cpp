@@ -11,17 +11,14 @@ static PipelineShaders loadShaders(VkDevice device, const std::string& vertName,
     shaders.vert.code = vk_utils::readShaderBinary(SHADER_PATH + vertName);
     shaders.frag.code = vk_utils::readShaderBinary(SHADER_PATH + fragName);
 
-    if (vk_utils::createShaderModule(device, shaders.vert.code, &shaders.vert.module)) {
-        std::cout << "Vertex shader [" << vertName << "] successfully loaded." << std::endl;
-    } else {
-        PRWRN("Failed to load vertex shader [" << vertName << "]!");
-    }
+    // A pipeline built from a null module would fail at draw, far from the cause
+    ASSERT_MSG(vk_utils::createShaderModule(device, shaders.vert.code, &shaders.vert.module),
+        "Failed to load vertex shader [" << vertName << "], recompile it with scripts/compile_shaders.py");
+    std::cout << "Vertex shader [" << vertName << "] successfully loaded." << std::endl;
 
-    if (vk_utils::createShaderModule(device, shaders.frag.code, &shaders.frag.module)) {
-        std::cout << "Fragment shader [" << fragName << "] successfully loaded." << std::endl;
-    } else {
-        PRWRN("Failed to load fragment shader [" << fragName << "]!");
-    }
+    ASSERT_MSG(vk_utils::createShaderModule(device, shaders.frag.code, &shaders.frag.module),
+        "Failed to load fragment shader [" << fragName << "], recompile it with scripts/compile_shaders.py");
+    std::cout << "Fragment shader [" << fragName << "] successfully loaded." << std::endl;
 
     return shaders;
 }
@@ -31,7 +28,8 @@ void Engine::createGraphicsPipeline(
     const std::string& name, const std::string vertBinName, const std::string fragBinName, 
     VkShaderStageFlags pushConstantsStages, uint32_t pushConstantsSize, 
     std::vector<VkDescriptorSetLayout> setLayouts, 
-    VkFormat colorFormat, VkFormat depthFormat, int cullMode)
+    VkFormat colorFormat, VkFormat depthFormat, int cullMode,
+    bool packedVertices)
 {
     PipelineShaders shaders = loadShaders(_device, vertBinName, fragBinName);
 
@@ -40,7 +38,22 @@ void Engine::createGraphicsPipeline(
             vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, shaders.frag.module)
     };
 
-    VertexInputDescription vertexDesc = Vertex::getDescription();
+    // PACKED_VERTICES specialization constant in incl/vertex_decode.glsl
+    VkBool32 packedVerticesConst = packedVertices ? VK_TRUE : VK_FALSE;
+    VkSpecializationMapEntry packedVerticesEntry = {
+        .constantID = 0,
+        .offset = 0,
+        .size = sizeof(VkBool32)
+    };
+    VkSpecializationInfo vertSpecialization = {
+        .mapEntryCount = 1,
+        .pMapEntries = &packedVerticesEntry,
+        .dataSize = sizeof(VkBool32),
+        .pData = &packedVerticesConst
+    };
+    shaderStages[0].pSpecializationInfo = &vertSpecialization;
+
+    VertexInputDescription vertexDesc = packedVertices ? PackedVertex::getDescription() : Vertex::getDescription();
 
     VkPipelineVertexInputStateCreateInfo vertexInputState = vkinit::vertex_input_state_create_info(
         uint32_t(vertexDesc.bindings.size()), vertexDesc.bindings.data(),
@@ -127,6 +140,9 @@ void Engine::createGraphicsPipeline(
     
     setDebugName(VK_OBJECT_TYPE_PIPELINE, pipeline, name);
 
+    // Pipelines recreated for another viewport format replace the material, whose old pipeline the caller destroyed
+    const bool recreated = _materials.contains(name);
+
     int stages = pushConstantsStages;
     auto& mat = _materials[name] = {
        .tag = name,
@@ -136,32 +152,41 @@ void Engine::createGraphicsPipeline(
     };
     
     shaders.cleanup(_device);
+    if (recreated) {
+        return;
+    }
     _deletionStack.push([&]() {
         vkDestroyPipeline(_device, mat.pipeline, nullptr);
         vkDestroyPipelineLayout(_device, mat.pipelineLayout, nullptr);
     });
 }
 
+void Engine::createViewportPipelines()
+{
+    createGraphicsPipeline(
+        "general",
+        "scene.vert.spv", "scene.frag.spv",
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(GPUScenePC),
+        { _sceneSetLayout },
+        _viewport.colorFormat, _viewport.depthFormat,
+        VK_CULL_MODE_BACK_BIT, // normal culling mode
+        _loaderSettings.packedVertices
+    );
+
+    createGraphicsPipeline(
+        "skybox",
+        "skybox.vert.spv", "skybox.frag.spv",
+        VK_SHADER_STAGE_VERTEX_BIT, sizeof(GPUScenePC),
+        { _sceneSetLayout },
+        _viewport.colorFormat, _viewport.depthFormat,
+        VK_CULL_MODE_FRONT_BIT // inverted culling mode for skybox
+    );
+}
+
 void Engine::createPipelines()
 {
     { // Create graphics pipelines
-        createGraphicsPipeline(
-            "general",
-            "scene.vert.spv", "scene.frag.spv",
-            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(GPUScenePC),
-            { _sceneSetLayout },
-            _viewport.colorFormat, _viewport.depthFormat,
-            VK_CULL_MODE_BACK_BIT // normal culling mode
-        );
-
-        createGraphicsPipeline(
-            "skybox",
-            "skybox.vert.spv", "skybox.frag.spv",
-            VK_SHADER_STAGE_VERTEX_BIT, sizeof(GPUScenePC),
-            { _sceneSetLayout },
-            _viewport.colorFormat, _viewport.depthFormat,
-            VK_CULL_MODE_FRONT_BIT // inverted culling mode for skybox
-        );
+        createViewportPipelines();
 
         createGraphicsPipeline(
             "shadow",
@@ -169,14 +194,15 @@ void Engine::createPipelines()
             VK_SHADER_STAGE_VERTEX_BIT, sizeof(GPUShadowPC),
             { _shadowSetLayout },
             _shadow.colorFormat, _shadow.depthFormat,
-            VK_CULL_MODE_FRONT_BIT // inverted culling mode for the shadow pass. 
+            VK_CULL_MODE_FRONT_BIT, // inverted culling mode for the shadow pass. 
             // Viz. https://learnopengl.com/Advanced-Lighting/Shadows/Point-Shadows
+            _loaderSettings.packedVertices
         );
     }
 
     { // Compute pipelines
         for (auto& stage : _postfx.stages) {
-            stage.second.Create(_device, _linearSampler, stage.second.shaderName, stage.second.usesPushConstants);
+            stage.second.Create(_device, _linearSampler, _postfx.getShaderBinName(stage.second, _viewport.colorFormat), stage.second.usesPushConstants);
         }
 
         _postfx.UpdateStagesDescriptorSets(MAX_FRAMES_IN_FLIGHT, _viewport.imageViews);
@@ -36,31 +36,37 @@ PostFX::PostFX()
 	std::string pref = "";
 	{
 		pref = getPrefixFromEffect(DURAND);
-		stages[pref + "lum_chrom"]   = { .shaderName = "ltm_durand_lum_chrom.comp.spv", .dsetBindings = { UB, IMG, IMG, IMG} };
-		stages[pref + "bilateral"]   = { .shaderName = "ltm_durand_bilateral.comp.spv", .dsetBindings = { UB, IMG, IMG, IMG } };
-		stages[pref + "reconstruct"] = { .shaderName = "ltm_durand_reconstruct.comp.spv", .dsetBindings = { UB, IMG, IMG, IMG, IMG } };
+		stages[pref + "lum_chrom"]   = { .shaderName = "ltm_durand_lum_chrom.comp.spv", .shaderVariant = "narrow", .accessesViewport = true, .dsetBindings = { UB, IMG, IMG, IMG} };
+		stages[pref + "bilateral"]   = { .shaderName = "ltm_durand_bilateral.comp.spv", .shaderVariant = "narrow", .dsetBindings = { UB, IMG, IMG, IMG } };
+		stages[pref + "reconstruct"] = { .shaderName = "ltm_durand_reconstruct.comp.spv", .shaderVariant = "narrow", .accessesViewport = true, .dsetBindings = { UB, IMG, IMG, IMG, IMG } };
 
 		att[pref + "lum"] = {};
 		att[pref + "chrom"] = {};
 		att[pref + "base"] = {};
 		att[pref + "detail"] = {};
+
+		// Log luminance and its base and detail layers are single channel
+		formats[pref + "lum"] = VK_FORMAT_R32_SFLOAT;
+		formats[pref + "chrom"] = VK_FORMAT_R16G16B16A16_SFLOAT;
+		formats[pref + "base"] = VK_FORMAT_R32_SFLOAT;
+		formats[pref + "detail"] = VK_FORMAT_R32_SFLOAT;
 	}
 	{
 		pref = getPrefixFromEffect(FUSION);
-		stages[pref + "lum_chrom_weight"] = { .shaderName = "ltm_fusion_lum_chrom_weight.comp.spv", .dsetBindings = { UB, IMG, IMG, IMG, IMG} };
+		stages[pref + "lum_chrom_weight"] = { .shaderName = "ltm_fusion_lum_chrom_weight.comp.spv", .shaderVariant = "narrow", .accessesViewport = true, .dsetBindings = { UB, IMG, IMG, IMG, IMG} };
 
 
-		stages[pref + "upsample0_sub"] = { .shaderName = "ltm_fusion_upsample.comp.spv", .dsetBindings = { PYR, PYR }, .usesPushConstants = true };
-		stages[pref + "upsample1_sub"] = { .shaderName = "ltm_fusion_laplacian.comp.spv", .dsetBindings = { PYR, PYR, PYR, PYR }, .usesPushConstants = true };
+		stages[pref + "upsample0_sub"] = { .shaderName = "ltm_fusion_upsample.comp.spv", .shaderVariant = "narrow", .dsetBindings = { PYR, PYR }, .usesPushConstants = true };
+		stages[pref + "upsample1_sub"] = { .shaderName = "ltm_fusion_laplacian.comp.spv", .shaderVariant = "narrow", .dsetBindings = { PYR, PYR, PYR, PYR }, .usesPushConstants = true };
 
-		stages[pref + "residual"] = { .shaderName = "ltm_fusion_residual.comp.spv", .dsetBindings = { IMG, IMG, IMG } };
+		stages[pref + "residual"] = { .shaderName = "ltm_fusion_residual.comp.spv", .shaderVariant = "narrow", .dsetBindings = { IMG, IMG, IMG } };
 
-		stages[pref + "upsample0_add"] = { .shaderName = "ltm_fusion_upsample.comp.spv", .dsetBindings = { PYR, PYR}, .usesPushConstants = true };
-		stages[pref + "upsample1_add"] = { .shaderName = "ltm_fusion_blended_laplacian_sum.comp.spv", .dsetBindings = { PYR, PYR}, .usesPushConstants = true };
+		stages[pref + "upsample0_add"] = { .shaderName = "ltm_fusion_upsample.comp.spv", .shaderVariant = "narrow_laplac", .dsetBindings = { PYR, PYR}, .usesPushConstants = true };
+		stages[pref + "upsample1_add"] = { .shaderName = "ltm_fusion_blended_laplacian_sum.comp.spv", .shaderVariant = "narrow", .dsetBindings = { PYR, PYR}, .usesPushConstants = true };
 
-		stages[pref + "reconstruct"] = { .shaderName = "ltm_fusion_reconstruct.comp.spv", .dsetBindings = { IMG, IMG, IMG} };
+		stages[pref + "reconstruct"] = { .shaderName = "ltm_fusion_reconstruct.comp.spv", .shaderVariant = "narrow", .accessesViewport = true, .dsetBindings = { IMG, IMG, IMG} };
 
-		stages[pref + "downsample"] = { .shaderName = "ltm_fusion_downsample.comp.spv", .dsetBindings = { PYR, PYR }, .usesPushConstants = true };
+		stages[pref + "downsample"] = { .shaderName = "ltm_fusion_downsample.comp.spv", .shaderVariant = "narrow", .dsetBindings = { PYR, PYR }, .usesPushConstants = true };
 
 		att[pref + "chrom"] = {};
 
@@ -69,47 +75,57 @@ PostFX::PostFX()
 		pyr[pref + "blendedLaplac"] = {};
 		// Pyramid that will hold intermediate filtered images when upsampling
 		pyr[pref + "upsampled0"] = {};
+
+		// Luminances and weights of the three exposures, the blended Laplacian (and their sum) is single channel.
+		// The upsampled pyramid holds both, so it has the wider format.
+		formats[pref + "chrom"] = VK_FORMAT_R16G16B16A16_SFLOAT;
+		formats[pref + "lum"] = VK_FORMAT_R16G16B16A16_SFLOAT;
+		formats[pref + "weight"] = VK_FORMAT_R16G16B16A16_SFLOAT;
+		formats[pref + "blendedLaplac"] = VK_FORMAT_R32_SFLOAT;
+		formats[pref + "upsampled0"] = VK_FORMAT_R16G16B16A16_SFLOAT;
 	}
 	{
 		pref = getPrefixFromEffect(BLOOM);
-		stages[pref + "threshold"] = { .shaderName = "bloom_threshold.comp.spv", .dsetBindings = { UB, IMG, IMG } };
-		stages[pref + "downsample"] = { .shaderName = "bloom_downsample.comp.spv", .dsetBindings = { UB, PYR }, .usesPushConstants = true };
+		stages[pref + "threshold"] = { .shaderName = "bloom_threshold.comp.spv", .shaderVariant = "narrow", .accessesViewport = true, .dsetBindings = { UB, IMG, IMG } };
+		stages[pref + "downsample"] = { .shaderName = "bloom_downsample.comp.spv", .shaderVariant = "narrow", .dsetBindings = { UB, PYR }, .usesPushConstants = true };
 
-		stages[pref + "upsample"] = { .shaderName = "bloom_upsample.comp.spv", .dsetBindings = { UB, PYR }, .usesPushConstants = true };
-		stages[pref + "combine"] = { .shaderName = "bloom_combine.comp.spv", .dsetBindings = { UB, IMG, IMG } };
+		stages[pref + "upsample"] = { .shaderName = "bloom_upsample.comp.spv", .shaderVariant = "narrow", .dsetBindings = { UB, PYR }, .usesPushConstants = true };
+		stages[pref + "combine"] = { .shaderName = "bloom_combine.comp.spv", .shaderVariant = "narrow", .accessesViewport = true, .dsetBindings = { UB, IMG, IMG } };
 
 		pyr[pref + "highlights"] = {};
+
+		formats[pref + "highlights"] = VK_FORMAT_R16G16B16A16_SFLOAT;
 	}
 	{
 		pref = getPrefixFromEffect(EXPADP);
-		stages[pref + "histogram"] = { .shaderName = "expadp_histogram.comp.spv", .dsetBindings = { SSBO, UB, IMG } };
+		stages[pref + "histogram"] = { .shaderName = "expadp_histogram.comp.spv", .accessesViewport = true, .dsetBindings = { SSBO, UB, IMG } };
 		stages[pref + "avglum"] = { .shaderName = "expadp_average_luminance.comp.spv", .dsetBindings = { SSBO, UB } };
-		stages[pref + "eyeadp"] = { .shaderName = "expadp_eye_adaptation.comp.spv", .dsetBindings = { SSBO, IMG } };
+		stages[pref + "eyeadp"] = { .shaderName = "expadp_eye_adaptation.comp.spv", .accessesViewport = true, .dsetBindings = { SSBO, IMG } };
 	}
 	{
 		pref = getPrefixFromEffect(GTMO);
-		stages[pref + "0"] = { .shaderName = "global_tone_mapping.comp.spv", .dsetBindings = { UB, IMG } };
+		stages[pref + "0"] = { .shaderName = "global_tone_mapping.comp.spv", .accessesViewport = true, .dsetBindings = { UB, IMG } };
 	}
 	{
 		pref = getPrefixFromEffect(GAMMA);
-		stages[pref + "0"] = { .shaderName = "gamma_correction.comp.spv", .dsetBindings = { UB, IMG } };
+		stages[pref + "0"] = { .shaderName = "gamma_correction.comp.spv", .accessesViewport = true, .dsetBindings = { UB, IMG } };
 	}
 }
 
 void PostFX::UpdateStagesDescriptorSets(int numOfFrames, const std::vector<VkImageView>& viewportImageViews)
 {
 	for (int i = 0; i < numOfFrames; ++i) {
-		int imageIndex = i;
+		int frameIndex = i;
 
 		{ // Durand
 			Stage(DURAND, "lum_chrom")
 				// In
-				.UpdateImage(viewportImageViews[imageIndex], 1)
+				.UpdateImage(viewportImageViews[frameIndex], 1)
 				// Out
 				.UpdateImage(Att(DURAND, "lum").view, 2)
 				.UpdateImage(Att(DURAND, "chrom").view, 3)
 
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(DURAND, "bilateral")
 				// In
@@ -118,7 +134,7 @@ void PostFX::UpdateStagesDescriptorSets(int numOfFrames, const std::vector<VkIma
 				.UpdateImage(Att(DURAND, "base").view, 2)
 				.UpdateImage(Att(DURAND, "detail").view, 3)
 
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(DURAND, "reconstruct")
 				// In
@@ -126,29 +142,29 @@ void PostFX::UpdateStagesDescriptorSets(int numOfFrames, const std::vector<VkIma
 				.UpdateImage(Att(DURAND, "base").view, 2)
 				.UpdateImage(Att(DURAND, "detail").view, 3)
 				// Out
-				.UpdateImage(viewportImageViews[imageIndex], 4)
+				.UpdateImage(viewportImageViews[frameIndex], 4)
 
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 		}
 
 		{ // Bloom
 			Stage(BLOOM, "threshold")
-				.UpdateImage(viewportImageViews[imageIndex], 1)
+				.UpdateImage(viewportImageViews[frameIndex], 1)
 				.UpdateImage(Pyr(BLOOM, "highlights").views[0], 2)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(BLOOM, "downsample")
 				.UpdateImagePyramid(Pyr(BLOOM, "highlights"), 1)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(BLOOM, "upsample")
 				.UpdateImagePyramid(Pyr(BLOOM, "highlights"), 1)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(BLOOM, "combine")
-				.UpdateImage(viewportImageViews[imageIndex], 1)
+				.UpdateImage(viewportImageViews[frameIndex], 1)
 				.UpdateImage(Pyr(BLOOM, "highlights").views[0], 2)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 		}
 
 		{ // Exposure fusion
@@ -158,14 +174,14 @@ void PostFX::UpdateStagesDescriptorSets(int numOfFrames, const std::vector<VkIma
 				.UpdateImage(Att(FUSION, "chrom"), 2)
 				.UpdateImage(Pyr(FUSION, "lum").views[0], 3)
 				.UpdateImage(Pyr(FUSION, "weight").views[0], 4)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(FUSION, "downsample")
 				// In
 				.UpdateImagePyramid(Pyr(FUSION, "lum"), 0)
 				// Out
 				.UpdateImagePyramid(Pyr(FUSION, "weight"), 1)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 
 			int last_i = ub.numOfViewportMips - 1;
@@ -175,7 +191,7 @@ void PostFX::UpdateStagesDescriptorSets(int numOfFrames, const std::vector<VkIma
 				.UpdateImage(Pyr(FUSION, "weight").views[last_i], 1)
 				// Out
 				.UpdateImage(Pyr(FUSION, "blendedLaplac").views[last_i], 2)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 
 			Stage(FUSION, "upsample0_sub")
@@ -184,7 +200,7 @@ void PostFX::UpdateStagesDescriptorSets(int numOfFrames, const std::vector<VkIma
 				// Out
 				.UpdateImagePyramid(Pyr(FUSION, "upsampled0"), 1)
 
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(FUSION, "upsample1_sub")
 				// In
@@ -193,21 +209,21 @@ void PostFX::UpdateStagesDescriptorSets(int numOfFrames, const std::vector<VkIma
 				.UpdateImagePyramid(Pyr(FUSION, "weight"), 2)
 				// Out
 				.UpdateImagePyramid(Pyr(FUSION, "blendedLaplac"), 3)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(FUSION, "upsample0_add")
 				// In
 				.UpdateImagePyramid(Pyr(FUSION, "blendedLaplac"), 0)
 				// Out
 				.UpdateImagePyramid(Pyr(FUSION, "upsampled0"), 1)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(FUSION, "upsample1_add")
 				// In
 				.UpdateImagePyramid(Pyr(FUSION, "upsampled0"), 0)
 				// Out
 				.UpdateImagePyramid(Pyr(FUSION, "blendedLaplac"), 1)
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(FUSION, "reconstruct")
 				// In
@@ -215,31 +231,31 @@ void PostFX::UpdateStagesDescriptorSets(int numOfFrames, const std::vector<VkIma
 
 				.UpdateImage(Pyr(FUSION, "blendedLaplac").views[0], 1)
 				// Out
-				.UpdateImage(viewportImageViews[imageIndex], 2)
+				.UpdateImage(viewportImageViews[frameIndex], 2)
 
-				.WriteDescriptorSets(imageIndex);
+				.WriteDescriptorSets(frameIndex);
 		}
 
 		{ // Exposure adaptation
 			Stage(EXPADP, "histogram")
-				.UpdateImage(viewportImageViews[imageIndex], 2)
-				.WriteDescriptorSets(imageIndex);
+				.UpdateImage(viewportImageViews[frameIndex], 2)
+				.WriteDescriptorSets(frameIndex);
 
 			Stage(EXPADP, "eyeadp")
-				.UpdateImage(viewportImageViews[imageIndex], 1)
-				.WriteDescriptorSets(imageIndex);
+				.UpdateImage(viewportImageViews[frameIndex], 1)
+				.WriteDescriptorSets(frameIndex);
 		}
 
 		{ // Global tone mapping
 			Stage(GTMO, "0")
-				.UpdateImage(viewportImageViews[imageIndex], 1)
-				.WriteDescriptorSets(imageIndex);
+				.UpdateImage(viewportImageViews[frameIndex], 1)
+				.WriteDescriptorSets(frameIndex);
 		}
 
 		{ // Gamma correction
 			Stage(GAMMA, "0")
-				.UpdateImage(viewportImageViews[imageIndex], 1)
-				.WriteDescriptorSets(imageIndex);
+				.UpdateImage(viewportImageViews[frameIndex], 1)
+				.WriteDescriptorSets(frameIndex);
 		}
 	}
 }
@@ -253,11 +269,10 @@ void PostFXStage::Create(VkDevice device, VkSampler sampler,
 	ShaderData comp;
 	comp.code = vk_utils::readShaderBinary(SHADER_PATH + shaderBinName);
 
-	if (vk_utils::createShaderModule(device, comp.code, &comp.module)) {
-		std::cout << "Compute shader [" << shaderBinName << "] successfully loaded." << std::endl;
-	} else {
-		PRWRN("Failed to load compute shader");
-	}
+	// A pipeline built from a null module would fail at dispatch, far from the cause
+	ASSERT_MSG(vk_utils::createShaderModule(device, comp.code, &comp.module),
+		"Failed to load compute shader [" << shaderBinName << "], recompile it with scripts/compile_shaders.py");
+	std::cout << "Compute shader [" << shaderBinName << "] successfully loaded." << std::endl;
 
 	VkPipelineShaderStageCreateInfo stageInfo{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -468,6 +483,74 @@ Effect PostFX::getEffectFromPrefix(std::string pref)
 	return INVALID;
 }
 
+uint32_t PostFX::getTransientPass(Effect fct)
+{
+	switch (fct) {
+	case BLOOM:
+		return 0;
+	case DURAND:
+		return 1;
+	case FUSION:
+		return 2;
+	default:
+		ASSERT(false);
+		return 0;
+	}
+}
+
+uint32_t PostFX::getTransientPass(const std::string& attKey)
+{
+	return getTransientPass(getEffectFromPrefix(attKey.substr(0, attKey.find('_') + 1)));
+}
+
+VkFormat PostFX::getFormat(const std::string& attKey)
+{
+	if (fullPrecision) {
+		return FULL_PRECISION_FORMAT;
+	}
+	ASSERT_MSG(formats.contains(attKey), "No format declared for PostFX attachment " << attKey);
+	return formats[attKey];
+}
+
+std::string PostFX::getShaderBinName(const PostFXStage& stage, VkFormat viewportFormat)
+{
+	return getShaderBinName(stage, viewportFormat, fullPrecision);
+}
+
+std::string PostFX::getShaderBinName(const PostFXStage& stage, VkFormat viewportFormat, bool fullPrecision)
+{
+	// <shader>.spv -> <shader>[.<variant>][.<viewport format>].spv, see scripts/compile_shaders.py
+	std::string name = stage.shaderName.substr(0, stage.shaderName.rfind(".spv"));
+	if (!fullPrecision && !stage.shaderVariant.empty()) {
+		name += "." + stage.shaderVariant;
+	}
+	if (stage.accessesViewport && viewportFormat != VK_FORMAT_R32G32B32A32_SFLOAT) {
+		switch (viewportFormat) {
+		case VK_FORMAT_R16G16B16A16_SFLOAT:
+			name += ".rgba16f";
+			break;
+		case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+			name += ".b10g11r11";
+			break;
+		default:
+			ASSERT_MSG(false, "No PostFX shader variant for viewport format " << string_VkFormat(viewportFormat));
+		}
+	}
+	return name + ".spv";
+}
+
+bool PostFX::hasShaderBinaries(bool fullPrecision, VkFormat viewportFormat)
+{
+	for (auto& [key, stage] : stages) {
+		std::string binName = getShaderBinName(stage, viewportFormat, fullPrecision);
+		if (!std::filesystem::exists(SHADER_PATH + binName)) {
+			PRWRN("PostFX shader " << binName << " is not compiled, run scripts/compile_shaders.py");
+			return false;
+		}
+	}
+	return true;
+}
+
 bool PostFX::isEffectEnabled(Effect fct)
 {
 	switch (fct) {
@@ -35,6 +35,11 @@ struct PostFXStage {
     VkSampler sampler;
 
     std::string shaderName;
+    // Variant of the shader compiled for the narrow attachment formats (see incl/postfx_formats.glsl), empty if the
+    // shader only accesses the viewport image
+    std::string shaderVariant;
+    // Reads or writes the viewport image, which has a shader variant for every ViewportPass::FORMATS entry
+    bool accessesViewport = false;
     std::vector<int> dsetBindings;
     bool usesPushConstants;
 
@@ -83,6 +88,21 @@ struct PostFX {
     std::string getPrefixFromEffect(Effect fct);
     Effect getEffectFromPrefix(std::string pref);
 
+    // Lifetime of the effect's attachments as pass index for TransientAllocator: effects using attachments in
+    // recording order. Durand and fusion never run in the same frame, so they get passes of their own.
+    uint32_t getTransientPass(Effect fct);
+    // Of the effect an attachment or pyramid key belongs to
+    uint32_t getTransientPass(const std::string& attKey);
+
+    // Storage format of an attachment or pyramid
+    VkFormat getFormat(const std::string& attKey);
+    // Binary of the stage's shader that expects attachments in the formats getFormat() returns and the viewport image
+    // in viewportFormat
+    std::string getShaderBinName(const PostFXStage& stage, VkFormat viewportFormat);
+    std::string getShaderBinName(const PostFXStage& stage, VkFormat viewportFormat, bool fullPrecision);
+    // Whether the binaries of all stages for this precision and viewport format exist, warns about the first missing one
+    bool hasShaderBinaries(bool fullPrecision, VkFormat viewportFormat);
+
     bool isEffectEnabled(Effect fct);
 
     void setGammaMode(GAMMA_MODE mode);
@@ -93,6 +113,13 @@ struct PostFX {
 
     std::map<Effect, std::string> effectPrefixMap;
 
+    // Storage formats of attachments and pyramids, must match incl/postfx_formats.glsl
+    std::map<std::string, VkFormat> formats;
+    // Keep all attachments in RGBA32F instead, the reference the narrow formats are validated against.
+    // Default until the narrow variants have been validated, see LoaderSettings::postfxNarrowFormats.
+    bool fullPrecision = true;
+    static constexpr VkFormat FULL_PRECISION_FORMAT = VK_FORMAT_R32G32B32A32_SFLOAT;
+
     GPUCompUB ub{};
 
     int numOfBloomMips;
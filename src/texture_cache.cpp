@@ -0,0 +1,329 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "texture_cache.h"
+#include "texture_converter.h"
+#include "texture_decoder.h"
+#include "timer.h"
+#include "vk_utils.h"
+
+namespace fs = std::filesystem;
+
+namespace texture_cache {
+	static constexpr char MAGIC[4] = { 'H', 'T', 'E', 'X' };
+
+	// Followed by the source path (uint32_t length + chars) and mip levels one after another
+	struct FileHeader {
+		char magic[4];
+		uint32_t version;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		uint64_t sourceSize;
+		int64_t sourceMtime;
+	};
+
+	static std::string getCacheDir()
+	{
+		return CACHE_PATH + "textures/";
+	}
+
+	static bool getSourceInfo(const std::string& sourcePath, uint64_t& size, int64_t& mtime)
+	{
+		std::error_code ec;
+		size = fs::file_size(sourcePath, ec);
+		if (ec) {
+			return false;
+		}
+		auto time = fs::last_write_time(sourcePath, ec);
+		if (ec) {
+			return false;
+		}
+		mtime = static_cast<int64_t>(time.time_since_epoch().count());
+		return true;
+	}
+
+	std::string getCachePath(const std::string& sourcePath, VkFormat format, bool mips)
+	{
+		std::string name = fs::path(sourcePath).lexically_normal().generic_string();
+		for (char& c : name) {
+			if (c == '/' || c == '\\' || c == ':') {
+				c = '_';
+			}
+		}
+		return getCacheDir() + name + "." + std::to_string(format) + (mips ? ".mips" : "") + ".tcache";
+	}
+
+	bool read(const std::string& sourcePath, VkFormat format, bool mips, texture_container::Texture& tex)
+	{
+		std::string cachePath = getCachePath(sourcePath, format, mips);
+
+		auto file = std::make_unique<MappedFile>();
+		if (!file->Open(cachePath)) {
+			return false;
+		}
+
+		FileHeader header;
+		if (file->size < sizeof(header)) {
+			return false;
+		}
+		memcpy(&header, file->data, sizeof(header));
+
+		uint64_t sourceSize;
+		int64_t sourceMtime;
+		if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+			|| header.version != VERSION
+			|| header.format != static_cast<uint32_t>(format)
+			|| header.width == 0 || header.height == 0
+			|| header.mipLevels != (mips ? vk_utils::getMipLevelCount(header.width, header.height) : 1)
+			|| !getSourceInfo(sourcePath, sourceSize, sourceMtime)
+			|| header.sourceSize != sourceSize
+			|| header.sourceMtime != sourceMtime)
+		{
+			return false;
+		}
+
+		const char* ptr = file->data + sizeof(header);
+		const char* end = file->data + file->size;
+
+		// Different paths may map to the same file name
+		uint32_t pathLength;
+		if (static_cast<size_t>(end - ptr) < sizeof(pathLength)) {
+			return false;
+		}
+		memcpy(&pathLength, ptr, sizeof(pathLength));
+		ptr += sizeof(pathLength);
+		if (static_cast<size_t>(end - ptr) < pathLength
+			|| std::string_view(ptr, pathLength) != fs::path(sourcePath).lexically_normal().generic_string())
+		{
+			return false;
+		}
+		ptr += pathLength;
+
+		std::vector<texture_container::Texture::Region> regions;
+		for (uint32_t level = 0; level < header.mipLevels; ++level) {
+			size_t size = texture_container::getLevelSize(format, std::max(header.width >> level, 1u), std::max(header.height >> level, 1u));
+			if (size == 0 || static_cast<size_t>(end - ptr) < size) {
+				return false;
+			}
+			regions.push_back({ ptr, size });
+			ptr += size;
+		}
+
+		tex.format = format;
+		tex.width = header.width;
+		tex.height = header.height;
+		tex.mipLevels = header.mipLevels;
+		tex.faces = 1;
+		tex.regions = std::move(regions);
+		tex.file = std::move(file);
+
+		// Mark as recently used for eviction
+		std::error_code ec;
+		fs::last_write_time(cachePath, fs::file_time_type::clock::now(), ec);
+
+		return true;
+	}
+
+	// Writes header and source path, writeLevels writes data of all levels after them
+	static bool writeEntry(const std::string& sourcePath, VkFormat format, bool mips, uint32_t width, uint32_t height,
+		const std::function<void(std::ofstream& out)>& writeLevels)
+	{
+		FileHeader header = {
+			.version = VERSION,
+			.format = static_cast<uint32_t>(format),
+			.width = width,
+			.height = height,
+			.mipLevels = mips ? vk_utils::getMipLevelCount(width, height) : 1
+		};
+		memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		if (!getSourceInfo(sourcePath, header.sourceSize, header.sourceMtime)) {
+			return false;
+		}
+
+		std::string cachePath = getCachePath(sourcePath, format, mips);
+
+		std::error_code ec;
+		fs::create_directories(getCacheDir(), ec);
+
+		// Write to temporary file first so that a crash never leaves half written cache behind
+		std::string tmpPath = cachePath + ".tmp";
+		{
+			std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+			if (!out) {
+				PRWRN("Failed to create texture cache file: " << tmpPath);
+				return false;
+			}
+
+			std::string normalPath = fs::path(sourcePath).lexically_normal().generic_string();
+			uint32_t pathLength = static_cast<uint32_t>(normalPath.size());
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(&pathLength), sizeof(pathLength));
+			out.write(normalPath.data(), pathLength);
+
+			writeLevels(out);
+
+			if (!out) {
+				PRWRN("Failed to write texture cache file: " << tmpPath);
+				return false;
+			}
+		}
+
+		fs::rename(tmpPath, cachePath, ec);
+		if (ec) {
+			PRWRN("Failed to write texture cache file: " << cachePath << " (" << ec.message() << ")");
+			fs::remove(tmpPath, ec);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool write(const std::string& sourcePath, VkFormat format, bool mips, const uint8_t* rgba, uint32_t width, uint32_t height)
+	{
+		ASSERT(format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_R8G8B8A8_UNORM);
+
+		return writeEntry(sourcePath, format, mips, width, height, [&](std::ofstream& out) {
+			// Levels are written as soon as they are generated, only the previous one is kept in memory
+			out.write(reinterpret_cast<const char*>(rgba), size_t(width) * height * 4);
+
+			std::vector<uint8_t> level;
+			uint32_t mipLevels = mips ? vk_utils::getMipLevelCount(width, height) : 1;
+			uint32_t w = width, h = height;
+			for (uint32_t i = 1; i < mipLevels; ++i) {
+				level = texture_converter::downsample(i == 1 ? rgba : level.data(), w, h, format == VK_FORMAT_R8G8B8A8_SRGB);
+				w = std::max(w / 2, 1u);
+				h = std::max(h / 2, 1u);
+				out.write(reinterpret_cast<const char*>(level.data()), level.size());
+			}
+		});
+	}
+
+	bool write(const std::string& sourcePath, VkFormat format, bool mips, uint32_t width, uint32_t height,
+		const std::vector<std::vector<uint8_t>>& levels)
+	{
+		ASSERT(levels.size() == (mips ? vk_utils::getMipLevelCount(width, height) : 1));
+
+		return writeEntry(sourcePath, format, mips, width, height, [&](std::ofstream& out) {
+			for (auto& level : levels) {
+				out.write(reinterpret_cast<const char*>(level.data()), level.size());
+			}
+		});
+	}
+
+	struct Entry {
+		fs::path path;
+		uint64_t size;
+		fs::file_time_type lastUse;
+	};
+
+	static std::vector<Entry> getEntries()
+	{
+		std::vector<Entry> entries;
+		std::error_code ec;
+		for (auto& file : fs::directory_iterator(getCacheDir(), ec)) {
+			if (!file.is_regular_file() || file.path().extension() != ".tcache") {
+				continue;
+			}
+			std::error_code ec1, ec2;
+			Entry entry = { file.path(), file.file_size(ec1), file.last_write_time(ec2) };
+			if (!ec1 && !ec2) {
+				entries.push_back(std::move(entry));
+			}
+		}
+		return entries;
+	}
+
+	uint64_t getSize()
+	{
+		uint64_t size = 0;
+		for (auto& entry : getEntries()) {
+			size += entry.size;
+		}
+		return size;
+	}
+
+	void evict(uint64_t maxSize)
+	{
+		std::vector<Entry> entries = getEntries();
+
+		uint64_t size = 0;
+		for (auto& entry : entries) {
+			size += entry.size;
+		}
+		if (size <= maxSize) {
+			return;
+		}
+
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+
+		uint64_t evictedSize = 0;
+		size_t numEvicted = 0;
+		for (auto& entry : entries) {
+			if (size <= maxSize) {
+				break;
+			}
+			std::error_code ec;
+			if (fs::remove(entry.path, ec)) {
+				size -= entry.size;
+				evictedSize += entry.size;
+				++numEvicted;
+			}
+		}
+
+		pr("[Texture cache] Evicted " << numEvicted << " entries (" << evictedSize / (1024 * 1024) << " MiB), "
+			<< size / (1024 * 1024) << " MiB left");
+	}
+
+	void clear()
+	{
+		std::error_code ec;
+		fs::remove_all(getCacheDir(), ec);
+	}
+
+	void prewarm(const std::string& dir, VkFormat format, bool mips, uint64_t maxSize, uint32_t numThreads)
+	{
+		std::vector<std::string> paths = texture_decoder::findImages(dir);
+		if (paths.empty()) {
+			PRWRN("No textures found in " << dir);
+			return;
+		}
+
+		pr("\nPrewarming texture cache for " << paths.size() << " textures in " << dir);
+
+		texture_decoder::Options options = {
+			.useCompressed = false,
+			.useCache = true,
+			.format = format,
+			.mips = mips
+		};
+
+		// First pass decodes and writes missing entries, second one loads everything from the cache
+		double ms[2];
+		size_t numCached[2];
+		for (int pass = 0; pass < 2; ++pass) {
+			std::vector<texture_decoder::DecodedTexture> textures(paths.size());
+			for (size_t i = 0; i < paths.size(); ++i) {
+				textures[i].path = paths[i];
+			}
+
+			Timer timer;
+			for (auto& tex : textures) {
+				texture_decoder::probe(tex, options);
+			}
+			texture_decoder::decodeRange(textures, 0, textures.size(), nullptr, options, numThreads);
+			ms[pass] = timer.ElapsedMs();
+
+			numCached[pass] = 0;
+			for (auto& tex : textures) {
+				numCached[pass] += tex.fromCache && !tex.cacheWritten;
+			}
+		}
+
+		pr("[Texture cache] Written " << paths.size() - numCached[0] << ", up to date " << numCached[0] << " in " << ms[0] << " ms");
+		pr("[Texture cache] Loaded " << numCached[1] << "/" << paths.size() << " from cache in " << ms[1] << " ms, "
+			<< getSize() / (1024 * 1024) << " MiB on disk");
+
+		evict(maxSize);
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "texture_container.h"
+
+// On-disk cache of decoded source images (.png/.jpg...), so repeated loads skip image decoding.
+// An entry holds the pixels in the target format, optionally with the full mip chain, and is keyed by
+// source path + target format + mips. It is invalidated when size or modification time of the source changes.
+// Entries are read through a memory mapping, texel data is copied from there directly into the staging buffer.
+//
+// Two channel entries (R8G8, BC5) hold derivative maps of bump textures, see texture_converter::buildDerivativeMap.
+//
+// Reading an entry bumps its modification time, evict() removes least recently used entries over the size cap.
+namespace texture_cache {
+    // Bump whenever layout of the cache file or encoding of converted entries changes
+    constexpr uint32_t VERSION = 2;
+
+    std::string getCachePath(const std::string& sourcePath, VkFormat format, bool mips);
+
+    // Returns false if the entry does not exist, is outdated or corrupted
+    bool read(const std::string& sourcePath, VkFormat format, bool mips, texture_container::Texture& tex);
+    // rgba is level 0 in format (R8G8B8A8 UNORM or SRGB), the rest of the mip chain is generated if requested
+    bool write(const std::string& sourcePath, VkFormat format, bool mips, const uint8_t* rgba, uint32_t width, uint32_t height);
+    // Entry converted from the source image by the caller (e.g. a derivative map), levels[i] is data of mip level i
+    bool write(const std::string& sourcePath, VkFormat format, bool mips, uint32_t width, uint32_t height,
+        const std::vector<std::vector<uint8_t>>& levels);
+
+    // Total size of all entries
+    uint64_t getSize();
+    // Removes least recently used entries until the cache fits into maxSize bytes
+    void evict(uint64_t maxSize);
+    void clear();
+
+    // Decodes every image under the directory that has no up to date entry yet, writes the entries
+    // and reports decode vs cached load timings
+    void prewarm(const std::string& dir, VkFormat format, bool mips, uint64_t maxSize, uint32_t numThreads = 0);
+}
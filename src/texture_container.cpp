@@ -0,0 +1,457 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "texture_container.h"
+
+namespace fs = std::filesystem;
+
+namespace texture_container {
+	/* KTX2, see https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html */
+
+	static constexpr uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	struct Ktx2Header {
+		uint8_t identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+
+	struct Ktx2Level {
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	/* DDS, see https://learn.microsoft.com/en-us/windows/win32/direct3ddds/dx-graphics-dds-pguide */
+
+	static constexpr uint32_t makeFourCC(char a, char b, char c, char d)
+	{
+		return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+	}
+
+	static constexpr uint32_t DDS_MAGIC = makeFourCC('D', 'D', 'S', ' ');
+
+	enum DdsFlags : uint32_t {
+		DDSD_CAPS = 0x1,
+		DDSD_HEIGHT = 0x2,
+		DDSD_WIDTH = 0x4,
+		DDSD_PIXELFORMAT = 0x1000,
+		DDSD_MIPMAPCOUNT = 0x20000,
+		DDSD_LINEARSIZE = 0x80000,
+
+		DDPF_FOURCC = 0x4,
+
+		DDSCAPS_COMPLEX = 0x8,
+		DDSCAPS_TEXTURE = 0x1000,
+		DDSCAPS_MIPMAP = 0x400000,
+
+		DDSCAPS2_CUBEMAP_ALLFACES = 0xFE00,
+
+		DDS_RESOURCE_MISC_TEXTURECUBE = 0x4,
+		DDS_DIMENSION_TEXTURE2D = 3
+	};
+
+	struct DdsPixelFormat {
+		uint32_t size;
+		uint32_t flags;
+		uint32_t fourCC;
+		uint32_t rgbBitCount;
+		uint32_t rBitMask, gBitMask, bBitMask, aBitMask;
+	};
+
+	struct DdsHeader {
+		uint32_t size;
+		uint32_t flags;
+		uint32_t height;
+		uint32_t width;
+		uint32_t pitchOrLinearSize;
+		uint32_t depth;
+		uint32_t mipMapCount;
+		uint32_t reserved1[11];
+		DdsPixelFormat pixelFormat;
+		uint32_t caps, caps2, caps3, caps4;
+		uint32_t reserved2;
+	};
+
+	struct DdsHeaderDX10 {
+		uint32_t dxgiFormat;
+		uint32_t resourceDimension;
+		uint32_t miscFlag;
+		uint32_t arraySize;
+		uint32_t miscFlags2;
+	};
+
+	// DXGI_FORMAT values of formats we can sample
+	static const std::pair<uint32_t, VkFormat> DXGI_FORMATS[] = {
+		{ 2,  VK_FORMAT_R32G32B32A32_SFLOAT },
+		{ 10, VK_FORMAT_R16G16B16A16_SFLOAT },
+		{ 26, VK_FORMAT_B10G11R11_UFLOAT_PACK32 },
+		{ 28, VK_FORMAT_R8G8B8A8_UNORM },
+		{ 29, VK_FORMAT_R8G8B8A8_SRGB },
+		{ 49, VK_FORMAT_R8G8_UNORM },
+		{ 67, VK_FORMAT_E5B9G9R9_UFLOAT_PACK32 },
+		{ 71, VK_FORMAT_BC1_RGBA_UNORM_BLOCK },
+		{ 72, VK_FORMAT_BC1_RGBA_SRGB_BLOCK },
+		{ 74, VK_FORMAT_BC2_UNORM_BLOCK },
+		{ 75, VK_FORMAT_BC2_SRGB_BLOCK },
+		{ 77, VK_FORMAT_BC3_UNORM_BLOCK },
+		{ 78, VK_FORMAT_BC3_SRGB_BLOCK },
+		{ 80, VK_FORMAT_BC4_UNORM_BLOCK },
+		{ 81, VK_FORMAT_BC4_SNORM_BLOCK },
+		{ 83, VK_FORMAT_BC5_UNORM_BLOCK },
+		{ 84, VK_FORMAT_BC5_SNORM_BLOCK },
+		{ 95, VK_FORMAT_BC6H_UFLOAT_BLOCK },
+		{ 96, VK_FORMAT_BC6H_SFLOAT_BLOCK },
+		{ 98, VK_FORMAT_BC7_UNORM_BLOCK },
+		{ 99, VK_FORMAT_BC7_SRGB_BLOCK },
+	};
+
+	uint32_t getBlockSize(VkFormat format, uint32_t* blockDim)
+	{
+		uint32_t dim = 4;
+		uint32_t size = 0;
+		switch (format) {
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+		case VK_FORMAT_BC4_SNORM_BLOCK:
+			size = 8;
+			break;
+		case VK_FORMAT_BC2_UNORM_BLOCK:
+		case VK_FORMAT_BC2_SRGB_BLOCK:
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+		case VK_FORMAT_BC5_SNORM_BLOCK:
+		case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+		case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			size = 16;
+			break;
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+		case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+		case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32:
+			dim = 1;
+			size = 4;
+			break;
+		case VK_FORMAT_R8G8_UNORM:
+			dim = 1;
+			size = 2;
+			break;
+		case VK_FORMAT_R16G16B16A16_SFLOAT:
+			dim = 1;
+			size = 8;
+			break;
+		case VK_FORMAT_R32G32B32A32_SFLOAT:
+			dim = 1;
+			size = 16;
+			break;
+		default:
+			break;
+		}
+		if (blockDim) {
+			*blockDim = dim;
+		}
+		return size;
+	}
+
+	bool isBlockCompressed(VkFormat format)
+	{
+		uint32_t dim;
+		return getBlockSize(format, &dim) > 0 && dim > 1;
+	}
+
+	size_t getLevelSize(VkFormat format, uint32_t width, uint32_t height)
+	{
+		uint32_t dim;
+		size_t blockSize = getBlockSize(format, &dim);
+		return blockSize * ((width + dim - 1) / dim) * ((height + dim - 1) / dim);
+	}
+
+	size_t Texture::totalSize() const
+	{
+		size_t size = 0;
+		for (auto& r : regions) {
+			size += r.size;
+		}
+		return size;
+	}
+
+	// A corrupt header can declare more levels than the full chain, their sizes would be computed from shifts past
+	// the width and height
+	static bool checkMipLevels(const std::string& path, const Texture& tex)
+	{
+		uint32_t fullChain = 1;
+		for (uint32_t size = std::max(tex.width, tex.height); size > 1; size >>= 1) {
+			++fullChain;
+		}
+		if (tex.mipLevels > fullChain) {
+			PRERR("Texture declares " << tex.mipLevels << " mip levels, a full chain has " << fullChain << ": " << path);
+			return false;
+		}
+		return true;
+	}
+
+	static bool loadKtx2(const std::string& path, Texture& tex)
+	{
+		const MappedFile& f = *tex.file;
+
+		Ktx2Header header;
+		if (f.size < sizeof(header)) {
+			PRERR("Truncated KTX2 file: " << path);
+			return false;
+		}
+		memcpy(&header, f.data, sizeof(header));
+
+		if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+			PRERR("Not a KTX2 file: " << path);
+			return false;
+		}
+		if (header.supercompressionScheme != 0 || header.vkFormat == VK_FORMAT_UNDEFINED) {
+			PRERR("Supercompressed/Basis KTX2 textures are not supported: " << path);
+			return false;
+		}
+		if (header.pixelDepth > 1 || header.layerCount > 1 || (header.faceCount != 1 && header.faceCount != 6)) {
+			PRERR("Only 2D textures and cubemaps are supported: " << path);
+			return false;
+		}
+
+		tex.format = static_cast<VkFormat>(header.vkFormat);
+		tex.width = header.pixelWidth;
+		tex.height = header.pixelHeight;
+		tex.faces = header.faceCount;
+		// 0 means that mipmaps should be generated at load, we only use level 0 then
+		tex.mipLevels = std::max(header.levelCount, 1u);
+
+		if (getBlockSize(tex.format) == 0) {
+			PRERR("Unsupported KTX2 format " << string_VkFormat(tex.format) << ": " << path);
+			return false;
+		}
+		if (!checkMipLevels(path, tex)) {
+			return false;
+		}
+
+		size_t levelIndexOffset = sizeof(header);
+		if (f.size < levelIndexOffset + tex.mipLevels * sizeof(Ktx2Level)) {
+			PRERR("Truncated KTX2 level index: " << path);
+			return false;
+		}
+
+		tex.regions.resize(size_t(tex.faces) * tex.mipLevels);
+		for (uint32_t level = 0; level < tex.mipLevels; ++level) {
+			Ktx2Level l;
+			memcpy(&l, f.data + levelIndexOffset + level * sizeof(Ktx2Level), sizeof(l));
+
+			size_t faceSize = getLevelSize(tex.format, std::max(tex.width >> level, 1u), std::max(tex.height >> level, 1u));
+			if (l.byteOffset > f.size || l.byteLength > f.size - l.byteOffset || l.byteLength < faceSize * tex.faces) {
+				PRERR("KTX2 level " << level << " is out of bounds: " << path);
+				return false;
+			}
+
+			// Faces of a level are stored one after another
+			for (uint32_t face = 0; face < tex.faces; ++face) {
+				tex.regions[face * tex.mipLevels + level] = { f.data + l.byteOffset + face * faceSize, faceSize };
+			}
+		}
+
+		return true;
+	}
+
+	static bool loadDds(const std::string& path, Texture& tex)
+	{
+		const MappedFile& f = *tex.file;
+
+		uint32_t magic;
+		DdsHeader header;
+		if (f.size < sizeof(magic) + sizeof(header)) {
+			PRERR("Truncated DDS file: " << path);
+			return false;
+		}
+		memcpy(&magic, f.data, sizeof(magic));
+		memcpy(&header, f.data + sizeof(magic), sizeof(header));
+		size_t offset = sizeof(magic) + sizeof(header);
+
+		if (magic != DDS_MAGIC || header.size != sizeof(DdsHeader)) {
+			PRERR("Not a DDS file: " << path);
+			return false;
+		}
+
+		tex.width = header.width;
+		tex.height = header.height;
+		tex.mipLevels = (header.flags & DDSD_MIPMAPCOUNT) ? std::max(header.mipMapCount, 1u) : 1;
+		tex.faces = (header.caps2 & DDSCAPS2_CUBEMAP_ALLFACES) == DDSCAPS2_CUBEMAP_ALLFACES ? 6 : 1;
+
+		const uint32_t fourCC = (header.pixelFormat.flags & DDPF_FOURCC) ? header.pixelFormat.fourCC : 0;
+		if (fourCC == makeFourCC('D', 'X', '1', '0')) {
+			DdsHeaderDX10 dx10;
+			if (f.size < offset + sizeof(dx10)) {
+				PRERR("Truncated DDS file: " << path);
+				return false;
+			}
+			memcpy(&dx10, f.data + offset, sizeof(dx10));
+			offset += sizeof(dx10);
+
+			for (auto& [dxgi, vk] : DXGI_FORMATS) {
+				if (dxgi == dx10.dxgiFormat) {
+					tex.format = vk;
+				}
+			}
+			if (dx10.resourceDimension != DDS_DIMENSION_TEXTURE2D || dx10.arraySize > 1) {
+				PRERR("Only 2D textures and cubemaps are supported: " << path);
+				return false;
+			}
+			if (dx10.miscFlag & DDS_RESOURCE_MISC_TEXTURECUBE) {
+				tex.faces = 6;
+			}
+		} else if (fourCC == makeFourCC('D', 'X', 'T', '1')) {
+			// Legacy headers have no color space, model textures are sRGB
+			tex.format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+		} else if (fourCC == makeFourCC('D', 'X', 'T', '3')) {
+			tex.format = VK_FORMAT_BC2_SRGB_BLOCK;
+		} else if (fourCC == makeFourCC('D', 'X', 'T', '5')) {
+			tex.format = VK_FORMAT_BC3_SRGB_BLOCK;
+		} else if (fourCC == makeFourCC('A', 'T', 'I', '1') || fourCC == makeFourCC('B', 'C', '4', 'U')) {
+			tex.format = VK_FORMAT_BC4_UNORM_BLOCK;
+		} else if (fourCC == makeFourCC('A', 'T', 'I', '2') || fourCC == makeFourCC('B', 'C', '5', 'U')) {
+			tex.format = VK_FORMAT_BC5_UNORM_BLOCK;
+		}
+
+		if (tex.format == VK_FORMAT_UNDEFINED) {
+			PRERR("Unsupported DDS pixel format: " << path);
+			return false;
+		}
+		if (!checkMipLevels(path, tex)) {
+			return false;
+		}
+
+		// All levels of a face are stored before the next face, every one of them has to be inside the file
+		tex.regions.resize(size_t(tex.faces) * tex.mipLevels);
+		for (uint32_t face = 0; face < tex.faces; ++face) {
+			for (uint32_t level = 0; level < tex.mipLevels; ++level) {
+				size_t size = getLevelSize(tex.format, std::max(tex.width >> level, 1u), std::max(tex.height >> level, 1u));
+				if (size > f.size - offset) {
+					PRERR("Truncated DDS file: " << path);
+					return false;
+				}
+				tex.regions[face * tex.mipLevels + level] = { f.data + offset, size };
+				offset += size;
+			}
+		}
+
+		return true;
+	}
+
+	bool load(const std::string& path, Texture& tex)
+	{
+		tex = {};
+		tex.file = std::make_unique<MappedFile>();
+		if (!tex.file->Open(path)) {
+			PRERR("Failed to open texture file: " << path);
+			return false;
+		}
+
+		std::string ext = fs::path(path).extension().string();
+		bool ok = ext == ".ktx2" ? loadKtx2(path, tex) : loadDds(path, tex);
+		if (ok && (tex.width == 0 || tex.height == 0)) {
+			PRERR("Texture has no pixels: " << path);
+			ok = false;
+		}
+		if (!ok) {
+			tex = {};
+		}
+		return ok;
+	}
+
+	std::string findCompressed(const std::string& sourcePath)
+	{
+		std::error_code ec;
+		for (const char* ext : { ".ktx2", ".dds" }) {
+			fs::path p = fs::path(sourcePath).replace_extension(ext);
+			if (!fs::is_regular_file(p, ec)) {
+				continue;
+			}
+			// Source image was edited after conversion
+			if (fs::exists(sourcePath, ec) && fs::last_write_time(sourcePath, ec) > fs::last_write_time(p, ec)) {
+				PRWRN("Ignoring outdated compressed texture: " << p.generic_string());
+				continue;
+			}
+			return p.generic_string();
+		}
+		return "";
+	}
+
+	bool writeDds(const std::string& path, VkFormat format, uint32_t width, uint32_t height,
+		const std::vector<std::vector<uint8_t>>& levels)
+	{
+		uint32_t dxgiFormat = 0;
+		for (auto& [dxgi, vk] : DXGI_FORMATS) {
+			if (vk == format) {
+				dxgiFormat = dxgi;
+			}
+		}
+		ASSERT(dxgiFormat != 0);
+
+		DdsHeader header = {
+			.size = sizeof(DdsHeader),
+			.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE,
+			.height = height,
+			.width = width,
+			.pitchOrLinearSize = static_cast<uint32_t>(levels[0].size()),
+			.depth = 1,
+			.mipMapCount = static_cast<uint32_t>(levels.size()),
+			.pixelFormat = {
+				.size = sizeof(DdsPixelFormat),
+				.flags = DDPF_FOURCC,
+				.fourCC = makeFourCC('D', 'X', '1', '0')
+			},
+			.caps = DDSCAPS_TEXTURE | (levels.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0u)
+		};
+		DdsHeaderDX10 dx10 = {
+			.dxgiFormat = dxgiFormat,
+			.resourceDimension = DDS_DIMENSION_TEXTURE2D,
+			.arraySize = 1
+		};
+
+		// Write to temporary file first so that a crash never leaves half written texture behind
+		std::string tmpPath = path + ".tmp";
+		{
+			std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(&DDS_MAGIC), sizeof(DDS_MAGIC));
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(&dx10), sizeof(dx10));
+			for (auto& level : levels) {
+				out.write(reinterpret_cast<const char*>(level.data()), level.size());
+			}
+			if (!out) {
+				PRWRN("Failed to write texture: " << tmpPath);
+				return false;
+			}
+		}
+
+		std::error_code ec;
+		fs::rename(tmpPath, path, ec);
+		if (ec) {
+			PRWRN("Failed to write texture: " << path << " (" << ec.message() << ")");
+			fs::remove(tmpPath, ec);
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "mapped_file.h"
+
+// Reading of pre-compressed/pre-mipmapped texture containers (.ktx2 and .dds) and writing of .dds.
+// Only uncompressed (no supercompression) KTX2 is supported. Image data stays in the memory mapped
+// file and is copied from there directly into the staging buffer.
+namespace texture_container {
+    struct Texture {
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipLevels = 0;
+        uint32_t faces = 0; // 6 for cubemaps, 1 otherwise
+
+        // One region per (face, level), index = face * mipLevels + level
+        struct Region {
+            const char* data;
+            size_t size;
+        };
+        std::vector<Region> regions;
+
+        std::unique_ptr<MappedFile> file;
+
+        const Region& region(uint32_t face, uint32_t level) const { return regions[face * mipLevels + level]; }
+        size_t totalSize() const;
+    };
+
+    // Loads .ktx2 or .dds by extension, prints reason of failure
+    bool load(const std::string& path, Texture& tex);
+
+    // Returns .ktx2 or .dds file next to the source image with the same name,
+    // empty if there is none or it is older than the source
+    std::string findCompressed(const std::string& sourcePath);
+
+    // Block size in bytes and block dimensions (1 for uncompressed formats), 0 bytes for unsupported formats
+    uint32_t getBlockSize(VkFormat format, uint32_t* blockDim = nullptr);
+    // Size of a level of one face
+    size_t getLevelSize(VkFormat format, uint32_t width, uint32_t height);
+
+    bool isBlockCompressed(VkFormat format);
+
+    // Writes a 2D texture with DX10 header. levels[i] is data of mip level i
+    bool writeDds(const std::string& path, VkFormat format, uint32_t width, uint32_t height,
+        const std::vector<std::vector<uint8_t>>& levels);
+}
@@ -0,0 +1,567 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "texture_converter.h"
+#include "texture_container.h"
+#include "parallel.h"
+#include "timer.h"
+
+#include "stb/stb_image.h"
+#include <glm/gtc/packing.hpp>
+
+namespace fs = std::filesystem;
+
+namespace texture_converter {
+	/* BC1-5 encoding, see https://learn.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression */
+
+	static uint16_t packRGB565(glm::vec3 c)
+	{
+		c = glm::clamp(c, 0.f, 255.f);
+		uint32_t r = static_cast<uint32_t>(std::round(c.r * 31.f / 255.f));
+		uint32_t g = static_cast<uint32_t>(std::round(c.g * 63.f / 255.f));
+		uint32_t b = static_cast<uint32_t>(std::round(c.b * 31.f / 255.f));
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	static glm::vec3 unpackRGB565(uint16_t c)
+	{
+		uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+		return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+	}
+
+	// Picks nearest of the 4 palette colors for every pixel, returns packed indices and total squared error
+	static uint32_t fitBC1Indices(const glm::vec3 colors[16], uint16_t c0, uint16_t c1, float& error)
+	{
+		glm::vec3 e0 = unpackRGB565(c0), e1 = unpackRGB565(c1);
+		const glm::vec3 palette[4] = { e0, e1, (2.f * e0 + e1) / 3.f, (e0 + 2.f * e1) / 3.f };
+
+		uint32_t indices = 0;
+		error = 0.f;
+		for (int i = 0; i < 16; ++i) {
+			int best = 0;
+			float bestDist = std::numeric_limits<float>::max();
+			for (int p = 0; p < 4; ++p) {
+				glm::vec3 d = colors[i] - palette[p];
+				float dist = glm::dot(d, d);
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = p;
+				}
+			}
+			indices |= uint32_t(best) << (2 * i);
+			error += bestDist;
+		}
+		return indices;
+	}
+
+	static void writeBC1(uint16_t c0, uint16_t c1, uint32_t indices, uint8_t out[8])
+	{
+		memcpy(out, &c0, 2);
+		memcpy(out + 2, &c1, 2);
+		memcpy(out + 4, &indices, 4);
+	}
+
+	// Orders endpoints for 4 color mode (c0 > c1) and encodes the block with them
+	static void encodeBC1Endpoints(const glm::vec3 colors[16], uint16_t c0, uint16_t c1, uint8_t out[8], float& error)
+	{
+		if (c0 < c1) {
+			std::swap(c0, c1);
+		}
+		if (c0 == c1) {
+			// Single color, every index points to c0
+			glm::vec3 e = unpackRGB565(c0);
+			error = 0.f;
+			for (int i = 0; i < 16; ++i) {
+				glm::vec3 d = colors[i] - e;
+				error += glm::dot(d, d);
+			}
+			writeBC1(c0, c1, 0, out);
+			return;
+		}
+		writeBC1(c0, c1, fitBC1Indices(colors, c0, c1, error), out);
+	}
+
+	void encodeBC1(const uint8_t* rgba, uint8_t out[8])
+	{
+		glm::vec3 colors[16];
+		glm::vec3 mean(0.f);
+		for (int i = 0; i < 16; ++i) {
+			colors[i] = glm::vec3(rgba[4 * i + 0], rgba[4 * i + 1], rgba[4 * i + 2]);
+			mean += colors[i];
+		}
+		mean /= 16.f;
+
+		// Principal axis of the colors by power iteration on their covariance
+		glm::mat3 cov(0.f);
+		for (int i = 0; i < 16; ++i) {
+			glm::vec3 d = colors[i] - mean;
+			cov += glm::outerProduct(d, d);
+		}
+		glm::vec3 axis(1.f);
+		for (int it = 0; it < 8; ++it) {
+			glm::vec3 next = cov * axis;
+			float len = glm::length(next);
+			if (len < 1e-6f) {
+				break;
+			}
+			axis = next / len;
+		}
+
+		float minT = std::numeric_limits<float>::max(), maxT = -std::numeric_limits<float>::max();
+		for (int i = 0; i < 16; ++i) {
+			float t = glm::dot(colors[i] - mean, axis);
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+
+		// Inset endpoints a bit, extremes are usually covered well enough by the interpolated colors
+		glm::vec3 e0 = mean + axis * maxT, e1 = mean + axis * minT;
+		glm::vec3 inset = (e0 - e1) / 16.f;
+		e0 -= inset;
+		e1 += inset;
+
+		float error;
+		encodeBC1Endpoints(colors, packRGB565(e0), packRGB565(e1), out, error);
+
+		// Least squares refit of endpoints to the chosen indices
+		uint32_t indices;
+		uint16_t c0, c1;
+		memcpy(&c0, out, 2);
+		memcpy(&c1, out + 2, 2);
+		memcpy(&indices, out + 4, 4);
+		if (c0 == c1) {
+			return;
+		}
+
+		static constexpr float WEIGHTS[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+		float aa = 0.f, bb = 0.f, ab = 0.f;
+		glm::vec3 ax(0.f), bx(0.f);
+		for (int i = 0; i < 16; ++i) {
+			float a = WEIGHTS[(indices >> (2 * i)) & 3];
+			float b = 1.f - a;
+			aa += a * a;
+			bb += b * b;
+			ab += a * b;
+			ax += a * colors[i];
+			bx += b * colors[i];
+		}
+		float det = aa * bb - ab * ab;
+		if (std::abs(det) < 1e-6f) {
+			return;
+		}
+		glm::vec3 r0 = (ax * bb - bx * ab) / det;
+		glm::vec3 r1 = (bx * aa - ax * ab) / det;
+
+		uint8_t refit[8];
+		float refitError;
+		encodeBC1Endpoints(colors, packRGB565(r0), packRGB565(r1), refit, refitError);
+		if (refitError < error) {
+			memcpy(out, refit, 8);
+		}
+	}
+
+	void encodeBC4(const uint8_t* rgba, uint8_t out[8], int channel)
+	{
+		uint8_t minV = 255, maxV = 0;
+		for (int i = 0; i < 16; ++i) {
+			minV = std::min(minV, rgba[4 * i + channel]);
+			maxV = std::max(maxV, rgba[4 * i + channel]);
+		}
+
+		// a0 > a1 selects 8 value mode: a0, a1 and 6 values in between
+		out[0] = maxV;
+		out[1] = minV;
+
+		float palette[8] = { float(maxV), float(minV) };
+		for (int p = 2; p < 8; ++p) {
+			palette[p] = ((8 - p) * float(maxV) + (p - 1) * float(minV)) / 7.f;
+		}
+
+		uint64_t indices = 0;
+		if (maxV > minV) {
+			for (int i = 0; i < 16; ++i) {
+				float v = rgba[4 * i + channel];
+				int best = 0;
+				for (int p = 1; p < 8; ++p) {
+					if (std::abs(v - palette[p]) < std::abs(v - palette[best])) {
+						best = p;
+					}
+				}
+				indices |= uint64_t(best) << (3 * i);
+			}
+		}
+		for (int b = 0; b < 6; ++b) {
+			out[2 + b] = static_cast<uint8_t>(indices >> (8 * b));
+		}
+	}
+
+	void encodeBC3(const uint8_t* rgba, uint8_t out[16])
+	{
+		// Alpha block followed by color block
+		encodeBC4(rgba, out, 3);
+		encodeBC1(rgba, out + 8);
+	}
+
+	void encodeBC5(const uint8_t* rgba, uint8_t out[16])
+	{
+		encodeBC4(rgba, out, 0);
+		encodeBC4(rgba, out + 8, 1);
+	}
+
+	std::vector<uint8_t> encodeImage(const uint8_t* rgba, uint32_t width, uint32_t height, VkFormat format, uint32_t numThreads)
+	{
+		const uint32_t blockSize = texture_container::getBlockSize(format);
+		const uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+		std::vector<uint8_t> out(size_t(blocksX) * blocksY * blockSize);
+
+		parallelFor(blocksY, numThreads, [&](size_t by) {
+			uint8_t block[64];
+			for (uint32_t bx = 0; bx < blocksX; ++bx) {
+				// Edge blocks repeat the last row/column
+				for (uint32_t y = 0; y < 4; ++y) {
+					for (uint32_t x = 0; x < 4; ++x) {
+						uint32_t sx = std::min(bx * 4 + x, width - 1);
+						uint32_t sy = std::min(uint32_t(by) * 4 + y, height - 1);
+						memcpy(block + 4 * (y * 4 + x), rgba + 4 * (size_t(sy) * width + sx), 4);
+					}
+				}
+
+				uint8_t* dst = out.data() + (by * blocksX + bx) * blockSize;
+				switch (format) {
+				case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+				case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+					encodeBC1(block, dst);
+					break;
+				case VK_FORMAT_BC3_UNORM_BLOCK:
+				case VK_FORMAT_BC3_SRGB_BLOCK:
+					encodeBC3(block, dst);
+					break;
+				case VK_FORMAT_BC4_UNORM_BLOCK:
+					encodeBC4(block, dst);
+					break;
+				case VK_FORMAT_BC5_UNORM_BLOCK:
+					encodeBC5(block, dst);
+					break;
+				default:
+					ASSERT_MSG(false, "Unsupported format for encoding: " << string_VkFormat(format));
+				}
+			}
+		});
+
+		return out;
+	}
+
+	/* Packed HDR formats, see "Shared Exponent" and "Unsigned 11-Bit/10-Bit Floating-Point Numbers" in the Vulkan spec */
+
+	// Unsigned float with 5 bit exponent (bias 15) and mantissaBits mantissa, round to nearest.
+	// Negative values and NaN become 0, values above the maximum are clamped to it.
+	static uint32_t packUFloat(float v, uint32_t mantissaBits)
+	{
+		if (!(v > 0.f)) {
+			return 0;
+		}
+		uint32_t bits;
+		memcpy(&bits, &v, sizeof(bits));
+		int exp = int((bits >> 23) & 0xFF) - 127 + 15;
+		uint32_t mantissa = bits & 0x7FFFFF;
+
+		const uint32_t maxValue = (30u << mantissaBits) | ((1u << mantissaBits) - 1);
+		if (exp >= 31) {
+			return maxValue;
+		}
+		if (exp <= 0) {
+			// Denormal
+			if (exp < -int(mantissaBits)) {
+				return 0;
+			}
+			uint32_t shift = 24 - mantissaBits - exp;
+			return ((mantissa | 0x800000) + (1u << (shift - 1))) >> shift;
+		}
+		uint32_t shift = 23 - mantissaBits;
+		// Carry of the rounding goes into the exponent
+		uint32_t packed = (uint32_t(exp) << mantissaBits | mantissa >> shift) + ((mantissa >> (shift - 1)) & 1);
+		return std::min(packed, maxValue);
+	}
+
+	static uint32_t packB10G11R11(const float* rgb)
+	{
+		return packUFloat(rgb[0], 6) | packUFloat(rgb[1], 6) << 11 | packUFloat(rgb[2], 5) << 22;
+	}
+
+	// 2^e as float, e must be in the normal range
+	static float exp2i(int e)
+	{
+		uint32_t bits = uint32_t(e + 127) << 23;
+		float v;
+		memcpy(&v, &bits, sizeof(v));
+		return v;
+	}
+
+	static uint32_t packE5B9G9R9(const float* rgb)
+	{
+		constexpr int N = 9, B = 15;
+		constexpr float SHARED_EXP_MAX = float((1 << N) - 1) / (1 << N) * (1 << (31 - B));
+
+		float c[3];
+		for (int i = 0; i < 3; ++i) {
+			c[i] = rgb[i] > 0.f ? std::min(rgb[i], SHARED_EXP_MAX) : 0.f; // Also NaN
+		}
+		float maxC = std::max({ c[0], c[1], c[2] });
+
+		// floor(log2(maxC)) is the unbiased float exponent, zero and denormals are below -B - 1 anyway
+		uint32_t bits;
+		memcpy(&bits, &maxC, sizeof(bits));
+		int exp = std::max(-B - 1, int(bits >> 23) - 127) + 1 + B;
+
+		float scale = exp2i(N + B - exp);
+		if (uint32_t(maxC * scale + 0.5f) == (1u << N)) {
+			++exp;
+			scale *= 0.5f;
+		}
+
+		uint32_t packed = uint32_t(exp) << 27;
+		for (int i = 0; i < 3; ++i) {
+			packed |= uint32_t(c[i] * scale + 0.5f) << (9 * i);
+		}
+		return packed;
+	}
+
+	void encodeHdr(const float* rgba, size_t numTexels, VkFormat format, uint8_t* out)
+	{
+		switch (format) {
+		case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32:
+			for (size_t i = 0; i < numTexels; ++i) {
+				uint32_t packed = packE5B9G9R9(rgba + 4 * i);
+				memcpy(out + 4 * i, &packed, 4);
+			}
+			break;
+		case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+			for (size_t i = 0; i < numTexels; ++i) {
+				uint32_t packed = packB10G11R11(rgba + 4 * i);
+				memcpy(out + 4 * i, &packed, 4);
+			}
+			break;
+		case VK_FORMAT_R16G16B16A16_SFLOAT:
+			for (size_t i = 0; i < numTexels; ++i) {
+				// Out of range values would become infinity
+				glm::vec4 v = glm::clamp(glm::make_vec4(rgba + 4 * i), -65504.f, 65504.f);
+				uint64_t packed = glm::packHalf4x16(v);
+				memcpy(out + 8 * i, &packed, 8);
+			}
+			break;
+		case VK_FORMAT_R32G32B32A32_SFLOAT:
+			memcpy(out, rgba, numTexels * 16);
+			break;
+		default:
+			ASSERT_MSG(false, "Unsupported HDR format: " << string_VkFormat(format));
+		}
+	}
+
+	std::vector<float> downsampleHdr(const float* rgba, uint32_t width, uint32_t height)
+	{
+		uint32_t dstW = std::max(width / 2, 1u), dstH = std::max(height / 2, 1u);
+		std::vector<float> dst(size_t(dstW) * dstH * 4);
+
+		for (uint32_t y = 0; y < dstH; ++y) {
+			for (uint32_t x = 0; x < dstW; ++x) {
+				glm::vec4 sum(0.f);
+				for (uint32_t dy = 0; dy < 2; ++dy) {
+					for (uint32_t dx = 0; dx < 2; ++dx) {
+						uint32_t sx = std::min(x * 2 + dx, width - 1), sy = std::min(y * 2 + dy, height - 1);
+						sum += glm::make_vec4(rgba + 4 * (size_t(sy) * width + sx));
+					}
+				}
+				memcpy(dst.data() + 4 * (size_t(y) * dstW + x), glm::value_ptr(sum * 0.25f), 16);
+			}
+		}
+		return dst;
+	}
+
+	static float srgbToLinear(float c)
+	{
+		return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	static float linearToSrgb(float c)
+	{
+		return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+	}
+
+	static const std::array<float, 256>& getSrgbToLinearTable()
+	{
+		static const std::array<float, 256> table = [] {
+			std::array<float, 256> t;
+			for (int i = 0; i < 256; ++i) {
+				t[i] = srgbToLinear(i / 255.f);
+			}
+			return t;
+		}();
+		return table;
+	}
+
+	std::vector<uint8_t> downsample(const uint8_t* src, uint32_t width, uint32_t height, bool srgb)
+	{
+		const std::array<float, 256>& toLinear = getSrgbToLinearTable();
+
+		uint32_t dstW = std::max(width / 2, 1u), dstH = std::max(height / 2, 1u);
+		std::vector<uint8_t> dst(size_t(dstW) * dstH * 4);
+
+		for (uint32_t y = 0; y < dstH; ++y) {
+			for (uint32_t x = 0; x < dstW; ++x) {
+				glm::vec4 sum(0.f);
+				for (uint32_t dy = 0; dy < 2; ++dy) {
+					for (uint32_t dx = 0; dx < 2; ++dx) {
+						uint32_t sx = std::min(x * 2 + dx, width - 1), sy = std::min(y * 2 + dy, height - 1);
+						const uint8_t* p = src + 4 * (size_t(sy) * width + sx);
+						sum += srgb ? glm::vec4(toLinear[p[0]], toLinear[p[1]], toLinear[p[2]], p[3] / 255.f)
+							: glm::vec4(p[0], p[1], p[2], p[3]) / 255.f;
+					}
+				}
+				sum *= 0.25f;
+
+				uint8_t* d = dst.data() + 4 * (size_t(y) * dstW + x);
+				for (int c = 0; c < 3; ++c) {
+					d[c] = static_cast<uint8_t>(std::round((srgb ? linearToSrgb(sum[c]) : sum[c]) * 255.f));
+				}
+				d[3] = static_cast<uint8_t>(std::round(sum.a * 255.f));
+			}
+		}
+		return dst;
+	}
+
+	std::vector<std::vector<uint8_t>> buildDerivativeMap(const uint8_t* rgba, uint32_t width, uint32_t height, VkFormat format, bool mips)
+	{
+		ASSERT(format == VK_FORMAT_R8G8_UNORM || format == VK_FORMAT_BC5_UNORM_BLOCK);
+
+		// Heights as the height path samples them from the sRGB texture
+		const std::array<float, 256>& toLinear = getSrgbToLinearTable();
+
+		// Level is kept as RGBA8 (derivatives in R and G) so it can go through downsample and encodeImage.
+		// Neighbours wrap around the edges, bump maps are sampled with repeat.
+		std::vector<uint8_t> level(size_t(width) * height * 4);
+		for (uint32_t y = 0; y < height; ++y) {
+			uint32_t yd = (y + height - 1) % height, yu = (y + 1) % height;
+			for (uint32_t x = 0; x < width; ++x) {
+				uint32_t xl = (x + width - 1) % width, xr = (x + 1) % width;
+				float dx = toLinear[rgba[4 * (size_t(y) * width + xr)]] - toLinear[rgba[4 * (size_t(y) * width + xl)]];
+				float dy = toLinear[rgba[4 * (size_t(yu) * width + x)]] - toLinear[rgba[4 * (size_t(yd) * width + x)]];
+
+				// Differences are in [-1, 1], halved so that hard edges keep their full height
+				uint8_t* d = level.data() + 4 * (size_t(y) * width + x);
+				d[0] = static_cast<uint8_t>(std::round((dx * 0.5f + 0.5f) * 255.f));
+				d[1] = static_cast<uint8_t>(std::round((dy * 0.5f + 0.5f) * 255.f));
+				d[2] = 0;
+				d[3] = 255;
+			}
+		}
+
+		// Averaging keeps the differences in units of level 0 texels, the shader scales them by level 0 size
+		std::vector<std::vector<uint8_t>> levels;
+		uint32_t lw = width, lh = height;
+		while (true) {
+			if (format == VK_FORMAT_BC5_UNORM_BLOCK) {
+				// Called from decoding threads, one thread per texture
+				levels.push_back(encodeImage(level.data(), lw, lh, format, 1));
+			} else {
+				std::vector<uint8_t> rg(size_t(lw) * lh * 2);
+				for (size_t i = 0; i < size_t(lw) * lh; ++i) {
+					rg[2 * i] = level[4 * i];
+					rg[2 * i + 1] = level[4 * i + 1];
+				}
+				levels.push_back(std::move(rg));
+			}
+
+			if (!mips || (lw == 1 && lh == 1)) {
+				break;
+			}
+			level = downsample(level.data(), lw, lh, false);
+			lw = std::max(lw / 2, 1u);
+			lh = std::max(lh / 2, 1u);
+		}
+		return levels;
+	}
+
+	void convertAll(const std::string& dir, uint32_t numThreads)
+	{
+		std::vector<fs::path> images;
+		std::error_code ec;
+		for (auto& entry : fs::recursive_directory_iterator(dir, ec)) {
+			std::string ext = entry.path().extension().string();
+			std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+			if (entry.is_regular_file() && (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga" || ext == ".bmp")) {
+				images.push_back(entry.path());
+			}
+		}
+		std::sort(images.begin(), images.end());
+
+		if (images.empty()) {
+			PRWRN("No textures found in " << dir);
+			return;
+		}
+
+		pr("\nConverting " << images.size() << " textures in " << dir);
+
+		size_t totalUncompressed = 0, totalCompressed = 0;
+		size_t numConverted = 0, numSkipped = 0;
+		Timer totalTimer;
+
+		for (auto& src : images) {
+			fs::path dst = fs::path(src).replace_extension(".dds");
+
+			std::error_code ec1, ec2;
+			if (fs::exists(dst, ec1) && fs::last_write_time(dst, ec1) >= fs::last_write_time(src, ec2) && !ec1 && !ec2) {
+				++numSkipped;
+				continue;
+			}
+
+			Timer timer;
+			int w, h, channels;
+			stbi_uc* pixels = stbi_load(src.generic_string().c_str(), &w, &h, &channels, STBI_rgb_alpha);
+			if (!pixels) {
+				PRERR("Failed to load texture file " << src);
+				continue;
+			}
+
+			std::vector<uint8_t> level(pixels, pixels + size_t(w) * h * 4);
+			stbi_image_free(pixels);
+
+			bool hasAlpha = false;
+			for (size_t i = 3; i < level.size(); i += 4) {
+				hasAlpha |= level[i] < 255;
+			}
+			// Model textures are sampled as sRGB
+			VkFormat format = hasAlpha ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+
+			std::vector<std::vector<uint8_t>> levels;
+			uint32_t lw = w, lh = h;
+			size_t uncompressed = 0, compressed = 0;
+			while (true) {
+				levels.push_back(encodeImage(level.data(), lw, lh, format, numThreads));
+				uncompressed += level.size();
+				compressed += levels.back().size();
+
+				if (lw == 1 && lh == 1) {
+					break;
+				}
+				level = downsample(level.data(), lw, lh, true);
+				lw = std::max(lw / 2, 1u);
+				lh = std::max(lh / 2, 1u);
+			}
+
+			if (!texture_container::writeDds(dst.generic_string(), format, w, h, levels)) {
+				continue;
+			}
+
+			totalUncompressed += uncompressed;
+			totalCompressed += compressed;
+			++numConverted;
+
+			pr("[Texture converter] " << src.generic_string() << ": " << w << "x" << h << " " << string_VkFormat(format)
+				<< ", " << levels.size() << " mips, " << uncompressed / 1024 << " KiB -> " << compressed / 1024 << " KiB in "
+				<< timer.ElapsedMs() << " ms");
+		}
+
+		pr("[Texture converter] Converted " << numConverted << ", up to date " << numSkipped << " in " << totalTimer.ElapsedMs() << " ms. "
+			<< "Texture memory of converted textures: " << totalUncompressed / 1024 << " KiB -> "
+			<< totalCompressed / 1024 << " KiB");
+	}
+}
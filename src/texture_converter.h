@@ -0,0 +1,36 @@
+#pragma once
+
+// Offline conversion of model textures into block compressed .dds files with full mip chains,
+// and packing of HDR images into compact formats.
+// The texture loader prefers a .dds/.ktx2 file next to the source image (see texture_container.h).
+namespace texture_converter {
+    // Encode one 4x4 block of RGBA8 pixels (row major, 64 bytes).
+    // BC1 ignores alpha, BC4 encodes channel 0 and BC5 channels 0 and 1.
+    void encodeBC1(const uint8_t* rgba, uint8_t out[8]);
+    void encodeBC3(const uint8_t* rgba, uint8_t out[16]);
+    void encodeBC4(const uint8_t* rgba, uint8_t out[8], int channel = 0);
+    void encodeBC5(const uint8_t* rgba, uint8_t out[16]);
+
+    // Encodes a whole RGBA8 image of the given block compressed format, numThreads = 0 uses all hardware threads
+    std::vector<uint8_t> encodeImage(const uint8_t* rgba, uint32_t width, uint32_t height, VkFormat format, uint32_t numThreads = 0);
+
+    // Next mip level of an RGBA8 image, 2x2 box filter, odd sizes repeat the last row/column.
+    // With srgb color channels are averaged in linear space.
+    std::vector<uint8_t> downsample(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb);
+
+    // Packs RGBA32F texels into E5B9G9R9 or B10G11R11 (both drop alpha), RGBA16F or RGBA32F.
+    // Values are clamped to the range of the format.
+    void encodeHdr(const float* rgba, size_t numTexels, VkFormat format, uint8_t* out);
+    // Next mip level of an RGBA32F image, 2x2 box filter, odd sizes repeat the last row/column
+    std::vector<float> downsampleHdr(const float* rgba, uint32_t width, uint32_t height);
+
+    // Converts a height map (channel 0 of RGBA8 sRGB, as sampled by the height bump mapping path) into a derivative map:
+    // R = h(x+1) - h(x-1), G = h(y+1) - h(y-1) in level 0 texels, stored as d * 0.5 + 0.5 in R8G8_UNORM or BC5_UNORM.
+    // levels[i] is data of mip level i, just level 0 without mips.
+    std::vector<std::vector<uint8_t>> buildDerivativeMap(const uint8_t* rgba, uint32_t width, uint32_t height, VkFormat format, bool mips);
+
+    // Converts every .png/.jpg/.tga/.bmp under the directory into .dds next to it:
+    // BC1 (sRGB) for opaque images, BC3 (sRGB) for images with alpha. Up to date .dds files are skipped.
+    // Reports memory of uncompressed vs compressed textures.
+    void convertAll(const std::string& dir, uint32_t numThreads = 0);
+}
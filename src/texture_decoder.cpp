@@ -0,0 +1,243 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "texture_decoder.h"
+#include "texture_cache.h"
+#include "texture_converter.h"
+#include "parallel.h"
+#include "timer.h"
+
+#include "stb/stb_image.h"
+
+namespace fs = std::filesystem;
+
+namespace texture_decoder {
+	size_t DecodedTexture::dataSize() const
+	{
+		return isCompressed() ? container.totalSize() : size_t(width) * height * 4;
+	}
+
+	void DecodedTexture::freePixels()
+	{
+		if (pixels) {
+			stbi_image_free(pixels);
+			pixels = nullptr;
+		}
+	}
+
+	// Replaces decoded pixels by container with all levels of the derivative map
+	static void convertToDerivativeMap(DecodedTexture& tex, const Options& options)
+	{
+		tex.convertedLevels = texture_converter::buildDerivativeMap(tex.pixels, tex.width, tex.height, options.format, options.mips);
+		tex.freePixels();
+
+		// Mapped entry can be read again later, e.g. by the texture streamer
+		if (options.useCache && texture_cache::write(tex.path, options.format, options.mips, tex.width, tex.height, tex.convertedLevels)
+			&& texture_cache::read(tex.path, options.format, options.mips, tex.container))
+		{
+			tex.convertedLevels.clear();
+			tex.fromCache = true;
+			tex.cacheWritten = true;
+			return;
+		}
+
+		auto& container = tex.container;
+		container.format = options.format;
+		container.width = tex.width;
+		container.height = tex.height;
+		container.mipLevels = static_cast<uint32_t>(tex.convertedLevels.size());
+		container.faces = 1;
+		for (auto& level : tex.convertedLevels) {
+			container.regions.push_back({ reinterpret_cast<const char*>(level.data()), level.size() });
+		}
+	}
+
+	void probe(DecodedTexture& tex, const Options& options)
+	{
+		tex.compressedPath = options.useCompressed && !options.derivativeMap ? texture_container::findCompressed(tex.path) : "";
+
+		std::error_code ec;
+		if (!tex.compressedPath.empty()) {
+			// Container data is uploaded as is
+			tex.estimatedSize = fs::file_size(tex.compressedPath, ec);
+			return;
+		}
+
+		if (options.useCache) {
+			// Entry is memory mapped, it takes no heap memory but goes through the staging buffer all the same
+			uint64_t size = fs::file_size(texture_cache::getCachePath(tex.path, options.format, options.mips), ec);
+			if (!ec) {
+				tex.estimatedSize = size;
+				return;
+			}
+		}
+
+		int w, h, channels;
+		if (stbi_info(tex.path.c_str(), &w, &h, &channels)) {
+			tex.estimatedSize = size_t(w) * h * 4;
+		} else {
+			// Will fail in decode, don't let it take space of a batch
+			tex.estimatedSize = 0;
+		}
+	}
+
+	// 64-bit multiply-xorshift over 8 byte words, fast enough to hash every texture on load
+	static uint64_t hashData(const void* data, size_t size, uint64_t hash)
+	{
+		const uint64_t prime = 0x9E3779B97F4A7C15ull;
+		const char* bytes = static_cast<const char*>(data);
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word;
+			memcpy(&word, bytes + i, 8);
+			hash = (hash ^ word) * prime;
+			hash ^= hash >> 29;
+		}
+		uint64_t tail = 0;
+		memcpy(&tail, bytes + i, size - i);
+		hash = (hash ^ tail ^ size) * prime;
+		return hash ^ (hash >> 32);
+	}
+
+	static uint64_t hashContent(const DecodedTexture& tex)
+	{
+		uint64_t hash = 0xCBF29CE484222325ull;
+		if (tex.isCompressed()) {
+			for (auto& region : tex.container.regions) {
+				hash = hashData(region.data, region.size, hash);
+			}
+		} else {
+			hash = hashData(tex.pixels, tex.dataSize(), hash);
+		}
+		// 0 means no hash
+		return hash != 0 ? hash : 1;
+	}
+
+	static bool decodeData(DecodedTexture& tex, const FormatFilter& isFormatSupported, const Options& options)
+	{
+		if (!tex.compressedPath.empty()) {
+			texture_container::Texture container;
+			if (texture_container::load(tex.compressedPath, container) && container.faces == 1
+				&& (!isFormatSupported || isFormatSupported(container.format)))
+			{
+				tex.container = std::move(container);
+				tex.width = tex.container.width;
+				tex.height = tex.container.height;
+				tex.valid = true;
+				return true;
+			}
+			PRWRN("Can't use compressed texture " << tex.compressedPath << ", loading source image");
+			tex.compressedPath.clear();
+		}
+
+		if (options.useCache && texture_cache::read(tex.path, options.format, options.mips, tex.container)) {
+			tex.width = tex.container.width;
+			tex.height = tex.container.height;
+			tex.fromCache = true;
+			tex.valid = true;
+			return true;
+		}
+
+		int texWidth, texHeight, texChannels;
+		tex.pixels = stbi_load(tex.path.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+		if (!tex.pixels) {
+			PRERR("Failed to load texture file " << tex.path << ": " << stbi_failure_reason());
+			return false;
+		}
+
+		tex.width = static_cast<uint32_t>(texWidth);
+		tex.height = static_cast<uint32_t>(texHeight);
+		tex.valid = true;
+
+		if (options.derivativeMap) {
+			convertToDerivativeMap(tex, options);
+			return true;
+		}
+
+		// Uploaded from the written entry like on the next load, so the texture can be streamed.
+		// Failure to write only costs the next load, pixels are uploaded from memory then.
+		if (options.useCache && texture_cache::write(tex.path, options.format, options.mips, tex.pixels, tex.width, tex.height)
+			&& texture_cache::read(tex.path, options.format, options.mips, tex.container))
+		{
+			tex.freePixels();
+			tex.fromCache = true;
+			tex.cacheWritten = true;
+		}
+		return true;
+	}
+
+	bool decode(DecodedTexture& tex, const FormatFilter& isFormatSupported, const Options& options)
+	{
+		if (!decodeData(tex, isFormatSupported, options)) {
+			return false;
+		}
+		tex.contentHash = hashContent(tex);
+		return true;
+	}
+
+	void decodeRange(std::vector<DecodedTexture>& textures, size_t begin, size_t end,
+		const FormatFilter& isFormatSupported, const Options& options, uint32_t numThreads)
+	{
+		ASSERT(begin <= end && end <= textures.size());
+
+		// One texture per item, decoding a single image is too coarse to split further
+		parallelFor(end - begin, numThreads, [&](size_t i) {
+			decode(textures[begin + i], isFormatSupported, options);
+		});
+	}
+
+	std::vector<std::string> findImages(const std::string& dir)
+	{
+		std::vector<std::string> paths;
+		std::error_code ec;
+		for (auto& entry : fs::recursive_directory_iterator(dir, ec)) {
+			std::string ext = entry.path().extension().string();
+			std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+			if (entry.is_regular_file() && (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga" || ext == ".bmp")) {
+				paths.push_back(entry.path().generic_string());
+			}
+		}
+		std::sort(paths.begin(), paths.end());
+		return paths;
+	}
+
+	void benchmark(const std::string& dir, const Options& options)
+	{
+		std::vector<std::string> paths = findImages(dir);
+		if (paths.empty()) {
+			PRWRN("No textures found in " << dir);
+			return;
+		}
+
+		pr("\nDecoding " << paths.size() << " textures in " << dir
+			<< (options.useCompressed ? " (compressed siblings preferred)" : " (source images only)")
+			<< (options.useCache ? " with texture cache" : ""));
+
+		double singleMs = 0.0;
+		for (uint32_t numThreads : { 1u, 4u, 16u }) {
+			std::vector<DecodedTexture> textures(paths.size());
+			for (size_t i = 0; i < paths.size(); ++i) {
+				textures[i].path = paths[i];
+			}
+
+			Timer timer;
+			for (auto& tex : textures) {
+				probe(tex, options);
+			}
+			decodeRange(textures, 0, textures.size(), nullptr, options, numThreads);
+			double ms = timer.ElapsedMs();
+
+			if (numThreads == 1) {
+				singleMs = ms;
+			}
+
+			size_t numValid = 0, totalSize = 0;
+			for (auto& tex : textures) {
+				numValid += tex.valid;
+				totalSize += tex.valid ? tex.dataSize() : 0;
+			}
+
+			pr("\t" << numThreads << " threads: " << ms << " ms (" << singleMs / ms << "x), "
+				<< numValid << "/" << textures.size() << " textures, " << totalSize / (1024 * 1024) << " MiB");
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "texture_container.h"
+
+// CPU side of texture loading: reading/decoding texture files into memory on worker threads.
+// Uploading to the GPU is done by the engine from the calling thread (see Engine::loadTextures).
+namespace texture_decoder {
+    struct Options {
+        // Prefer .ktx2/.dds next to the source image, see texture_container.h
+        bool useCompressed = true;
+        // Load source images from the decoded texture cache and write it on a miss, see texture_cache.h
+        bool useCache = false;
+        // Format source images are uploaded in and whether they get mips, both are part of the cache key
+        VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+        bool mips = false;
+        // Source images are height maps converted into derivative maps in format (R8G8 or BC5) with mips built on CPU,
+        // see texture_converter::buildDerivativeMap. Compressed siblings are ignored.
+        bool derivativeMap = false;
+    };
+
+    // Decoded texture: either a container (pre-compressed file or texture cache entry) or RGBA8 pixels from stb_image
+    struct DecodedTexture {
+        std::string path;
+
+        // Set by probe()
+        std::string compressedPath;
+        size_t estimatedSize = 0;
+
+        // Set by decode()
+        bool valid = false;
+        texture_container::Texture container; // Used if container.format != VK_FORMAT_UNDEFINED
+        bool fromCache = false;               // Container is a texture cache entry
+        bool cacheWritten = false;            // The entry was written by decode() from the source image
+        std::vector<std::vector<uint8_t>> convertedLevels; // Container data of textures converted while decoding, if not from cache
+        uint8_t* pixels = nullptr;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint64_t contentHash = 0; // Of the data to upload, textures with identical data share an image (see TextureRegistry)
+
+        DecodedTexture() = default;
+        ~DecodedTexture() { freePixels(); }
+
+        DecodedTexture(const DecodedTexture&) = delete;
+        DecodedTexture& operator=(const DecodedTexture&) = delete;
+
+        bool isCompressed() const { return container.format != VK_FORMAT_UNDEFINED; }
+        // Size of the data to upload
+        size_t dataSize() const;
+        void freePixels();
+    };
+
+    // Returns true if the device can sample the format, used for choosing between container and source image
+    using FormatFilter = std::function<bool(VkFormat)>;
+
+    // Finds compressed sibling and estimates the decoded size from the file header without decoding.
+    // Used for splitting loads into batches of bounded memory.
+    void probe(DecodedTexture& tex, const Options& options);
+
+    // Loads the texture, prefers the compressed sibling found by probe() if its format passes the filter,
+    // then the texture cache entry. Source images decoded with options.useCache are written to the cache
+    // and the written entry is used instead of the decoded pixels.
+    // Thread safe, prints reason of failure.
+    bool decode(DecodedTexture& tex, const FormatFilter& isFormatSupported, const Options& options);
+
+    // Decodes textures [begin, end) on up to numThreads threads (0 = all hardware threads)
+    void decodeRange(std::vector<DecodedTexture>& textures, size_t begin, size_t end,
+        const FormatFilter& isFormatSupported, const Options& options, uint32_t numThreads = 0);
+
+    // Paths of all .png/.jpg/.tga/.bmp images under the directory, sorted
+    std::vector<std::string> findImages(const std::string& dir);
+
+    // Decodes every image under the directory with 1, 4 and 16 threads and reports the timings
+    void benchmark(const std::string& dir, const Options& options);
+}
@@ -0,0 +1,120 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "texture_registry.h"
+
+void TextureRegistry::Create(VkDevice device, VkSampler sampler, uint32_t maxSlots)
+{
+	_device = device;
+	_sampler = sampler;
+
+	_slots.resize(maxSlots);
+	// Lowest slots are handed out first
+	_freeSlots.reserve(maxSlots);
+	for (uint32_t i = maxSlots; i-- > 0;) {
+		_freeSlots.push_back(i);
+	}
+}
+
+void TextureRegistry::Register(Attachment& texture, const ContentKey& key)
+{
+	ASSERT_MSG(!_freeSlots.empty(), "Out of texture slots, MAX_TEXTURES is " << _slots.size());
+
+	uint32_t index = _freeSlots.back();
+	_freeSlots.pop_back();
+
+	Slot& slot = _slots[index];
+	slot.texture = &texture;
+	slot.key = key;
+	slot.pendingFrames = (1u << MAX_FRAMES_IN_FLIGHT) - 1;
+	_dirtySlots.push_back(index);
+
+	if (key.hash != 0) {
+		_contents.emplace(key, index);
+	}
+
+	texture.globalIndex = index;
+	++_stats.slots;
+}
+
+void TextureRegistry::Release(Attachment& texture)
+{
+	uint32_t index = texture.globalIndex;
+	ASSERT(index < _slots.size() && _slots[index].texture == &texture);
+
+	Slot& slot = _slots[index];
+	auto it = _contents.find(slot.key);
+	if (it != _contents.end() && it->second == index) {
+		_contents.erase(it);
+	}
+	_stats.aliases -= static_cast<uint32_t>(std::erase_if(_aliases, [index](const auto& alias) { return alias.second == index; }));
+
+	slot = {};
+	_freeSlots.push_back(index);
+	--_stats.slots;
+}
+
+Attachment* TextureRegistry::FindContent(const ContentKey& key) const
+{
+	if (key.hash == 0) {
+		return nullptr;
+	}
+	auto it = _contents.find(key);
+	return it != _contents.end() ? _slots[it->second].texture : nullptr;
+}
+
+void TextureRegistry::AddAlias(const std::string& tag, Attachment& texture)
+{
+	ASSERT(_slots[texture.globalIndex].texture == &texture);
+
+	if (_aliases.emplace(tag, texture.globalIndex).second) {
+		++_stats.aliases;
+	}
+}
+
+Attachment* TextureRegistry::FindAlias(const std::string& tag) const
+{
+	auto it = _aliases.find(tag);
+	return it != _aliases.end() ? _slots[it->second].texture : nullptr;
+}
+
+void TextureRegistry::Write(const Attachment& texture, VkDescriptorSet set)
+{
+	VkDescriptorImageInfo imageInfo = {
+		.sampler = _sampler,
+		.imageView = texture.view,
+		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	};
+
+	// Diffuse and bump arrays
+	VkWriteDescriptorSet writes[2];
+	for (uint32_t i = 0; i < 2; ++i) {
+		writes[i] = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = set,
+			.dstBinding = 5 + i,
+			.dstArrayElement = texture.globalIndex,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.pImageInfo = &imageInfo
+		};
+	}
+
+	vkUpdateDescriptorSets(_device, 2, writes, 0, nullptr);
+	_stats.writes += 2;
+}
+
+void TextureRegistry::Update(uint32_t frameIndex, VkDescriptorSet set)
+{
+	std::erase_if(_dirtySlots, [&](uint32_t index) {
+		Slot& slot = _slots[index];
+		// Released in the meantime
+		if (!slot.texture) {
+			return true;
+		}
+		if (slot.pendingFrames & (1u << frameIndex)) {
+			Write(*slot.texture, set);
+			slot.pendingFrames &= ~(1u << frameIndex);
+		}
+		return slot.pendingFrames == 0;
+	});
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "types.h"
+
+// Bindless slots of model textures in the texture arrays of the scene set (bindings 5 and 6, indexed by
+// Attachment::globalIndex in scene.frag). A texture gets one slot, valid in both arrays, however many meshes use it.
+//
+// Textures are deduplicated by path (their tag) and by content: a texture whose uploaded data hashes the same as that
+// of a registered one becomes an alias of it and shares its image and slot.
+// Slots stay the same while the texture is registered, released slots go to a free list and are handed out again.
+//
+// Only changed slots are written. Each frame in flight writes them into its own descriptor set in Update,
+// once its previous submission finished.
+struct TextureRegistry {
+    // Identifies the data of a texture, hash of the uploaded levels (0 = unknown, never matches)
+    struct ContentKey {
+        uint64_t hash = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipLevels = 0;
+
+        bool operator==(const ContentKey& other) const = default;
+    };
+
+    struct Stats {
+        uint32_t slots = 0;        // Registered textures
+        uint32_t aliases = 0;      // Paths that share a registered texture with identical content
+        uint32_t writes = 0;       // Descriptor writes since creation
+    };
+
+    void Create(VkDevice device, VkSampler sampler, uint32_t maxSlots);
+
+    // Gives the texture a slot (texture.globalIndex) and queues its descriptor writes
+    void Register(Attachment& texture, const ContentKey& key);
+    // Returns the slot to the free list and forgets aliases of the texture.
+    // The stale descriptors are left in place, partially bound arrays may hold them as long as they are not sampled.
+    void Release(Attachment& texture);
+
+    // Registered texture with the same content, nullptr if there is none
+    Attachment* FindContent(const ContentKey& key) const;
+    // Makes tag another name of the registered texture
+    void AddAlias(const std::string& tag, Attachment& texture);
+    Attachment* FindAlias(const std::string& tag) const;
+
+    // Writes slots changed since the previous update of the frame into its descriptor set
+    void Update(uint32_t frameIndex, VkDescriptorSet set);
+    // Writes the slot of the texture into the set right away, e.g. after its view was replaced
+    void Write(const Attachment& texture, VkDescriptorSet set);
+
+    const Stats& GetStats() const { return _stats; }
+
+private:
+    struct ContentKeyHash {
+        size_t operator()(const ContentKey& key) const { return static_cast<size_t>(key.hash); }
+    };
+
+    struct Slot {
+        Attachment* texture = nullptr;
+        ContentKey key;
+        uint32_t pendingFrames = 0; // Bit per frame in flight whose descriptor set doesn't have the slot yet
+    };
+
+    VkDevice _device = VK_NULL_HANDLE;
+    VkSampler _sampler = VK_NULL_HANDLE;
+
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _freeSlots;
+    std::vector<uint32_t> _dirtySlots;
+
+    std::unordered_map<ContentKey, uint32_t, ContentKeyHash> _contents;
+    std::unordered_map<std::string, uint32_t> _aliases;
+
+    Stats _stats;
+};
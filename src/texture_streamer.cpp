@@ -0,0 +1,309 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "texture_streamer.h"
+#include "texture_container.h"
+#include "gpu_memory.h"
+#include "vk_initializers.h"
+
+void TextureStreamer::Create(VkDevice device, VmaAllocator allocator, UploadManager* uploader, VkDeviceSize budget)
+{
+	_device = device;
+	_allocator = allocator;
+	_uploader = uploader;
+	_budget = budget;
+}
+
+void TextureStreamer::Clear()
+{
+	// Called with the device idle, nothing uses the images anymore
+	for (auto& retired : _retired) {
+		vkDestroyImageView(_device, retired.view, nullptr);
+		vmaDestroyImage(_allocator, retired.image.image, retired.image.allocation);
+	}
+	for (auto& streamed : _textures) {
+		streamed.texture->Cleanup(_device, _allocator);
+	}
+
+	_retired.clear();
+	_textures.clear();
+	_indices.clear();
+	_stats = {};
+}
+
+void TextureStreamer::createImage(const texture_container::Texture& tex, uint32_t firstLevel, const std::string& name, AllocatedImage& image, VkImageView& view)
+{
+	uint32_t width = std::max(tex.width >> firstLevel, 1u);
+	uint32_t height = std::max(tex.height >> firstLevel, 1u);
+	uint32_t mipLevels = tex.mipLevels - firstLevel;
+
+	std::vector<VkBufferImageCopy> copyRegions;
+	VkDeviceSize stagingSize = 0;
+	for (uint32_t level = 0; level < mipLevels; ++level) {
+		stagingSize = (stagingSize + 15) & ~VkDeviceSize(15);
+		copyRegions.push_back({
+			.bufferOffset = stagingSize,
+			.imageSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = level,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+			.imageExtent = {
+				.width = std::max(width >> level, 1u),
+				.height = std::max(height >> level, 1u),
+				.depth = 1
+			}
+		});
+		stagingSize += tex.region(0, firstLevel + level).size;
+	}
+
+	VkImageCreateInfo imageInfo = vkinit::image_create_info(tex.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		{ width, height, 1 }, mipLevels);
+	VmaAllocationCreateInfo allocInfo = {
+		.usage = VMA_MEMORY_USAGE_GPU_ONLY
+	};
+	VK_ASSERT(vmaCreateImage(_allocator, &imageInfo, &allocInfo, &image.image, &image.allocation, nullptr));
+	gpu_memory::tag(_allocator, image.allocation, gpu_memory::Category::Textures, name);
+
+	VkImageSubresourceRange subresourceRange = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = mipLevels,
+		.baseArrayLayer = 0,
+		.layerCount = 1
+	};
+
+	_uploader->UploadImage(image.image, subresourceRange, copyRegions, stagingSize,
+		[&](void* dst) {
+			for (uint32_t level = 0; level < mipLevels; ++level) {
+				const auto& region = tex.region(0, firstLevel + level);
+				memcpy((char*)dst + copyRegions[level].bufferOffset, region.data, region.size);
+			}
+		});
+
+	VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(tex.format, image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.subresourceRange.levelCount = mipLevels;
+	VK_ASSERT(vkCreateImageView(_device, &viewInfo, nullptr, &view));
+
+	_stats.uploadedBytes += stagingSize;
+}
+
+void TextureStreamer::Add(Attachment& texture, const texture_container::Texture& tex, const ReloadFn& reload)
+{
+	ASSERT(!IsStreamed(&texture) && tex.faces == 1);
+
+	StreamedTexture streamed = {
+		.texture = &texture,
+		.reload = reload,
+		.format = tex.format,
+		.width = tex.width,
+		.height = tex.height,
+		.mipLevels = tex.mipLevels
+	};
+
+	streamed.tailSizes.resize(tex.mipLevels + 1, 0);
+	for (uint32_t level = tex.mipLevels; level-- > 0;) {
+		streamed.tailSizes[level] = streamed.tailSizes[level + 1] + tex.region(0, level).size;
+	}
+
+	// Coarsest levels are tiny, starting from the first one that fits into MIN_RESIDENT_SIZE
+	while (streamed.minResidentLevel + 1 < tex.mipLevels
+		&& std::max(tex.width >> streamed.minResidentLevel, tex.height >> streamed.minResidentLevel) > MIN_RESIDENT_SIZE)
+	{
+		++streamed.minResidentLevel;
+	}
+	streamed.residentLevel = streamed.minResidentLevel;
+	streamed.requestedLevel = tex.mipLevels;
+	streamed.wantedLevel = streamed.minResidentLevel;
+
+	createImage(tex, streamed.residentLevel, texture.tag, texture.allocImage, texture.view);
+
+	_stats.residentBytes += streamed.tailSizes[streamed.residentLevel];
+	++_stats.textures;
+
+	_indices[&texture] = static_cast<uint32_t>(_textures.size());
+	_textures.push_back(std::move(streamed));
+}
+
+void TextureStreamer::Request(const Attachment* texture, float uvScreenSize)
+{
+	auto it = _indices.find(texture);
+	if (it == _indices.end() || !(uvScreenSize > 0.f)) {
+		return;
+	}
+	StreamedTexture& streamed = _textures[it->second];
+
+	// Trilinear filtering blends the level whose texels map 1:1 to pixels with the next coarser one
+	float texelsPerPixel = std::max(streamed.width, streamed.height) / uvScreenSize;
+	uint32_t level = texelsPerPixel > 1.f ? static_cast<uint32_t>(std::log2(texelsPerPixel)) : 0;
+
+	streamed.requestedLevel = std::min(streamed.requestedLevel, level);
+}
+
+bool TextureStreamer::setResidentLevel(uint32_t index, uint32_t level, uint32_t frameIndex, const WriteDescriptorsFn& writeDescriptors)
+{
+	StreamedTexture& streamed = _textures[index];
+
+	texture_container::Texture tex;
+	if (!streamed.reload(tex) || tex.format != streamed.format || tex.width != streamed.width
+		|| tex.height != streamed.height || tex.mipLevels != streamed.mipLevels)
+	{
+		PRWRN("Can't stream texture " << streamed.texture->tag << ", source changed or is not available anymore");
+		// Keep what is resident, don't retry every frame
+		streamed.minResidentLevel = streamed.residentLevel;
+		streamed.wantedLevel = streamed.residentLevel;
+		return false;
+	}
+
+	_retired.push_back({
+		.image = streamed.texture->allocImage,
+		.view = streamed.texture->view,
+		.textureIndex = index,
+		.unusedFrame = UINT64_MAX
+	});
+
+	createImage(tex, level, streamed.texture->tag, streamed.texture->allocImage, streamed.texture->view);
+
+	if (level < streamed.residentLevel) {
+		++_stats.streamedIn;
+	} else {
+		++_stats.streamedOut;
+	}
+	_stats.residentBytes += streamed.tailSizes[level];
+	_stats.residentBytes -= streamed.tailSizes[streamed.residentLevel];
+	streamed.residentLevel = level;
+
+	// Descriptor set of this frame is not in use, the others are rewritten in their frames
+	writeDescriptors(*streamed.texture, frameIndex);
+	streamed.pendingFrames = ((1u << MAX_FRAMES_IN_FLIGHT) - 1) & ~(1u << frameIndex);
+
+	return true;
+}
+
+VkDeviceSize TextureStreamer::queryBudget() const
+{
+	const VkPhysicalDeviceMemoryProperties* memoryProperties;
+	vmaGetMemoryProperties(_allocator, &memoryProperties);
+
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(_allocator, budgets);
+
+	uint32_t heap = UINT32_MAX;
+	for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; ++i) {
+		if ((memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			&& (heap == UINT32_MAX || memoryProperties->memoryHeaps[i].size > memoryProperties->memoryHeaps[heap].size))
+		{
+			heap = i;
+		}
+	}
+	if (heap == UINT32_MAX) {
+		return _budget;
+	}
+
+	// Never take memory the rest of the engine or other applications use
+	VkDeviceSize otherUsage = budgets[heap].usage - std::min(budgets[heap].usage, _stats.residentBytes);
+	VkDeviceSize available = budgets[heap].budget - std::min(budgets[heap].budget, otherUsage);
+
+	return std::min(_budget > 0 ? _budget : budgets[heap].budget / 2, available);
+}
+
+void TextureStreamer::Update(uint32_t frameIndex, const WriteDescriptorsFn& writeDescriptors)
+{
+	++_frame;
+
+	for (uint32_t i = 0; i < _textures.size(); ++i) {
+		StreamedTexture& streamed = _textures[i];
+		if (streamed.pendingFrames & (1u << frameIndex)) {
+			writeDescriptors(*streamed.texture, frameIndex);
+			streamed.pendingFrames &= ~(1u << frameIndex);
+		}
+	}
+
+	// Submission of a frame waited for before this one used the old view last, all of them finish
+	// in MAX_FRAMES_IN_FLIGHT frames after the descriptors are rewritten
+	for (auto& retired : _retired) {
+		if (retired.unusedFrame == UINT64_MAX && _textures[retired.textureIndex].pendingFrames == 0) {
+			retired.unusedFrame = _frame;
+		}
+	}
+	std::erase_if(_retired, [this](const RetiredImage& retired) {
+		if (retired.unusedFrame == UINT64_MAX || _frame < retired.unusedFrame + MAX_FRAMES_IN_FLIGHT) {
+			return false;
+		}
+		vkDestroyImageView(_device, retired.view, nullptr);
+		vmaDestroyImage(_allocator, retired.image.image, retired.image.allocation);
+		return true;
+	});
+
+	if (_textures.empty()) {
+		return;
+	}
+
+	// Finer requests apply immediately, coarser ones only once the finer level was not requested for a while
+	uint32_t maxMipLevels = 0;
+	for (auto& streamed : _textures) {
+		uint32_t requested = std::min(streamed.requestedLevel, streamed.minResidentLevel);
+		if (requested <= streamed.wantedLevel || _frame - streamed.wantedFrame > STREAM_OUT_DELAY) {
+			streamed.wantedLevel = requested;
+			streamed.wantedFrame = _frame;
+		}
+		streamed.requestedLevel = streamed.mipLevels;
+		maxMipLevels = std::max(maxMipLevels, streamed.mipLevels);
+	}
+
+	// Smallest bias that fits all textures into the budget
+	_stats.budget = queryBudget();
+	auto targetLevel = [](const StreamedTexture& streamed, uint32_t bias) {
+		return std::min(streamed.wantedLevel + bias, streamed.minResidentLevel);
+	};
+	auto totalSize = [&](uint32_t bias) {
+		VkDeviceSize size = 0;
+		for (auto& streamed : _textures) {
+			size += streamed.tailSizes[targetLevel(streamed, bias)];
+		}
+		return size;
+	};
+	_stats.requestedBytes = totalSize(0);
+	_stats.bias = 0;
+	while (_stats.bias < maxMipLevels && totalSize(_stats.bias) > _stats.budget) {
+		++_stats.bias;
+	}
+
+	uint32_t numChanged = _stats.streamedIn + _stats.streamedOut;
+
+	// Streaming out only uploads the few coarse levels that remain, free the memory first
+	std::vector<uint32_t> streamIn;
+	for (uint32_t i = 0; i < _textures.size(); ++i) {
+		StreamedTexture& streamed = _textures[i];
+		if (streamed.pendingFrames != 0) {
+			continue;
+		}
+		uint32_t target = targetLevel(streamed, _stats.bias);
+		if (target > streamed.residentLevel) {
+			setResidentLevel(i, target, frameIndex, writeDescriptors);
+		} else if (target < streamed.residentLevel) {
+			streamIn.push_back(i);
+		}
+	}
+
+	// Textures missing the most levels first, limited per frame so that streaming doesn't cause hitches
+	std::sort(streamIn.begin(), streamIn.end(), [&](uint32_t a, uint32_t b) {
+		return _textures[a].residentLevel - targetLevel(_textures[a], _stats.bias)
+			> _textures[b].residentLevel - targetLevel(_textures[b], _stats.bias);
+	});
+	VkDeviceSize streamedBytes = 0;
+	for (uint32_t i : streamIn) {
+		StreamedTexture& streamed = _textures[i];
+		uint32_t target = targetLevel(streamed, _stats.bias);
+		if (streamedBytes > 0 && streamedBytes + streamed.tailSizes[target] > STREAM_BYTES_PER_FRAME) {
+			break;
+		}
+		if (setResidentLevel(i, target, frameIndex, writeDescriptors)) {
+			streamedBytes += streamed.tailSizes[target];
+		}
+	}
+
+	if (numChanged != _stats.streamedIn + _stats.streamedOut) {
+		_uploader->Submit();
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "types.h"
+#include "upload_manager.h"
+
+namespace texture_container {
+    struct Texture;
+}
+
+// Budgeted streaming of mip levels of model textures.
+// Streamed textures can read their full mip chain again at any time (a .ktx2/.dds container or a texture cache entry,
+// both memory mapped). The smallest levels (up to MIN_RESIDENT_SIZE) stay resident all the time, finer levels are
+// streamed in when the screen space footprint reported by Request() needs them and streamed out when it no longer does.
+// If the requested levels don't fit into the budget, every request is made coarser by the same number of levels.
+//
+// Changing residency of a texture creates a new image with the resident levels, uploads them through the UploadManager
+// and replaces image and view of the Attachment. Descriptor sets of frames in flight still sample the old view, so they
+// are rewritten one by one by Update() of their frame and the old image is destroyed once no frame can use it.
+struct TextureStreamer {
+    // Reads the full mip chain of the texture
+    using ReloadFn = std::function<bool(texture_container::Texture& tex)>;
+    // Writes descriptors sampling the texture into the descriptor set of a frame in flight
+    using WriteDescriptorsFn = std::function<void(const Attachment& texture, uint32_t frameIndex)>;
+
+    struct Stats {
+        uint32_t textures = 0;
+        VkDeviceSize residentBytes = 0;
+        VkDeviceSize requestedBytes = 0; // Size of the levels requested by footprints, before the budget is applied
+        VkDeviceSize budget = 0;
+        uint32_t bias = 0;               // Levels every request is made coarser by to fit into the budget
+        uint32_t streamedIn = 0;         // Residency changes since the scene was loaded
+        uint32_t streamedOut = 0;
+        VkDeviceSize uploadedBytes = 0;
+    };
+
+    // Largest dimension of levels that are always resident
+    static constexpr uint32_t MIN_RESIDENT_SIZE = 128;
+    // Data streamed in per frame, at least one texture is streamed in each frame
+    static constexpr VkDeviceSize STREAM_BYTES_PER_FRAME = 16ull * 1024 * 1024;
+    // Frames a finer level stays resident after it was requested last time, avoids streaming back and forth
+    static constexpr uint32_t STREAM_OUT_DELAY = 120;
+
+    // budget = 0 uses half of the budget VMA reports for the largest device local heap
+    void Create(VkDevice device, VmaAllocator allocator, UploadManager* uploader, VkDeviceSize budget);
+    // Destroys images of all streamed textures
+    void Clear();
+
+    // Creates image of the always resident levels of tex (full mip chain) for the texture and queues their upload.
+    // The streamer owns the image and view of the texture from now on.
+    void Add(Attachment& texture, const texture_container::Texture& tex, const ReloadFn& reload);
+    bool IsStreamed(const Attachment* texture) const { return _indices.contains(texture); }
+
+    // Screen space size in pixels of the texture's [0, 1] uv range on a surface that samples it this frame.
+    // Levels finer than the largest footprint of a frame are not needed.
+    void Request(const Attachment* texture, float uvScreenSize);
+
+    // Called each frame once the previous submission of frameIndex finished and before recording it.
+    // Rewrites outdated descriptors of the frame, destroys images no longer in use, applies the budget
+    // to the requests of the frame and streams levels in or out.
+    void Update(uint32_t frameIndex, const WriteDescriptorsFn& writeDescriptors);
+
+    const Stats& GetStats() const { return _stats; }
+
+private:
+    struct StreamedTexture {
+        Attachment* texture = nullptr;
+        ReloadFn reload;
+
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipLevels = 0;
+        // tailSizes[l] is the size of levels [l, mipLevels), with an extra 0 at the end
+        std::vector<VkDeviceSize> tailSizes;
+
+        uint32_t minResidentLevel = 0;  // Coarser levels are always resident
+        uint32_t residentLevel = 0;     // Finest resident level
+        uint32_t requestedLevel = 0;    // Finest level requested this frame, mipLevels if none
+        uint32_t wantedLevel = 0;       // Requested level with stream out delay applied
+        uint64_t wantedFrame = 0;
+
+        uint32_t pendingFrames = 0;     // Bit per frame in flight whose descriptors still use the previous view
+    };
+
+    struct RetiredImage {
+        AllocatedImage image;
+        VkImageView view;
+        uint32_t textureIndex;
+        uint64_t unusedFrame; // Frame all descriptors were rewritten in, UINT64_MAX until then
+    };
+
+    // Creates image and view of levels [firstLevel, mipLevels) of tex and queues the upload, name is for memory reports
+    void createImage(const texture_container::Texture& tex, uint32_t firstLevel, const std::string& name, AllocatedImage& image, VkImageView& view);
+    // Replaces the resident levels of the texture, returns false if its source can't be read anymore
+    bool setResidentLevel(uint32_t index, uint32_t level, uint32_t frameIndex, const WriteDescriptorsFn& writeDescriptors);
+    VkDeviceSize queryBudget() const;
+
+    VkDevice _device = VK_NULL_HANDLE;
+    VmaAllocator _allocator = VK_NULL_HANDLE;
+    UploadManager* _uploader = nullptr;
+    VkDeviceSize _budget = 0;
+
+    std::vector<StreamedTexture> _textures;
+    std::unordered_map<const Attachment*, uint32_t> _indices;
+    std::vector<RetiredImage> _retired;
+
+    uint64_t _frame = 0;
+
+    Stats _stats;
+};
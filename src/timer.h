@@ -0,0 +1,16 @@
+#pragma once
+
+// Simple wall clock timer used for measuring load times
+struct Timer {
+    using Clock = std::chrono::high_resolution_clock;
+
+    Clock::time_point start = Clock::now();
+
+    void Reset() {
+        start = Clock::now();
+    }
+
+    double ElapsedMs() const {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+};
@@ -0,0 +1,139 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "transient_allocator.h"
+#include "gpu_memory.h"
+
+void TransientAllocator::Create(VkDevice device, VmaAllocator allocator)
+{
+	_device = device;
+	_allocator = allocator;
+}
+
+void TransientAllocator::Add(const VkImageCreateInfo& imageInfo, uint32_t firstPass, uint32_t lastPass, VkImage* image)
+{
+	ASSERT(_memory == VK_NULL_HANDLE && firstPass <= lastPass);
+
+	_entries.push_back({
+		.imageInfo = imageInfo,
+		.firstPass = firstPass,
+		.lastPass = lastPass,
+		.image = image
+	});
+}
+
+void TransientAllocator::Allocate(const std::string& name)
+{
+	ASSERT(_memory == VK_NULL_HANDLE);
+	if (_entries.empty()) {
+		return;
+	}
+
+	std::vector<VkMemoryRequirements> requirements(_entries.size());
+	for (size_t i = 0; i < _entries.size(); ++i) {
+		VkDeviceImageMemoryRequirements info = {
+			.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+			.pCreateInfo = &_entries[i].imageInfo
+		};
+		VkMemoryRequirements2 memReq2 = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2
+		};
+		vkGetDeviceImageMemoryRequirements(_device, &info, &memReq2);
+		requirements[i] = memReq2.memoryRequirements;
+	}
+
+	// Biggest images first, each at the lowest offset where it doesn't overlap
+	// an already placed image that is alive at the same time
+	std::vector<size_t> order(_entries.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return requirements[a].size > requirements[b].size; });
+
+	VkMemoryRequirements total = {
+		.size = 0,
+		.alignment = 1,
+		.memoryTypeBits = UINT32_MAX
+	};
+	std::vector<std::pair<VkDeviceSize, VkDeviceSize>> taken; // [begin, end) of live images placed so far
+	for (size_t k = 0; k < order.size(); ++k) {
+		Entry& entry = _entries[order[k]];
+		const VkMemoryRequirements& req = requirements[order[k]];
+
+		taken.clear();
+		for (size_t j = 0; j < k; ++j) {
+			const Entry& other = _entries[order[j]];
+			if (other.firstPass <= entry.lastPass && entry.firstPass <= other.lastPass) {
+				taken.push_back({ other.offset, other.offset + requirements[order[j]].size });
+			}
+		}
+		std::sort(taken.begin(), taken.end());
+
+		VkDeviceSize offset = 0;
+		for (auto [begin, end] : taken) {
+			if (offset + req.size <= begin) {
+				break;
+			}
+			offset = std::max(offset, (end + req.alignment - 1) / req.alignment * req.alignment);
+		}
+		entry.offset = offset;
+
+		total.size = std::max(total.size, offset + req.size);
+		total.alignment = std::max(total.alignment, req.alignment);
+		total.memoryTypeBits &= req.memoryTypeBits;
+
+		_stats.requestedBytes += req.size;
+	}
+	ASSERT_MSG(total.memoryTypeBits != 0, "Transient images have no memory type in common");
+
+	VmaAllocationCreateInfo allocInfo = {
+		.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+		.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+		.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+	};
+	VK_ASSERT(vmaAllocateMemory(_allocator, &total, &allocInfo, &_memory, nullptr));
+	gpu_memory::tag(_allocator, _memory, gpu_memory::Category::PostFX, name);
+
+	for (Entry& entry : _entries) {
+		VK_ASSERT(vmaCreateAliasingImage2(_allocator, _memory, entry.offset, &entry.imageInfo, entry.image));
+	}
+
+	_stats.images = static_cast<uint32_t>(_entries.size());
+	_stats.allocatedBytes = total.size;
+}
+
+void TransientAllocator::Reset()
+{
+	if (_memory != VK_NULL_HANDLE) {
+		vmaFreeMemory(_allocator, _memory);
+		_memory = VK_NULL_HANDLE;
+	}
+	_entries.clear();
+	_stats = {};
+}
+
+void TransientAllocator::BeginPass(VkCommandBuffer cmd, uint32_t pass, VkImageLayout layout) const
+{
+	std::vector<VkImageMemoryBarrier> barriers;
+	for (const Entry& entry : _entries) {
+		if (entry.firstPass != pass) {
+			continue;
+		}
+		barriers.push_back({
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+			// Previous contents are discarded
+			.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.newLayout = layout,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = *entry.image,
+			.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS }
+		});
+	}
+
+	if (!barriers.empty()) {
+		// Images sharing the memory may still be read or written by earlier passes (or sampled by the UI of the previous frame)
+		vkCmdPipelineBarrier(cmd,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// One allocation shared by images that are only used during a part of the frame (PostFX intermediates).
+// Lifetimes are ranges [firstPass, lastPass] of pass indices in recording order. Images whose lifetimes don't
+// overlap are placed at overlapping offsets, so the allocation is as big as the largest set of images alive at once.
+// Passes that never run in the same frame (e.g. the two local tone mapping operators) simply get consecutive indices.
+//
+// Writes through one image leave the contents of images aliasing it undefined. BeginPass() records the
+// UNDEFINED -> layout transitions of the images whose lifetime starts at the pass, which also orders them after
+// all earlier users of the memory.
+struct TransientAllocator {
+    struct Stats {
+        uint32_t images = 0;
+        // Sum of the sizes of all images, what they would take with their own memory
+        VkDeviceSize requestedBytes = 0;
+        VkDeviceSize allocatedBytes = 0;
+    };
+
+    void Create(VkDevice device, VmaAllocator allocator);
+    // Destroy the images first
+    void Destroy() { Reset(); }
+
+    // Color image created by Allocate(), *image must stay valid until then
+    void Add(const VkImageCreateInfo& imageInfo, uint32_t firstPass, uint32_t lastPass, VkImage* image);
+    // Places all added images, allocates the memory and creates the images in it
+    void Allocate(const std::string& name);
+    // Frees the memory and forgets the images, they must have been destroyed already
+    void Reset();
+
+    void BeginPass(VkCommandBuffer cmd, uint32_t pass, VkImageLayout layout) const;
+
+    const Stats& GetStats() const { return _stats; }
+
+private:
+    struct Entry {
+        VkImageCreateInfo imageInfo;
+        uint32_t firstPass;
+        uint32_t lastPass;
+        VkImage* image;
+        VkDeviceSize offset = 0;
+    };
+
+    VkDevice _device = VK_NULL_HANDLE;
+    VmaAllocator _allocator = VK_NULL_HANDLE;
+
+    std::vector<Entry> _entries;
+    VmaAllocation _memory = VK_NULL_HANDLE;
+
+    Stats _stats;
+};
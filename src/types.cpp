@@ -50,6 +50,9 @@ RenderContext::RenderContext()
 
 	showNormals = false;
 
+	enableLods = true;
+	lodPixelError = 1.f;
+
 	// Treshold to calculate light's effective radius for optimization
 	lightRadiusTreshold = 1.f / 255.f;
 
@@ -213,10 +216,58 @@ Mesh* Engine::getMesh(const std::string& name)
 
 Attachment* Engine::getTexture(const std::string& name)
 {
-	return get_cache(name, _textures);
+	Attachment* texture = get_cache(name, _textures);
+	// Textures with the same content as another one are only known to the registry
+	return texture ? texture : _textureRegistry.FindAlias(name);
 }
 
 Model* Engine::getModel(const std::string& name)
 {
 	return get_cache(name, _models);
-}
\ No newline at end of file
+}
+
+VertexInputDescription PackedVertex::getDescription()
+{
+	VertexInputDescription description;
+
+	VkVertexInputBindingDescription bindingDescription = {
+		.binding = 0,
+		.stride = sizeof(PackedVertex),
+		.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+	};
+
+	description.bindings.push_back(bindingDescription);
+
+	VkVertexInputAttributeDescription positionAttribute = {
+		.location = 0,
+		.binding = 0,
+		.format = VK_FORMAT_R16G16B16A16_UNORM,
+		.offset = offsetof(PackedVertex, pos),
+	};
+
+	VkVertexInputAttributeDescription normalAttribute = {
+		.location = 1,
+		.binding = 0,
+		.format = VK_FORMAT_R16G16_SNORM,
+		.offset = offsetof(PackedVertex, normal),
+	};
+
+	// There is no color in packed vertex, shaders use decoded normal instead.
+	// Location still needs an attribute, so it aliases the normal
+	VkVertexInputAttributeDescription colorAttribute = normalAttribute;
+	colorAttribute.location = 2;
+
+	VkVertexInputAttributeDescription uvAttribute = {
+		.location = 3,
+		.binding = 0,
+		.format = VK_FORMAT_R16G16_UNORM,
+		.offset = offsetof(PackedVertex, uv)
+	};
+
+	description.attributes.push_back(positionAttribute);
+	description.attributes.push_back(normalAttribute);
+	description.attributes.push_back(colorAttribute);
+	description.attributes.push_back(uvAttribute);
+
+	return description;
+}
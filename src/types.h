@@ -45,6 +45,15 @@ struct AllocatedBuffer {
     void destroy(const VmaAllocator& allocator);
 };
 
+// Suballocation of a GeometryBuffer block
+struct GeometryRange {
+    uint32_t block = UINT32_MAX;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+
+    bool IsValid() const { return block != UINT32_MAX; }
+};
+
 struct AllocatedImage {
     /* Based on https://github.com/vblanco20-1/vulkan-guide */
     VkImage image;
@@ -131,11 +140,17 @@ struct UploadContext {
 #define MAX_VIEWPORT_MIPS 13
 
 struct ViewportPass {
-    std::vector<AllocatedImage> images; // Allocated with VMA
+    // One per frame in flight, allocated with VMA
+    std::vector<AllocatedImage> images;
     std::vector<VkImageView> imageViews;
 
-    // Rendering in 32-bit HDR format to allow further processing with compute shaders
-    const VkFormat colorFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+    // HDR format to allow further processing with compute shaders, one of FORMATS. Every PostFX stage reads and writes
+    // the whole image, so the narrower formats save bandwidth as well as memory.
+    VkFormat colorFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+    // Selectable at runtime, B10G11R11 drops alpha and negative values and needs shaderStorageImageExtendedFormats
+    static constexpr VkFormat FORMATS[] = {
+        VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_B10G11R11_UFLOAT_PACK32
+    };
 
     Attachment depth;
 
@@ -206,6 +221,26 @@ struct Vertex {
     }
 };
 
+// Compact vertex layout, 16 bytes instead of 44 (see LoaderSettings::packedVertices).
+// Position and uv are 16-bit unorm relative to model bounds and are dequantized in shaders
+// using VertexDequant of the model. Normal is octahedral encoded. Color is not stored
+// because the loader fills it with the normal anyway.
+struct PackedVertex {
+    uint16_t pos[4]; // w is unused, 3 component 16-bit formats are rarely supported
+    int16_t normal[2];
+    uint16_t uv[2];
+
+    static VertexInputDescription getDescription();
+};
+
+// Maps packed [0, 1] positions and uvs back to model space
+struct VertexDequant {
+    glm::vec3 posScale{ 1.f };
+    glm::vec3 posOffset{ 0.f };
+    glm::vec2 uvScale{ 1.f };
+    glm::vec2 uvOffset{ 0.f };
+};
+
 template <class T>
 inline void hash_combine(std::size_t& s, const T& v)
 {
@@ -235,13 +270,52 @@ struct Material {
 };
 
 
+// Levels of detail of a mesh share its vertex and index buffer, LOD 0 is the original mesh
+constexpr uint32_t MAX_MESH_LODS = 4;
+
+struct MeshLod {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    // Upper bound on distance from the original surface, in model space units
+    float error = 0.f;
+};
+
+// Per frame LOD selection counters of a render pass
+struct LodStats {
+    std::array<uint32_t, MAX_MESH_LODS> draws{};
+    uint64_t triangles = 0;
+    // Triangles that would be drawn with LOD 0 only
+    uint64_t fullTriangles = 0;
+};
+
 struct Mesh {
     std::string tag = "";
     std::vector<Vertex> vertices;
-    AllocatedBuffer vertexBuffer;
+    // Uploaded instead of vertices if the model uses packed vertices
+    std::vector<PackedVertex> packedVertices;
 
     std::vector<uint32_t> indices;
-    AllocatedBuffer indexBuffer;
+    // UINT16 when every index fits, chosen on upload
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+    // Clusters of triangles, each is a contiguous range of indices. Empty for meshes not created by the model loader
+    std::vector<GPUMeshlet> meshlets;
+
+    // Ranges in the scene geometry buffer (see geometry_buffer.h), meshlets are read as storage buffer
+    GeometryRange vertexRange;
+    GeometryRange indexRange;
+    GeometryRange meshletRange;
+    // Added to indices and LOD first indices of the mesh's draws, the ranges divided by vertex/index size
+    int32_t vertexOffset = 0;
+    uint32_t firstIndex = 0;
+
+    // At least one level, ranges of indices
+    std::vector<MeshLod> lods;
+    // Bounding sphere in model space, used for LOD selection
+    glm::vec3 boundsCenter{ 0.f };
+    float boundsRadius = 0.f;
+    // Uv units per model space unit, averaged over the surface of level 0. Used for texture streaming
+    float uvDensity = 0.f;
 
     Attachment* diffuseTex{ nullptr };
     Attachment* bumpTex{ nullptr };
@@ -262,6 +336,9 @@ struct Model {
     bool useObjectColor = false;
 
     float maxExtent{ 0.f };
+
+    bool packedVertices = false;
+    VertexDequant dequant{};
 };
 
 struct RenderObject {
@@ -295,6 +372,63 @@ struct GPUData {
     void Reset(FrameData& fd);
 };
 
+// Options of model and texture loading. Set from command line arguments (see main.cpp)
+struct LoaderSettings {
+    enum class ObjParser {
+        Tinyobj,
+        Multithreaded // See obj_parser.h
+    };
+
+    // Load models from binary mesh cache when it is up to date, (re)build it otherwise
+    bool useMeshCache = true;
+
+    ObjParser objParser = ObjParser::Multithreaded;
+
+    // Reorder index and vertex buffers for vertex cache and fetch efficiency and split meshes into meshlets, see mesh_optimizer.h
+    bool optimizeMeshes = true;
+    // Additionally reorder triangle clusters to reduce overdraw (only with optimizeMeshes)
+    bool optimizeOverdraw = true;
+
+    // Build simplified levels of detail for every mesh
+    bool generateLods = true;
+
+    // Generate full mip chains of model textures
+    bool generateTextureMips = true;
+    // Convert bump (height) maps into two channel derivative maps at load time, sampled with one tap instead of eight
+    bool derivativeBumpMaps = true;
+    // Load .ktx2/.dds next to a texture or skybox instead of the source image, see texture_container.h
+    bool useCompressedTextures = true;
+    // Load decoded source images from the texture cache when it is up to date, (re)build it otherwise, see texture_cache.h
+    bool useTextureCache = true;
+    // Least recently used texture cache entries are evicted above this size
+    uint32_t textureCacheSizeMiB = 2048;
+
+    // Keep only the mip levels of model textures their screen space footprint needs resident, see texture_streamer.h.
+    // Applies to .ktx2/.dds textures and texture cache entries with mips.
+    bool streamTextures = true;
+    // Memory streamed textures may use, 0 = half of the device local heap budget reported by VMA
+    uint32_t textureBudgetMiB = 0;
+
+    // Let PostFX attachments of effects that don't run at the same time share memory, see transient_allocator.h
+    bool aliasPostFXMemory = true;
+    // Store PostFX attachments in the narrower formats declared in PostFX::formats instead of RGBA32F.
+    // Opt in until the narrow shader variants have been validated with --validate-postfx-precision.
+    bool postfxNarrowFormats = false;
+    // Format of the viewport images, one of ViewportPass::FORMATS. RGBA32F is used if the device can't store it.
+    VkFormat viewportFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+
+    // Format of skyboxes loaded from .hdr faces, VK_FORMAT_UNDEFINED = most compact supported one
+    VkFormat skyboxFormat = VK_FORMAT_UNDEFINED;
+
+    // Copy uploads on a separate transfer queue family if the device has one
+    bool useTransferQueue = true;
+
+    // Upload vertices in PackedVertex layout instead of Vertex
+    bool packedVertices = false;
+    // Threads used by multithreaded loading, 0 = all hardware threads
+    uint32_t numThreads = 0;
+};
+
 struct RenderContext {
     GPUSceneUB sceneData{};
     
@@ -313,6 +447,10 @@ struct RenderContext {
 
     bool showNormals;
 
+    bool enableLods;
+    // Coarsest LOD whose error projects to at most this many pixels is drawn
+    float lodPixelError;
+
     // Treshold to calculate light's effective radius for optimization
     float lightRadiusTreshold;
 
@@ -0,0 +1,384 @@
+#include "stdafx.h"
+#include "defs.h"
+#include "upload_manager.h"
+#include "gpu_memory.h"
+#include "vk_initializers.h"
+#include "vk_utils.h"
+#include "timer.h"
+
+void UploadManager::Create(VkDevice device, VmaAllocator allocator,
+	VkQueue transferQueue, uint32_t transferQueueFamily,
+	VkQueue graphicsQueue, uint32_t graphicsQueueFamily,
+	VkDeviceSize ringSize)
+{
+	_device = device;
+	_allocator = allocator;
+	_transferQueue = transferQueue;
+	_transferQueueFamily = transferQueueFamily;
+	_graphicsQueue = graphicsQueue;
+	_graphicsQueueFamily = graphicsQueueFamily;
+	_ringSize = ringSize;
+
+	// Command buffers of the batches are reset one by one
+	VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(_transferQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	VK_ASSERT(vkCreateCommandPool(_device, &poolInfo, nullptr, &_transferCommandPool));
+
+	if (UsesTransferQueue()) {
+		poolInfo.queueFamilyIndex = _graphicsQueueFamily;
+		VK_ASSERT(vkCreateCommandPool(_device, &poolInfo, nullptr, &_graphicsCommandPool));
+	}
+
+	VkFenceCreateInfo fenceInfo = vkinit::fence_create_info();
+	VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+	for (auto& batch : _batches) {
+		VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_transferCommandPool, 1);
+		VK_ASSERT(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &batch.cmd));
+		VK_ASSERT(vkCreateFence(_device, &fenceInfo, nullptr, &batch.fence));
+
+		if (UsesTransferQueue()) {
+			cmdAllocInfo = vkinit::command_buffer_allocate_info(_graphicsCommandPool, 1);
+			VK_ASSERT(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &batch.graphicsCmd));
+			VK_ASSERT(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &batch.copiesDone));
+		} else {
+			batch.graphicsCmd = batch.cmd;
+		}
+	}
+
+	// Persistently mapped, CPU_ONLY buffers are mapped on creation
+	VkBufferCreateInfo bufferInfo = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = _ringSize,
+		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+	};
+	VmaAllocationCreateInfo allocInfo = {
+		.usage = VMA_MEMORY_USAGE_CPU_ONLY
+	};
+	_ring.create(_allocator, bufferInfo, allocInfo);
+	gpu_memory::tag(_allocator, _ring.allocation, gpu_memory::Category::Staging, "UPLOAD_RING");
+}
+
+void UploadManager::Destroy()
+{
+	Flush();
+
+	for (auto& batch : _batches) {
+		vkDestroyFence(_device, batch.fence, nullptr);
+		if (batch.copiesDone != VK_NULL_HANDLE) {
+			vkDestroySemaphore(_device, batch.copiesDone, nullptr);
+		}
+	}
+	vkDestroyCommandPool(_device, _transferCommandPool, nullptr);
+	if (_graphicsCommandPool != VK_NULL_HANDLE) {
+		vkDestroyCommandPool(_device, _graphicsCommandPool, nullptr);
+	}
+
+	_ring.destroy(_allocator);
+}
+
+void UploadManager::upload(VkDeviceSize size, const FillFn& fill, const RecordFn& record)
+{
+	Timer timer;
+
+	// Release staging memory of batches that finished in the meantime
+	Update();
+
+	if (size > _ringSize / 2) {
+		// Would make the ring wait for all previous uploads
+		VkBufferCreateInfo bufferInfo = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.size = size,
+			.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+		};
+		VmaAllocationCreateInfo allocInfo = {
+			.usage = VMA_MEMORY_USAGE_CPU_ONLY
+		};
+		AllocatedBuffer staging;
+		staging.create(_allocator, bufferInfo, allocInfo);
+		gpu_memory::tag(_allocator, staging.allocation, gpu_memory::Category::Staging, "UPLOAD_DEDICATED");
+
+		Batch& batch = currentBatch(_head);
+		fill(staging.memory_ptr);
+		record(batch.cmd, batch.graphicsCmd, staging.buffer, 0);
+
+		batch.dedicatedBuffers.push_back(staging);
+		batch.bytes += size;
+	} else {
+		uint64_t offset = allocate(size);
+
+		Batch& batch = currentBatch(offset);
+		VkDeviceSize physOffset = offset % _ringSize;
+		fill((char*)_ring.memory_ptr + physOffset);
+		record(batch.cmd, batch.graphicsCmd, _ring.buffer, physOffset);
+
+		batch.bytes += size;
+	}
+
+	_stats.bytes += size;
+	++_stats.uploads;
+
+	// Let the GPU start copying while the next uploads are prepared
+	if (_batches[_current].bytes >= _ringSize / 4) {
+		Submit();
+	}
+
+	_stats.ms += timer.ElapsedMs();
+}
+
+void UploadManager::UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size, const FillFn& fill)
+{
+	upload(size, fill, [&](VkCommandBuffer transferCmd, VkCommandBuffer graphicsCmd, VkBuffer stagingBuffer, VkDeviceSize stagingOffset) {
+		VkBufferCopy copy = {
+			.srcOffset = stagingOffset,
+			.dstOffset = dstOffset,
+			.size = size
+		};
+		vkCmdCopyBuffer(transferCmd, stagingBuffer, dstBuffer, 1, &copy);
+
+		if (!UsesTransferQueue()) {
+			// Covered by the memory barrier at the end of the batch
+			return;
+		}
+
+		// Release by transfer queue and acquire by graphics queue, buffers are used by any stage later
+		VkBufferMemoryBarrier barrier = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = 0,
+			.srcQueueFamilyIndex = _transferQueueFamily,
+			.dstQueueFamilyIndex = _graphicsQueueFamily,
+			.buffer = dstBuffer,
+			.offset = dstOffset,
+			.size = size
+		};
+		vkCmdPipelineBarrier(transferCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		vkCmdPipelineBarrier(graphicsCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0, 0, nullptr, 1, &barrier, 0, nullptr);
+	});
+}
+
+void UploadManager::UploadImage(VkImage image, const VkImageSubresourceRange& range, std::vector<VkBufferImageCopy> regions,
+	VkDeviceSize size, const FillFn& fill, bool generateMips)
+{
+	ASSERT(!regions.empty());
+
+	upload(size, fill, [&](VkCommandBuffer transferCmd, VkCommandBuffer graphicsCmd, VkBuffer stagingBuffer, VkDeviceSize stagingOffset) {
+		for (auto& region : regions) {
+			region.bufferOffset += stagingOffset;
+		}
+
+		vk_utils::imageMemoryBarrier(transferCmd, image,
+			0,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			range);
+
+		// Copy the buffer into the image
+		vkCmdCopyBufferToImage(transferCmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()), regions.data());
+
+		// Blits need the image in transfer layout on the graphics queue
+		VkImageLayout finalLayout = generateMips ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		VkAccessFlags finalAccess = generateMips ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+		VkPipelineStageFlags finalStage = generateMips ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+		if (UsesTransferQueue()) {
+			// Release by transfer queue, layout transition is part of the ownership transfer
+			vk_utils::imageMemoryBarrier(transferCmd, image,
+				VK_ACCESS_TRANSFER_WRITE_BIT,
+				0,
+
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				finalLayout,
+
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				range, _transferQueueFamily, _graphicsQueueFamily);
+
+			// Matching acquire by graphics queue
+			vk_utils::imageMemoryBarrier(graphicsCmd, image,
+				0,
+				finalAccess,
+
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				finalLayout,
+
+				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				finalStage,
+				range, _transferQueueFamily, _graphicsQueueFamily);
+		} else if (!generateMips) {
+			vk_utils::imageMemoryBarrier(graphicsCmd, image,
+				VK_ACCESS_TRANSFER_WRITE_BIT,
+				finalAccess,
+
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				finalLayout,
+
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				finalStage,
+				range);
+		}
+
+		if (generateMips) {
+			// Also transitions all levels to shader read layout
+			vk_utils::generateMipmaps(graphicsCmd, image, regions[0].imageExtent.width, regions[0].imageExtent.height,
+				range.levelCount, range.layerCount);
+		}
+	});
+}
+
+void UploadManager::Submit()
+{
+	Batch& batch = _batches[_current];
+	if (!batch.recording) {
+		return;
+	}
+
+	if (UsesTransferQueue()) {
+		// Copies signal the graphics queue part, which acquires the resources
+		VK_ASSERT(vkEndCommandBuffer(batch.cmd));
+
+		VkSubmitInfo transferSubmit = vkinit::submit_info(&batch.cmd);
+		transferSubmit.signalSemaphoreCount = 1;
+		transferSubmit.pSignalSemaphores = &batch.copiesDone;
+		VK_ASSERT(vkQueueSubmit(_transferQueue, 1, &transferSubmit, VK_NULL_HANDLE));
+
+		VK_ASSERT(vkEndCommandBuffer(batch.graphicsCmd));
+
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo graphicsSubmit = vkinit::submit_info(&batch.graphicsCmd);
+		graphicsSubmit.waitSemaphoreCount = 1;
+		graphicsSubmit.pWaitSemaphores = &batch.copiesDone;
+		graphicsSubmit.pWaitDstStageMask = &waitStage;
+		VK_ASSERT(vkQueueSubmit(_graphicsQueue, 1, &graphicsSubmit, batch.fence));
+	} else {
+		// Make all copies of the batch visible to whatever uses the resources next
+		vk_utils::memoryBarrier(batch.cmd,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+		VK_ASSERT(vkEndCommandBuffer(batch.cmd));
+
+		VkSubmitInfo submit = vkinit::submit_info(&batch.cmd);
+		VK_ASSERT(vkQueueSubmit(_graphicsQueue, 1, &submit, batch.fence));
+	}
+
+	batch.recording = false;
+	batch.inFlight = true;
+	_inFlight.push_back(_current);
+	++_stats.submits;
+
+	_current = (_current + 1) % NUM_BATCHES;
+}
+
+void UploadManager::Flush()
+{
+	Timer timer;
+
+	Submit();
+	while (!_inFlight.empty()) {
+		retireOldest();
+	}
+
+	_stats.ms += timer.ElapsedMs();
+}
+
+UploadManager::Stats UploadManager::TakeStats()
+{
+	Stats stats = _stats;
+	_stats = {};
+	return stats;
+}
+
+VkDeviceSize UploadManager::allocate(VkDeviceSize size)
+{
+	_head = (_head + ALIGNMENT - 1) & ~uint64_t(ALIGNMENT - 1);
+	// Allocations don't wrap around the end of the ring
+	VkDeviceSize physOffset = _head % _ringSize;
+	if (physOffset + size > _ringSize) {
+		_head += _ringSize - physOffset;
+	}
+
+	// Staging memory from the oldest unfinished batch on is still in use
+	auto tail = [&]() -> uint64_t {
+		if (!_inFlight.empty()) {
+			return _batches[_inFlight.front()].ringBegin;
+		}
+		return _batches[_current].recording ? _batches[_current].ringBegin : _head;
+	};
+
+	while (_head + size - tail() > _ringSize) {
+		if (_inFlight.empty()) {
+			// Only the batch being recorded is using the ring
+			Submit();
+		}
+		retireOldest();
+	}
+
+	uint64_t offset = _head;
+	_head += size;
+	return offset;
+}
+
+UploadManager::Batch& UploadManager::currentBatch(uint64_t ringBegin)
+{
+	Batch& batch = _batches[_current];
+	if (batch.recording) {
+		return batch;
+	}
+
+	// Batches are submitted round robin, so an in flight batch in this slot is the oldest one
+	while (batch.inFlight) {
+		retireOldest();
+	}
+
+	VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_ASSERT(vkBeginCommandBuffer(batch.cmd, &beginInfo));
+	if (UsesTransferQueue()) {
+		VK_ASSERT(vkBeginCommandBuffer(batch.graphicsCmd, &beginInfo));
+	}
+
+	batch.recording = true;
+	batch.ringBegin = ringBegin;
+	batch.bytes = 0;
+	return batch;
+}
+
+void UploadManager::retireOldest()
+{
+	ASSERT(!_inFlight.empty());
+
+	Batch& batch = _batches[_inFlight.front()];
+	if (vkGetFenceStatus(_device, batch.fence) != VK_SUCCESS) {
+		++_stats.waits;
+		VK_ASSERT(vkWaitForFences(_device, 1, &batch.fence, VK_TRUE, UINT64_MAX));
+	}
+	VK_ASSERT(vkResetFences(_device, 1, &batch.fence));
+	VK_ASSERT(vkResetCommandBuffer(batch.cmd, 0));
+	if (UsesTransferQueue()) {
+		VK_ASSERT(vkResetCommandBuffer(batch.graphicsCmd, 0));
+	}
+
+	for (auto& buffer : batch.dedicatedBuffers) {
+		buffer.destroy(_allocator);
+	}
+	batch.dedicatedBuffers.clear();
+
+	batch.inFlight = false;
+	_inFlight.pop_front();
+}
+
+void UploadManager::Update()
+{
+	while (!_inFlight.empty() && vkGetFenceStatus(_device, _batches[_inFlight.front()].fence) == VK_SUCCESS) {
+		retireOldest();
+	}
+}
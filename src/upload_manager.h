@@ -0,0 +1,115 @@
+#pragma once
+
+#include <deque>
+
+#include "types.h"
+
+// Batched staging uploads of scene resources.
+// Data is written into a persistently mapped ring buffer and copy commands of many uploads are recorded into
+// one command buffer, which is submitted once enough data accumulates. Submitted batches are tracked with fences,
+// the CPU only waits when the ring has no free space left or every batch command buffer is in flight.
+// Uploads bigger than half of the ring get a dedicated staging buffer which is released together with its batch.
+//
+// Copies run on a dedicated transfer queue if the device has one. Uploaded resources are then released by the
+// transfer queue and acquired by the graphics queue in a second command buffer of the batch, which waits for the
+// copies with a semaphore. So rendering doesn't wait for the CPU, only the GPU orders frames after the acquire.
+// Mip generation (blits) always runs on the graphics queue.
+// Without a separate transfer family everything is recorded into one command buffer on the graphics queue.
+//
+// Resources are ready for any graphics queue submission made after the batch is submitted.
+// Flush() submits and waits for all uploads.
+struct UploadManager {
+    // Writes the data of an upload into mapped staging memory
+    using FillFn = std::function<void(void* dst)>;
+
+    struct Stats {
+        VkDeviceSize bytes = 0;
+        uint32_t uploads = 0;
+        uint32_t submits = 0;
+        uint32_t waits = 0; // Times the CPU had to wait for a batch to finish to get ring space or a command buffer
+        double ms = 0.0;    // Time spent in uploads and Flush, including the waits
+
+        double MBps() const { return ms > 0.0 ? bytes / (1000.0 * ms) : 0.0; }
+    };
+
+    // transferQueue may be the graphics queue
+    void Create(VkDevice device, VmaAllocator allocator,
+        VkQueue transferQueue, uint32_t transferQueueFamily,
+        VkQueue graphicsQueue, uint32_t graphicsQueueFamily,
+        VkDeviceSize ringSize);
+    void Destroy();
+
+    void UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size, const FillFn& fill);
+
+    // Copies regions into the image and leaves the whole range in SHADER_READ_ONLY_OPTIMAL.
+    // Region buffer offsets are relative to the start of the upload data.
+    // With generateMips only level 0 is copied and the rest of range levels is blitted from it.
+    void UploadImage(VkImage image, const VkImageSubresourceRange& range, std::vector<VkBufferImageCopy> regions,
+        VkDeviceSize size, const FillFn& fill, bool generateMips = false);
+
+    // Submits the current batch without waiting for it
+    void Submit();
+    // Submits the current batch and waits for all batches to finish
+    void Flush();
+    // Releases staging memory of finished batches, never waits
+    void Update();
+
+    bool UsesTransferQueue() const { return _transferQueueFamily != _graphicsQueueFamily; }
+
+    // Returns stats gathered since the last call
+    Stats TakeStats();
+
+private:
+    // Records the copy of an upload (transferCmd) and makes the resource usable (graphicsCmd),
+    // data is at stagingOffset in stagingBuffer. Both are the same command buffer without transfer queue.
+    using RecordFn = std::function<void(VkCommandBuffer transferCmd, VkCommandBuffer graphicsCmd,
+        VkBuffer stagingBuffer, VkDeviceSize stagingOffset)>;
+
+    struct Batch {
+        VkCommandBuffer cmd = VK_NULL_HANDLE;         // Transfer queue
+        VkCommandBuffer graphicsCmd = VK_NULL_HANDLE; // Graphics queue, only with transfer queue
+        VkSemaphore copiesDone = VK_NULL_HANDLE;      // Only with transfer queue
+        VkFence fence = VK_NULL_HANDLE;
+
+        bool recording = false;
+        bool inFlight = false;
+
+        uint64_t ringBegin = 0; // Virtual ring offset of the first staging allocation of the batch
+        VkDeviceSize bytes = 0;
+
+        std::vector<AllocatedBuffer> dedicatedBuffers;
+    };
+
+    static constexpr uint32_t NUM_BATCHES = 4;
+    static constexpr VkDeviceSize ALIGNMENT = 16; // Enough for texel blocks of any format
+
+    void upload(VkDeviceSize size, const FillFn& fill, const RecordFn& record);
+
+    // Reserves ring space, submits and waits for older batches if there is not enough
+    VkDeviceSize allocate(VkDeviceSize size);
+    // Batch commands of the next upload are recorded into
+    Batch& currentBatch(uint64_t ringBegin);
+    void retireOldest();
+
+    VkDevice _device = VK_NULL_HANDLE;
+    VmaAllocator _allocator = VK_NULL_HANDLE;
+
+    VkQueue _transferQueue = VK_NULL_HANDLE;
+    VkQueue _graphicsQueue = VK_NULL_HANDLE;
+    uint32_t _transferQueueFamily = 0;
+    uint32_t _graphicsQueueFamily = 0;
+
+    VkCommandPool _transferCommandPool = VK_NULL_HANDLE;
+    VkCommandPool _graphicsCommandPool = VK_NULL_HANDLE;
+
+    AllocatedBuffer _ring{};
+    VkDeviceSize _ringSize = 0;
+    // Virtual offsets only grow, physical offset = virtual % _ringSize
+    uint64_t _head = 0;
+
+    std::array<Batch, NUM_BATCHES> _batches;
+    uint32_t _current = 0;
+    std::deque<uint32_t> _inFlight; // Batch indices in submission order
+
+    Stats _stats;
+};
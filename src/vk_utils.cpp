@@ -168,12 +168,14 @@ namespace vk_utils {
 		VkImageLayout           new_layout,
 		VkPipelineStageFlags    src_stage_mask,
 		VkPipelineStageFlags    dst_stage_mask,
-		VkImageSubresourceRange subresource_range)
+		VkImageSubresourceRange subresource_range,
+		uint32_t                src_queue_family,
+		uint32_t                dst_queue_family)
 	{
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.srcQueueFamilyIndex = src_queue_family;
+		barrier.dstQueueFamilyIndex = dst_queue_family;
 		barrier.srcAccessMask = src_access_mask;
 		barrier.dstAccessMask = dst_access_mask;
 		barrier.oldLayout = old_layout;
@@ -263,6 +265,82 @@ namespace vk_utils {
 		return false;
 	}
 
+	uint32_t getMipLevelCount(uint32_t width, uint32_t height)
+	{
+		uint32_t levels = 1;
+		while ((std::max(width, height) >> levels) > 0) {
+			++levels;
+		}
+		return levels;
+	}
+
+	bool formatSupportsLinearBlit(VkPhysicalDevice physicalDevice, VkFormat format)
+	{
+		VkFormatProperties props;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+		VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT
+			| VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+		return (props.optimalTilingFeatures & required) == required;
+	}
+
+	void generateMipmaps(VkCommandBuffer cmd, VkImage image, uint32_t width, uint32_t height,
+		uint32_t mipLevels, uint32_t layerCount)
+	{
+		VkImageSubresourceRange range = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = 0,
+			.levelCount = 1,
+			.baseArrayLayer = 0,
+			.layerCount = layerCount
+		};
+
+		int32_t srcWidth = static_cast<int32_t>(width);
+		int32_t srcHeight = static_cast<int32_t>(height);
+
+		for (uint32_t i = 1; i < mipLevels; ++i) {
+			int32_t dstWidth = std::max(srcWidth / 2, 1);
+			int32_t dstHeight = std::max(srcHeight / 2, 1);
+
+			// Previous level becomes blit source
+			range.baseMipLevel = i - 1;
+			imageMemoryBarrier(cmd, image,
+				VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				range);
+
+			VkImageBlit blit = {
+				.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i - 1, 0, layerCount },
+				.srcOffsets = { { 0, 0, 0 }, { srcWidth, srcHeight, 1 } },
+				.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i, 0, layerCount },
+				.dstOffsets = { { 0, 0, 0 }, { dstWidth, dstHeight, 1 } }
+			};
+			vkCmdBlitImage(cmd,
+				image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1, &blit, VK_FILTER_LINEAR);
+
+			// Previous level is final
+			imageMemoryBarrier(cmd, image,
+				VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				range);
+
+			srcWidth = dstWidth;
+			srcHeight = dstHeight;
+		}
+
+		// Last level was only written to
+		range.baseMipLevel = mipLevels - 1;
+		imageMemoryBarrier(cmd, image,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			range);
+	}
+
 	VkBool32 formatHasStencil(VkFormat format)
 	{
 		std::vector<VkFormat> stencilFormats = {
@@ -278,7 +356,7 @@ namespace vk_utils {
 	std::vector<char> readShaderBinary(const std::string& filename)
 	{
 		std::ifstream file(filename, std::ios::ate | std::ios::binary);
-		ASSERT_MSG(file.is_open(), "Failed to open file: " << filename);
+		ASSERT_MSG(file.is_open(), "Failed to open file: " << filename << ", shaders are compiled by scripts/compile_shaders.py");
 
 		size_t fileSize = (size_t)file.tellg();
 		std::vector<char> buffer(fileSize);
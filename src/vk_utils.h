@@ -44,7 +44,10 @@ namespace vk_utils {
 		VkImageLayout           new_layout,
 		VkPipelineStageFlags    src_stage_mask,
 		VkPipelineStageFlags    dst_stage_mask,
-		VkImageSubresourceRange subresource_range);
+		VkImageSubresourceRange subresource_range,
+		// Queue family ownership transfer if different, record the same barrier on both queues
+		uint32_t                src_queue_family = VK_QUEUE_FAMILY_IGNORED,
+		uint32_t                dst_queue_family = VK_QUEUE_FAMILY_IGNORED);
 
 	void memoryBarrier(
 		VkCommandBuffer         command_buffer,
@@ -53,6 +56,18 @@ namespace vk_utils {
 		VkPipelineStageFlags    src_stage_mask,
 		VkPipelineStageFlags    dst_stage_mask);
 
+	// Number of levels of a full mip chain down to 1x1
+	uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+
+	// True if images of the format can be blitted with linear filtering (needed by generateMipmaps)
+	bool formatSupportsLinearBlit(VkPhysicalDevice physicalDevice, VkFormat format);
+
+	// Fills mip levels 1..mipLevels-1 of all layers by successive linear blits from level 0.
+	// Expects all levels in TRANSFER_DST_OPTIMAL with level 0 written,
+	// leaves all levels in SHADER_READ_ONLY_OPTIMAL for fragment shader reads.
+	void generateMipmaps(VkCommandBuffer cmd, VkImage image, uint32_t width, uint32_t height,
+		uint32_t mipLevels, uint32_t layerCount = 1);
+
 	VkBool32 getSupportedDepthFormat(VkPhysicalDevice physicalDevice, VkFormat* depthFormat);
 	VkBool32 getSupportedDepthStencilFormat(VkPhysicalDevice physicalDevice, VkFormat* depthStencilFormat);
 